@@ -146,6 +146,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(varint_bench)
+        {
+            int ret = varint_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(test_sack)
         {
             int ret = sacktest();
@@ -167,6 +174,20 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(padding_skip)
+        {
+            int ret = padding_skip_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(frame_decode_bench)
+        {
+            int ret = frame_decode_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(test_logger)
         {
             int ret = logger_test();
@@ -181,6 +202,34 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(test_binlog_ring)
+        {
+            int ret = binlog_ring_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(test_binlog_policy)
+        {
+            int ret = binlog_policy_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(test_binlog_v2)
+        {
+            int ret = binlog_v2_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(test_binlog_map)
+        {
+            int ret = binlog_map_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(test_TlsStreamFrame)
         {
             int ret = TlsStreamFrameTest();
@@ -304,6 +353,27 @@ namespace UnitTest1
         {
             int ret = pacing_test();
 
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(pacing_horizon)
+        {
+            int ret = pacing_horizon_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(rate_sampler)
+        {
+            int ret = rate_sampler_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(cubic_fixed_point)
+        {
+            int ret = cubic_fixed_point_test();
+
             Assert::AreEqual(ret, 0);
         }
 
@@ -669,6 +739,13 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(aead_backend_bench)
+        {
+            int ret = aead_backend_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
         
         TEST_METHOD(draft17_vector)
         {
@@ -936,6 +1013,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(key_rotation_auto)
+        {
+            int ret = key_rotation_auto_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(false_migration)
         {
             int ret = false_migration_test();
@@ -985,6 +1069,20 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(textlog_deferred)
+        {
+            int ret = textlog_deferred_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(sqlog)
+        {
+            int ret = sqlog_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(rebinding_stress)
         {
             int ret = rebinding_stress_test();
@@ -1047,6 +1145,69 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(bbr2)
+        {
+            int ret = bbr2_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(bbr2_jitter)
+        {
+            int ret = bbr2_jitter_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(bbr2_shallow_buffer)
+        {
+            int ret = bbr2_shallow_buffer_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(hystart_jitter)
+        {
+            int ret = hystart_jitter_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(ledbat)
+        {
+            int ret = ledbat_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(ecn_validation)
+        {
+            int ret = ecn_validation_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(l4s_prague)
+        {
+            int ret = l4s_prague_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(multipath)
+        {
+            int ret = multipath_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(reorder)
+        {
+            int ret = reorder_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(bbr_performance)
         {
             int ret = bbr_performance_test();
@@ -1124,6 +1285,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(routable_cid)
+        {
+            int ret = routable_cid_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(optimistic_ack)
         {
             int ret = optimistic_ack_test();
@@ -1183,6 +1351,80 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(cc_telemetry) {
+            int ret = cc_telemetry_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(stats) {
+            int ret = stats_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(histogram) {
+            int ret = histogram_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(wake_profile)
+        {
+            int ret = wake_profile_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(send_limits)
+        {
+            int ret = send_limits_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(ack_delay_max_rtt)
+        {
+            int ret = ack_delay_max_rtt_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(binlog_trigger_spurious)
+        {
+            int ret = binlog_trigger_spurious_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(binlog_trigger_window)
+        {
+            int ret = binlog_trigger_window_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(binlog_trigger_stall)
+        {
+            int ret = binlog_trigger_stall_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(binlog_trigger_handshake)
+        {
+            int ret = binlog_trigger_handshake_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(binlog_trigger_close)
+        {
+            int ret = binlog_trigger_close_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(direct_receive) {
             int ret = direct_receive_test();
 
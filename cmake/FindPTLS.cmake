@@ -11,6 +11,7 @@ set(PTLS_HINTS ${CMAKE_BINARY_DIR}/../picotls ../picotls)
 find_library(PTLS_CORE_LIBRARY picotls-core HINTS ${PTLS_HINTS})
 find_library(PTLS_MINICRYPTO_LIBRARY picotls-minicrypto HINTS ${PTLS_HINTS})
 find_library(PTLS_OPENSSL_LIBRARY picotls-openssl HINTS ${PTLS_HINTS})
+find_library(PTLS_FUSION_LIBRARY picotls-fusion HINTS ${PTLS_HINTS})
 
 include(FindPackageHandleStandardArgs)
 # handle the QUIETLY and REQUIRED arguments and set PTLS_FOUND to TRUE
@@ -25,6 +26,12 @@ if(PTLS_FOUND)
     set(PTLS_LIBRARIES
         ${PTLS_CORE_LIBRARY} ${PTLS_MINICRYPTO_LIBRARY} ${PTLS_OPENSSL_LIBRARY})
     set(PTLS_INCLUDE_DIRS ${PTLS_INCLUDE_DIR})
+    if(PTLS_FUSION_LIBRARY)
+        set(PTLS_WITH_FUSION TRUE)
+        list(APPEND PTLS_LIBRARIES ${PTLS_FUSION_LIBRARY})
+    else()
+        set(PTLS_WITH_FUSION FALSE)
+    endif()
 endif()
 
 mark_as_advanced(PTLS_LIBRARIES PTLS_INCLUDE_DIRS)
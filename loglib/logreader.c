@@ -23,22 +23,283 @@
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "picoquic_internal.h"
 #include "bytestream.h"
 #include "logreader.h"
 #include "logwriter.h"
+#include "logcompress.h"
 #include "cidset.h"
 
 static int byteread_packet_header(bytestream * s, picoquic_packet_header * ph);
 
+/* Read the version of the log from the file header */
+static int binlog_read_version(FILE* bin_log, uint32_t* version)
+{
+    uint8_t head[16];
+    int ret = 0;
+
+    if (fseek(bin_log, 0, SEEK_SET) != 0 || fread(head, sizeof(head), 1, bin_log) <= 0 ||
+        PICOPARSE_32(head) != FOURCC('q', 'l', 'o', 'g')) {
+        ret = -1;
+    }
+    else {
+        *version = PICOPARSE_32(head + 4);
+    }
+
+    return ret;
+}
+
+/* Buffers used to decode the blocks of a version 2 log */
+typedef struct st_binlog_v2_buffers_t {
+    uint8_t stored[PICOQUIC_BINLOG_BLOCK_RAW_MAX];
+    uint8_t raw[PICOQUIC_BINLOG_BLOCK_RAW_MAX];
+} binlog_v2_buffers_t;
+
+/* Decode the records of a block, and pass them to the callback in the
+ * version 1 format. If cid is not NULL, only the records of that
+ * connection are passed. */
+static int binlog_v2_decode_records(const uint8_t* raw, size_t raw_length, uint64_t base_time,
+    const picoquic_connection_id_t* cid, int(*cb)(bytestream*, void*), void* cbptr)
+{
+    int ret = 0;
+    bytestream stream;
+    bytestream* s = bytestream_ref_init(&stream, raw, raw_length);
+    picoquic_connection_id_t cids[PICOQUIC_BINLOG_BLOCK_CID_MAX];
+    size_t nb_cids = 0;
+    uint64_t time_stamp = base_time;
+
+    while (ret == 0 && bytestream_remain(s) > 0) {
+        uint64_t cid_index = 0;
+        uint64_t zigzag = 0;
+        size_t rest_length = 0;
+
+        if (byteread_vint(s, &cid_index) != 0 || cid_index > nb_cids) {
+            ret = -1;
+        }
+        else if (cid_index == nb_cids && (nb_cids >= PICOQUIC_BINLOG_BLOCK_CID_MAX ||
+            byteread_cid(s, &cids[nb_cids++]) != 0)) {
+            ret = -1;
+        }
+        else if (byteread_vint(s, &zigzag) != 0 || byteread_vlen(s, &rest_length) != 0 ||
+            rest_length > bytestream_remain(s)) {
+            ret = -1;
+        }
+        else {
+            time_stamp += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+
+            if (cid == NULL || picoquic_compare_connection_id(cid, &cids[cid_index]) == 0) {
+                bytestream_buf stream_msg;
+                bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+
+                if (bytewrite_cid(msg, &cids[cid_index]) != 0 || bytewrite_vint(msg, time_stamp) != 0 ||
+                    bytewrite_buffer(msg, bytestream_ptr(s), rest_length) != 0) {
+                    ret = -1;
+                }
+                else {
+                    msg = bytestream_buf_init(&stream_msg, bytestream_length(msg));
+                    ret = cb(msg, cbptr);
+                }
+            }
+            if (ret == 0) {
+                ret = bytestream_skip(s, rest_length);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Decode a records block, given its header and stored content */
+static int binlog_v2_decode_block(const uint8_t* header, const uint8_t* stored, uint8_t* raw,
+    const picoquic_connection_id_t* cid, int(*cb)(bytestream*, void*), void* cbptr)
+{
+    int ret = 0;
+    size_t raw_length = PICOPARSE_32(header + 4);
+    size_t stored_length = PICOPARSE_32(header + 8);
+    uint64_t base_time = PICOPARSE_64(header + 13);
+
+    if (header[12] == PICOQUIC_BINLOG_CODEC_LZ) {
+        ret = picoquic_lz_decompress(stored, stored_length, raw, raw_length);
+        if (ret == 0) {
+            ret = binlog_v2_decode_records(raw, raw_length, base_time, cid, cb, cbptr);
+        }
+    }
+    else if (header[12] == PICOQUIC_BINLOG_CODEC_NONE && stored_length == raw_length) {
+        ret = binlog_v2_decode_records(stored, raw_length, base_time, cid, cb, cbptr);
+    }
+    else {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Read the block at the current position. Sets is_index if the block is the
+ * index, which marks the end of the records. */
+static int binlog_v2_read_block(FILE* bin_log, binlog_v2_buffers_t* buffers, const picoquic_connection_id_t* cid,
+    int(*cb)(bytestream*, void*), void* cbptr, int* is_index)
+{
+    int ret = 0;
+    uint8_t header[PICOQUIC_BINLOG_BLOCK_HEADER_SIZE];
+    uint32_t block_type;
+    size_t raw_length;
+    size_t stored_length;
+
+    *is_index = 0;
+    if (fread(header, sizeof(header), 1, bin_log) <= 0) {
+        /* End of a log that was not closed */
+        *is_index = 1;
+        return 0;
+    }
+
+    block_type = PICOPARSE_32(header);
+    raw_length = PICOPARSE_32(header + 4);
+    stored_length = PICOPARSE_32(header + 8);
+
+    if (block_type == FOURCC('q', 'i', 'd', 'x')) {
+        *is_index = 1;
+    }
+    else if (block_type != FOURCC('q', 'b', 'l', 'k') || raw_length > PICOQUIC_BINLOG_BLOCK_RAW_MAX ||
+        stored_length > PICOQUIC_BINLOG_BLOCK_RAW_MAX ||
+        (stored_length > 0 && fread(buffers->stored, stored_length, 1, bin_log) <= 0)) {
+        ret = -1;
+    }
+    else {
+        ret = binlog_v2_decode_block(header, buffers->stored, buffers->raw, cid, cb, cbptr);
+    }
+
+    return ret;
+}
+
+static int fileread_binlog_v2(FILE* bin_log, int(*cb)(bytestream*, void*), void* cbptr)
+{
+    int ret = 0;
+    int is_index = 0;
+    binlog_v2_buffers_t* buffers = (binlog_v2_buffers_t*)malloc(sizeof(binlog_v2_buffers_t));
+
+    if (buffers == NULL || fseek(bin_log, 16, SEEK_SET) != 0) {
+        ret = -1;
+    }
+
+    while (ret == 0 && !is_index) {
+        ret = binlog_v2_read_block(bin_log, buffers, NULL, cb, cbptr, &is_index);
+    }
+
+    if (buffers != NULL) {
+        free(buffers);
+    }
+
+    return ret;
+}
+
+/* Read the index of a version 2 log. Returns -1 if the log has no index */
+static int binlog_v2_read_index(FILE* bin_log, uint8_t** index_bytes, size_t* index_length)
+{
+    int ret = 0;
+    uint8_t trailer[PICOQUIC_BINLOG_TRAILER_SIZE];
+    uint8_t header[PICOQUIC_BINLOG_BLOCK_HEADER_SIZE];
+
+    *index_bytes = NULL;
+    *index_length = 0;
+
+    if (fseek(bin_log, -PICOQUIC_BINLOG_TRAILER_SIZE, SEEK_END) != 0 ||
+        fread(trailer, sizeof(trailer), 1, bin_log) <= 0 ||
+        PICOPARSE_32(trailer + 8) != FOURCC('q', 'e', 'n', 'd') ||
+        fseek(bin_log, (long)PICOPARSE_64(trailer), SEEK_SET) != 0 ||
+        fread(header, sizeof(header), 1, bin_log) <= 0 ||
+        PICOPARSE_32(header) != FOURCC('q', 'i', 'd', 'x') ||
+        PICOPARSE_32(header + 8) != PICOPARSE_32(header + 4)) {
+        ret = -1;
+    }
+    else {
+        *index_length = PICOPARSE_32(header + 4);
+        *index_bytes = (uint8_t*)malloc(*index_length);
+        if (*index_bytes == NULL || fread(*index_bytes, *index_length, 1, bin_log) <= 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret != 0 && *index_bytes != NULL) {
+        free(*index_bytes);
+        *index_bytes = NULL;
+    }
+
+    return ret;
+}
+
+/* Call back the records of a connection, reading only the blocks listed
+ * for that connection in the index. */
+static int binlog_v2_read_cid(FILE* bin_log, uint8_t* index_bytes, size_t index_length,
+    const picoquic_connection_id_t* cid, int(*cb)(bytestream*, void*), void* cbptr)
+{
+    int ret = 0;
+    bytestream stream;
+    bytestream* s = bytestream_ref_init(&stream, index_bytes, index_length);
+    uint64_t nb_cids = 0;
+    int is_found = 0;
+
+    ret = byteread_vint(s, &nb_cids);
+    for (uint64_t i = 0; ret == 0 && !is_found && i < nb_cids; i++) {
+        picoquic_connection_id_t index_cid;
+        uint64_t nb_blocks = 0;
+        uint64_t offset = 0;
+
+        if (byteread_cid(s, &index_cid) != 0 || byteread_vint(s, &nb_blocks) != 0) {
+            ret = -1;
+        }
+        else if (picoquic_compare_connection_id(cid, &index_cid) != 0) {
+            for (uint64_t j = 0; ret == 0 && j < nb_blocks; j++) {
+                ret = byteread_skip_vint(s);
+            }
+        }
+        else {
+            binlog_v2_buffers_t* buffers = (binlog_v2_buffers_t*)malloc(sizeof(binlog_v2_buffers_t));
+
+            is_found = 1;
+            if (buffers == NULL) {
+                ret = -1;
+            }
+            for (uint64_t j = 0; ret == 0 && j < nb_blocks; j++) {
+                uint64_t delta = 0;
+                int is_index = 0;
+
+                if (byteread_vint(s, &delta) != 0 || fseek(bin_log, (long)(offset + delta), SEEK_SET) != 0) {
+                    ret = -1;
+                }
+                else {
+                    offset += delta;
+                    ret = binlog_v2_read_block(bin_log, buffers, cid, cb, cbptr, &is_index);
+                }
+            }
+            if (buffers != NULL) {
+                free(buffers);
+            }
+        }
+    }
+
+    return ret;
+}
+
 int fileread_binlog(FILE* bin_log, int(*cb)(bytestream*, void*), void* cbptr)
 {
     int ret = 0;
     uint8_t head[4];
     bytestream_buf stream_msg;
+    uint32_t version = 0;
 
-    fseek(bin_log, 16, SEEK_SET);
+    if (binlog_read_version(bin_log, &version) != 0) {
+        return -1;
+    }
+    else if (version == PICOQUIC_BINLOG_VERSION_2) {
+        return fileread_binlog_v2(bin_log, cb, cbptr);
+    }
 
     while (ret == 0 && fread(head, sizeof(head), 1, bin_log) > 0) {
 
@@ -174,11 +435,34 @@ static int binlog_convert_event(bytestream * s, void * ptr)
 
 int binlog_convert(FILE * f_binlog, const picoquic_connection_id_t * cid, binlog_convert_cb_t * callbacks)
 {
+    int ret;
+    uint32_t version = 0;
+    uint8_t* index_bytes = NULL;
+    size_t index_length = 0;
     convert_log_file_event_t ctx;
     ctx.cid = cid;
     ctx.callbacks = callbacks;
 
-    return fileread_binlog(f_binlog, binlog_convert_event, &ctx);
+    if (binlog_read_version(f_binlog, &version) == 0 && version == PICOQUIC_BINLOG_VERSION_2 &&
+        binlog_v2_read_index(f_binlog, &index_bytes, &index_length) == 0) {
+        /* Only read the blocks that contain records of this connection */
+        ret = binlog_v2_read_cid(f_binlog, index_bytes, index_length, cid, binlog_convert_event, &ctx);
+        free(index_bytes);
+    }
+    else {
+        ret = fileread_binlog(f_binlog, binlog_convert_event, &ctx);
+    }
+
+    return ret;
+}
+
+int binlog_convert_record(bytestream * s, const picoquic_connection_id_t * cid, binlog_convert_cb_t * callbacks)
+{
+    convert_log_file_event_t ctx;
+    ctx.cid = cid;
+    ctx.callbacks = callbacks;
+
+    return binlog_convert_event(s, &ctx);
 }
 
 static int binlog_list_cids_cb(bytestream * s, void * cbptr)
@@ -195,7 +479,569 @@ static int binlog_list_cids_cb(bytestream * s, void * cbptr)
 
 int binlog_list_cids(FILE * binlog, picohash_table * cids)
 {
-    return fileread_binlog(binlog, binlog_list_cids_cb, cids);
+    int ret = 0;
+    uint32_t version = 0;
+    uint8_t* index_bytes = NULL;
+    size_t index_length = 0;
+
+    if (binlog_read_version(binlog, &version) == 0 && version == PICOQUIC_BINLOG_VERSION_2 &&
+        binlog_v2_read_index(binlog, &index_bytes, &index_length) == 0) {
+        /* The index lists all the connections */
+        bytestream stream;
+        bytestream* s = bytestream_ref_init(&stream, index_bytes, index_length);
+        uint64_t nb_cids = 0;
+
+        ret = byteread_vint(s, &nb_cids);
+        for (uint64_t i = 0; ret == 0 && i < nb_cids; i++) {
+            picoquic_connection_id_t cid;
+            uint64_t nb_blocks = 0;
+
+            ret = byteread_cid(s, &cid);
+            if (ret == 0) {
+                ret = cidset_insert(cids, &cid);
+            }
+            if (ret == 0) {
+                ret = byteread_vint(s, &nb_blocks);
+            }
+            for (uint64_t j = 0; ret == 0 && j < nb_blocks; j++) {
+                ret = byteread_skip_vint(s);
+            }
+        }
+        free(index_bytes);
+    }
+    else {
+        ret = fileread_binlog(binlog, binlog_list_cids_cb, cids);
+    }
+
+    return ret;
+}
+
+/* Memory mapped reader.
+ *
+ * The file is mapped once, and a single pass builds for each connection
+ * the list of its records: the offset of each record in version 1 logs,
+ * or the offset of each block containing records of the connection in
+ * version 2 logs. For version 2 logs that were properly closed, the index
+ * at the end of the file is used instead of scanning the blocks.
+ * Connections can then be converted independently, and in parallel,
+ * without reading the file again.
+ */
+typedef struct st_binlog_map_cid_t {
+    picoquic_connection_id_t cid;
+    size_t nb_offsets;
+    size_t nb_alloc;
+    uint64_t* offsets;
+} binlog_map_cid_t;
+
+struct st_binlog_map_t {
+    const uint8_t* bytes;
+    uint64_t length;
+    uint32_t version;
+    picohash_table* cid_table;
+    binlog_map_cid_t** cids;
+    size_t nb_cids;
+    size_t nb_alloc;
+#ifdef _WINDOWS
+    HANDLE h_file;
+    HANDLE h_mapping;
+#endif
+};
+
+static uint64_t binlog_map_cid_hash(const void* key)
+{
+    return picoquic_connection_id_hash(&((const binlog_map_cid_t*)key)->cid);
+}
+
+static int binlog_map_cid_compare(const void* key0, const void* key1)
+{
+    return picoquic_compare_connection_id(&((const binlog_map_cid_t*)key0)->cid,
+        &((const binlog_map_cid_t*)key1)->cid);
+}
+
+static binlog_map_cid_t* binlog_map_get_cid(binlog_map_t* map, const picoquic_connection_id_t* cid)
+{
+    binlog_map_cid_t key;
+    picohash_item* item;
+
+    key.cid = *cid;
+    item = picohash_retrieve(map->cid_table, &key);
+
+    return (item == NULL) ? NULL : (binlog_map_cid_t*)item->key;
+}
+
+static int binlog_map_add_offset(binlog_map_t* map, const picoquic_connection_id_t* cid, uint64_t offset)
+{
+    int ret = 0;
+    binlog_map_cid_t* entry = binlog_map_get_cid(map, cid);
+
+    if (entry == NULL) {
+        if (map->nb_cids >= map->nb_alloc) {
+            size_t nb_alloc = (map->nb_alloc == 0) ? 256 : 2 * map->nb_alloc;
+            binlog_map_cid_t** cids = (binlog_map_cid_t**)realloc(map->cids, nb_alloc * sizeof(binlog_map_cid_t*));
+            if (cids == NULL) {
+                return -1;
+            }
+            map->cids = cids;
+            map->nb_alloc = nb_alloc;
+        }
+        entry = (binlog_map_cid_t*)malloc(sizeof(binlog_map_cid_t));
+        if (entry == NULL) {
+            return -1;
+        }
+        memset(entry, 0, sizeof(binlog_map_cid_t));
+        entry->cid = *cid;
+        if (picohash_insert(map->cid_table, entry) != 0) {
+            free(entry);
+            return -1;
+        }
+        map->cids[map->nb_cids++] = entry;
+    }
+
+    if (entry->nb_offsets > 0 && entry->offsets[entry->nb_offsets - 1] == offset) {
+        /* Several records of the same connection in a version 2 block */
+    }
+    else if (entry->nb_offsets >= entry->nb_alloc) {
+        size_t nb_alloc = (entry->nb_alloc == 0) ? 16 : 2 * entry->nb_alloc;
+        uint64_t* offsets = (uint64_t*)realloc(entry->offsets, nb_alloc * sizeof(uint64_t));
+        if (offsets == NULL) {
+            ret = -1;
+        }
+        else {
+            entry->offsets = offsets;
+            entry->nb_alloc = nb_alloc;
+        }
+    }
+    if (ret == 0 && (entry->nb_offsets == 0 || entry->offsets[entry->nb_offsets - 1] != offset)) {
+        entry->offsets[entry->nb_offsets++] = offset;
+    }
+
+    return ret;
+}
+
+/* Index the records of a version 1 log. A truncated last record, as found
+ * in the log of a process that did not exit cleanly, ends the index. */
+static int binlog_map_index_v1(binlog_map_t* map)
+{
+    int ret = 0;
+    uint64_t offset = 16;
+
+    while (ret == 0 && offset + 4 <= map->length) {
+        uint32_t len = PICOPARSE_32(map->bytes + offset);
+        bytestream stream;
+        bytestream* s;
+        picoquic_connection_id_t cid;
+
+        if (len > BYTESTREAM_MAX_BUFFER_SIZE) {
+            ret = -1;
+        }
+        else if (offset + 4 + len > map->length) {
+            break;
+        }
+        else {
+            s = bytestream_ref_init(&stream, map->bytes + offset + 4, len);
+            ret = byteread_cid(s, &cid);
+            if (ret == 0) {
+                ret = binlog_map_add_offset(map, &cid, offset);
+            }
+            offset += 4 + (uint64_t)len;
+        }
+    }
+
+    return ret;
+}
+
+typedef struct st_binlog_map_block_ctx_t {
+    binlog_map_t* map;
+    uint64_t block_offset;
+} binlog_map_block_ctx_t;
+
+static int binlog_map_block_cb(bytestream* s, void* ptr)
+{
+    binlog_map_block_ctx_t* ctx = (binlog_map_block_ctx_t*)ptr;
+    picoquic_connection_id_t cid;
+    int ret = byteread_cid(s, &cid);
+
+    if (ret == 0) {
+        ret = binlog_map_add_offset(ctx->map, &cid, ctx->block_offset);
+    }
+
+    return ret;
+}
+
+/* Check that the block at offset is a records block that fits in the file */
+static int binlog_map_check_block(binlog_map_t* map, uint64_t offset, int * is_index)
+{
+    const uint8_t* header = map->bytes + offset;
+    int ret = 0;
+
+    *is_index = 0;
+    if (offset + PICOQUIC_BINLOG_BLOCK_HEADER_SIZE > map->length) {
+        ret = -1;
+    }
+    else if (PICOPARSE_32(header) == FOURCC('q', 'i', 'd', 'x')) {
+        *is_index = 1;
+    }
+    else if (PICOPARSE_32(header) != FOURCC('q', 'b', 'l', 'k') ||
+        PICOPARSE_32(header + 4) > PICOQUIC_BINLOG_BLOCK_RAW_MAX ||
+        PICOPARSE_32(header + 8) > PICOQUIC_BINLOG_BLOCK_RAW_MAX ||
+        offset + PICOQUIC_BINLOG_BLOCK_HEADER_SIZE + PICOPARSE_32(header + 8) > map->length) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Index the blocks of a version 2 log, using the index written when the
+ * log was closed if there is one, or decoding each block otherwise. */
+static int binlog_map_index_v2(binlog_map_t* map)
+{
+    int ret = 0;
+    int is_index = 0;
+    uint64_t index_offset = 0;
+
+    if (map->length >= 16 + PICOQUIC_BINLOG_TRAILER_SIZE &&
+        PICOPARSE_32(map->bytes + map->length - 4) == FOURCC('q', 'e', 'n', 'd') &&
+        (index_offset = PICOPARSE_64(map->bytes + map->length - PICOQUIC_BINLOG_TRAILER_SIZE)) >= 16 &&
+        binlog_map_check_block(map, index_offset, &is_index) == 0 && is_index &&
+        index_offset + PICOQUIC_BINLOG_BLOCK_HEADER_SIZE + PICOPARSE_32(map->bytes + index_offset + 4) <= map->length) {
+        bytestream stream;
+        bytestream* s = bytestream_ref_init(&stream, map->bytes + index_offset + PICOQUIC_BINLOG_BLOCK_HEADER_SIZE,
+            PICOPARSE_32(map->bytes + index_offset + 4));
+        uint64_t nb_cids = 0;
+
+        ret = byteread_vint(s, &nb_cids);
+        for (uint64_t i = 0; ret == 0 && i < nb_cids; i++) {
+            picoquic_connection_id_t cid;
+            uint64_t nb_blocks = 0;
+            uint64_t offset = 0;
+
+            ret = byteread_cid(s, &cid);
+            if (ret == 0) {
+                ret = byteread_vint(s, &nb_blocks);
+            }
+            for (uint64_t j = 0; ret == 0 && j < nb_blocks; j++) {
+                uint64_t delta = 0;
+                ret = byteread_vint(s, &delta);
+                if (ret == 0) {
+                    offset += delta;
+                    ret = binlog_map_check_block(map, offset, &is_index);
+                    if (ret == 0 && is_index) {
+                        ret = -1;
+                    }
+                }
+                if (ret == 0) {
+                    ret = binlog_map_add_offset(map, &cid, offset);
+                }
+            }
+        }
+    }
+    else {
+        uint8_t* raw = (uint8_t*)malloc(PICOQUIC_BINLOG_BLOCK_RAW_MAX);
+        binlog_map_block_ctx_t ctx;
+        uint64_t offset = 16;
+
+        ctx.map = map;
+        if (raw == NULL) {
+            ret = -1;
+        }
+        /* A truncated last block ends the index, as in version 1 */
+        while (ret == 0 && !is_index && binlog_map_check_block(map, offset, &is_index) == 0 && !is_index) {
+            const uint8_t* header = map->bytes + offset;
+
+            ctx.block_offset = offset;
+            ret = binlog_v2_decode_block(header, header + PICOQUIC_BINLOG_BLOCK_HEADER_SIZE, raw,
+                NULL, binlog_map_block_cb, &ctx);
+            offset += PICOQUIC_BINLOG_BLOCK_HEADER_SIZE + PICOPARSE_32(header + 8);
+        }
+        if (raw != NULL) {
+            free(raw);
+        }
+    }
+
+    return ret;
+}
+
+static int binlog_map_file(binlog_map_t* map, const char* binlog_name)
+{
+    int ret = 0;
+#ifdef _WINDOWS
+    LARGE_INTEGER file_size;
+
+    map->h_file = CreateFileA(binlog_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (map->h_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(map->h_file, &file_size) ||
+        file_size.QuadPart < 16) {
+        ret = -1;
+    }
+    else {
+        map->length = (uint64_t)file_size.QuadPart;
+        map->h_mapping = CreateFileMappingA(map->h_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (map->h_mapping == NULL) {
+            ret = -1;
+        }
+        else {
+            map->bytes = (const uint8_t*)MapViewOfFile(map->h_mapping, FILE_MAP_READ, 0, 0, 0);
+            if (map->bytes == NULL) {
+                ret = -1;
+            }
+        }
+    }
+#else
+    struct stat file_stat;
+    int fd = open(binlog_name, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || file_stat.st_size < 16 ||
+        (uint64_t)file_stat.st_size > (uint64_t)SIZE_MAX) {
+        ret = -1;
+    }
+    else {
+        void* bytes = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (bytes == MAP_FAILED) {
+            ret = -1;
+        }
+        else {
+            map->bytes = (const uint8_t*)bytes;
+            map->length = (uint64_t)file_stat.st_size;
+        }
+    }
+    if (fd >= 0) {
+        (void)close(fd);
+    }
+#endif
+    if (ret != 0) {
+        DBG_PRINTF("Cannot map the log file %s\n", binlog_name);
+    }
+
+    return ret;
+}
+
+binlog_map_t* binlog_map_open(const char* binlog_name)
+{
+    int ret = 0;
+    binlog_map_t* map = (binlog_map_t*)malloc(sizeof(binlog_map_t));
+
+    if (map == NULL) {
+        return NULL;
+    }
+    memset(map, 0, sizeof(binlog_map_t));
+#ifdef _WINDOWS
+    map->h_file = INVALID_HANDLE_VALUE;
+#endif
+
+    ret = binlog_map_file(map, binlog_name);
+    if (ret == 0) {
+        /* Size the hash table for a large number of connections */
+        size_t nb_bin = (size_t)((map->length / 0x10000) | 0xFF) + 1;
+        if (nb_bin > 0x100000) {
+            nb_bin = 0x100000;
+        }
+        map->cid_table = picohash_create(nb_bin, binlog_map_cid_hash, binlog_map_cid_compare);
+        if (map->cid_table == NULL || PICOPARSE_32(map->bytes) != FOURCC('q', 'l', 'o', 'g')) {
+            ret = -1;
+        }
+        else {
+            map->version = PICOPARSE_32(map->bytes + 4);
+            if (map->version == PICOQUIC_BINLOG_VERSION_1) {
+                ret = binlog_map_index_v1(map);
+            }
+            else if (map->version == PICOQUIC_BINLOG_VERSION_2) {
+                ret = binlog_map_index_v2(map);
+            }
+            else {
+                DBG_PRINTF("Unsupported version %u for log file %s\n", map->version, binlog_name);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret != 0) {
+        binlog_map_close(map);
+        map = NULL;
+    }
+
+    return map;
+}
+
+void binlog_map_close(binlog_map_t* map)
+{
+    if (map->cid_table != NULL) {
+        picohash_delete(map->cid_table, 0);
+    }
+    for (size_t i = 0; i < map->nb_cids; i++) {
+        if (map->cids[i]->offsets != NULL) {
+            free(map->cids[i]->offsets);
+        }
+        free(map->cids[i]);
+    }
+    if (map->cids != NULL) {
+        free(map->cids);
+    }
+#ifdef _WINDOWS
+    if (map->bytes != NULL) {
+        (void)UnmapViewOfFile(map->bytes);
+    }
+    if (map->h_mapping != NULL) {
+        (void)CloseHandle(map->h_mapping);
+    }
+    if (map->h_file != INVALID_HANDLE_VALUE) {
+        (void)CloseHandle(map->h_file);
+    }
+#else
+    if (map->bytes != NULL) {
+        (void)munmap((void*)map->bytes, (size_t)map->length);
+    }
+#endif
+    free(map);
+}
+
+size_t binlog_map_nb_cids(const binlog_map_t* map)
+{
+    return map->nb_cids;
+}
+
+const picoquic_connection_id_t* binlog_map_cid(const binlog_map_t* map, size_t rank)
+{
+    return (rank < map->nb_cids) ? &map->cids[rank]->cid : NULL;
+}
+
+int binlog_map_convert(binlog_map_t* map, const picoquic_connection_id_t* cid, binlog_convert_cb_t* callbacks)
+{
+    int ret = 0;
+    binlog_map_cid_t* entry = binlog_map_get_cid(map, cid);
+    convert_log_file_event_t ctx;
+    ctx.cid = cid;
+    ctx.callbacks = callbacks;
+
+    if (entry == NULL) {
+        /* No record for this connection */
+    }
+    else if (map->version == PICOQUIC_BINLOG_VERSION_1) {
+        for (size_t i = 0; ret == 0 && i < entry->nb_offsets; i++) {
+            bytestream stream;
+            bytestream* s = bytestream_ref_init(&stream, map->bytes + entry->offsets[i] + 4,
+                PICOPARSE_32(map->bytes + entry->offsets[i]));
+            ret = binlog_convert_event(s, &ctx);
+        }
+    }
+    else {
+        uint8_t* raw = (uint8_t*)malloc(PICOQUIC_BINLOG_BLOCK_RAW_MAX);
+
+        if (raw == NULL) {
+            ret = -1;
+        }
+        for (size_t i = 0; ret == 0 && i < entry->nb_offsets; i++) {
+            const uint8_t* header = map->bytes + entry->offsets[i];
+            ret = binlog_v2_decode_block(header, header + PICOQUIC_BINLOG_BLOCK_HEADER_SIZE, raw,
+                cid, binlog_convert_event, &ctx);
+        }
+        if (raw != NULL) {
+            free(raw);
+        }
+    }
+
+    return ret;
+}
+
+/* Parallel conversion. Worker threads take the next connection to convert
+ * from a shared counter, so long and short connections balance out. */
+typedef struct st_binlog_map_workers_t {
+    binlog_map_t* map;
+    int (*convert_fn)(binlog_map_t* map, const picoquic_connection_id_t* cid, void* ptr);
+    void* ptr;
+    picoquic_mutex_t mutex;
+    size_t next_rank;
+    int ret;
+} binlog_map_workers_t;
+
+static picoquic_thread_return_t binlog_map_worker(void* arg)
+{
+    binlog_map_workers_t* workers = (binlog_map_workers_t*)arg;
+    int is_done = 0;
+
+    while (!is_done) {
+        size_t rank;
+        int ret;
+
+        (void)picoquic_lock_mutex(&workers->mutex);
+        rank = workers->next_rank;
+        if (rank < workers->map->nb_cids && workers->ret == 0) {
+            workers->next_rank++;
+        }
+        else {
+            is_done = 1;
+        }
+        (void)picoquic_unlock_mutex(&workers->mutex);
+
+        if (!is_done) {
+            ret = workers->convert_fn(workers->map, &workers->map->cids[rank]->cid, workers->ptr);
+            if (ret != 0) {
+                (void)picoquic_lock_mutex(&workers->mutex);
+                workers->ret = ret;
+                (void)picoquic_unlock_mutex(&workers->mutex);
+            }
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+int binlog_map_convert_all(binlog_map_t* map, int nb_threads,
+    int (*convert_fn)(binlog_map_t* map, const picoquic_connection_id_t* cid, void* ptr), void* ptr)
+{
+    int ret = 0;
+    binlog_map_workers_t workers;
+    picoquic_thread_t* threads = NULL;
+    int nb_started = 0;
+
+    memset(&workers, 0, sizeof(workers));
+    workers.map = map;
+    workers.convert_fn = convert_fn;
+    workers.ptr = ptr;
+
+    if (nb_threads > 1 && (size_t)nb_threads > map->nb_cids) {
+        nb_threads = (int)map->nb_cids;
+    }
+
+    if (nb_threads <= 1) {
+        for (size_t i = 0; ret == 0 && i < map->nb_cids; i++) {
+            ret = convert_fn(map, &map->cids[i]->cid, ptr);
+        }
+    }
+    else if (picoquic_create_mutex(&workers.mutex) != 0) {
+        ret = -1;
+    }
+    else {
+        threads = (picoquic_thread_t*)malloc(nb_threads * sizeof(picoquic_thread_t));
+        if (threads == NULL) {
+            ret = -1;
+        }
+        while (ret == 0 && nb_started < nb_threads) {
+            if (picoquic_create_thread(&threads[nb_started], binlog_map_worker, &workers) != 0) {
+                ret = -1;
+            }
+            else {
+                nb_started++;
+            }
+        }
+        if (ret != 0) {
+            /* Stop the workers already started */
+            (void)picoquic_lock_mutex(&workers.mutex);
+            workers.ret = ret;
+            (void)picoquic_unlock_mutex(&workers.mutex);
+        }
+        for (int i = 0; i < nb_started; i++) {
+            picoquic_join_thread(&threads[i]);
+        }
+        if (threads != NULL) {
+            free(threads);
+        }
+        (void)picoquic_delete_mutex(&workers.mutex);
+        if (ret == 0) {
+            ret = workers.ret;
+        }
+    }
+
+    return ret;
 }
 
 static int byteread_packet_header(bytestream * s, picoquic_packet_header * ph)
@@ -288,7 +1134,8 @@ FILE * picoquic_open_cc_log_file_for_read(char const * bin_cc_log_name, uint64_t
             ret = -1;
             DBG_PRINTF("Header for file %s does not start with magic number.\n", bin_cc_log_name);
         }
-        else if (byteread_int32(ps, &version) != 0 || version != 0x01) {
+        else if (byteread_int32(ps, &version) != 0 ||
+            (version != PICOQUIC_BINLOG_VERSION_1 && version != PICOQUIC_BINLOG_VERSION_2)) {
             ret = -1;
             DBG_PRINTF("Header for file %s requires unsupported version.\n", bin_cc_log_name);
         }
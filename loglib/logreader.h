@@ -65,6 +65,15 @@ typedef struct binlog_convert_cb_st {
  */
 int binlog_convert(FILE * f_binlog, const picoquic_connection_id_t * cid, binlog_convert_cb_t * callbacks);
 
+/*! \brief Convert a single record, as passed to the binary log sink, into
+ *         the matching log event call if it belongs to the connection.
+ *
+ *  \param s         Bytestream of the record, starting with the initial CID.
+ *  \param cid       Initial connection id for the events to be called back.
+ *  \param callbacks Callback functions for the events.
+ */
+int binlog_convert_record(bytestream * s, const picoquic_connection_id_t * cid, binlog_convert_cb_t * callbacks);
+
 /*! \brief Write all connection ids contained in a binary log file into a
  *         picohash_table.
  *
@@ -74,6 +83,46 @@ int binlog_convert(FILE * f_binlog, const picoquic_connection_id_t * cid, binlog
  */
 int binlog_list_cids(FILE * binlog, picohash_table * cids);
 
+/*! \brief Memory mapped binary log, indexed by connection id.
+ *
+ *  The file is mapped and scanned once, building for each connection the
+ *  list of its records, or of the blocks that contain them in version 2
+ *  logs. Conversions then only touch the records of the connection, and
+ *  can run in parallel.
+ */
+typedef struct st_binlog_map_t binlog_map_t;
+
+/*! \brief Map and index a binary log file. Returns NULL if the file cannot
+ *         be mapped or is not a valid binary log.
+ */
+binlog_map_t* binlog_map_open(const char* binlog_name);
+
+/*! \brief Unmap the file and free the index. */
+void binlog_map_close(binlog_map_t* map);
+
+/*! \brief Number of connections in the log, and connection id by rank in
+ *         order of first appearance.
+ */
+size_t binlog_map_nb_cids(const binlog_map_t* map);
+const picoquic_connection_id_t* binlog_map_cid(const binlog_map_t* map, size_t rank);
+
+/*! \brief Same as binlog_convert, using the index of a mapped log. Several
+ *         connections of the same map can be converted concurrently.
+ */
+int binlog_map_convert(binlog_map_t* map, const picoquic_connection_id_t* cid, binlog_convert_cb_t* callbacks);
+
+/*! \brief Call convert_fn for every connection in the log, from nb_threads
+ *         worker threads. The conversion stops at the first error.
+ *
+ *  \param map        The mapped log.
+ *  \param nb_threads Number of worker threads. Connections are converted in
+ *                    the calling thread if nb_threads is 1 or less.
+ *  \param convert_fn Conversion function, must be thread safe.
+ *  \param ptr        Context pointer passed to convert_fn.
+ */
+int binlog_map_convert_all(binlog_map_t* map, int nb_threads,
+    int (*convert_fn)(binlog_map_t* map, const picoquic_connection_id_t* cid, void* ptr), void* ptr);
+
 /*! \brief Return the file handle of the output file for log file conversion.
  *
  *  \param cid_name The initial connection id converted to a string. This will
@@ -28,6 +28,7 @@
 #include "bytestream.h"
 #include "logreader.h"
 #include "logconvert.h"
+#include "logwriter.h"
 
 typedef struct qlog_context_st {
 
@@ -52,8 +53,34 @@ typedef struct qlog_context_st {
 
 
     int state;
+    unsigned int is_seq : 1; /*!< Write JSON-SEQ records instead of a single JSON document */
 } qlog_context_t;
 
+/* Events are elements of the "events" array in the qlog file. In the
+ * JSON-SEQ format, each event is a record of its own, starting with the
+ * RS character and ending with a line feed (RFC 7464).
+ */
+static void qlog_event_start(qlog_context_t* ctx)
+{
+    if (ctx->is_seq) {
+        fprintf(ctx->f_txtlog, "\x1e");
+    }
+    else if (ctx->event_count != 0) {
+        fprintf(ctx->f_txtlog, ",\n");
+    }
+    else {
+        fprintf(ctx->f_txtlog, "\n");
+    }
+}
+
+static void qlog_event_end(qlog_context_t* ctx)
+{
+    if (ctx->is_seq) {
+        fprintf(ctx->f_txtlog, "\n");
+    }
+    ctx->event_count++;
+}
+
 int qlog_string(FILE* f, bytestream* s, uint64_t l)
 {
     uint64_t x;
@@ -322,12 +349,7 @@ int qlog_param_update(uint64_t time, bytestream* s, void* ptr)
 
     ret |= byteread_vint(s, &owner);
 
-    if (ctx->event_count != 0) {
-        fprintf(f, ",\n");
-    }
-    else {
-        fprintf(f, "\n");
-    }
+    qlog_event_start(ctx);
 
     ret |= byteread_vint(s, &sni_length);
     fprintf(f, "[%"PRId64", \"TRANSPORT\", \"parameters_set\", {\n    \"owner\": \"%s\"",
@@ -367,7 +389,7 @@ int qlog_param_update(uint64_t time, bytestream* s, void* ptr)
     
     fprintf(f, "}]");
 
-    ctx->event_count++;
+    qlog_event_end(ctx);
 
     return 0;
 }
@@ -388,12 +410,7 @@ int qlog_packet_lost(uint64_t time, bytestream* s, void* ptr)
     ret |= byteread_vint(s, &sequence);
     ret |= byteread_vint(s, &trigger_length);
 
-    if (ctx->event_count != 0) {
-        fprintf(f, ",\n");
-    }
-    else {
-        fprintf(f, "\n");
-    }
+    qlog_event_start(ctx);
 
     fprintf(f, "[%"PRId64", \"RECOVERY\", \"PACKET_LOST\", {\n", delta_time);
     fprintf(f, "    \"packet_type\" : \"%s\"", ptype2str((picoquic_packet_type_enum)packet_type));
@@ -416,7 +433,7 @@ int qlog_packet_lost(uint64_t time, bytestream* s, void* ptr)
     }
     fprintf(f, "}}]");
 
-    ctx->event_count++;
+    qlog_event_end(ctx);
 
     return 0;
 }
@@ -435,12 +452,7 @@ int qlog_pdu(uint64_t time, int rxtx, bytestream* s, void * ptr)
     byteread_vint(s, &byte_length);
     ret_local = byteread_addr(s, &addr_local);
 
-    if (ctx->event_count != 0) {
-        fprintf(f, ",\n");
-    }
-    else {
-        fprintf(f, "\n");
-    }
+    qlog_event_start(ctx);
 
     fprintf(f, "[%"PRId64", \"TRANSPORT\", \"%s\", { \"byte_length\": %" PRIu64,
         delta_time, (rxtx == 0) ? "DATAGRAM_SENT" : "DATAGRAM_RECEIVED", byte_length);
@@ -462,7 +474,7 @@ int qlog_pdu(uint64_t time, int rxtx, bytestream* s, void * ptr)
     }
 
     fprintf(f, "}]");
-    ctx->event_count++;
+    qlog_event_end(ctx);
     return 0;
 }
 
@@ -473,11 +485,7 @@ int qlog_packet_start(uint64_t time, uint64_t size, const picoquic_packet_header
 
     int64_t delta_time = time - ctx->start_time;
 
-    if (ctx->event_count != 0) {
-        fprintf(f, ",\n");
-    } else {
-        fprintf(f, "\n");
-    }
+    qlog_event_start(ctx);
 
     fprintf(f, "[%"PRId64", \"TRANSPORT\", \"%s\", { \"packet_type\": \"%s\", \"header\": { \"packet_size\": %"PRIu64 ,
         delta_time, (rxtx == 0)?"PACKET_SENT":"PACKET_RECEIVED", ptype2str(ph->ptype), size);
@@ -961,7 +969,7 @@ int qlog_packet_end(void * ptr)
         fprintf(f, "]}]");
     }
     ctx->packet_count++; 
-    ctx->event_count++;
+    qlog_event_end(ctx);
     return 0;
 }
 
@@ -985,15 +993,26 @@ int qlog_connection_start(uint64_t time, const picoquic_connection_id_t * cid, i
     ctx->spin_bit_sent_last = 0;
     ctx->spin_bit_sent = 0;
 
-    fprintf(f, "{ \"qlog_version\": \"draft-00\", \"title\": \"picoquic\", \"traces\": [\n");
+    if (ctx->is_seq) {
+        fprintf(f, "\x1e{ \"qlog_version\": \"draft-00\", \"qlog_format\": \"JSON-SEQ\", \"title\": \"picoquic\", \"trace\":\n");
+    }
+    else {
+        fprintf(f, "{ \"qlog_version\": \"draft-00\", \"title\": \"picoquic\", \"traces\": [\n");
+    }
     fprintf(f, "{ \"vantage_point\": { \"name\": \"backend-67\", \"type\": \"%s\" },\n",
         client_mode?"client":"server");
 
     fprintf(f, "\"title\": \"picoquic\", \"description\": \"%s\",", ctx->cid_name);
     fprintf(f, "\"event_fields\": [\"relative_time\", \"CATEGORY\", \"EVENT_TYPE\", \"DATA\"],\n");
     fprintf(f, "\"configuration\": {\"time_units\": \"us\"},\n");
-    fprintf(f, "\"common_fields\": { \"protocol_type\": \"QUIC_HTTP3\", \"reference_time\": \"%"PRIu64"\"},\n", ctx->start_time);
-    fprintf(f, "\"events\": [");
+    if (ctx->is_seq) {
+        /* The events follow the header, as separate records */
+        fprintf(f, "\"common_fields\": { \"protocol_type\": \"QUIC_HTTP3\", \"reference_time\": \"%"PRIu64"\"}}}\n", ctx->start_time);
+    }
+    else {
+        fprintf(f, "\"common_fields\": { \"protocol_type\": \"QUIC_HTTP3\", \"reference_time\": \"%"PRIu64"\"},\n", ctx->start_time);
+        fprintf(f, "\"events\": [");
+    }
     ctx->state = 1;
     return 0;
 }
@@ -1002,13 +1021,18 @@ int qlog_connection_end(uint64_t time, void * ptr)
 {
     qlog_context_t * ctx = (qlog_context_t*)ptr;
     FILE * f = ctx->f_txtlog;
-    fprintf(f, "]}]}\n");
+
+    if (!ctx->is_seq) {
+        fprintf(f, "]}]}\n");
+    }
 
     ctx->state = 2;
     return 0;
 }
 
-int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char* binlog_name, const char* txt_name, const char* out_dir)
+/* Convert from either an open log file or a mapped log */
+static int qlog_convert_from(const picoquic_connection_id_t* cid, FILE* f_binlog, binlog_map_t* map,
+    const char* binlog_name, const char* txt_name, const char* out_dir)
 {
     int ret = 0;
     FILE* f_txtlog = NULL;
@@ -1036,6 +1060,7 @@ int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char
         qlog.start_time = 0;
         qlog.packet_count = 0;
         qlog.state = 0;
+        qlog.is_seq = 0;
 
         binlog_convert_cb_t ctx;
         ctx.connection_start = qlog_connection_start;
@@ -1048,7 +1073,12 @@ int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char
         ctx.packet_lost = qlog_packet_lost;
         ctx.ptr = &qlog;
 
-        ret = binlog_convert(f_binlog, cid, &ctx);
+        if (map != NULL) {
+            ret = binlog_map_convert(map, cid, &ctx);
+        }
+        else {
+            ret = binlog_convert(f_binlog, cid, &ctx);
+        }
 
         if (qlog.state == 1) {
             qlog_connection_end(0, &qlog);
@@ -1059,3 +1089,179 @@ int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char
 
     return ret;
 }
+
+int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char* binlog_name, const char* txt_name, const char* out_dir)
+{
+    return qlog_convert_from(cid, f_binlog, NULL, binlog_name, txt_name, out_dir);
+}
+
+int qlog_convert_map(const picoquic_connection_id_t* cid, binlog_map_t* map, const char* binlog_name, const char* txt_name, const char* out_dir)
+{
+    return qlog_convert_from(cid, NULL, map, binlog_name, txt_name, out_dir);
+}
+
+/*
+ * Streaming qlog. The records of the binary log are passed to the sink as
+ * they are produced, converted, and written to one JSON-SEQ file per
+ * connection, named from the initial CID with the extension "sqlog". The
+ * file is opened by the new connection record and closed by the connection
+ * close record. The connections are selected by the binary log policy, and
+ * with the default ring the conversion runs in the writer thread.
+ */
+typedef struct st_sqlog_cnx_t {
+    picoquic_connection_id_t cid;
+    char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
+    qlog_context_t qlog;
+} sqlog_cnx_t;
+
+typedef struct st_sqlog_ctx_t {
+    char* out_dir;
+    picohash_table* cnx_table;
+} sqlog_ctx_t;
+
+static uint64_t sqlog_cnx_hash(const void* key)
+{
+    return picoquic_connection_id_hash(&((const sqlog_cnx_t*)key)->cid);
+}
+
+static int sqlog_cnx_compare(const void* key0, const void* key1)
+{
+    return picoquic_compare_connection_id(&((const sqlog_cnx_t*)key0)->cid,
+        &((const sqlog_cnx_t*)key1)->cid);
+}
+
+static sqlog_cnx_t* sqlog_get_cnx(sqlog_ctx_t* sqlog, const picoquic_connection_id_t* cid)
+{
+    sqlog_cnx_t key;
+    picohash_item* item;
+
+    key.cid = *cid;
+    item = picohash_retrieve(sqlog->cnx_table, &key);
+
+    return (item == NULL) ? NULL : (sqlog_cnx_t*)item->key;
+}
+
+static sqlog_cnx_t* sqlog_open_cnx(sqlog_ctx_t* sqlog, const picoquic_connection_id_t* cid)
+{
+    sqlog_cnx_t* cnx = (sqlog_cnx_t*)malloc(sizeof(sqlog_cnx_t));
+
+    if (cnx != NULL) {
+        memset(cnx, 0, sizeof(sqlog_cnx_t));
+        cnx->cid = *cid;
+        if (picoquic_print_connection_id_hexa(cnx->cid_name, sizeof(cnx->cid_name), cid) != 0 ||
+            (cnx->qlog.f_txtlog = open_outfile(cnx->cid_name, "sqlog", sqlog->out_dir, "sqlog")) == NULL) {
+            free(cnx);
+            cnx = NULL;
+        }
+        else if (picohash_insert(sqlog->cnx_table, cnx) != 0) {
+            (void)picoquic_file_close(cnx->qlog.f_txtlog);
+            free(cnx);
+            cnx = NULL;
+        }
+        else {
+            cnx->qlog.cid_name = cnx->cid_name;
+            cnx->qlog.is_seq = 1;
+        }
+    }
+
+    return cnx;
+}
+
+static void sqlog_close_cnx(sqlog_ctx_t* sqlog, sqlog_cnx_t* cnx)
+{
+    picohash_delete_key(sqlog->cnx_table, cnx, 0);
+    (void)picoquic_file_close(cnx->qlog.f_txtlog);
+    free(cnx);
+}
+
+static void sqlog_delete(sqlog_ctx_t* sqlog)
+{
+    if (sqlog->cnx_table != NULL) {
+        for (size_t i = 0; i < sqlog->cnx_table->nb_bin; i++) {
+            for (picohash_item* item = sqlog->cnx_table->hash_bin[i]; item != NULL; item = item->next_in_bin) {
+                sqlog_cnx_t* cnx = (sqlog_cnx_t*)item->key;
+                (void)picoquic_file_close(cnx->qlog.f_txtlog);
+            }
+        }
+        picohash_delete(sqlog->cnx_table, 1);
+    }
+    if (sqlog->out_dir != NULL) {
+        free(sqlog->out_dir);
+    }
+    free(sqlog);
+}
+
+static void sqlog_record(void* sink_ctx, const uint8_t* record, size_t length)
+{
+    sqlog_ctx_t* sqlog = (sqlog_ctx_t*)sink_ctx;
+    bytestream stream;
+    bytestream* s;
+    picoquic_connection_id_t cid;
+    uint64_t time_stamp = 0;
+    uint64_t event_id = 0;
+    sqlog_cnx_t* cnx;
+
+    if (record == NULL) {
+        /* The sink was removed */
+        sqlog_delete(sqlog);
+        return;
+    }
+
+    s = bytestream_ref_init(&stream, record, length);
+    if (byteread_cid(s, &cid) != 0 || byteread_vint(s, &time_stamp) != 0 || byteread_vint(s, &event_id) != 0) {
+        return;
+    }
+
+    cnx = sqlog_get_cnx(sqlog, &cid);
+    if (cnx == NULL && event_id == picoquic_log_event_new_connection) {
+        cnx = sqlog_open_cnx(sqlog, &cid);
+    }
+
+    if (cnx != NULL) {
+        binlog_convert_cb_t callbacks;
+        callbacks.connection_start = qlog_connection_start;
+        callbacks.connection_end = qlog_connection_end;
+        callbacks.param_update = qlog_param_update;
+        callbacks.pdu = qlog_pdu;
+        callbacks.packet_start = qlog_packet_start;
+        callbacks.packet_frame = qlog_packet_frame;
+        callbacks.packet_end = qlog_packet_end;
+        callbacks.packet_lost = qlog_packet_lost;
+        callbacks.ptr = &cnx->qlog;
+
+        s = bytestream_ref_init(&stream, record, length);
+        (void)binlog_convert_record(s, &cid, &callbacks);
+
+        if (cnx->qlog.state == 2) {
+            sqlog_close_cnx(sqlog, cnx);
+        }
+    }
+}
+
+int picoquic_set_sqlog(picoquic_quic_t* quic, char const* sqlog_dir)
+{
+    int ret = 0;
+    sqlog_ctx_t* sqlog;
+
+    if (sqlog_dir == NULL) {
+        ret = picoquic_set_binlog_sink(quic, NULL, NULL);
+    }
+    else if ((sqlog = (sqlog_ctx_t*)malloc(sizeof(sqlog_ctx_t))) == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(sqlog, 0, sizeof(sqlog_ctx_t));
+        if ((sqlog->out_dir = picoquic_string_duplicate(sqlog_dir)) == NULL ||
+            (sqlog->cnx_table = picohash_create(256, sqlog_cnx_hash, sqlog_cnx_compare)) == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            ret = picoquic_set_binlog_sink(quic, sqlog_record, sqlog);
+        }
+        if (ret != 0) {
+            sqlog_delete(sqlog);
+        }
+    }
+
+    return ret;
+}
@@ -29,3 +29,15 @@ int qlog_connection_start(uint64_t time, const picoquic_connection_id_t * cid, i
 int qlog_connection_end(uint64_t time, void * ptr);
 
 int qlog_convert(const picoquic_connection_id_t* cid, FILE * f_binlog, const char * binlog_name, const char* txt_name, const char * out_dir);
+
+struct st_binlog_map_t;
+
+/* Same as qlog_convert, reading the records from a mapped log. Several connections
+ * of the same map can be converted concurrently. */
+int qlog_convert_map(const picoquic_connection_id_t* cid, struct st_binlog_map_t* map, const char* binlog_name, const char* txt_name, const char* out_dir);
+
+/* Write a streaming qlog, in JSON-SEQ format, while the connections run. The
+ * connections selected by the binary log policy are written to one file per
+ * connection, "<initial cid>.sqlog" in sqlog_dir. This uses the binary log
+ * sink, and works with or without a binary log file. Set NULL to stop. */
+int picoquic_set_sqlog(picoquic_quic_t* quic, char const* sqlog_dir);
@@ -0,0 +1,274 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2019, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "picoquic_internal.h"
+#include "bytestream.h"
+#include "logreader.h"
+#include "logconvert.h"
+#include "textlog.h"
+
+/*
+ * Conversion of the binary log into the packet trace of the text log.
+ *
+ * The binary log keeps the headers of the packets and the control frames,
+ * but only the first bytes of the stream, crypto and datagram frames, and
+ * a single byte of padding. These frames are printed from the recorded
+ * fields; the other frames are printed by the text logger itself.
+ */
+
+typedef struct textlog_context_st {
+    FILE* f_txtlog;
+    uint64_t cid64;
+    uint64_t start_time;
+    picoquic_packet_type_enum packet_type;
+    int state;
+} textlog_context_t;
+
+static void textlog_data_bytes(FILE* f, bytestream* s, uint64_t length)
+{
+    size_t nb_bytes = bytestream_remain(s);
+    const uint8_t* bytes = bytestream_ptr(s);
+
+    fprintf(f, ": ");
+    for (size_t i = 0; i < nb_bytes && i < 8; i++) {
+        fprintf(f, "%02x", bytes[i]);
+    }
+    fprintf(f, "%s\n", (length > 8) ? "..." : "");
+}
+
+static int textlog_connection_start(uint64_t time, const picoquic_connection_id_t* cid, int client_mode,
+    uint32_t proposed_version, const picoquic_connection_id_t* remote_cnxid, void* ptr)
+{
+    textlog_context_t* ctx = (textlog_context_t*)ptr;
+
+    ctx->cid64 = picoquic_val64_connection_id(*cid);
+    ctx->start_time = time;
+    picoquic_log_prefix_initial_cid64(ctx->f_txtlog, ctx->cid64);
+    fprintf(ctx->f_txtlog, "%s connection, version %08x, at %" PRIu64 "\n",
+        (client_mode) ? "Client" : "Server", proposed_version, time);
+    ctx->state = 1;
+
+    return 0;
+}
+
+static int textlog_connection_end(uint64_t time, void* ptr)
+{
+    textlog_context_t* ctx = (textlog_context_t*)ptr;
+
+    if (ctx->state == 1) {
+        picoquic_log_prefix_initial_cid64(ctx->f_txtlog, ctx->cid64);
+        fprintf(ctx->f_txtlog, "Connection closed at T=%" PRIu64 "\n",
+            (time > ctx->start_time) ? time - ctx->start_time : 0);
+    }
+    ctx->state = 2;
+
+    return 0;
+}
+
+static int textlog_param_update(uint64_t time, bytestream* s, void* ptr)
+{
+    return 0;
+}
+
+static int textlog_pdu(uint64_t time, int rxtx, bytestream* s, void* ptr)
+{
+    textlog_context_t* ctx = (textlog_context_t*)ptr;
+    FILE* f = ctx->f_txtlog;
+    struct sockaddr_storage addr_peer = { 0 };
+    uint64_t byte_length = 0;
+    uint64_t delta_t = time - ctx->start_time;
+    int ret = byteread_addr(s, &addr_peer);
+
+    ret |= byteread_vint(s, &byte_length);
+
+    if (ret == 0) {
+        picoquic_log_prefix_initial_cid64(f, ctx->cid64);
+        fprintf(f, (rxtx) ? "Receiving %d bytes from " : "Sending %d bytes to ", (int)byte_length);
+        picoquic_log_address(f, (struct sockaddr*)&addr_peer);
+        fprintf(f, " at T=%llu.%06d (%llx)\n", (unsigned long long)(delta_t / 1000000),
+            (int)(delta_t % 1000000), (unsigned long long)time);
+    }
+
+    return ret;
+}
+
+static int textlog_packet_start(uint64_t time, uint64_t size, const picoquic_packet_header* ph, int rxtx, void* ptr)
+{
+    textlog_context_t* ctx = (textlog_context_t*)ptr;
+    FILE* f = ctx->f_txtlog;
+    picoquic_packet_header lph = *ph;
+
+    lph.pn = (uint32_t)ph->pn64;
+    lph.pl_val = ph->payload_length;
+    picoquic_log_packet_header(f, ctx->cid64, &lph, rxtx);
+
+    if (ph->ptype != picoquic_packet_version_negotiation &&
+        ph->ptype != picoquic_packet_retry) {
+        picoquic_log_prefix_initial_cid64(f, ctx->cid64);
+        fprintf(f, "    %s %d bytes\n", (rxtx) ? "Decrypted" : "Prepared", (int)ph->payload_length);
+    }
+    ctx->packet_type = ph->ptype;
+
+    return 0;
+}
+
+static int textlog_packet_frame(bytestream* s, void* ptr)
+{
+    textlog_context_t* ctx = (textlog_context_t*)ptr;
+    FILE* f = ctx->f_txtlog;
+    uint64_t ftype = 0;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    int ret = 0;
+
+    if (ctx->packet_type == picoquic_packet_version_negotiation ||
+        ctx->packet_type == picoquic_packet_retry) {
+        length = bytestream_remain(s);
+        picoquic_log_prefix_initial_cid64(f, ctx->cid64);
+        fprintf(f, "    %s, %d bytes", (ctx->packet_type == picoquic_packet_retry) ?
+            "Retry token" : "Versions", (int)length);
+        textlog_data_bytes(f, s, length);
+    }
+    else if (picoquic_varint_decode(bytestream_ptr(s), bytestream_remain(s), &ftype) == 0 ||
+        !(PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max) ||
+        ftype == picoquic_frame_type_padding || ftype == picoquic_frame_type_ping ||
+        ftype == picoquic_frame_type_crypto_hs || ftype == picoquic_frame_type_datagram ||
+        ftype == picoquic_frame_type_datagram_l)) {
+        /* The complete frame is recorded, and printed by the text logger */
+        picoquic_log_frames(f, ctx->cid64, (uint8_t*)bytestream_ptr(s), bytestream_remain(s));
+    }
+    else {
+        picoquic_log_prefix_initial_cid64(f, ctx->cid64);
+        ret |= byteread_vint(s, &ftype);
+
+        if (PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
+            uint64_t stream_id = 0;
+
+            ret |= byteread_vint(s, &stream_id);
+            if ((ftype & 4) != 0) {
+                ret |= byteread_vint(s, &offset);
+            }
+            ret |= byteread_vint(s, &length);
+            fprintf(f, "    Stream %" PRIu64 ", offset %" PRIu64 ", length %d, fin = %d",
+                stream_id, offset, (int)length, (int)(ftype & 1));
+            textlog_data_bytes(f, s, length);
+        }
+        else if (ftype == picoquic_frame_type_crypto_hs) {
+            ret |= byteread_vint(s, &offset);
+            ret |= byteread_vint(s, &length);
+            fprintf(f, "    Crypto HS frame, offset %" PRIu64 ", length %d\n", offset, (int)length);
+        }
+        else if (ftype == picoquic_frame_type_datagram_l) {
+            ret |= byteread_vint(s, &length);
+            fprintf(f, "    Datagram frame, length: %d\n", (int)length);
+        }
+        else {
+            /* Only the first byte of padding and datagrams without length are recorded */
+            fprintf(f, "    %s\n", picoquic_log_frame_names(ftype));
+        }
+    }
+
+    return ret;
+}
+
+static int textlog_packet_end(void* ptr)
+{
+    textlog_context_t* ctx = (textlog_context_t*)ptr;
+
+    fprintf(ctx->f_txtlog, "\n");
+
+    return 0;
+}
+
+static int textlog_packet_lost(uint64_t time, bytestream* s, void* ptr)
+{
+    textlog_context_t* ctx = (textlog_context_t*)ptr;
+    FILE* f = ctx->f_txtlog;
+    uint64_t packet_type = 0;
+    uint64_t sequence = 0;
+    uint64_t trigger_length = 0;
+    int ret = 0;
+
+    ret |= byteread_vint(s, &packet_type);
+    ret |= byteread_vint(s, &sequence);
+    ret |= byteread_vint(s, &trigger_length);
+
+    if (ret == 0) {
+        picoquic_log_prefix_initial_cid64(f, ctx->cid64);
+        fprintf(f, "Lost %s packet %" PRIu64 " at T=%" PRIu64,
+            ptype2str((picoquic_packet_type_enum)packet_type), sequence, time - ctx->start_time);
+        if (trigger_length > 0 && trigger_length <= bytestream_remain(s)) {
+            fprintf(f, ", %.*s", (int)trigger_length, (const char*)bytestream_ptr(s));
+        }
+        fprintf(f, "\n");
+    }
+
+    return ret;
+}
+
+int textlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char* binlog_name, const char* txt_name, const char* out_dir)
+{
+    int ret = 0;
+    FILE* f_txtlog = NULL;
+    char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
+
+    if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), cid) != 0) {
+        DBG_PRINTF("Cannot convert connection id for %s", binlog_name);
+        ret = -1;
+    }
+    else if (txt_name == NULL) {
+        f_txtlog = open_outfile(cid_name, binlog_name, out_dir, "log");
+    }
+    else {
+        f_txtlog = picoquic_file_open(txt_name, "w");
+    }
+
+    if (f_txtlog == NULL) {
+        ret = -1;
+    }
+    else if (ret == 0) {
+        textlog_context_t textlog;
+        binlog_convert_cb_t ctx;
+
+        memset(&textlog, 0, sizeof(textlog));
+        textlog.f_txtlog = f_txtlog;
+
+        ctx.connection_start = textlog_connection_start;
+        ctx.connection_end = textlog_connection_end;
+        ctx.param_update = textlog_param_update;
+        ctx.pdu = textlog_pdu;
+        ctx.packet_start = textlog_packet_start;
+        ctx.packet_frame = textlog_packet_frame;
+        ctx.packet_end = textlog_packet_end;
+        ctx.packet_lost = textlog_packet_lost;
+        ctx.ptr = &textlog;
+
+        ret = binlog_convert(f_binlog, cid, &ctx);
+
+        picoquic_file_close(f_txtlog);
+    }
+
+    return ret;
+}
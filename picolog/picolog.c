@@ -29,6 +29,7 @@
 #include "csv.h"
 #include "svg.h"
 #include "qlog.h"
+#include "textlog.h"
 #include "cidset.h"
 #include "logreader.h"
 #ifdef _WINDOWS
@@ -47,11 +48,17 @@ typedef struct app_conversion_context_st
     FILE * f_template;
 
     uint64_t log_time;
+
+    int convert_all;
+    int nb_threads;
 } app_conversion_context_t;
 
 int convert_csv(const picoquic_connection_id_t * cid, void * ptr);
 int convert_svg(const picoquic_connection_id_t * cid, void * ptr);
 int convert_qlog(const picoquic_connection_id_t * cid, void * ptr);
+int convert_qlog_map(binlog_map_t* map, const picoquic_connection_id_t* cid, void* ptr);
+int convert_all_qlog(app_conversion_context_t* appctx, const picoquic_connection_id_t* cid);
+int convert_textlog(const picoquic_connection_id_t* cid, void* ptr);
 int filedump_binlog(FILE* bin_log, FILE* bin_dump);
 
 int usage();
@@ -80,9 +87,10 @@ int main(int argc, char ** argv)
 
     app_conversion_context_t appctx = { 0 };
     appctx.out_format = "csv";
+    appctx.nb_threads = 4;
 
     int opt;
-    while ((opt = getopt(argc, argv, "o:f:t:c:h")) != -1) {
+    while ((opt = getopt(argc, argv, "o:f:t:c:aj:h")) != -1) {
         switch (opt) {
         case 'o':
             appctx.out_dir = optarg;
@@ -96,6 +104,16 @@ int main(int argc, char ** argv)
         case 'c':
             cid_name = optarg;
             break;
+        case 'a':
+            appctx.convert_all = 1;
+            break;
+        case 'j':
+            appctx.nb_threads = atoi(optarg);
+            if (appctx.nb_threads < 1) {
+                fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                return usage();
+            }
+            break;
         case 'h':
         default:
             return usage();
@@ -127,7 +145,16 @@ int main(int argc, char ** argv)
         ret = -1;
     }
 
-    if (ret == 0 && strcmp(appctx.out_format, "dump") == 0) {
+    if (ret == 0 && appctx.convert_all) {
+        if (strcmp(appctx.out_format, "qlog") != 0) {
+            fprintf(stderr, "The -a option only supports the qlog format\n");
+            ret = -1;
+        }
+        else {
+            ret = convert_all_qlog(&appctx, (cid_name == NULL) ? NULL : &cid);
+        }
+    }
+    else if (ret == 0 && strcmp(appctx.out_format, "dump") == 0) {
         char dump_file_name[512];
         FILE* bin_dump = NULL;
         size_t name_len = 0;
@@ -191,6 +218,9 @@ int main(int argc, char ** argv)
             else if (strcmp(appctx.out_format, "qlog") == 0) {
                 ret = cidset_iterate(cids, convert_qlog, &appctx);
             }
+            else if (strcmp(appctx.out_format, "log") == 0) {
+                ret = cidset_iterate(cids, convert_textlog, &appctx);
+            }
             else {
                 fprintf(stderr, "Invalid output format '%s'. Valid formats are\n\n", appctx.out_format);
                 usage_formats();
@@ -217,6 +247,9 @@ int usage()
     usage_formats();
     fprintf(stderr, "  -t template-file      template file for svg format conversion\n");
     fprintf(stderr, "  -c connection-id      only convert logs of specified connection id\n");
+    fprintf(stderr, "  -a                    convert all connections in one pass over a memory\n");
+    fprintf(stderr, "                        mapped log, using worker threads (qlog only)\n");
+    fprintf(stderr, "  -j threads            number of worker threads for -a, default 4\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "picolog converts binary log files into the format specified. Output files are\n");
     fprintf(stderr, "placed in the specified directory with their connection-id as file name.\n");
@@ -233,6 +266,7 @@ void usage_formats()
     fprintf(stderr, "                        -f svg  : generate svg packet flow diagram.\n");
     fprintf(stderr, "                                  requires a template specified by -t\n");
     fprintf(stderr, "                        -f qlog : generate IETF QLOG file\n");
+    fprintf(stderr, "                        -f log  : generate the packet trace of the text log\n");
 }
 
 int convert_csv(const picoquic_connection_id_t * cid, void * ptr)
@@ -266,52 +300,99 @@ int convert_qlog(const picoquic_connection_id_t * cid, void * ptr)
     return qlog_convert(cid, appctx->f_binlog, appctx->binlog_name, NULL, appctx->out_dir);
 }
 
-int filedump_binlog(FILE* bin_log, FILE* bin_dump)
+int convert_textlog(const picoquic_connection_id_t* cid, void* ptr)
 {
-    int ret = 0;
-    uint8_t head[4];
-    bytestream_buf stream_msg;
+    const app_conversion_context_t* appctx = (const app_conversion_context_t*)ptr;
+    return textlog_convert(cid, appctx->f_binlog, appctx->binlog_name, NULL, appctx->out_dir);
+}
 
-    fseek(bin_log, 16, SEEK_SET);
+int convert_qlog_map(binlog_map_t* map, const picoquic_connection_id_t* cid, void* ptr)
+{
+    const app_conversion_context_t* appctx = (const app_conversion_context_t*)ptr;
+    return qlog_convert_map(cid, map, appctx->binlog_name, NULL, appctx->out_dir);
+}
 
-    fprintf(bin_dump, "MSG-len, I-CID, Time, ID, Comment\n");
+/* Map the log, index all the connections in one pass, then convert them
+ * from worker threads, each connection to its own file. */
+int convert_all_qlog(app_conversion_context_t* appctx, const picoquic_connection_id_t* cid)
+{
+    int ret = 0;
+    binlog_map_t* map = binlog_map_open(appctx->binlog_name);
 
-    while (ret == 0 && fread(head, sizeof(head), 1, bin_log) > 0) {
+    if (appctx->out_dir == NULL) {
+        /* Workers cannot share the standard output */
+        appctx->out_dir = ".";
+    }
 
-        uint32_t len = (head[0] << 24) | (head[1] << 16) | (head[2] << 8) | head[3];
-        if (len > sizeof(stream_msg.buf)) {
-            fprintf(bin_dump, "%d, x, 0, 0, \"Message larger than buffer[%d]\"\n", len, (int)sizeof(stream_msg.buf));
-            ret = -1;
+    if (map == NULL) {
+        fprintf(stderr, "Could not map log file %s\n", appctx->binlog_name);
+        ret = -1;
+    }
+    else {
+        fprintf(stderr, "%s contains %" PRIst " connection(s)\n", appctx->binlog_name, binlog_map_nb_cids(map));
+        if (cid != NULL) {
+            size_t rank = 0;
+            while (rank < binlog_map_nb_cids(map) &&
+                picoquic_compare_connection_id(binlog_map_cid(map, rank), cid) != 0) {
+                rank++;
+            }
+            if (rank >= binlog_map_nb_cids(map)) {
+                fprintf(stderr, "%s does not contain the requested connection\n", appctx->binlog_name);
+                ret = -1;
+            }
+            else {
+                ret = convert_qlog_map(map, cid, appctx);
+            }
         }
-
-        if (ret == 0 && fread(stream_msg.buf, len, 1, bin_log) <= 0) {
-            fprintf(bin_dump, "%d, x, 0, 0, \"Message cannot be read from file\n", len);
-            ret = -1;
+        else {
+            ret = binlog_map_convert_all(map, appctx->nb_threads, convert_qlog_map, appctx);
         }
+        binlog_map_close(map);
+    }
 
-        if (ret == 0) {
-            bytestream* s = bytestream_buf_init(&stream_msg, len);
+    return ret;
+}
 
-            picoquic_connection_id_t cid;
-            ret |= byteread_cid(s, &cid);
+static int filedump_binlog_cb(bytestream* s, void* ptr)
+{
+    FILE* bin_dump = (FILE*)ptr;
+    int ret = 0;
+    size_t len = bytestream_size(s);
 
-            uint64_t time = 0;
-            ret |= byteread_vint(s, &time);
+    picoquic_connection_id_t cid;
+    ret |= byteread_cid(s, &cid);
 
-            uint64_t id = 0;
-            ret |= byteread_vint(s, &id);
+    uint64_t time = 0;
+    ret |= byteread_vint(s, &time);
 
-            if (ret != 0) {
-                fprintf(bin_dump, "%d, x, 0, 0, \"cannot read CID, Time and ID\n", len);
-            }
-            else {
-                fprintf(bin_dump, "%d, x", len);
-                for (uint8_t x = 0; x < cid.id_len; x++) {
-                    fprintf(bin_dump, "%02x", cid.id[x]);
-                }
-                fprintf(bin_dump, ", %" PRIu64 ", %" PRIu64 ",\n", time, id);
-            }
+    uint64_t id = 0;
+    ret |= byteread_vint(s, &id);
+
+    if (ret != 0) {
+        fprintf(bin_dump, "%d, x, 0, 0, \"cannot read CID, Time and ID\n", (int)len);
+    }
+    else {
+        fprintf(bin_dump, "%d, x", (int)len);
+        for (uint8_t x = 0; x < cid.id_len; x++) {
+            fprintf(bin_dump, "%02x", cid.id[x]);
         }
+        fprintf(bin_dump, ", %" PRIu64 ", %" PRIu64 ",\n", time, id);
+    }
+
+    return ret;
+}
+
+/* Records of version 2 logs are decoded by the log reader, so the dump
+ * shows the same records for both versions. */
+int filedump_binlog(FILE* bin_log, FILE* bin_dump)
+{
+    int ret;
+
+    fprintf(bin_dump, "MSG-len, I-CID, Time, ID, Comment\n");
+
+    ret = fileread_binlog(bin_log, filedump_binlog_cb, bin_dump);
+    if (ret != 0) {
+        fprintf(bin_dump, "0, x, 0, 0, \"Message cannot be read from file\"\n");
     }
 
     return ret;
@@ -127,17 +127,22 @@ typedef enum {
 
 #define BBR_BTL_BW_FILTER_LENGTH 10
 #define BBR_RT_PROP_FILTER_LENGTH 10
-#define BBR_HIGH_GAIN 2.8853900817779 /* 2/ln(2) */
+#define BBR_GAIN_UNIT 1024 /* Gains are fixed point numbers, in units of 1/1024 */
+#define BBR_HIGH_GAIN 2955 /* 2/ln(2) = 2.8854 */
+#define BBR_DRAIN_GAIN 355 /* 1/BBR_HIGH_GAIN */
+#define BBR_PROBE_BW_CWND_GAIN 1536 /* 1.5 */
 #define BBR_MIN_PIPE_CWND(mss) (4*mss)
 #define BBR_GAIN_CYCLE_LEN 8
 #define BBR_PROBE_RTT_INTERVAL 10000000 /* 10 sec, 10000000 microsecs */
 #define BBR_PROBE_RTT_DURATION 200000 /* 200msec, 200000 microsecs */
-#define BBR_PACING_RATE_LOW 150000.0 /* 150000 B/s = 1.2 Mbps */
-#define BBR_PACING_RATE_MEDIUM 3000000.0 /* 3000000 B/s = 24 Mbps */
+#define BBR_PACING_RATE_LOW 150000 /* 150000 B/s = 1.2 Mbps */
+#define BBR_PACING_RATE_MEDIUM 3000000 /* 3000000 B/s = 24 Mbps */
 #define BBR_GAIN_CYCLE_LEN 8
 #define BBR_GAIN_CYCLE_MAX_START 5
 
-static const double bbr_pacing_gain_cycle[BBR_GAIN_CYCLE_LEN] = { 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.25, 0.75};
+static const uint64_t bbr_pacing_gain_cycle[BBR_GAIN_CYCLE_LEN] = {
+    BBR_GAIN_UNIT, BBR_GAIN_UNIT, BBR_GAIN_UNIT, BBR_GAIN_UNIT, BBR_GAIN_UNIT, BBR_GAIN_UNIT,
+    (BBR_GAIN_UNIT * 5) / 4, (BBR_GAIN_UNIT * 3) / 4 };
 
 typedef struct st_picoquic_bbr_state_t {
     picoquic_bbr_alg_state_t state;
@@ -156,9 +161,9 @@ typedef struct st_picoquic_bbr_state_t {
     uint64_t send_quantum;
     picoquic_min_max_rtt_t rtt_filter;
     uint64_t target_cwnd;
-    double pacing_gain;
-    double cwnd_gain;
-    double pacing_rate;
+    uint64_t pacing_gain;
+    uint64_t cwnd_gain;
+    uint64_t pacing_rate;
     int cycle_index;
     int cycle_start;
     int round_count;
@@ -178,7 +183,7 @@ void BBREnterStartupLongRTT(picoquic_bbr_state_t* bbr_state, picoquic_path_t* pa
     bbr_state->state = picoquic_bbr_alg_startup_long_rtt;
 
     if (path_x->smoothed_rtt > PICOQUIC_TARGET_RENO_RTT) {
-        cwnd = (uint64_t)((double)cwnd * (double)path_x->smoothed_rtt / (double)PICOQUIC_TARGET_RENO_RTT);
+        cwnd = (cwnd * path_x->smoothed_rtt) / PICOQUIC_TARGET_RENO_RTT;
     }
     if (cwnd > path_x->cwin) {
         path_x->cwin = cwnd;
@@ -201,21 +206,21 @@ void BBRSetSendQuantum(picoquic_bbr_state_t* bbr_state, picoquic_path_t* path_x)
         bbr_state->send_quantum = 2ull * path_x->send_mtu;
     }
     else {
-        bbr_state->send_quantum = (uint64_t)(bbr_state->pacing_rate * 0.001);
+        bbr_state->send_quantum = bbr_state->pacing_rate / 1000;
         if (bbr_state->send_quantum > 64000) {
             bbr_state->send_quantum = 64000;
         }
     }
 }
 
-uint64_t BBRInflight(picoquic_bbr_state_t* bbr_state, double gain)
+uint64_t BBRInflight(picoquic_bbr_state_t* bbr_state, uint64_t gain)
 {
     uint64_t cwnd = PICOQUIC_CWIN_INITIAL;
     if (bbr_state->rt_prop != UINT64_MAX){
         /* Bandwidth is estimated in bytes per second, rtt in microseconds*/
-        double estimated_bdp = (((double)bbr_state->btl_bw * (double)bbr_state->rt_prop) / 1000000.0);
+        uint64_t estimated_bdp = (bbr_state->btl_bw * bbr_state->rt_prop) / 1000000;
         uint64_t quanta = 3 * bbr_state->send_quantum;       
-        cwnd = (uint64_t)(gain * estimated_bdp) + quanta;
+        cwnd = (gain * estimated_bdp) / BBR_GAIN_UNIT + quanta;
     }
     return cwnd;
 }
@@ -269,7 +274,7 @@ void BBRUpdateBtlBw(picoquic_bbr_state_t* bbr_state, picoquic_path_t* path_x)
         bandwidth_estimate = path_x->max_bandwidth_estimate/2;
     }
 
-    if (path_x->delivered_last_packet >= bbr_state->next_round_delivered)
+    if (path_x->rate_sample.prior_delivered >= bbr_state->next_round_delivered)
     {
         bbr_state->next_round_delivered = path_x->delivered;
         bbr_state->round_count++;
@@ -327,14 +332,14 @@ int BBRIsNextCyclePhase(picoquic_bbr_state_t* bbr_state, uint64_t prior_in_fligh
 {
     int is_full_length = (current_time - bbr_state->cycle_stamp) > bbr_state->rt_prop;
     
-    if (bbr_state->pacing_gain != 1.0) {
-        if (bbr_state->pacing_gain > 1.0) {
+    if (bbr_state->pacing_gain != BBR_GAIN_UNIT) {
+        if (bbr_state->pacing_gain > BBR_GAIN_UNIT) {
             is_full_length &=
                 (packets_lost > 0 ||
                     prior_in_flight >= BBRInflight(bbr_state, bbr_state->pacing_gain));
         }
         else {  /*  (BBR.pacing_gain < 1) */
-            is_full_length &= prior_in_flight <= BBRInflight(bbr_state, 1.0);
+            is_full_length &= prior_in_flight <= BBRInflight(bbr_state, BBR_GAIN_UNIT);
         }
     }
     return is_full_length;
@@ -375,7 +380,7 @@ void BBRCheckCyclePhase(picoquic_bbr_state_t* bbr_state, uint64_t packets_lost,
 void BBRCheckFullPipe(picoquic_bbr_state_t* bbr_state, int rs_is_app_limited)
 {
     if (!bbr_state->filled_pipe && bbr_state->round_start && !rs_is_app_limited) {
-        if (bbr_state->btl_bw >= bbr_state->full_bw * 1.25) {  // BBR.BtlBw still growing?
+        if (4 * bbr_state->btl_bw >= 5 * bbr_state->full_bw) {  // BBR.BtlBw still growing?
             bbr_state->full_bw = bbr_state->btl_bw;   // record new baseline level
             bbr_state->full_bw_count = 0;
         }
@@ -392,8 +397,8 @@ void BBREnterProbeBW(picoquic_bbr_state_t* bbr_state, uint64_t current_time)
 {
     int start = 0;
     bbr_state->state = picoquic_bbr_alg_probe_bw;
-    bbr_state->pacing_gain = 1.0;
-    bbr_state->cwnd_gain = 1.5;
+    bbr_state->pacing_gain = BBR_GAIN_UNIT;
+    bbr_state->cwnd_gain = BBR_PROBE_BW_CWND_GAIN;
 
     if (bbr_state->rt_prop > PICOQUIC_TARGET_RENO_RTT) {
         start = (int)(bbr_state->rt_prop / PICOQUIC_TARGET_RENO_RTT);
@@ -415,7 +420,7 @@ void BBREnterProbeBW(picoquic_bbr_state_t* bbr_state, uint64_t current_time)
 void BBREnterDrain(picoquic_bbr_state_t* bbr_state)
 {
     bbr_state->state = picoquic_bbr_alg_drain;
-    bbr_state->pacing_gain = 1.0 / BBR_HIGH_GAIN;  /* pace slowly */
+    bbr_state->pacing_gain = BBR_DRAIN_GAIN;  /* pace slowly */
     bbr_state->cwnd_gain = BBR_HIGH_GAIN;   /* maintain cwnd */
 }
 
@@ -425,7 +430,7 @@ void BBRCheckDrain(picoquic_bbr_state_t* bbr_state, uint64_t bytes_in_transit, u
         BBREnterDrain(bbr_state);
     }
 
-    if (bbr_state->state == picoquic_bbr_alg_drain && bytes_in_transit <= BBRInflight(bbr_state, 1.0)) {
+    if (bbr_state->state == picoquic_bbr_alg_drain && bytes_in_transit <= BBRInflight(bbr_state, BBR_GAIN_UNIT)) {
         BBREnterProbeBW(bbr_state, current_time);  /* we estimate queue is drained */
     }
 }
@@ -443,7 +448,7 @@ void BBRExitStartupLongRtt(picoquic_bbr_state_t* bbr_state, picoquic_path_t* pat
     /* Enter drain */
     BBREnterDrain(bbr_state);
     /* If there were just few bytes in transit, enter probe */
-    if (path_x->bytes_in_transit <= BBRInflight(bbr_state, 1.0)) {
+    if (path_x->bytes_in_transit <= BBRInflight(bbr_state, BBR_GAIN_UNIT)) {
         BBREnterProbeBW(bbr_state, current_time);
     }
 }
@@ -451,8 +456,8 @@ void BBRExitStartupLongRtt(picoquic_bbr_state_t* bbr_state, picoquic_path_t* pat
 void BBREnterProbeRTT(picoquic_bbr_state_t* bbr_state)
 {
     bbr_state->state = picoquic_bbr_alg_probe_rtt;
-    bbr_state->pacing_gain = 1.0;
-    bbr_state->cwnd_gain = 1.0;
+    bbr_state->pacing_gain = BBR_GAIN_UNIT;
+    bbr_state->cwnd_gain = BBR_GAIN_UNIT;
 }
 
 void BBRExitProbeRTT(picoquic_bbr_state_t* bbr_state, uint64_t current_time)
@@ -539,15 +544,27 @@ void BBRUpdateModelAndState(picoquic_bbr_state_t* bbr_state, picoquic_path_t* pa
 {
     BBRUpdateBtlBw(bbr_state, path_x);
     BBRCheckCyclePhase(bbr_state, packets_lost, current_time);
-    BBRCheckFullPipe(bbr_state, path_x->last_bw_estimate_path_limited);
+    BBRCheckFullPipe(bbr_state, path_x->rate_sample.is_app_limited);
     BBRCheckDrain(bbr_state, bytes_in_transit, current_time);
     BBRUpdateRTprop(bbr_state, rtt_sample, current_time);
     BBRCheckProbeRTT(bbr_state, path_x, bytes_in_transit, current_time);
 }
 
-void BBRSetPacingRateWithGain(picoquic_bbr_state_t* bbr_state, double pacing_gain)
+/* As in the BBR draft, the initial pacing rate is derived from the initial
+ * window and the first RTT, rather than from the first bandwidth samples.
+ * These samples are app limited, and would otherwise slow down the sending
+ * of acknowledgements by a receiver that has little data to send. */
+void BBRInitPacingRate(picoquic_bbr_state_t* bbr_state, picoquic_path_t* path_x)
 {
-    double rate = pacing_gain * (double)bbr_state->btl_bw;
+    uint64_t rtt = (path_x->smoothed_rtt > 1000) ? path_x->smoothed_rtt : 1000;
+    uint64_t nominal_bandwidth = ((uint64_t)PICOQUIC_CWIN_INITIAL * 1000000) / rtt;
+
+    bbr_state->pacing_rate = (bbr_state->pacing_gain * nominal_bandwidth) / BBR_GAIN_UNIT;
+}
+
+void BBRSetPacingRateWithGain(picoquic_bbr_state_t* bbr_state, uint64_t pacing_gain)
+{
+    uint64_t rate = (pacing_gain * bbr_state->btl_bw) / BBR_GAIN_UNIT;
 
     if (bbr_state->filled_pipe || rate > bbr_state->pacing_rate){
         bbr_state->pacing_rate = rate;
@@ -626,7 +643,7 @@ void BBRHandleRestartFromIdle(picoquic_bbr_state_t* bbr_state, uint64_t bytes_in
     {
         bbr_state->idle_restart = 1;
         if (bbr_state->state == picoquic_bbr_alg_probe_bw) {
-            BBRSetPacingRateWithGain(bbr_state, 1.0);
+            BBRSetPacingRateWithGain(bbr_state, BBR_GAIN_UNIT);
         }
     }
 }
@@ -748,6 +765,9 @@ static void picoquic_bbr_notify(
 
                 picoquic_update_pacing_data(cnx, path_x, 1);
             } else {
+                if (bbr_state->pacing_rate == 0) {
+                    BBRInitPacingRate(bbr_state, path_x);
+                }
                 BBRUpdateOnACK(bbr_state, path_x,
                     rtt_measurement, path_x->bytes_in_transit, 0 /* packets_lost */, bbr_state->bytes_delivered,
                     current_time);
@@ -0,0 +1,770 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include "cc_common.h"
+#include "tls_api.h"
+
+/*
+Implementation of BBRv2, following the structure of draft-cardwell-iccrg-bbr-congestion-control-02.
+
+BBRv1, implemented in bbr.c, only reacts to losses indirectly, through the
+reduction of the measured delivery rate. On links with shallow buffers, the
+"probe" phase at 1.25 times the bottleneck rate can cause heavy losses, and
+the flows share poorly with Cubic or Reno. BBRv2 keeps the model of BBRv1,
+bottleneck bandwidth and minimum RTT, and adds bounds on the amount of
+data in flight derived from losses and ECN marks:
+
+* inflight_hi is the long term upper bound. It is set when a probe for
+  bandwidth causes too many losses, and grows again when probing succeeds.
+
+* bw_lo and inflight_lo are short term lower bounds, reduced by a factor
+  beta after a round trip with losses outside of probing, and reset at the
+  beginning of each bandwidth probe.
+
+The ProbeBW state is split in four phases:
+
+* DOWN drains the queue that may have been created by the previous probe,
+  by pacing at 0.9 times the estimated bandwidth,
+* CRUISE keeps the data in flight slightly below inflight_hi, leaving some
+  headroom for competing flows,
+* REFILL paces at the estimated rate for one round, to refill the pipe
+  before probing,
+* UP paces at 1.25 times the estimated bandwidth, and raises inflight_hi
+  exponentially until the queue grows or losses exceed 2%.
+
+The time between probes is randomized between 2 and 3 seconds, but a probe
+is also started after a number of rounds equal to the BDP in packets, so that
+BBRv2 probes at least as often as Reno would on the same path.
+
+The ProbeRTT phase occurs every 5 seconds instead of 10, and reduces the
+window to half the BDP instead of 4 packets, which limits its impact on
+throughput.
+
+The bottleneck bandwidth is the maximum of the delivery rate measured
+during the current and the previous ProbeBW cycle.
+
+As in bbr.c, there is one BBR state per path, BBR.delivered is represented
+by path_x->delivered, and the bytes lost per loss event are approximated by
+the path MTU since the loss notification does not carry the packet length.
+*/
+
+typedef enum {
+    picoquic_bbr2_alg_startup = 0,
+    picoquic_bbr2_alg_drain,
+    picoquic_bbr2_alg_probe_bw_down,
+    picoquic_bbr2_alg_probe_bw_cruise,
+    picoquic_bbr2_alg_probe_bw_refill,
+    picoquic_bbr2_alg_probe_bw_up,
+    picoquic_bbr2_alg_probe_rtt
+} picoquic_bbr2_alg_state_t;
+
+#define BBR2_GAIN_UNIT 1024 /* Gains are fixed point numbers, in units of 1/1024 */
+#define BBR2_GAIN(x100) ((BBR2_GAIN_UNIT * (x100)) / 100)
+#define BBR2_STARTUP_PACING_GAIN BBR2_GAIN(277) /* 4*ln(2) */
+#define BBR2_STARTUP_CWND_GAIN BBR2_GAIN(200)
+#define BBR2_DRAIN_PACING_GAIN BBR2_GAIN(35) /* about 1/2.77 */
+#define BBR2_CWND_GAIN BBR2_GAIN(200)
+#define BBR2_PROBE_DOWN_PACING_GAIN BBR2_GAIN(90)
+#define BBR2_PROBE_UP_PACING_GAIN BBR2_GAIN(125)
+#define BBR2_PROBE_UP_CWND_GAIN BBR2_GAIN(225)
+#define BBR2_LOSS_THRESH_INVERSE 50 /* 2% */
+#define BBR2_ECN_THRESH_INVERSE 2 /* 50% */
+#define BBR2_BETA BBR2_GAIN(70)
+#define BBR2_HEADROOM BBR2_GAIN(85)
+#define BBR2_STARTUP_FULL_LOSS_COUNT 6
+#define BBR2_MIN_PIPE_CWND(mss) (4*mss)
+#define BBR2_MIN_RTT_INTERVAL 10000000 /* 10 sec */
+#define BBR2_PROBE_RTT_INTERVAL 5000000 /* 5 sec */
+#define BBR2_PROBE_RTT_DURATION 200000 /* 200 msec */
+#define BBR2_PROBE_RTT_CWND_GAIN BBR2_GAIN(50)
+#define BBR2_PROBE_WAIT_BASE 2000000 /* 2 sec */
+#define BBR2_PROBE_WAIT_RANDOM 1000000 /* up to 1 additional second */
+#define BBR2_MAX_ROUNDS_BEFORE_PROBE 63
+#define BBR2_MAX_PROBE_UP_ROUNDS 30
+#define BBR2_PACING_RATE_LOW 150000 /* 150000 B/s = 1.2 Mbps */
+#define BBR2_PACING_RATE_MEDIUM 3000000 /* 3000000 B/s = 24 Mbps */
+#define BBR2_UNSET UINT64_MAX
+
+typedef struct st_picoquic_bbr2_state_t {
+    picoquic_bbr2_alg_state_t state;
+    uint64_t max_bw;
+    uint64_t bw_hi[2];
+    uint64_t bw_lo;
+    uint64_t bw_latest;
+    uint64_t inflight_hi;
+    uint64_t inflight_lo;
+    uint64_t inflight_latest;
+    uint64_t inflight_at_loss;
+    uint64_t min_rtt;
+    uint64_t min_rtt_stamp;
+    uint64_t probe_rtt_min_delay;
+    uint64_t probe_rtt_min_stamp;
+    uint64_t probe_rtt_done_stamp;
+    uint64_t next_round_delivered;
+    uint64_t full_bw;
+    uint64_t cycle_stamp;
+    uint64_t bw_probe_wait;
+    uint64_t prior_cwnd;
+    uint64_t bytes_delivered;
+    uint64_t round_delivered;
+    uint64_t round_lost;
+    uint64_t round_ce;
+    uint64_t ecn_ce_total_last;
+    uint64_t send_quantum;
+    uint64_t pacing_gain;
+    uint64_t cwnd_gain;
+    uint64_t pacing_rate;
+    int round_count;
+    int full_bw_count;
+    int round_loss_events;
+    int rounds_since_bw_probe;
+    int probe_up_rounds;
+    unsigned int filled_pipe : 1;
+    unsigned int round_start : 1;
+    unsigned int probe_rtt_expired : 1;
+    unsigned int probe_rtt_round_done : 1;
+} picoquic_bbr2_state_t;
+
+static void BBR2SetSendQuantum(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (bbr2_state->pacing_rate < BBR2_PACING_RATE_LOW) {
+        bbr2_state->send_quantum = 1ull * path_x->send_mtu;
+    }
+    else if (bbr2_state->pacing_rate < BBR2_PACING_RATE_MEDIUM) {
+        bbr2_state->send_quantum = 2ull * path_x->send_mtu;
+    }
+    else {
+        bbr2_state->send_quantum = bbr2_state->pacing_rate / 1000;
+        if (bbr2_state->send_quantum > 64000) {
+            bbr2_state->send_quantum = 64000;
+        }
+    }
+}
+
+/* Bandwidth used by the model: the max filter, bounded by the short term lower bound */
+static uint64_t BBR2ModelBw(picoquic_bbr2_state_t* bbr2_state)
+{
+    return (bbr2_state->bw_lo < bbr2_state->max_bw) ? bbr2_state->bw_lo : bbr2_state->max_bw;
+}
+
+static uint64_t BBR2Inflight(picoquic_bbr2_state_t* bbr2_state, uint64_t gain)
+{
+    uint64_t cwnd = PICOQUIC_CWIN_INITIAL;
+    if (bbr2_state->min_rtt != BBR2_UNSET && bbr2_state->max_bw > 0) {
+        /* Bandwidth is estimated in bytes per second, rtt in microseconds*/
+        uint64_t estimated_bdp = (BBR2ModelBw(bbr2_state) * bbr2_state->min_rtt) / 1000000;
+        cwnd = (gain * estimated_bdp) / BBR2_GAIN_UNIT + 3 * bbr2_state->send_quantum;
+    }
+    return cwnd;
+}
+
+static uint64_t BBR2InflightWithHeadroom(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t inflight = BBR2_UNSET;
+
+    if (bbr2_state->inflight_hi != BBR2_UNSET) {
+        inflight = (BBR2_HEADROOM * bbr2_state->inflight_hi) / BBR2_GAIN_UNIT;
+        if (inflight < BBR2_MIN_PIPE_CWND(path_x->send_mtu)) {
+            inflight = BBR2_MIN_PIPE_CWND(path_x->send_mtu);
+        }
+    }
+
+    return inflight;
+}
+
+static void BBR2ResetLowerBounds(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->bw_lo = BBR2_UNSET;
+    bbr2_state->inflight_lo = BBR2_UNSET;
+}
+
+static void BBR2ResetCongestionSignals(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->round_delivered = 0;
+    bbr2_state->round_lost = 0;
+    bbr2_state->round_ce = 0;
+    bbr2_state->round_loss_events = 0;
+    bbr2_state->inflight_at_loss = 0;
+    bbr2_state->bw_latest = 0;
+    bbr2_state->inflight_latest = 0;
+}
+
+static void BBR2EnterStartup(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->state = picoquic_bbr2_alg_startup;
+    bbr2_state->pacing_gain = BBR2_STARTUP_PACING_GAIN;
+    bbr2_state->cwnd_gain = BBR2_STARTUP_CWND_GAIN;
+}
+
+static void picoquic_bbr2_init(picoquic_path_t* path_x, uint64_t current_time)
+{
+    /* Initialize the state of the congestion control algorithm */
+    picoquic_bbr2_state_t* bbr2_state = (picoquic_bbr2_state_t*)malloc(sizeof(picoquic_bbr2_state_t));
+    path_x->congestion_alg_state = (void*)bbr2_state;
+    if (bbr2_state != NULL) {
+        memset(bbr2_state, 0, sizeof(picoquic_bbr2_state_t));
+        path_x->cwin = PICOQUIC_CWIN_INITIAL;
+        bbr2_state->min_rtt = BBR2_UNSET;
+        bbr2_state->min_rtt_stamp = current_time;
+        bbr2_state->probe_rtt_min_delay = BBR2_UNSET;
+        bbr2_state->probe_rtt_min_stamp = current_time;
+        bbr2_state->inflight_hi = BBR2_UNSET;
+        bbr2_state->cycle_stamp = current_time;
+        BBR2ResetLowerBounds(bbr2_state);
+        BBR2EnterStartup(bbr2_state);
+        BBR2SetSendQuantum(bbr2_state, path_x);
+    }
+}
+
+/* Release the state of the congestion control algorithm */
+static void picoquic_bbr2_delete(picoquic_path_t* path_x)
+{
+    if (path_x->congestion_alg_state != NULL) {
+        free(path_x->congestion_alg_state);
+        path_x->congestion_alg_state = NULL;
+    }
+}
+
+/* Round trip counting, as in bbr.c */
+static void BBR2UpdateRound(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (path_x->rate_sample.prior_delivered >= bbr2_state->next_round_delivered) {
+        bbr2_state->next_round_delivered = path_x->delivered;
+        bbr2_state->round_count++;
+        bbr2_state->rounds_since_bw_probe++;
+        bbr2_state->round_start = 1;
+    }
+    else {
+        bbr2_state->round_start = 0;
+    }
+}
+
+static void BBR2UpdateLatestDeliverySignals(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t inflight = path_x->bytes_in_transit + bbr2_state->bytes_delivered;
+
+    if (path_x->bandwidth_estimate > bbr2_state->bw_latest) {
+        bbr2_state->bw_latest = path_x->bandwidth_estimate;
+    }
+    if (inflight > bbr2_state->inflight_latest) {
+        bbr2_state->inflight_latest = inflight;
+    }
+    bbr2_state->round_delivered += bbr2_state->bytes_delivered;
+}
+
+/* The max bandwidth filter covers the current and the previous ProbeBW cycle */
+static void BBR2UpdateMaxBw(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t bw = path_x->bandwidth_estimate;
+
+    if (bbr2_state->state == picoquic_bbr2_alg_startup &&
+        bw < (path_x->max_bandwidth_estimate / 2)) {
+        bw = path_x->max_bandwidth_estimate / 2;
+    }
+
+    if (bw > bbr2_state->bw_hi[0]) {
+        bbr2_state->bw_hi[0] = bw;
+    }
+    bbr2_state->max_bw = (bbr2_state->bw_hi[0] > bbr2_state->bw_hi[1]) ? bbr2_state->bw_hi[0] : bbr2_state->bw_hi[1];
+}
+
+static void BBR2AdvanceMaxBwFilter(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->bw_hi[1] = bbr2_state->bw_hi[0];
+    bbr2_state->bw_hi[0] = 0;
+}
+
+static void BBR2UpdateMinRtt(picoquic_bbr2_state_t* bbr2_state, uint64_t rtt_sample, uint64_t current_time)
+{
+    bbr2_state->probe_rtt_expired = current_time > bbr2_state->probe_rtt_min_stamp + BBR2_PROBE_RTT_INTERVAL;
+
+    if (rtt_sample > 0 && (rtt_sample < bbr2_state->probe_rtt_min_delay || bbr2_state->probe_rtt_expired)) {
+        bbr2_state->probe_rtt_min_delay = rtt_sample;
+        bbr2_state->probe_rtt_min_stamp = current_time;
+    }
+
+    if (bbr2_state->probe_rtt_min_delay < bbr2_state->min_rtt ||
+        current_time > bbr2_state->min_rtt_stamp + BBR2_MIN_RTT_INTERVAL) {
+        bbr2_state->min_rtt = bbr2_state->probe_rtt_min_delay;
+        bbr2_state->min_rtt_stamp = bbr2_state->probe_rtt_min_stamp;
+    }
+}
+
+/* Losses or ECN marks above the thresholds over the current round */
+static int BBR2IsInflightTooHigh(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t total = bbr2_state->round_delivered + bbr2_state->round_lost;
+    int too_high = 0;
+
+    if (total >= BBR2_MIN_PIPE_CWND(path_x->send_mtu)) {
+        too_high = (bbr2_state->round_lost * BBR2_LOSS_THRESH_INVERSE > total) ||
+            (bbr2_state->round_ce * BBR2_ECN_THRESH_INVERSE > total);
+    }
+
+    return too_high;
+}
+
+static void BBR2StartProbeBWDown(picoquic_bbr2_state_t* bbr2_state, uint64_t current_time)
+{
+    BBR2ResetCongestionSignals(bbr2_state);
+    BBR2AdvanceMaxBwFilter(bbr2_state);
+    bbr2_state->rounds_since_bw_probe = 0;
+    bbr2_state->bw_probe_wait = BBR2_PROBE_WAIT_BASE + picoquic_public_uniform_random(BBR2_PROBE_WAIT_RANDOM);
+    bbr2_state->cycle_stamp = current_time;
+    bbr2_state->state = picoquic_bbr2_alg_probe_bw_down;
+    bbr2_state->pacing_gain = BBR2_PROBE_DOWN_PACING_GAIN;
+    bbr2_state->cwnd_gain = BBR2_CWND_GAIN;
+}
+
+static void BBR2StartProbeBWCruise(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->state = picoquic_bbr2_alg_probe_bw_cruise;
+    bbr2_state->pacing_gain = BBR2_GAIN_UNIT;
+    bbr2_state->cwnd_gain = BBR2_CWND_GAIN;
+}
+
+static void BBR2StartProbeBWRefill(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    BBR2ResetLowerBounds(bbr2_state);
+    bbr2_state->probe_up_rounds = 0;
+    bbr2_state->next_round_delivered = path_x->delivered;
+    bbr2_state->state = picoquic_bbr2_alg_probe_bw_refill;
+    bbr2_state->pacing_gain = BBR2_GAIN_UNIT;
+    bbr2_state->cwnd_gain = BBR2_CWND_GAIN;
+}
+
+static void BBR2StartProbeBWUp(picoquic_bbr2_state_t* bbr2_state, uint64_t current_time)
+{
+    bbr2_state->cycle_stamp = current_time;
+    bbr2_state->state = picoquic_bbr2_alg_probe_bw_up;
+    bbr2_state->pacing_gain = BBR2_PROBE_UP_PACING_GAIN;
+    bbr2_state->cwnd_gain = BBR2_PROBE_UP_CWND_GAIN;
+}
+
+/* Probe after a randomized wait, or after the number of rounds that Reno
+ * would need to grow its window by one BDP, whichever comes first. */
+static int BBR2IsTimeToProbeBW(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    uint64_t reno_rounds = BBR2Inflight(bbr2_state, BBR2_GAIN_UNIT) / path_x->send_mtu;
+
+    if (reno_rounds > BBR2_MAX_ROUNDS_BEFORE_PROBE) {
+        reno_rounds = BBR2_MAX_ROUNDS_BEFORE_PROBE;
+    }
+
+    return (current_time - bbr2_state->cycle_stamp > bbr2_state->bw_probe_wait ||
+        (uint64_t)bbr2_state->rounds_since_bw_probe >= reno_rounds);
+}
+
+/* When probing causes too many losses, set the long term bound to the
+ * amount in flight at the time of the loss and stop probing. */
+static void BBR2HandleInflightTooHigh(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    uint64_t inflight = bbr2_state->inflight_at_loss;
+    uint64_t floor = (BBR2_BETA * BBR2Inflight(bbr2_state, BBR2_GAIN_UNIT)) / BBR2_GAIN_UNIT;
+
+    if (inflight == 0) {
+        inflight = path_x->bytes_in_transit;
+    }
+    if (inflight < floor) {
+        inflight = floor;
+    }
+    bbr2_state->inflight_hi = inflight;
+
+    if (bbr2_state->state == picoquic_bbr2_alg_probe_bw_up) {
+        BBR2StartProbeBWDown(bbr2_state, current_time);
+    }
+}
+
+/* Grow inflight_hi while probing up, as long as the window is fully used.
+ * The growth per round doubles each round, starting at one packet. */
+static void BBR2ProbeInflightHiUpward(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (bbr2_state->inflight_hi != BBR2_UNSET && path_x->cwin >= bbr2_state->inflight_hi &&
+        path_x->bytes_in_transit + bbr2_state->bytes_delivered + path_x->send_mtu >= path_x->cwin) {
+        uint64_t growth = ((uint64_t)path_x->send_mtu) << bbr2_state->probe_up_rounds;
+        uint64_t delta = (bbr2_state->bytes_delivered * growth) / path_x->cwin;
+
+        bbr2_state->inflight_hi += (delta > 0) ? delta : 1;
+    }
+    if (bbr2_state->round_start && bbr2_state->probe_up_rounds < BBR2_MAX_PROBE_UP_ROUNDS) {
+        bbr2_state->probe_up_rounds++;
+    }
+}
+
+static void BBR2UpdateProbeBWCyclePhase(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    if (!bbr2_state->filled_pipe) {
+        return;
+    }
+
+    if ((bbr2_state->state == picoquic_bbr2_alg_probe_bw_up || bbr2_state->state == picoquic_bbr2_alg_probe_bw_refill) &&
+        BBR2IsInflightTooHigh(bbr2_state, path_x)) {
+        BBR2HandleInflightTooHigh(bbr2_state, path_x, current_time);
+    }
+
+    switch (bbr2_state->state) {
+    case picoquic_bbr2_alg_probe_bw_down:
+        if (BBR2IsTimeToProbeBW(bbr2_state, path_x, current_time)) {
+            BBR2StartProbeBWRefill(bbr2_state, path_x);
+        }
+        else {
+            uint64_t headroom = BBR2InflightWithHeadroom(bbr2_state, path_x);
+            if (path_x->bytes_in_transit <= headroom &&
+                path_x->bytes_in_transit <= BBR2Inflight(bbr2_state, BBR2_GAIN_UNIT)) {
+                BBR2StartProbeBWCruise(bbr2_state);
+            }
+        }
+        break;
+    case picoquic_bbr2_alg_probe_bw_cruise:
+        if (BBR2IsTimeToProbeBW(bbr2_state, path_x, current_time)) {
+            BBR2StartProbeBWRefill(bbr2_state, path_x);
+        }
+        break;
+    case picoquic_bbr2_alg_probe_bw_refill:
+        /* Refill lasts one round trip */
+        if (bbr2_state->round_start) {
+            BBR2StartProbeBWUp(bbr2_state, current_time);
+        }
+        break;
+    case picoquic_bbr2_alg_probe_bw_up:
+        BBR2ProbeInflightHiUpward(bbr2_state, path_x);
+        /* Stop probing once the queue builds up */
+        if (current_time - bbr2_state->cycle_stamp > bbr2_state->min_rtt &&
+            path_x->bytes_in_transit > BBR2Inflight(bbr2_state, BBR2_PROBE_UP_PACING_GAIN)) {
+            BBR2StartProbeBWDown(bbr2_state, current_time);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Outside of bandwidth probes, a round with losses or marks reduces the short term bounds.
+ * The drain phase is excluded, as its losses are the tail of the startup overshoot. */
+static void BBR2AdaptLowerBounds(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (bbr2_state->filled_pipe &&
+        bbr2_state->state != picoquic_bbr2_alg_drain &&
+        bbr2_state->state != picoquic_bbr2_alg_probe_bw_up &&
+        bbr2_state->state != picoquic_bbr2_alg_probe_bw_refill &&
+        BBR2IsInflightTooHigh(bbr2_state, path_x)) {
+        uint64_t bw_lo = (bbr2_state->bw_lo == BBR2_UNSET) ? bbr2_state->max_bw : bbr2_state->bw_lo;
+        uint64_t inflight_lo = (bbr2_state->inflight_lo == BBR2_UNSET) ? path_x->cwin : bbr2_state->inflight_lo;
+
+        bw_lo = (BBR2_BETA * bw_lo) / BBR2_GAIN_UNIT;
+        inflight_lo = (BBR2_BETA * inflight_lo) / BBR2_GAIN_UNIT;
+
+        bbr2_state->bw_lo = (bbr2_state->bw_latest > bw_lo) ? bbr2_state->bw_latest : bw_lo;
+        bbr2_state->inflight_lo = (bbr2_state->inflight_latest > inflight_lo) ? bbr2_state->inflight_latest : inflight_lo;
+    }
+}
+
+static void BBR2EnterDrain(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->state = picoquic_bbr2_alg_drain;
+    bbr2_state->pacing_gain = BBR2_DRAIN_PACING_GAIN;
+    bbr2_state->cwnd_gain = BBR2_STARTUP_CWND_GAIN;
+}
+
+/* Startup ends when the bandwidth stops growing, or when a round has too many losses */
+static void BBR2CheckStartupDone(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (bbr2_state->state != picoquic_bbr2_alg_startup || !bbr2_state->round_start) {
+        return;
+    }
+
+    if (!path_x->rate_sample.is_app_limited) {
+        if (4 * bbr2_state->max_bw >= 5 * bbr2_state->full_bw) {
+            bbr2_state->full_bw = bbr2_state->max_bw;
+            bbr2_state->full_bw_count = 0;
+        }
+        else {
+            bbr2_state->full_bw_count++;
+            if (bbr2_state->full_bw_count >= 3) {
+                bbr2_state->filled_pipe = 1;
+            }
+        }
+    }
+
+    if (!bbr2_state->filled_pipe && BBR2IsInflightTooHigh(bbr2_state, path_x) &&
+        (bbr2_state->round_loss_events >= BBR2_STARTUP_FULL_LOSS_COUNT || bbr2_state->round_ce > 0)) {
+        uint64_t bdp = BBR2Inflight(bbr2_state, BBR2_GAIN_UNIT);
+        bbr2_state->inflight_hi = (bbr2_state->inflight_latest > bdp) ? bbr2_state->inflight_latest : bdp;
+        bbr2_state->filled_pipe = 1;
+    }
+
+    if (bbr2_state->filled_pipe) {
+        BBR2EnterDrain(bbr2_state);
+    }
+}
+
+static void BBR2CheckDrain(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    if (bbr2_state->state == picoquic_bbr2_alg_drain &&
+        path_x->bytes_in_transit <= BBR2Inflight(bbr2_state, BBR2_GAIN_UNIT)) {
+        BBR2StartProbeBWDown(bbr2_state, current_time);
+    }
+}
+
+static uint64_t BBR2ProbeRTTCwnd(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t cwnd = BBR2Inflight(bbr2_state, BBR2_PROBE_RTT_CWND_GAIN);
+
+    if (cwnd < BBR2_MIN_PIPE_CWND(path_x->send_mtu)) {
+        cwnd = BBR2_MIN_PIPE_CWND(path_x->send_mtu);
+    }
+
+    return cwnd;
+}
+
+static void BBR2ExitProbeRTT(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    BBR2ResetLowerBounds(bbr2_state);
+    if (path_x->cwin < bbr2_state->prior_cwnd) {
+        path_x->cwin = bbr2_state->prior_cwnd;
+    }
+    if (bbr2_state->filled_pipe) {
+        BBR2StartProbeBWDown(bbr2_state, current_time);
+        BBR2StartProbeBWCruise(bbr2_state);
+    }
+    else {
+        BBR2EnterStartup(bbr2_state);
+    }
+}
+
+static void BBR2CheckProbeRTT(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    if (bbr2_state->state != picoquic_bbr2_alg_probe_rtt &&
+        bbr2_state->probe_rtt_expired) {
+        bbr2_state->prior_cwnd = path_x->cwin;
+        bbr2_state->state = picoquic_bbr2_alg_probe_rtt;
+        bbr2_state->pacing_gain = BBR2_GAIN_UNIT;
+        bbr2_state->cwnd_gain = BBR2_GAIN_UNIT;
+        bbr2_state->probe_rtt_done_stamp = 0;
+    }
+
+    if (bbr2_state->state == picoquic_bbr2_alg_probe_rtt) {
+        if (bbr2_state->probe_rtt_done_stamp == 0 &&
+            path_x->bytes_in_transit <= BBR2ProbeRTTCwnd(bbr2_state, path_x)) {
+            bbr2_state->probe_rtt_done_stamp = current_time + BBR2_PROBE_RTT_DURATION;
+            bbr2_state->probe_rtt_round_done = 0;
+            bbr2_state->next_round_delivered = path_x->delivered;
+        }
+        else if (bbr2_state->probe_rtt_done_stamp != 0) {
+            if (bbr2_state->round_start) {
+                bbr2_state->probe_rtt_round_done = 1;
+            }
+            if (bbr2_state->probe_rtt_round_done && current_time > bbr2_state->probe_rtt_done_stamp) {
+                bbr2_state->probe_rtt_min_stamp = current_time;
+                BBR2ExitProbeRTT(bbr2_state, path_x, current_time);
+            }
+        }
+    }
+}
+
+/* As in bbr.c, the initial pacing rate is derived from the initial window
+ * and the first RTT, since the first bandwidth samples are app limited. */
+static void BBR2InitPacingRate(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t rtt = (path_x->smoothed_rtt > 1000) ? path_x->smoothed_rtt : 1000;
+    uint64_t nominal_bandwidth = ((uint64_t)PICOQUIC_CWIN_INITIAL * 1000000) / rtt;
+
+    bbr2_state->pacing_rate = (bbr2_state->pacing_gain * nominal_bandwidth) / BBR2_GAIN_UNIT;
+}
+
+static void BBR2SetPacingRate(picoquic_bbr2_state_t* bbr2_state)
+{
+    uint64_t rate = (bbr2_state->pacing_gain * BBR2ModelBw(bbr2_state)) / BBR2_GAIN_UNIT;
+
+    if (bbr2_state->filled_pipe || rate > bbr2_state->pacing_rate) {
+        bbr2_state->pacing_rate = rate;
+    }
+}
+
+static void BBR2SetCwnd(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t target_cwnd = BBR2Inflight(bbr2_state, bbr2_state->cwnd_gain);
+    uint64_t cap = BBR2_UNSET;
+
+    if (bbr2_state->filled_pipe) {
+        path_x->cwin += bbr2_state->bytes_delivered;
+        if (path_x->cwin > target_cwnd) {
+            path_x->cwin = target_cwnd;
+        }
+    }
+    else if (path_x->cwin < target_cwnd || path_x->delivered < PICOQUIC_CWIN_INITIAL) {
+        path_x->cwin += bbr2_state->bytes_delivered;
+    }
+
+    /* Apply the bounds derived from losses and ECN marks */
+    switch (bbr2_state->state) {
+    case picoquic_bbr2_alg_probe_bw_down:
+    case picoquic_bbr2_alg_probe_bw_refill:
+    case picoquic_bbr2_alg_probe_bw_up:
+        cap = bbr2_state->inflight_hi;
+        break;
+    case picoquic_bbr2_alg_probe_bw_cruise:
+    case picoquic_bbr2_alg_probe_rtt:
+        cap = BBR2InflightWithHeadroom(bbr2_state, path_x);
+        break;
+    default:
+        break;
+    }
+    if (bbr2_state->inflight_lo < cap) {
+        cap = bbr2_state->inflight_lo;
+    }
+    if (path_x->cwin > cap) {
+        path_x->cwin = cap;
+    }
+
+    if (bbr2_state->state == picoquic_bbr2_alg_probe_rtt) {
+        uint64_t probe_rtt_cwnd = BBR2ProbeRTTCwnd(bbr2_state, path_x);
+        if (path_x->cwin > probe_rtt_cwnd) {
+            path_x->cwin = probe_rtt_cwnd;
+        }
+    }
+
+    if (path_x->cwin < BBR2_MIN_PIPE_CWND(path_x->send_mtu)) {
+        path_x->cwin = BBR2_MIN_PIPE_CWND(path_x->send_mtu);
+    }
+}
+
+/* This is the per ACK processing, activated upon receiving an ACK.
+ * At that point, we expect the following:
+ *  - delivered has been updated to reflect all the data acked on the path.
+ *  - the delivery rate sample has been computed.
+ */
+static void BBR2UpdateOnACK(picoquic_bbr2_state_t* bbr2_state, picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    uint64_t rtt_sample, uint64_t current_time)
+{
+    BBR2UpdateRound(bbr2_state, path_x);
+    BBR2UpdateLatestDeliverySignals(bbr2_state, path_x);
+    BBR2UpdateMaxBw(bbr2_state, path_x);
+    BBR2UpdateMinRtt(bbr2_state, rtt_sample, current_time);
+    BBR2CheckStartupDone(bbr2_state, path_x);
+    BBR2CheckDrain(bbr2_state, path_x, current_time);
+    BBR2UpdateProbeBWCyclePhase(bbr2_state, path_x, current_time);
+    BBR2CheckProbeRTT(bbr2_state, path_x, current_time);
+
+    if (bbr2_state->round_start) {
+        BBR2AdaptLowerBounds(bbr2_state, path_x);
+    }
+
+    BBR2SetPacingRate(bbr2_state);
+    BBR2SetSendQuantum(bbr2_state, path_x);
+    BBR2SetCwnd(bbr2_state, path_x);
+
+    if (bbr2_state->round_start) {
+        BBR2ResetCongestionSignals(bbr2_state);
+    }
+    bbr2_state->bytes_delivered = 0;
+
+    if (bbr2_state->pacing_rate > 0) {
+        /* Set the pacing rate in picoquic sender */
+        picoquic_update_pacing_rate(cnx, path_x, bbr2_state->pacing_rate, bbr2_state->send_quantum);
+    }
+}
+
+/*
+ * In order to implement BBRv2, we map generic congestion notification
+ * signals to the corresponding BBR actions.
+ */
+static void picoquic_bbr2_notify(
+    picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    uint64_t rtt_measurement,
+    uint64_t one_way_delay,
+    uint64_t nb_bytes_acknowledged,
+    uint64_t lost_packet_number,
+    uint64_t current_time)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(one_way_delay);
+    UNREFERENCED_PARAMETER(lost_packet_number);
+#endif
+    picoquic_bbr2_state_t* bbr2_state = (picoquic_bbr2_state_t*)path_x->congestion_alg_state;
+
+    if (bbr2_state != NULL) {
+        switch (notification) {
+        case picoquic_congestion_notification_acknowledgement:
+            /* sum the amount of data acked per packet */
+            bbr2_state->bytes_delivered += nb_bytes_acknowledged;
+            break;
+        case picoquic_congestion_notification_repeat:
+        case picoquic_congestion_notification_timeout:
+            bbr2_state->round_lost += path_x->send_mtu;
+            bbr2_state->round_loss_events++;
+            if (path_x->bytes_in_transit > bbr2_state->inflight_at_loss) {
+                bbr2_state->inflight_at_loss = path_x->bytes_in_transit;
+            }
+            break;
+        case picoquic_congestion_notification_ecn_ec:
+            if (cnx->ecn_ce_total_remote > bbr2_state->ecn_ce_total_last) {
+                bbr2_state->round_ce += (cnx->ecn_ce_total_remote - bbr2_state->ecn_ce_total_last) * path_x->send_mtu;
+                bbr2_state->ecn_ce_total_last = cnx->ecn_ce_total_remote;
+            }
+            break;
+        case picoquic_congestion_notification_spurious_repeat:
+            if (bbr2_state->round_lost >= path_x->send_mtu) {
+                bbr2_state->round_lost -= path_x->send_mtu;
+            }
+            break;
+        case picoquic_congestion_notification_rtt_measurement:
+            break;
+        case picoquic_congestion_notification_bw_measurement:
+            if (bbr2_state->pacing_rate == 0) {
+                BBR2InitPacingRate(bbr2_state, path_x);
+            }
+            BBR2UpdateOnACK(bbr2_state, cnx, path_x, rtt_measurement, current_time);
+            break;
+        case picoquic_congestion_notification_cwin_blocked:
+            break;
+        default:
+            /* ignore */
+            break;
+        }
+    }
+}
+
+/* Observe the state of congestion control */
+
+static void picoquic_bbr2_observe(picoquic_path_t* path_x, uint64_t* cc_state, uint64_t* cc_param)
+{
+    picoquic_bbr2_state_t* bbr2_state = (picoquic_bbr2_state_t*)path_x->congestion_alg_state;
+    *cc_state = (uint64_t)bbr2_state->state;
+    *cc_param = bbr2_state->max_bw;
+}
+
+#define picoquic_bbr2_ID "bbr2" /* BBRv2 */
+
+picoquic_congestion_algorithm_t picoquic_bbr2_algorithm_struct = {
+    picoquic_bbr2_ID,
+    picoquic_bbr2_init,
+    picoquic_bbr2_notify,
+    picoquic_bbr2_delete,
+    picoquic_bbr2_observe
+};
+
+picoquic_congestion_algorithm_t* picoquic_bbr2_algorithm = &picoquic_bbr2_algorithm_struct;
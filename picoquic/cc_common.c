@@ -107,6 +107,102 @@ void picoquic_hystart_increase(picoquic_path_t * path_x, picoquic_min_max_rtt_t*
     path_x->cwin += nb_delivered;
 }
 
+void picoquic_hystart_pp_init(picoquic_hystart_pp_t* hystart)
+{
+    memset(hystart, 0, sizeof(picoquic_hystart_pp_t));
+    hystart->state = picoquic_hystart_pp_slow_start;
+    hystart->last_round_min_rtt = UINT64_MAX;
+    hystart->current_round_min_rtt = UINT64_MAX;
+}
+
+/* Process an RTT sample during slow start. Returns 1 if slow start shall end. */
+int picoquic_hystart_pp_test(picoquic_hystart_pp_t* hystart, picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    uint64_t rtt_measurement, uint64_t current_time)
+{
+    int ret = 0;
+    uint64_t ack_number = picoquic_cc_get_ack_number(cnx);
+
+    if (hystart->state == picoquic_hystart_pp_done || rtt_measurement == 0) {
+        return 0;
+    }
+
+    /* A round ends when the last packet sent in the previous round is acknowledged */
+    if (ack_number != UINT64_MAX && ack_number >= hystart->round_end_sequence) {
+        hystart->round_end_sequence = picoquic_cc_get_sequence_number(cnx);
+        hystart->last_round_min_rtt = hystart->current_round_min_rtt;
+        hystart->current_round_min_rtt = UINT64_MAX;
+        hystart->rtt_sample_count = 0;
+        path_x->hystart_stats.nb_rounds++;
+
+        if (hystart->state == picoquic_hystart_pp_css) {
+            hystart->css_rounds++;
+            if (hystart->css_rounds >= PICOQUIC_HYSTART_PP_CSS_ROUNDS) {
+                hystart->state = picoquic_hystart_pp_done;
+                path_x->hystart_stats.nb_delay_exits++;
+                path_x->hystart_stats.exit_cwin = path_x->cwin;
+                path_x->hystart_stats.exit_time = current_time;
+                ret = 1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        if (rtt_measurement < hystart->current_round_min_rtt) {
+            hystart->current_round_min_rtt = rtt_measurement;
+        }
+        hystart->rtt_sample_count++;
+
+        if (hystart->rtt_sample_count >= PICOQUIC_HYSTART_PP_N_RTT_SAMPLE) {
+            if (hystart->state == picoquic_hystart_pp_slow_start) {
+                if (hystart->last_round_min_rtt != UINT64_MAX) {
+                    uint64_t rtt_thresh = hystart->last_round_min_rtt / PICOQUIC_HYSTART_PP_MIN_RTT_DIVISOR;
+
+                    if (rtt_thresh < PICOQUIC_HYSTART_PP_MIN_RTT_THRESH) {
+                        rtt_thresh = PICOQUIC_HYSTART_PP_MIN_RTT_THRESH;
+                    }
+                    else if (rtt_thresh > PICOQUIC_HYSTART_PP_MAX_RTT_THRESH) {
+                        rtt_thresh = PICOQUIC_HYSTART_PP_MAX_RTT_THRESH;
+                    }
+
+                    if (hystart->current_round_min_rtt >= hystart->last_round_min_rtt + rtt_thresh) {
+                        hystart->css_baseline_min_rtt = hystart->current_round_min_rtt;
+                        hystart->css_rounds = 0;
+                        hystart->state = picoquic_hystart_pp_css;
+                        path_x->hystart_stats.nb_css_entries++;
+                    }
+                }
+            }
+            else if (hystart->current_round_min_rtt < hystart->css_baseline_min_rtt) {
+                /* The RTT increase was spurious, resume slow start */
+                hystart->state = picoquic_hystart_pp_slow_start;
+                path_x->hystart_stats.nb_css_spurious++;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Grow the window during slow start, or by a quarter of that during CSS */
+void picoquic_hystart_pp_increase(picoquic_hystart_pp_t* hystart, picoquic_path_t* path_x, uint64_t nb_delivered)
+{
+    if (hystart->state == picoquic_hystart_pp_css) {
+        uint64_t complete_delta = nb_delivered + hystart->residual_ack;
+
+        hystart->residual_ack = complete_delta % PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR;
+        path_x->cwin += complete_delta / PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR;
+    }
+    else {
+        path_x->cwin += nb_delivered;
+    }
+}
+
+/* Slow start ended for another reason, e.g., a loss */
+void picoquic_hystart_pp_exit(picoquic_hystart_pp_t* hystart)
+{
+    hystart->state = picoquic_hystart_pp_done;
+}
+
 uint64_t picoquic_cc_increased_window(picoquic_cnx_t* cnx, uint64_t previous_window)
 {
     uint64_t new_window;
@@ -120,4 +216,54 @@ uint64_t picoquic_cc_increased_window(picoquic_cnx_t* cnx, uint64_t previous_win
         new_window = (uint64_t)w;
     }
     return new_window;
-}
\ No newline at end of file
+}
+/* Integer cube root, as in "cubic_root" in Linux. A table of 64*cbrt(i)
+ * for 6 bit values provides the first approximation, within a few percent,
+ * and two Newton steps bring the relative error well below 0.1%. The
+ * result is then adjusted to the exact floor of the cube root.
+ */
+static const uint8_t picoquic_cube_root_table[64] = {
+      0,  64,  81,  92, 102, 109, 116, 122,
+    128, 133, 138, 142, 147, 150, 154, 158,
+    161, 165, 168, 171, 174, 177, 179, 182,
+    185, 187, 190, 192, 194, 197, 199, 201,
+    203, 205, 207, 209, 211, 213, 215, 217,
+    219, 221, 222, 224, 226, 228, 229, 231,
+    233, 234, 236, 237, 239, 240, 242, 243,
+    245, 246, 248, 249, 251, 252, 253, 255 };
+
+/* Largest value whose cube fits in 64 bits */
+#define PICOQUIC_CUBE_ROOT_MAX 2642245ull
+
+uint64_t picoquic_cc_cube_root(uint64_t x)
+{
+    uint64_t y;
+
+    if (x < 64) {
+        y = (picoquic_cube_root_table[x] + 32) >> 6;
+    }
+    else {
+        int nb_bits = 0;
+        int b;
+
+        while (nb_bits < 64 && (x >> nb_bits) != 0) {
+            nb_bits++;
+        }
+        /* Scale x by a power of 8 so the index has at most 6 bits */
+        b = (nb_bits - 4) / 3;
+        y = ((uint64_t)picoquic_cube_root_table[x >> (3 * b)] << b) >> 6;
+        /* Newton-Raphson steps: y = (2*y + x/y^2)/3 */
+        for (int i = 0; i < 2; i++) {
+            y = (2 * y + x / (y * y)) / 3;
+        }
+    }
+
+    while (y > 0 && (y > PICOQUIC_CUBE_ROOT_MAX || y * y * y > x)) {
+        y--;
+    }
+    while (y < PICOQUIC_CUBE_ROOT_MAX && (y + 1) * (y + 1) * (y + 1) <= x) {
+        y++;
+    }
+
+    return y;
+}
@@ -45,4 +45,54 @@ int picoquic_hystart_test(picoquic_min_max_rtt_t* rtt_track, uint64_t rtt_measur
 
 void picoquic_hystart_increase(picoquic_path_t* path_x, picoquic_min_max_rtt_t* rtt_filter, uint64_t nb_delivered);
 
+/* HyStart++, per RFC 9406. Slow start proceeds by rounds of one RTT. If the
+ * minimum RTT of a round exceeds that of the previous round by more than a
+ * threshold, slow start switches to conservative slow start (CSS), in which
+ * the window grows 4 times slower. If the RTT goes back down, the increase
+ * was spurious and slow start resumes. Slow start ends after 5 rounds of CSS.
+ * There is no per ACK growth limit, since picoquic paces packets.
+ */
+#define PICOQUIC_HYSTART_PP_MIN_RTT_THRESH 4000
+#define PICOQUIC_HYSTART_PP_MAX_RTT_THRESH 16000
+#define PICOQUIC_HYSTART_PP_MIN_RTT_DIVISOR 8
+#define PICOQUIC_HYSTART_PP_N_RTT_SAMPLE 8
+#define PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR 4
+#define PICOQUIC_HYSTART_PP_CSS_ROUNDS 5
+
+typedef enum {
+    picoquic_hystart_pp_slow_start = 0,
+    picoquic_hystart_pp_css,
+    picoquic_hystart_pp_done
+} picoquic_hystart_pp_state_t;
+
+typedef struct st_picoquic_hystart_pp_t {
+    picoquic_hystart_pp_state_t state;
+    uint64_t round_end_sequence;
+    uint64_t last_round_min_rtt;
+    uint64_t current_round_min_rtt;
+    uint64_t css_baseline_min_rtt;
+    uint64_t residual_ack;
+    int rtt_sample_count;
+    int css_rounds;
+} picoquic_hystart_pp_t;
+
+void picoquic_hystart_pp_init(picoquic_hystart_pp_t* hystart);
+
+int picoquic_hystart_pp_test(picoquic_hystart_pp_t* hystart, picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    uint64_t rtt_measurement, uint64_t current_time);
+
+void picoquic_hystart_pp_increase(picoquic_hystart_pp_t* hystart, picoquic_path_t* path_x, uint64_t nb_delivered);
+
+void picoquic_hystart_pp_exit(picoquic_hystart_pp_t* hystart);
+
+/* Integer arithmetic for Cubic, so the per ACK computations avoid floating
+ * point. Windows are in bytes and times in microseconds. The cube root
+ * returns the floor of the exact root.
+ */
+uint64_t picoquic_cc_cube_root(uint64_t x);
+
+uint64_t picoquic_cubic_K(uint64_t W_max, uint64_t send_mtu);
+
+uint64_t picoquic_cubic_W_cubic(uint64_t W_max, uint64_t K, uint64_t send_mtu, uint64_t elapsed);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,218 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+/*
+ * Congestion control telemetry. The check is called after each received
+ * packet and each sent packet, so it must cost nothing when no application
+ * subscribed, and little when the snapshot is not due.
+ */
+
+void picoquic_subscribe_cc_telemetry(picoquic_cnx_t* cnx, uint64_t interval_microsec,
+    picoquic_cc_telemetry_fn telemetry_fn, void* telemetry_ctx)
+{
+    cnx->cc_telemetry_fn = telemetry_fn;
+    cnx->cc_telemetry_ctx = telemetry_ctx;
+    cnx->cc_telemetry_interval = interval_microsec;
+    cnx->cc_telemetry_next_time = 0;
+    cnx->cc_telemetry_nb_retransmission = cnx->nb_retransmission_total;
+    cnx->cc_telemetry_cc_state = UINT64_MAX;
+}
+
+void picoquic_get_cc_snapshot(picoquic_cnx_t* cnx, picoquic_cc_snapshot_t* snapshot, uint64_t current_time)
+{
+    picoquic_path_t* path_x = cnx->path[0];
+
+    memset(snapshot, 0, sizeof(picoquic_cc_snapshot_t));
+    snapshot->current_time = current_time;
+    snapshot->trigger = picoquic_cc_telemetry_periodic;
+    snapshot->cwin = path_x->cwin;
+    snapshot->bytes_in_transit = path_x->bytes_in_transit;
+    snapshot->pacing_rate = path_x->pacing_rate;
+    snapshot->bandwidth_estimate = path_x->bandwidth_estimate;
+    snapshot->max_bandwidth_estimate = path_x->max_bandwidth_estimate;
+    snapshot->receive_rate_estimate = path_x->receive_rate_estimate;
+    snapshot->rtt_min = path_x->rtt_min;
+    snapshot->smoothed_rtt = path_x->smoothed_rtt;
+    snapshot->rtt_variant = path_x->rtt_variant;
+    snapshot->rtt_sample = path_x->rtt_sample;
+    snapshot->send_mtu = path_x->send_mtu;
+    snapshot->nb_retransmission_total = cnx->nb_retransmission_total;
+    snapshot->nb_spurious = cnx->nb_spurious;
+
+    if (cnx->congestion_alg != NULL && path_x->congestion_alg_state != NULL) {
+        cnx->congestion_alg->alg_observe(path_x, &snapshot->cc_state, &snapshot->cc_param);
+    }
+}
+
+/* The snapshot is only built when it will be delivered. The loss counter and
+ * the timer are checked first; the state of the congestion controller is
+ * only observed if neither triggers.
+ */
+void picoquic_cc_telemetry_check(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    if (cnx->cc_telemetry_fn != NULL) {
+        picoquic_cc_snapshot_t snapshot;
+        picoquic_cc_telemetry_trigger_t trigger = picoquic_cc_telemetry_periodic;
+        int is_due = 1;
+
+        if (cnx->nb_retransmission_total > cnx->cc_telemetry_nb_retransmission) {
+            trigger = picoquic_cc_telemetry_loss;
+        }
+        else if (current_time < cnx->cc_telemetry_next_time) {
+            picoquic_path_t* path_x = cnx->path[0];
+            uint64_t cc_state = 0;
+            uint64_t cc_param = 0;
+
+            if (cnx->congestion_alg != NULL && path_x->congestion_alg_state != NULL) {
+                cnx->congestion_alg->alg_observe(path_x, &cc_state, &cc_param);
+            }
+            if (cc_state != cnx->cc_telemetry_cc_state) {
+                trigger = picoquic_cc_telemetry_state_change;
+            }
+            else {
+                is_due = 0;
+            }
+        }
+
+        if (is_due) {
+            picoquic_get_cc_snapshot(cnx, &snapshot, current_time);
+            if (trigger == picoquic_cc_telemetry_periodic && snapshot.cc_state != cnx->cc_telemetry_cc_state) {
+                trigger = picoquic_cc_telemetry_state_change;
+            }
+            snapshot.trigger = trigger;
+            cnx->cc_telemetry_nb_retransmission = snapshot.nb_retransmission_total;
+            cnx->cc_telemetry_cc_state = snapshot.cc_state;
+            cnx->cc_telemetry_next_time = current_time + cnx->cc_telemetry_interval;
+            cnx->cc_telemetry_fn(cnx, &snapshot, cnx->cc_telemetry_ctx);
+        }
+    }
+}
+
+/*
+ * Telemetry ring. The connection thread is the only producer, a single
+ * application thread is the only consumer. The producer owns the head index
+ * and the consumer the tail index; each side reads the other index with
+ * acquire semantics and publishes its own with release semantics, so the
+ * slot content is visible before the index that covers it.
+ */
+
+#ifdef _WINDOWS
+static uint64_t picoquic_cc_ring_load(volatile uint64_t* x)
+{
+    uint64_t v = *x;
+    MemoryBarrier();
+    return v;
+}
+
+static void picoquic_cc_ring_store(volatile uint64_t* x, uint64_t v)
+{
+    MemoryBarrier();
+    *x = v;
+}
+#else
+static uint64_t picoquic_cc_ring_load(volatile uint64_t* x)
+{
+    return __atomic_load_n(x, __ATOMIC_ACQUIRE);
+}
+
+static void picoquic_cc_ring_store(volatile uint64_t* x, uint64_t v)
+{
+    __atomic_store_n(x, v, __ATOMIC_RELEASE);
+}
+#endif
+
+struct st_picoquic_cc_ring_t {
+    volatile uint64_t head;
+    uint8_t head_pad[56];
+    volatile uint64_t tail;
+    uint8_t tail_pad[56];
+    volatile uint64_t nb_dropped;
+    size_t nb_slots;
+    picoquic_cc_snapshot_t* slots;
+};
+
+picoquic_cc_ring_t* picoquic_cc_ring_create(size_t nb_slots)
+{
+    picoquic_cc_ring_t* ring = NULL;
+
+    if (nb_slots > 0) {
+        ring = (picoquic_cc_ring_t*)malloc(sizeof(picoquic_cc_ring_t));
+        if (ring != NULL) {
+            memset(ring, 0, sizeof(picoquic_cc_ring_t));
+            ring->nb_slots = nb_slots;
+            ring->slots = (picoquic_cc_snapshot_t*)malloc(nb_slots * sizeof(picoquic_cc_snapshot_t));
+            if (ring->slots == NULL) {
+                free(ring);
+                ring = NULL;
+            }
+        }
+    }
+
+    return ring;
+}
+
+void picoquic_cc_ring_delete(picoquic_cc_ring_t* ring)
+{
+    if (ring != NULL) {
+        free(ring->slots);
+        free(ring);
+    }
+}
+
+void picoquic_cc_ring_push(picoquic_cnx_t* cnx, picoquic_cc_snapshot_t const* snapshot, void* ring_ctx)
+{
+    picoquic_cc_ring_t* ring = (picoquic_cc_ring_t*)ring_ctx;
+    uint64_t head = ring->head;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+#endif
+
+    if (head - picoquic_cc_ring_load(&ring->tail) >= ring->nb_slots) {
+        ring->nb_dropped++;
+    }
+    else {
+        ring->slots[head % ring->nb_slots] = *snapshot;
+        picoquic_cc_ring_store(&ring->head, head + 1);
+    }
+}
+
+int picoquic_cc_ring_pop(picoquic_cc_ring_t* ring, picoquic_cc_snapshot_t* snapshot)
+{
+    uint64_t tail = ring->tail;
+    int ret = 0;
+
+    if (picoquic_cc_ring_load(&ring->head) != tail) {
+        *snapshot = ring->slots[tail % ring->nb_slots];
+        picoquic_cc_ring_store(&ring->tail, tail + 1);
+        ret = 1;
+    }
+
+    return ret;
+}
+
+uint64_t picoquic_cc_ring_dropped(picoquic_cc_ring_t* ring)
+{
+    return picoquic_cc_ring_load(&ring->nb_dropped);
+}
@@ -30,19 +30,27 @@ typedef enum {
     picoquic_cubic_alg_congestion_avoidance
 } picoquic_cubic_alg_state_t;
 
+/* Cubic parameters: C = 0.4, expressed as a ratio, and beta = 7/8. The
+ * window is computed in bytes, and times are in microseconds. */
+#define PICOQUIC_CUBIC_C_NUM 2
+#define PICOQUIC_CUBIC_C_DEN 5
+#define PICOQUIC_CUBIC_BETA(w) ((w) - ((w) >> 3))
+/* Bound on |t - K|, about 1000 seconds, so the cube fits in 64 bits */
+#define PICOQUIC_CUBIC_DELTA_MAX 1000000000ull
+
 typedef struct st_picoquic_cubic_state_t {
     picoquic_cubic_alg_state_t alg_state;
     uint64_t recovery_sequence;
     uint64_t start_of_epoch;
     uint64_t previous_start_of_epoch;
-    double K;
-    double W_max;
-    double W_last_max;
-    double C;
-    double beta;
-    double W_reno;
+    uint64_t K;
+    uint64_t W_max;
+    uint64_t W_last_max;
+    uint64_t W_reno;
+    uint64_t reno_residual;
     uint64_t ssthresh;
     picoquic_min_max_rtt_t rtt_filter;
+    picoquic_hystart_pp_t hystart;
 } picoquic_cubic_state_t;
 
 static void picoquic_cubic_init(picoquic_path_t* path_x, uint64_t current_time)
@@ -55,63 +63,101 @@ static void picoquic_cubic_init(picoquic_path_t* path_x, uint64_t current_time)
         memset(cubic_state, 0, sizeof(picoquic_cubic_state_t));
         cubic_state->alg_state = picoquic_cubic_alg_slow_start;
         cubic_state->ssthresh = (uint64_t)((int64_t)-1);
-        cubic_state->W_last_max = (double)cubic_state->ssthresh / (double)path_x->send_mtu;
+        cubic_state->W_last_max = cubic_state->ssthresh;
         cubic_state->W_max = cubic_state->W_last_max;
-        cubic_state->C = 0.4;
-        cubic_state->beta = 7.0 / 8.0;
         cubic_state->start_of_epoch = current_time;
         cubic_state->previous_start_of_epoch = 0;
         cubic_state->W_reno = PICOQUIC_CWIN_INITIAL;
         cubic_state->recovery_sequence = 0;
+        picoquic_hystart_pp_init(&cubic_state->hystart);
         path_x->cwin = PICOQUIC_CWIN_INITIAL;
     }
 }
 
-static double picoquic_cubic_root(double x)
+/* Compute K = cubic_root(W_max*(1 - beta)/C), in microseconds, with W_max
+ * in packets. The argument of the cube root is scaled by a power of 8 as
+ * large as possible without overflow, to keep the precision of the root.
+ */
+uint64_t picoquic_cubic_K(uint64_t W_max, uint64_t send_mtu)
 {
-    /* First find an approximation */
-    double v = 1;
-    double y = 1.0;
-    double y2;
-    double y3;
-
-    while (v > x * 8) {
-        v /= 8;
-        y /= 2;
-    }
+    uint64_t v;
+    int shift = 60;
 
-    while (v < x) {
-        v *= 8;
-        y *= 2;
+    if (W_max > UINT64_MAX / 5) {
+        v = (W_max / (16 * send_mtu)) * 5;
+        shift = 0;
+    }
+    else {
+        uint64_t w5 = W_max * 5;
+        while (shift > 0 && (w5 >> (63 - shift)) != 0) {
+            shift -= 3;
+        }
+        v = (w5 << shift) / (16 * send_mtu);
     }
 
-    for (int i = 0; i < 3; i++) {
-        y2 = y * y;
-        y3 = y2 * y;
-        y += (x - y3) / (3.0*y2);
+    return (picoquic_cc_cube_root(v) * 1000000) >> (shift / 3);
+}
+
+/* Compute W_cubic(t) = C * (t - K) ^ 3 + W_max, in bytes. The time
+ * difference is converted to units of 2^-16 seconds, and the cube to
+ * units of 2^-32 packets before multiplying by the MTU. */
+uint64_t picoquic_cubic_W_cubic(uint64_t W_max, uint64_t K, uint64_t send_mtu, uint64_t elapsed)
+{
+    uint64_t delta_us = (elapsed > K) ? elapsed - K : K - elapsed;
+    uint64_t delta;
+    uint64_t cube;
+    uint64_t offset;
+
+    if (delta_us > PICOQUIC_CUBIC_DELTA_MAX) {
+        delta_us = PICOQUIC_CUBIC_DELTA_MAX;
     }
+    delta = (delta_us << 10) / 15625;
+    cube = ((delta * delta) >> 16) * delta;
+    offset = (((cube / PICOQUIC_CUBIC_C_DEN) * PICOQUIC_CUBIC_C_NUM) >> 16) * send_mtu;
+    offset >>= 16;
 
-    return y;
+    if (elapsed >= K) {
+        return (offset > UINT64_MAX - W_max) ? UINT64_MAX : W_max + offset;
+    }
+    else {
+        return (offset > W_max) ? 0 : W_max - offset;
+    }
 }
 
-/* Compute W_cubic(t) = C * (t - K) ^ 3 + W_max */
-static double picoquic_cubic_W_cubic(
+static uint64_t picoquic_cubic_state_W_cubic(
     picoquic_cubic_state_t* cubic_state,
+    picoquic_path_t* path_x,
     uint64_t current_time)
 {
-    double delta_t_sec = ((double)(current_time - cubic_state->start_of_epoch) / 1000000.0) - cubic_state->K;
-    double W_cubic = (cubic_state->C * (delta_t_sec * delta_t_sec * delta_t_sec)) + cubic_state->W_max;
+    uint64_t elapsed = (current_time > cubic_state->start_of_epoch) ? current_time - cubic_state->start_of_epoch : 0;
+
+    return picoquic_cubic_W_cubic(cubic_state->W_max, cubic_state->K, path_x->send_mtu, elapsed);
+}
+
+/* Grow the Reno window by one MTU per window acknowledged, keeping the
+ * remainder of the division for the next acknowledgement */
+static void picoquic_cubic_reno_increase(picoquic_cubic_state_t* cubic_state, picoquic_path_t* path_x, uint64_t nb_bytes_acknowledged)
+{
+    uint64_t increase = nb_bytes_acknowledged * path_x->send_mtu + cubic_state->reno_residual;
 
-    return W_cubic;
+    cubic_state->W_reno += increase / cubic_state->W_reno;
+    cubic_state->reno_residual = increase % cubic_state->W_reno;
+}
+
+static void picoquic_cubic_set_reno(picoquic_cubic_state_t* cubic_state, uint64_t W_reno)
+{
+    cubic_state->W_reno = (W_reno > 0) ? W_reno : 1;
+    cubic_state->reno_residual = 0;
 }
 
 /* On entering congestion avoidance, need to compute the new coefficients
  * of the cubit curve */
 static void picoquic_cubic_enter_avoidance(
     picoquic_cubic_state_t* cubic_state,
+    picoquic_path_t* path_x,
     uint64_t current_time)
 {
-    cubic_state->K = picoquic_cubic_root(cubic_state->W_max*(1.0 - cubic_state->beta) / cubic_state->C);
+    cubic_state->K = picoquic_cubic_K(cubic_state->W_max, path_x->send_mtu);
     cubic_state->alg_state = picoquic_cubic_alg_congestion_avoidance;
     cubic_state->start_of_epoch = current_time;
     cubic_state->previous_start_of_epoch = cubic_state->start_of_epoch;
@@ -126,18 +172,19 @@ static void picoquic_cubic_enter_recovery(picoquic_cnx_t * cnx,
     uint64_t current_time)
 {
     cubic_state->recovery_sequence = picoquic_cc_get_sequence_number(cnx);
+    picoquic_hystart_pp_exit(&cubic_state->hystart);
     /* Update similar to new reno, but different beta */
-    cubic_state->W_max = (double)path_x->cwin / (double)path_x->send_mtu;
+    cubic_state->W_max = path_x->cwin;
     /* Apply fast convergence */
     if (cubic_state->W_max < cubic_state->W_last_max) {
         cubic_state->W_last_max = cubic_state->W_max;
-        cubic_state->W_max = cubic_state->W_max *cubic_state->beta; 
+        cubic_state->W_max = PICOQUIC_CUBIC_BETA(cubic_state->W_max);
     }
     else {
         cubic_state->W_last_max = cubic_state->W_max;
     }
     /* Compute the new ssthresh */
-    cubic_state->ssthresh = (uint64_t)(cubic_state->W_max * cubic_state->beta*(double)path_x->send_mtu);
+    cubic_state->ssthresh = PICOQUIC_CUBIC_BETA(cubic_state->W_max);
     if (cubic_state->ssthresh < PICOQUIC_CWIN_MINIMUM) {
         /* If things are that bad, fall back to slow start */
         cubic_state->ssthresh = PICOQUIC_CWIN_MINIMUM;
@@ -145,7 +192,7 @@ static void picoquic_cubic_enter_recovery(picoquic_cnx_t * cnx,
         cubic_state->ssthresh = (uint64_t)((int64_t)-1);
         cubic_state->previous_start_of_epoch = cubic_state->start_of_epoch;
         cubic_state->start_of_epoch = current_time;
-        cubic_state->W_reno = PICOQUIC_CWIN_MINIMUM;
+        picoquic_cubic_set_reno(cubic_state, PICOQUIC_CWIN_MINIMUM);
         path_x->cwin = PICOQUIC_CWIN_MINIMUM;
     }
     else {
@@ -158,11 +205,10 @@ static void picoquic_cubic_enter_recovery(picoquic_cnx_t * cnx,
         }
         else {
             /* Enter congestion avoidance immediately */
-            picoquic_cubic_enter_avoidance(cubic_state, current_time);
+            picoquic_cubic_enter_avoidance(cubic_state, path_x, current_time);
             /* Compute the inital window for both Reno and Cubic */
-            double W_cubic = picoquic_cubic_W_cubic(cubic_state, current_time);
-            uint64_t win_cubic = (uint64_t)(W_cubic * (double)path_x->send_mtu);
-            cubic_state->W_reno = ((double)path_x->cwin) / 2.0;
+            uint64_t win_cubic = picoquic_cubic_state_W_cubic(cubic_state, path_x, current_time);
+            picoquic_cubic_set_reno(cubic_state, path_x->cwin / 2);
 
             /* Pick the largest */
             if (win_cubic > cubic_state->W_reno) {
@@ -170,7 +216,7 @@ static void picoquic_cubic_enter_recovery(picoquic_cnx_t * cnx,
                 path_x->cwin = win_cubic;
             }
             else {
-                path_x->cwin = (uint64_t)cubic_state->W_reno;
+                path_x->cwin = cubic_state->W_reno;
             }
         }
     }
@@ -187,11 +233,10 @@ static void picoquic_cubic_correct_spurious(picoquic_path_t* path_x,
     uint64_t current_time)
 {
     cubic_state->W_max = cubic_state->W_last_max;
-    picoquic_cubic_enter_avoidance(cubic_state, cubic_state->previous_start_of_epoch);
-    double W_cubic = picoquic_cubic_W_cubic(cubic_state, current_time);
-    cubic_state->W_reno = W_cubic * (double)path_x->send_mtu;
-    cubic_state->ssthresh = (uint64_t)(cubic_state->W_max * cubic_state->beta * (double)path_x->send_mtu);
-    path_x->cwin = (uint64_t)cubic_state->W_reno;
+    picoquic_cubic_enter_avoidance(cubic_state, path_x, cubic_state->previous_start_of_epoch);
+    picoquic_cubic_set_reno(cubic_state, picoquic_cubic_state_W_cubic(cubic_state, path_x, current_time));
+    cubic_state->ssthresh = PICOQUIC_CUBIC_BETA(cubic_state->W_max);
+    path_x->cwin = cubic_state->W_reno;
 }
 
 /*
@@ -221,11 +266,11 @@ static void picoquic_cubic_notify(
             switch (notification) {
             case picoquic_congestion_notification_acknowledgement:
                 if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
-                    picoquic_hystart_increase(path_x, &cubic_state->rtt_filter, nb_bytes_acknowledged);
+                    picoquic_hystart_pp_increase(&cubic_state->hystart, path_x, nb_bytes_acknowledged);
                     /* if cnx->cwin exceeds SSTHRESH, exit and go to CA */
                     if (path_x->cwin >= cubic_state->ssthresh) {
-                        cubic_state->W_reno = ((double)path_x->cwin) / 2.0;
-                        picoquic_cubic_enter_avoidance(cubic_state, current_time);
+                        picoquic_cubic_set_reno(cubic_state, path_x->cwin / 2);
+                        picoquic_cubic_enter_avoidance(cubic_state, path_x, current_time);
                     }
                 }
                 break;
@@ -245,28 +290,26 @@ static void picoquic_cubic_notify(
             case picoquic_congestion_notification_rtt_measurement:
                 /* Using RTT increases as signal to get out of initial slow start */
                 if (cubic_state->ssthresh == UINT64_MAX &&
-                    picoquic_hystart_test(&cubic_state->rtt_filter, (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement,
-                        cnx->path[0]->pacing_packet_time_microsec, current_time, cnx->is_time_stamp_enabled)) {
+                    picoquic_hystart_pp_test(&cubic_state->hystart, cnx, path_x,
+                        (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement, current_time)) {
                     /* RTT increased too much, get out of slow start! */
-                    if (cubic_state->rtt_filter.rtt_filtered_min > PICOQUIC_TARGET_RENO_RTT) {
-                        double correction = (double)PICOQUIC_TARGET_RENO_RTT / (double)cubic_state->rtt_filter.rtt_filtered_min;
-                        uint64_t base_window = (uint64_t)(correction * (double)path_x->cwin);
+                    if (path_x->rtt_min > PICOQUIC_TARGET_RENO_RTT) {
+                        uint64_t base_window = (path_x->cwin * PICOQUIC_TARGET_RENO_RTT) / path_x->rtt_min;
                         uint64_t delta_window = path_x->cwin - base_window;
                         path_x->cwin -= (delta_window / 2);
                     }
                     cubic_state->ssthresh = path_x->cwin;
-                    cubic_state->W_max = (double)path_x->cwin / (double)path_x->send_mtu;
+                    cubic_state->W_max = path_x->cwin;
                     cubic_state->W_last_max = cubic_state->W_max;
-                    cubic_state->W_reno = ((double)path_x->cwin);
-                    picoquic_cubic_enter_avoidance(cubic_state, current_time);
+                    picoquic_cubic_set_reno(cubic_state, path_x->cwin);
+                    picoquic_cubic_enter_avoidance(cubic_state, path_x, current_time);
                     /* apply a correction to enter the test phase immediately */
-                    uint64_t K_micro = (uint64_t)(cubic_state->K * 1000000.0);
-                    if (K_micro > current_time) {
-                        cubic_state->K = ((double)current_time) / 1000000.0;
+                    if (cubic_state->K > current_time) {
+                        cubic_state->K = current_time;
                         cubic_state->start_of_epoch = 0;
                     }
                     else {
-                        cubic_state->start_of_epoch = current_time - K_micro;
+                        cubic_state->start_of_epoch = current_time - cubic_state->K;
                     }
                 }
 
@@ -324,10 +367,9 @@ static void picoquic_cubic_notify(
             case picoquic_congestion_notification_acknowledgement: 
                 if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
                     /* Compute the cubic formula */
-                    double W_cubic = picoquic_cubic_W_cubic(cubic_state, current_time);
-                    uint64_t win_cubic = (uint64_t)(W_cubic * (double)path_x->send_mtu);
+                    uint64_t win_cubic = picoquic_cubic_state_W_cubic(cubic_state, path_x, current_time);
                     /* Also compute the Reno formula */
-                    cubic_state->W_reno += ((double)nb_bytes_acknowledged) * ((double)path_x->send_mtu) / cubic_state->W_reno;
+                    picoquic_cubic_reno_increase(cubic_state, path_x, nb_bytes_acknowledged);
 
                     /* Pick the largest */
                     if (win_cubic > cubic_state->W_reno) {
@@ -335,7 +377,7 @@ static void picoquic_cubic_notify(
                         path_x->cwin = win_cubic;
                     }
                     else {
-                        path_x->cwin = (uint64_t)cubic_state->W_reno;
+                        path_x->cwin = cubic_state->W_reno;
                     }
                 }
                 break;
@@ -400,8 +442,8 @@ static void picoquic_dcubic_notify(
                     picoquic_hystart_increase(path_x, &cubic_state->rtt_filter, nb_bytes_acknowledged);
                     /* if cnx->cwin exceeds SSTHRESH, exit and go to CA */
                     if (path_x->cwin >= cubic_state->ssthresh) {
-                        cubic_state->W_reno = ((double)path_x->cwin) / 2.0;
-                        picoquic_cubic_enter_avoidance(cubic_state, current_time);
+                        picoquic_cubic_set_reno(cubic_state, path_x->cwin / 2);
+                        picoquic_cubic_enter_avoidance(cubic_state, path_x, current_time);
                     }
                 }
                 break;
@@ -421,25 +463,23 @@ static void picoquic_dcubic_notify(
                     cnx->path[0]->pacing_packet_time_microsec, current_time, cnx->is_time_stamp_enabled)) {
                     if (cubic_state->ssthresh == UINT64_MAX) {
                         if (cubic_state->rtt_filter.rtt_filtered_min > PICOQUIC_TARGET_RENO_RTT) {
-                            double correction = (double)PICOQUIC_TARGET_RENO_RTT / (double)cubic_state->rtt_filter.rtt_filtered_min;
-                            uint64_t base_window = (uint64_t)(correction * (double)path_x->cwin);
+                            uint64_t base_window = (path_x->cwin * PICOQUIC_TARGET_RENO_RTT) / cubic_state->rtt_filter.rtt_filtered_min;
                             uint64_t delta_window = path_x->cwin - base_window;
                             path_x->cwin -= (delta_window / 2);
                         }
 
                         cubic_state->ssthresh = path_x->cwin;
-                        cubic_state->W_max = (double)path_x->cwin / (double)path_x->send_mtu;
+                        cubic_state->W_max = path_x->cwin;
                         cubic_state->W_last_max = cubic_state->W_max;
-                        cubic_state->W_reno = ((double)path_x->cwin);
-                        picoquic_cubic_enter_avoidance(cubic_state, current_time);
+                        picoquic_cubic_set_reno(cubic_state, path_x->cwin);
+                        picoquic_cubic_enter_avoidance(cubic_state, path_x, current_time);
                         /* apply a correction to enter the test phase immediately */
-                        uint64_t K_micro = (uint64_t)(cubic_state->K * 1000000.0);
-                        if (K_micro > current_time) {
-                            cubic_state->K = ((double)current_time) / 1000000.0;
+                        if (cubic_state->K > current_time) {
+                            cubic_state->K = current_time;
                             cubic_state->start_of_epoch = 0;
                         }
                         else {
-                            cubic_state->start_of_epoch = current_time - K_micro;
+                            cubic_state->start_of_epoch = current_time - cubic_state->K;
                         }
                     } else {
                         if (current_time - cubic_state->start_of_epoch > path_x->smoothed_rtt ||
@@ -501,10 +541,9 @@ static void picoquic_dcubic_notify(
             case picoquic_congestion_notification_acknowledgement:
                 if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
                     /* Compute the cubic formula */
-                    double W_cubic = picoquic_cubic_W_cubic(cubic_state, current_time);
-                    uint64_t win_cubic = (uint64_t)(W_cubic * (double)path_x->send_mtu);
+                    uint64_t win_cubic = picoquic_cubic_state_W_cubic(cubic_state, path_x, current_time);
                     /* Also compute the Reno formula */
-                    cubic_state->W_reno += ((double)nb_bytes_acknowledged) * ((double)path_x->send_mtu) / cubic_state->W_reno;
+                    picoquic_cubic_reno_increase(cubic_state, path_x, nb_bytes_acknowledged);
 
                     /* Pick the largest */
                     if (win_cubic > cubic_state->W_reno) {
@@ -512,7 +551,7 @@ static void picoquic_dcubic_notify(
                         path_x->cwin = win_cubic;
                     }
                     else {
-                        path_x->cwin = (uint64_t)cubic_state->W_reno;
+                        path_x->cwin = cubic_state->W_reno;
                     }
                 }
                 break;
@@ -25,6 +25,7 @@
 #include <string.h>
 #include "picoquic_internal.h"
 #include "tls_api.h"
+#include "logwriter.h"
 
 static const size_t challenge_length = 8;
 
@@ -669,6 +670,22 @@ int picoquic_parse_stream_header(const uint8_t* bytes, size_t bytes_max,
     return ret;
 }
 
+/* Record the time to first byte when data first arrives on a stream, and
+ * the completion time when all the data up to the FIN is delivered. */
+static void picoquic_stream_record_first_byte(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, uint64_t current_time)
+{
+    if (!stream->is_first_byte_received) {
+        stream->is_first_byte_received = 1;
+        PICOQUIC_HISTOGRAM_RECORD(cnx->quic, picoquic_histogram_stream_first_byte, current_time - stream->creation_time);
+    }
+}
+
+static void picoquic_stream_record_completion(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    PICOQUIC_HISTOGRAM_RECORD(cnx->quic, picoquic_histogram_stream_completion,
+        picoquic_get_quic_time(cnx->quic) - stream->creation_time);
+}
+
 void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
 {
     picoquic_stream_data_node_t* data;
@@ -683,6 +700,7 @@ void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t*
         if (stream->consumed_offset >= stream->fin_offset && stream->fin_received && !stream->fin_signalled){
             fin_now = picoquic_callback_stream_fin;
             stream->fin_signalled = 1;
+            picoquic_stream_record_completion(cnx, stream);
         }
 
         if (cnx->callback_fn(cnx, stream->stream_id, data->bytes + start, data_length, fin_now,
@@ -699,6 +717,7 @@ void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t*
 
     if (stream->consumed_offset >= stream->fin_offset && stream->fin_received && !stream->fin_signalled) {
         stream->fin_signalled = 1;
+        picoquic_stream_record_completion(cnx, stream);
         if (cnx->callback_fn(cnx, stream->stream_id, NULL, 0, picoquic_callback_stream_fin,
             cnx->callback_ctx, stream->app_stream_ctx) != 0) {
             picoquic_log_app_message(cnx->quic, &cnx->initial_cnxid, "FIN callback on stream %" PRIu64 " returns error 0x%x\n", 
@@ -834,10 +853,15 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
      */
 
     if (ret == 0) {
+        if (length > 0) {
+            picoquic_stream_record_first_byte(cnx, stream, current_time);
+        }
+
         if (stream->direct_receive_fn != NULL) {
             ret = stream->direct_receive_fn(cnx, stream_id, fin, bytes, offset, length, stream->direct_receive_ctx);
             if (ret == PICOQUIC_STREAM_RECEIVE_COMPLETE && stream->fin_received) {
                 stream->fin_signalled = 1;
+                picoquic_stream_record_completion(cnx, stream);
                 ret = 0;
             }
             else if (ret != 0) {
@@ -927,12 +951,15 @@ picoquic_stream_head_t* picoquic_find_ready_stream(picoquic_cnx_t* cnx)
             (stream->reset_requested && !stream->reset_sent) ||
             (stream->stop_sending_requested && !stream->stop_sending_sent)) {
             /* Something can be sent */
+            PICOQUIC_STREAM_SEND_LIMIT(cnx, stream, picoquic_send_limit_none);
             found_stream = stream;
             break;
         }
         else if (((stream->fin_requested && stream->fin_sent) || (stream->reset_requested && stream->reset_sent)) && (!stream->stop_sending_requested || stream->stop_sending_sent)) {
             picoquic_stream_head_t* next_stream = stream->next_output_stream;
             /* If stream is exhausted, remove from output list */
+            binlog_stream_send_limits(cnx, stream);
+            PICOQUIC_STREAM_SEND_LIMIT(cnx, stream, picoquic_send_limit_max);
             picoquic_remove_output_stream(cnx, stream, previous_stream);
 
             picoquic_delete_stream_if_closed(cnx, stream);
@@ -943,11 +970,18 @@ picoquic_stream_head_t* picoquic_find_ready_stream(picoquic_cnx_t* cnx)
                 (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset)) {
                 if (stream->sent_offset >= stream->maxdata_remote) {
                     cnx->stream_blocked = 1;
+                    PICOQUIC_SEND_LIMIT_FLAG(cnx, picoquic_send_limit_stream_flow);
+                    PICOQUIC_STREAM_SEND_LIMIT(cnx, stream, picoquic_send_limit_stream_flow);
                 }
                 else if (cnx->maxdata_remote <= cnx->data_sent) {
                     cnx->flow_blocked = 1;
+                    PICOQUIC_SEND_LIMIT_FLAG(cnx, picoquic_send_limit_flow);
+                    PICOQUIC_STREAM_SEND_LIMIT(cnx, stream, picoquic_send_limit_flow);
                 }
             }
+            else {
+                PICOQUIC_STREAM_SEND_LIMIT(cnx, stream, picoquic_send_limit_app);
+            }
             previous_stream = stream;
             stream = stream->next_output_stream;
         }
@@ -1674,6 +1708,9 @@ picoquic_packet_t* picoquic_check_spurious_retransmission(picoquic_cnx_t* cnx,
             }
 
             cnx->nb_spurious++;
+            if (cnx->quic->binlog_trigger_nb_spurious > 0) {
+                binlog_count_spurious(cnx, current_time);
+            }
             should_delete = p;
         }
 
@@ -1710,96 +1747,6 @@ void picoquic_dequeue_old_retransmitted_packets(picoquic_cnx_t* cnx, picoquic_pa
     }
 }
 
-void picoquic_estimate_path_bandwidth(picoquic_cnx_t * cnx, picoquic_path_t* path_x, uint64_t send_time,
-    uint64_t delivered_prior, uint64_t delivered_time_prior, uint64_t delivered_sent_prior,
-    uint64_t delivery_time, uint64_t current_time, int rs_is_path_limited)
-{
-    if (send_time >= path_x->delivered_sent_last) {
-        if (path_x->delivered_time_last == 0) {
-            /* No estimate yet, need to initialize the variables */
-            path_x->delivered_last = path_x->delivered;
-            path_x->delivered_time_last = delivery_time;
-            path_x->delivered_sent_last = send_time;
-        }
-        else {
-            uint64_t receive_interval = delivery_time - delivered_time_prior;
-
-            if (receive_interval > PICOQUIC_BANDWIDTH_TIME_INTERVAL_MIN) {
-                uint64_t delivered = path_x->delivered - delivered_prior;
-                uint64_t send_interval = send_time - delivered_sent_prior;
-                uint64_t bw_estimate;
-
-                if (send_interval > receive_interval) {
-                    receive_interval = send_interval;
-                }
-
-                bw_estimate = delivered * 1000000;
-                bw_estimate /= receive_interval;
-
-                if (!rs_is_path_limited || bw_estimate > path_x->bandwidth_estimate) {
-                    path_x->bandwidth_estimate = bw_estimate;
-                    if (path_x == cnx->path[0]){
-                        if (cnx->is_ack_frequency_negotiated &&
-                            cnx->ack_gap_local != picoquic_compute_ack_gap(cnx, bw_estimate)){
-                            cnx->is_ack_frequency_updated = 1;
-                        }
-                    }
-                }
-
-                /* Bandwidth was estimated, update the references */
-                path_x->delivered_last = path_x->delivered;
-                path_x->delivered_time_last = delivery_time;
-                path_x->delivered_sent_last = send_time;
-                path_x->delivered_last_packet = delivered_prior;
-                path_x->last_bw_estimate_path_limited = rs_is_path_limited;
-                if (path_x->delivered > path_x->delivered_limited_index) {
-                    path_x->delivered_limited_index = 0;
-                }
-            }
-        }
-    }
-}
-
-void picoquic_estimate_max_path_bandwidth(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t send_time,
-    uint64_t delivery_time, uint64_t current_time)
-{
-    /* Test whether there is enough time since the last max bandwidth estimate */
-    if (send_time >= path_x->max_sample_sent_time) {
-        if (path_x->max_sample_sent_time == 0) {
-            /* No sample set yet, need to initialize the variables */
-            path_x->max_sample_delivered = path_x->delivered;
-            path_x->max_sample_acked_time = delivery_time;
-            path_x->max_sample_sent_time = send_time;
-        }
-        else {
-            /* Compute a max bandwidth estimate */
-            uint64_t receive_interval = delivery_time - path_x->max_sample_acked_time;
-
-            if (receive_interval > PICOQUIC_MAX_BANDWIDTH_TIME_INTERVAL_MIN) {
-                uint64_t delivered = path_x->delivered - path_x->max_sample_delivered;
-                uint64_t send_interval = send_time - path_x->max_sample_sent_time;
-                uint64_t bw_estimate;
-
-                if (send_interval > receive_interval) {
-                    receive_interval = send_interval;
-                }
-
-                bw_estimate = delivered * 1000000;
-                bw_estimate /= receive_interval;
-                /* Retain if larger than previous estimate */
-                if (bw_estimate > path_x->max_bandwidth_estimate) {
-                    path_x->max_bandwidth_estimate = bw_estimate;
-                }
-
-                /* Change the reference point if estimate duration is long enough */
-                path_x->max_sample_delivered = path_x->delivered;
-                path_x->max_sample_acked_time = delivery_time;
-                path_x->max_sample_sent_time = send_time;
-            }
-        }
-    }
-}
-
 /* Compute the desired number of packets coalesce in a single ACK.
  * This will be used to compute the value sent to the peer in the ACK FREQUENCY frame,
  * using the bandwidth estimate computed from received ACKs.
@@ -1875,6 +1822,9 @@ void picoquic_update_path_rtt(picoquic_cnx_t* cnx, picoquic_path_t * old_path, u
     int64_t rtt_estimate = acknowledged_time - send_time;
 
     if (rtt_estimate > 0 && old_path != NULL) {
+        PICOQUIC_HISTOGRAM_RECORD(cnx->quic, picoquic_histogram_rtt, rtt_estimate);
+        PICOQUIC_HISTOGRAM_RECORD(cnx->quic, picoquic_histogram_ack_delay, ack_delay);
+
         if (ack_delay > old_path->max_ack_delay) {
             old_path->max_ack_delay = ack_delay;
         }
@@ -1956,8 +1906,10 @@ static picoquic_packet_t* picoquic_find_acked_packet(picoquic_cnx_t* cnx, uint64
         pkt_ctx->ack_of_ack_requested = 0;
         *is_new_ack = 1;
 
-        if (ack_delay < PICOQUIC_ACK_DELAY_MAX) {
-            /* if the ACK is reasonably recent, use it to update the RTT */
+        if (ack_delay <= PICOQUIC_ACK_DELAY_MAX) {
+            /* if the ACK is reasonably recent, use it to update the RTT.
+             * Peers delay ACKs by exactly the maximum when few packets are in
+             * flight, and these ACKs must still provide RTT samples. */
             /* find the stored copy of the largest acknowledged packet */
 
             while (packet != NULL && packet->previous_packet != NULL && packet->sequence_number < largest) {
@@ -2376,9 +2328,33 @@ void picoquic_process_possible_ack_of_ack_frame(picoquic_cnx_t* cnx, picoquic_pa
     }
 }
 
+/*
+ * ECN validation, RFC 9000 section 13.4.2. When an ACK newly acknowledges
+ * packets that were sent with an ECT mark, the peer's counts shall reflect
+ * at least that many marked packets, and shall not report more ECT(0) or ECT(1)
+ * packets than were sent with that mark. Otherwise, the path or the peer
+ * bleaches or mangles the marks, and ECN is disabled for the connection.
+ */
+void picoquic_ecn_validate(picoquic_cnx_t* cnx, int is_ecn)
+{
+    if (cnx->ecn_newly_acked > 0 && cnx->ecn_state != picoquic_ecn_state_failed &&
+        cnx->ecn_state != picoquic_ecn_state_disabled) {
+        if (!is_ecn ||
+            cnx->ecn_ect0_total_remote + cnx->ecn_ect1_total_remote + cnx->ecn_ce_total_remote < cnx->ecn_marked_acked ||
+            cnx->ecn_ect0_total_remote > cnx->ecn_ect0_sent ||
+            cnx->ecn_ect1_total_remote > cnx->ecn_ect1_sent) {
+            cnx->ecn_state = picoquic_ecn_state_failed;
+        }
+        else {
+            cnx->ecn_state = picoquic_ecn_state_capable;
+        }
+    }
+    cnx->ecn_newly_acked = 0;
+}
+
 static int picoquic_process_ack_range(
     picoquic_cnx_t* cnx, picoquic_packet_context_enum pc, uint64_t highest, uint64_t range, picoquic_packet_t** ppacket,
-    uint64_t current_time)
+    uint64_t ack_delay, uint64_t current_time)
 {
     picoquic_packet_t* p = *ppacket;
     int ret = 0;
@@ -2397,8 +2373,24 @@ static int picoquic_process_ack_range(
                     break;
                 }
 
+                if (p->ecn_codepoint != PICOQUIC_ECN_NOT_ECT) {
+                    cnx->ecn_marked_acked++;
+                    cnx->ecn_newly_acked++;
+                }
+
                 if (old_path != NULL) {
-                    old_path->delivered += p->length;
+                    picoquic_rate_sampler_packet_acked(old_path, p, current_time);
+
+                    if (p->path_packet_number > old_path->path_packet_acked) {
+                        /* Track the highest packet acknowledged on each path, used by the loss detection
+                         * when several paths are in use */
+                        old_path->path_packet_acked = p->path_packet_number;
+                        if (cnx->is_multipath_enabled && p->sequence_number != cnx->pkt_ctx[pc].highest_acknowledged &&
+                            ack_delay <= PICOQUIC_ACK_DELAY_MAX) {
+                            /* The path of the largest packet was already sampled in picoquic_find_acked_packet */
+                            picoquic_update_path_rtt(cnx, old_path, p->send_time, current_time, ack_delay);
+                        }
+                    }
 
                     if (cnx->congestion_alg != NULL) {
                         cnx->congestion_alg->alg_notify(cnx, old_path,
@@ -2430,6 +2422,7 @@ static int picoquic_process_ack_range(
                 p = next;
                 /* Any acknowledgement shows progress */
                 cnx->pkt_ctx[pc].nb_retransmit = 0;
+                cnx->pkt_ctx[pc].pto_probe_needed = 0;
             }
 
             range--;
@@ -2462,7 +2455,11 @@ uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
         bytes = NULL;
         picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
     } else {
+        PICOQUIC_STATS_ADD(&cnx->stats, nb_ack_frames_received, 1);
+        PICOQUIC_STATS_ADD(&cnx->stats, nb_ack_ranges_received, num_block + 1);
         bytes += consumed;
+        /* The loss timer will be recomputed after processing the acknowledgements */
+        cnx->pkt_ctx[pc].loss_timer = 0;
 
         /* Attempt to update the RTT */
         int is_new_ack = 0;
@@ -2479,10 +2476,6 @@ uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
                 packet_data->acked_path = top_packet->send_path;
                 packet_data->last_ack_delay = ack_delay;
                 packet_data->largest_sent_time = top_packet->send_time;
-                packet_data->delivered_prior = top_packet->delivered_prior;
-                packet_data->delivered_time_prior = top_packet->delivered_time_prior;
-                packet_data->delivered_sent_prior = top_packet->delivered_sent_prior;
-                packet_data->rs_is_path_limited = top_packet->delivered_app_limited;
             }
         }
 
@@ -2505,7 +2498,7 @@ uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
                 break;
             }
 
-            if (picoquic_process_ack_range(cnx, pc, largest, range, &top_packet, current_time) != 0) {
+            if (picoquic_process_ack_range(cnx, pc, largest, range, &top_packet, ack_delay, current_time) != 0) {
                 bytes = NULL;
                 break;
             }
@@ -2549,16 +2542,26 @@ uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
         }
     }
 
-    if (bytes != 0 && is_ecn) {
-        if (ecnx3[0] > cnx->ecn_ect0_total_remote) {
-            cnx->ecn_ect0_total_remote = ecnx3[0];
-        }
-        if (ecnx3[1] > cnx->ecn_ect1_total_remote) {
-            cnx->ecn_ect1_total_remote = ecnx3[1];
+    if (bytes != 0) {
+        int is_new_ce = 0;
+
+        if (is_ecn) {
+            if (ecnx3[0] > cnx->ecn_ect0_total_remote) {
+                cnx->ecn_ect0_total_remote = ecnx3[0];
+            }
+            if (ecnx3[1] > cnx->ecn_ect1_total_remote) {
+                cnx->ecn_ect1_total_remote = ecnx3[1];
+            }
+            if (ecnx3[2] > cnx->ecn_ce_total_remote) {
+                cnx->ecn_ce_total_remote = ecnx3[2];
+                is_new_ce = 1;
+            }
         }
-        if (ecnx3[2] > cnx->ecn_ce_total_remote) {
-            cnx->ecn_ce_total_remote = ecnx3[2];
 
+        picoquic_ecn_validate(cnx, is_ecn);
+
+        if (is_new_ce && cnx->congestion_alg != NULL &&
+            cnx->ecn_state != picoquic_ecn_state_failed && cnx->ecn_state != picoquic_ecn_state_disabled) {
             cnx->congestion_alg->alg_notify(cnx, cnx->path[0],
                 picoquic_congestion_notification_ecn_ec,
                 0, 0, 0, cnx->pkt_ctx[pc].first_sack_item.end_of_sack_range, current_time);
@@ -2689,7 +2692,7 @@ int picoquic_is_ack_needed(picoquic_cnx_t* cnx, uint64_t current_time, uint64_t
             }
             else if (pkt_ctx->time_oldest_unack_packet_received + cnx->ack_delay_remote < *next_wake_time) {
                 *next_wake_time = pkt_ctx->time_oldest_unack_packet_received + cnx->ack_delay_remote;
-                SET_LAST_WAKE(cnx->quic, PICOQUIC_FRAME);
+                SET_LAST_WAKE_REASON(cnx, PICOQUIC_FRAME, picoquic_wake_reason_ack);
             }
         }
     }
@@ -2742,6 +2745,10 @@ uint8_t* picoquic_decode_connection_close_frame(picoquic_cnx_t* cnx, uint8_t* by
             picoquic_frame_type_connection_close);
     }
     else {
+        if (cnx->cnx_state < picoquic_state_server_false_start) {
+            /* The peer closed the connection during the handshake */
+            picoquic_binlog_trigger(cnx);
+        }
         cnx->cnx_state = (cnx->cnx_state < picoquic_state_client_ready_start || cnx->crypto_context[picoquic_epoch_1rtt].aead_decrypt == NULL) ? picoquic_state_disconnected : picoquic_state_closing_received;
 
         if (cnx->callback_fn) {
@@ -3179,11 +3186,7 @@ uint8_t* picoquic_decode_streams_blocked_frame(picoquic_cnx_t* cnx, uint8_t* byt
 
 static uint8_t* picoquic_skip_0len_frame(uint8_t* bytes, const uint8_t* bytes_max)
 {
-    uint8_t frame = bytes[0];
-    do {
-        bytes++;
-    } while (bytes < bytes_max && *bytes == frame);
-    return bytes;
+    return (uint8_t*)picoquic_skip_repeated_bytes(bytes, bytes_max);
 }
 
 /* Handling of Handshake Done frame. 
@@ -3498,6 +3501,11 @@ size_t picoquic_encode_time_stamp_length(picoquic_cnx_t* cnx, uint64_t current_t
 
 void process_decoded_packet_data(picoquic_cnx_t* cnx, uint64_t current_time, picoquic_packet_data_t * packet_data)
 {
+    /* Close the delivery rate samples of all the paths acknowledged by this packet */
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        picoquic_rate_sampler_generate(cnx, cnx->path[i], current_time);
+    }
+
     if (packet_data->acked_path != NULL) {
         uint64_t one_way_delay = 0;
 
@@ -3519,14 +3527,8 @@ void process_decoded_packet_data(picoquic_cnx_t* cnx, uint64_t current_time, pic
                 packet_data->acked_path->rtt_sample, one_way_delay, 0, 0, current_time);
         }
     
-        picoquic_estimate_path_bandwidth(cnx, packet_data->acked_path, packet_data->largest_sent_time,
-            packet_data->delivered_prior, packet_data->delivered_time_prior, packet_data->delivered_sent_prior,
-            (packet_data->last_time_stamp_received == 0) ? current_time : packet_data->last_time_stamp_received,
-            current_time, packet_data->rs_is_path_limited);
-
-        picoquic_estimate_max_path_bandwidth(cnx, packet_data->acked_path, packet_data->largest_sent_time,
-            (packet_data->last_time_stamp_received == 0) ? current_time : packet_data->last_time_stamp_received,
-            current_time);
+        picoquic_estimate_max_path_bandwidth(packet_data->acked_path, packet_data->largest_sent_time,
+            (packet_data->last_time_stamp_received == 0) ? current_time : packet_data->last_time_stamp_received);
 
         if (cnx->congestion_alg != NULL && packet_data->acked_path->rtt_sample > 0) {
             cnx->congestion_alg->alg_notify(cnx, packet_data->acked_path,
@@ -3536,6 +3538,49 @@ void process_decoded_packet_data(picoquic_cnx_t* cnx, uint64_t current_time, pic
     }
 }
 
+/* Frame properties, indexed by the first byte of single byte frame types.
+ * The low bits indicate in which epochs the frame can be received, the
+ * high bit whether the frame requires an acknowledgement. Checking the
+ * table replaces the chain of tests that used to precede the switch in
+ * the decoding loop. Multi-byte frame types are only allowed in 0-RTT
+ * and 1-RTT packets, and set the ack_needed flag in the decoding switch.
+ */
+#define PICOQUIC_FRAME_EPOCH_ALL 0x0F
+#define PICOQUIC_FRAME_EPOCH_NO_0RTT 0x0D
+#define PICOQUIC_FRAME_EPOCH_APP 0x0A
+#define PICOQUIC_FRAME_ACK_NEEDED 0x10
+#define PICOQUIC_FRAME_APP_ACK (PICOQUIC_FRAME_EPOCH_APP | PICOQUIC_FRAME_ACK_NEEDED)
+#define PICOQUIC_FRAME_TABLE_SIZE 0x40
+
+static const uint8_t picoquic_frame_flags[PICOQUIC_FRAME_TABLE_SIZE] = {
+    /* 0x00: padding, ping, ack, ack_ecn, reset_stream, stop_sending, crypto_hs, new_token */
+    PICOQUIC_FRAME_EPOCH_ALL, PICOQUIC_FRAME_EPOCH_ALL | PICOQUIC_FRAME_ACK_NEEDED,
+    PICOQUIC_FRAME_EPOCH_NO_0RTT, PICOQUIC_FRAME_EPOCH_NO_0RTT,
+    PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK,
+    PICOQUIC_FRAME_EPOCH_ALL | PICOQUIC_FRAME_ACK_NEEDED, PICOQUIC_FRAME_APP_ACK,
+    /* 0x08: stream frames */
+    PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK,
+    PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK,
+    /* 0x10: max_data, max_stream_data, max_streams, data_blocked, stream_data_blocked, streams_blocked */
+    PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK,
+    PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK,
+    /* 0x18: new_cid, retire_cid, path_challenge, path_response, connection_close, application_close, handshake_done */
+    PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP,
+    PICOQUIC_FRAME_EPOCH_ALL | PICOQUIC_FRAME_ACK_NEEDED, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_APP_ACK, PICOQUIC_FRAME_EPOCH_APP,
+    /* 0x20 */
+    PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP,
+    PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP,
+    /* 0x28 */
+    PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP,
+    PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP,
+    /* 0x30: datagram, datagram_l */
+    PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP,
+    PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP,
+    /* 0x38 */
+    PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP,
+    PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP, PICOQUIC_FRAME_EPOCH_APP
+};
+
 int picoquic_decode_frames(picoquic_cnx_t* cnx, picoquic_path_t * path_x, uint8_t* bytes,
     size_t bytes_maxsize, int epoch,
     struct sockaddr* addr_from,
@@ -3546,105 +3591,77 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, picoquic_path_t * path_x, uint8_
     int ack_needed = 0;
     picoquic_packet_context_enum pc = picoquic_context_from_epoch(epoch);
     picoquic_packet_data_t packet_data;
+    uint64_t nb_stream_frames = 0;
 
     memset(&packet_data, 0, sizeof(packet_data));
 
     while (bytes != NULL && bytes < bytes_max) {
         uint8_t first_byte = bytes[0];
+        uint8_t frame_flags = (first_byte < PICOQUIC_FRAME_TABLE_SIZE) ?
+            picoquic_frame_flags[first_byte] : PICOQUIC_FRAME_EPOCH_APP;
 
-        if (PICOQUIC_IN_RANGE(first_byte, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
-            if (epoch != 1 && epoch != 3) {
-                DBG_PRINTF("Data frame (0x%x), when only TLS stream is expected", first_byte);
-                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-                bytes = NULL;
-                break;
-            }
+        if ((frame_flags & (1 << epoch)) == 0) {
+            DBG_PRINTF("Frame (0x%x) not expected in epoch %d", first_byte, epoch);
+            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
+            bytes = NULL;
+            break;
+        }
 
-            bytes = picoquic_decode_stream_frame(cnx, bytes, bytes_max, current_time);
-            ack_needed = 1;
+        ack_needed |= frame_flags & PICOQUIC_FRAME_ACK_NEEDED;
 
+        /* Most packets carry stream data, acks and padding. Test these first. */
+        if (PICOQUIC_IN_RANGE(first_byte, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
+            bytes = picoquic_decode_stream_frame(cnx, bytes, bytes_max, current_time);
+            nb_stream_frames++;
         }
         else if (first_byte == picoquic_frame_type_ack) {
-            if (epoch == 1) {
-                DBG_PRINTF("Ack frame (0x%x) not expected in 0-RTT packet", first_byte);
-                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-                bytes = NULL;
-                break;
-            }
             bytes = picoquic_decode_ack_frame(cnx, bytes, bytes_max, current_time, epoch, 0, &packet_data);
         }
-        else if (first_byte == picoquic_frame_type_ack_ecn) {
-            if (epoch == 1) {
-                DBG_PRINTF("Ack-ECN frame (0x%x) not expected in 0-RTT packet", first_byte);
-                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-                bytes = NULL;
-                break;
-            }
-            bytes = picoquic_decode_ack_frame(cnx, bytes, bytes_max, current_time, epoch, 1, &packet_data);
-        }
-        else if (epoch != 1 && epoch != 3 && first_byte != picoquic_frame_type_padding
-            && first_byte != picoquic_frame_type_ping
-            && first_byte != picoquic_frame_type_connection_close
-            && first_byte != picoquic_frame_type_crypto_hs) {
-            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-            bytes = NULL;
-            break;
-
+        else if (first_byte == picoquic_frame_type_padding) {
+            bytes = picoquic_skip_0len_frame(bytes, bytes_max);
         }
         else {
             switch (first_byte) {
-            case picoquic_frame_type_padding:
-                bytes = picoquic_skip_0len_frame(bytes, bytes_max);
+            case picoquic_frame_type_ack_ecn:
+                bytes = picoquic_decode_ack_frame(cnx, bytes, bytes_max, current_time, epoch, 1, &packet_data);
                 break;
             case picoquic_frame_type_reset_stream:
                 bytes = picoquic_decode_stream_reset_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_connection_close:
                 bytes = picoquic_decode_connection_close_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_application_close:
                 bytes = picoquic_decode_application_close_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_max_data:
                 bytes = picoquic_decode_max_data_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_max_stream_data:
                 bytes = picoquic_decode_max_stream_data_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_max_streams_bidir:
             case picoquic_frame_type_max_streams_unidir:
                 bytes = picoquic_decode_max_streams_frame(cnx, bytes, bytes_max, first_byte);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_ping:
                 bytes = picoquic_skip_0len_frame(bytes, bytes_max);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_data_blocked:
                 bytes = picoquic_decode_blocked_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_stream_data_blocked:
                 bytes = picoquic_decode_stream_blocked_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_streams_blocked_unidir:
             case picoquic_frame_type_streams_blocked_bidir:
                 bytes = picoquic_decode_streams_blocked_frame(cnx, bytes, bytes_max, first_byte);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_new_connection_id:
                 bytes = picoquic_decode_new_connection_id_frame(cnx, bytes, bytes_max, current_time);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_stop_sending:
                 bytes = picoquic_decode_stop_sending_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_path_challenge:
                 bytes = picoquic_decode_path_challenge_frame(cnx, bytes, bytes_max, path_x, addr_from, addr_to);
@@ -3654,20 +3671,16 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, picoquic_path_t * path_x, uint8_
                 break;
             case picoquic_frame_type_crypto_hs:
                 bytes = picoquic_decode_crypto_hs_frame(cnx, bytes, bytes_max, epoch);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_new_token:
                 bytes = picoquic_decode_new_token_frame(cnx, bytes, bytes_max, current_time, addr_to);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_retire_connection_id:
                 /* the old code point for ACK frames, but this is taken care of in the ACK tests above */
                 bytes = picoquic_decode_retire_connection_id_frame(cnx, bytes, bytes_max, current_time, path_x);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_handshake_done:
                 bytes = picoquic_decode_handshake_done_frame(cnx, bytes, current_time);
-                ack_needed = 1;
                 break;
             case picoquic_frame_type_datagram:
             case picoquic_frame_type_datagram_l:
@@ -3702,6 +3715,11 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, picoquic_path_t * path_x, uint8_
         process_decoded_packet_data(cnx, current_time, &packet_data);
     }
 
+    if (nb_stream_frames > 0) {
+        PICOQUIC_STATS_ADD(&cnx->stats, nb_packets_with_stream_frames, 1);
+        PICOQUIC_STATS_ADD(&cnx->stats, nb_stream_frames_received, nb_stream_frames);
+    }
+
     if (bytes != NULL && ack_needed != 0) {
         cnx->latest_progress_time = current_time;
         picoquic_set_ack_needed(cnx, current_time, pc);
@@ -0,0 +1,342 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+/*
+ * Log-linear latency histograms, in the style of HdrHistogram.
+ *
+ * Values below 2*SUB_BUCKETS map to their own bucket. Larger values are
+ * shifted right until they fall between SUB_BUCKETS and 2*SUB_BUCKETS,
+ * so each power of 2 is split in SUB_BUCKETS buckets of equal width.
+ * Values that need more than MAX_SHIFT shifts go to the last bucket.
+ *
+ * Each histogram has a single writer, the thread running the context.
+ * Counters are updated with plain loads and stores, which are atomic for
+ * aligned 64 bit values, so readers in other threads never see a torn
+ * value. The percentiles are computed from the bucket counts, not from
+ * the total count, so a reader racing with the writer still gets a
+ * consistent result.
+ */
+
+#ifdef _WINDOWS
+static uint64_t picoquic_histogram_load(const volatile uint64_t* x)
+{
+    return *x;
+}
+
+static void picoquic_histogram_store(volatile uint64_t* x, uint64_t v)
+{
+    *x = v;
+}
+#else
+static uint64_t picoquic_histogram_load(const uint64_t* x)
+{
+    return __atomic_load_n(x, __ATOMIC_RELAXED);
+}
+
+static void picoquic_histogram_store(uint64_t* x, uint64_t v)
+{
+    __atomic_store_n(x, v, __ATOMIC_RELAXED);
+}
+#endif
+
+static size_t picoquic_histogram_index(uint64_t value)
+{
+    int shift = 0;
+
+    while ((value >> shift) >= 2 * PICOQUIC_HISTOGRAM_SUB_BUCKETS) {
+        shift++;
+    }
+
+    if (shift > PICOQUIC_HISTOGRAM_MAX_SHIFT) {
+        return PICOQUIC_HISTOGRAM_NB_BUCKETS - 1;
+    }
+
+    return (size_t)(shift + 1) * PICOQUIC_HISTOGRAM_SUB_BUCKETS +
+        (size_t)((value >> shift) - PICOQUIC_HISTOGRAM_SUB_BUCKETS);
+}
+
+/* Highest value that maps to the bucket */
+static uint64_t picoquic_histogram_bucket_value(size_t index)
+{
+    uint64_t value;
+
+    if (index < 2 * PICOQUIC_HISTOGRAM_SUB_BUCKETS) {
+        value = index;
+    }
+    else {
+        int shift = (int)(index / PICOQUIC_HISTOGRAM_SUB_BUCKETS) - 1;
+        uint64_t mantissa = PICOQUIC_HISTOGRAM_SUB_BUCKETS + (index % PICOQUIC_HISTOGRAM_SUB_BUCKETS);
+
+        value = (mantissa << shift) + (1ull << shift) - 1;
+    }
+
+    return value;
+}
+
+void picoquic_histogram_record(picoquic_histogram_t* histogram, uint64_t value)
+{
+    size_t index = picoquic_histogram_index(value);
+
+    if (histogram->count == 0 || value < histogram->min) {
+        picoquic_histogram_store(&histogram->min, value);
+    }
+    if (value > histogram->max) {
+        picoquic_histogram_store(&histogram->max, value);
+    }
+    picoquic_histogram_store(&histogram->sum, histogram->sum + value);
+    picoquic_histogram_store(&histogram->buckets[index], histogram->buckets[index] + 1);
+    picoquic_histogram_store(&histogram->count, histogram->count + 1);
+}
+
+/* Add the content of "other" to "histogram". The other histogram may be
+ * updated concurrently by its own thread, but "histogram" may not. */
+void picoquic_histogram_merge(picoquic_histogram_t* histogram, picoquic_histogram_t const* other)
+{
+    uint64_t other_count = picoquic_histogram_load(&other->count);
+
+    if (other_count > 0) {
+        uint64_t other_min = picoquic_histogram_load(&other->min);
+        uint64_t other_max = picoquic_histogram_load(&other->max);
+
+        if (histogram->count == 0 || other_min < histogram->min) {
+            histogram->min = other_min;
+        }
+        if (other_max > histogram->max) {
+            histogram->max = other_max;
+        }
+        histogram->count += other_count;
+        histogram->sum += picoquic_histogram_load(&other->sum);
+        for (size_t i = 0; i < PICOQUIC_HISTOGRAM_NB_BUCKETS; i++) {
+            histogram->buckets[i] += picoquic_histogram_load(&other->buckets[i]);
+        }
+    }
+}
+
+/* Return the smallest value such that at least "percentile" percent of the
+ * samples are lower or equal, within the precision of the buckets. Returns
+ * 0 if the histogram is empty. */
+uint64_t picoquic_histogram_value_at_percentile(picoquic_histogram_t const* histogram, double percentile)
+{
+    uint64_t total = 0;
+    uint64_t target;
+    uint64_t cumulated = 0;
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < PICOQUIC_HISTOGRAM_NB_BUCKETS; i++) {
+        total += picoquic_histogram_load(&histogram->buckets[i]);
+    }
+
+    if (total > 0) {
+        uint64_t min_value = picoquic_histogram_load(&histogram->min);
+        uint64_t max_value = picoquic_histogram_load(&histogram->max);
+
+        if (percentile < 0.0) {
+            percentile = 0.0;
+        }
+        else if (percentile > 100.0) {
+            percentile = 100.0;
+        }
+        target = (uint64_t)(((double)total * percentile) / 100.0 + 0.5);
+        if (target == 0) {
+            target = 1;
+        }
+
+        for (size_t i = 0; i < PICOQUIC_HISTOGRAM_NB_BUCKETS; i++) {
+            cumulated += picoquic_histogram_load(&histogram->buckets[i]);
+            if (cumulated >= target) {
+                value = picoquic_histogram_bucket_value(i);
+                break;
+            }
+        }
+
+        /* The bucket bound is not more precise than the recorded extremes */
+        if (value > max_value) {
+            value = max_value;
+        }
+        if (value < min_value) {
+            value = min_value;
+        }
+    }
+
+    return value;
+}
+
+/*
+ * Binary snapshot. All numbers are encoded as QUIC varints:
+ * - version (1), number of sub buckets, max shift, number of histograms,
+ * - for each histogram: identifier, count, sum, min, max, number of non
+ *   empty buckets, and for each non empty bucket the number of empty
+ *   buckets skipped since the previous one, and the bucket count.
+ * Snapshots taken with different bucket layouts cannot be merged.
+ */
+#define PICOQUIC_HISTOGRAM_SNAPSHOT_VERSION 1
+
+#ifndef PICOQUIC_DISABLE_STATS
+static uint8_t* picoquic_histogram_encode_varint(uint8_t* bytes, const uint8_t* bytes_max, uint64_t n64)
+{
+    if (bytes != NULL) {
+        size_t l = picoquic_varint_encode(bytes, bytes_max - bytes, n64);
+        bytes = (l == 0) ? NULL : bytes + l;
+    }
+    return bytes;
+}
+
+static uint8_t* picoquic_histogram_encode(uint8_t* bytes, const uint8_t* bytes_max, uint64_t histogram_id, picoquic_histogram_t const* histogram)
+{
+    uint64_t buckets[PICOQUIC_HISTOGRAM_NB_BUCKETS];
+    uint64_t nb_buckets = 0;
+    size_t next_index = 0;
+
+    /* Copy the counters first, so the number of non empty buckets
+     * matches the buckets encoded below */
+    for (size_t i = 0; i < PICOQUIC_HISTOGRAM_NB_BUCKETS; i++) {
+        buckets[i] = picoquic_histogram_load(&histogram->buckets[i]);
+        nb_buckets += (buckets[i] != 0);
+    }
+
+    bytes = picoquic_histogram_encode_varint(bytes, bytes_max, histogram_id);
+    bytes = picoquic_histogram_encode_varint(bytes, bytes_max, picoquic_histogram_load(&histogram->count));
+    bytes = picoquic_histogram_encode_varint(bytes, bytes_max, picoquic_histogram_load(&histogram->sum));
+    bytes = picoquic_histogram_encode_varint(bytes, bytes_max, picoquic_histogram_load(&histogram->min));
+    bytes = picoquic_histogram_encode_varint(bytes, bytes_max, picoquic_histogram_load(&histogram->max));
+    bytes = picoquic_histogram_encode_varint(bytes, bytes_max, nb_buckets);
+    for (size_t i = 0; bytes != NULL && i < PICOQUIC_HISTOGRAM_NB_BUCKETS; i++) {
+        if (buckets[i] != 0) {
+            bytes = picoquic_histogram_encode_varint(bytes, bytes_max, i - next_index);
+            bytes = picoquic_histogram_encode_varint(bytes, bytes_max, buckets[i]);
+            next_index = i + 1;
+        }
+    }
+
+    return bytes;
+}
+#endif
+
+int picoquic_get_histogram_snapshot(picoquic_quic_t* quic, uint8_t* bytes, size_t bytes_max, size_t* length)
+{
+    int ret = 0;
+#ifndef PICOQUIC_DISABLE_STATS
+    uint8_t* bytes_next = bytes;
+    const uint8_t* bytes_end = bytes + bytes_max;
+
+    bytes_next = picoquic_histogram_encode_varint(bytes_next, bytes_end, PICOQUIC_HISTOGRAM_SNAPSHOT_VERSION);
+    bytes_next = picoquic_histogram_encode_varint(bytes_next, bytes_end, PICOQUIC_HISTOGRAM_SUB_BUCKETS);
+    bytes_next = picoquic_histogram_encode_varint(bytes_next, bytes_end, PICOQUIC_HISTOGRAM_MAX_SHIFT);
+    bytes_next = picoquic_histogram_encode_varint(bytes_next, bytes_end, picoquic_histogram_max);
+    for (int i = 0; i < picoquic_histogram_max; i++) {
+        bytes_next = picoquic_histogram_encode(bytes_next, bytes_end, i, &quic->histograms[i]);
+    }
+
+    if (bytes_next == NULL) {
+        *length = 0;
+        ret = PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
+    }
+    else {
+        *length = bytes_next - bytes;
+    }
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+    UNREFERENCED_PARAMETER(bytes);
+    UNREFERENCED_PARAMETER(bytes_max);
+#endif
+    *length = 0;
+    ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+#endif
+    return ret;
+}
+
+/* Add the histograms found in the snapshot to the array. Histograms with
+ * unknown identifiers are skipped, so that snapshots of newer versions of
+ * the code can still be read. */
+int picoquic_histogram_snapshot_merge(picoquic_histogram_t histograms[picoquic_histogram_max], const uint8_t* bytes, size_t length)
+{
+    uint8_t* bytes_next = (uint8_t*)bytes;
+    const uint8_t* bytes_max = bytes + length;
+    uint64_t version = 0;
+    uint64_t sub_buckets = 0;
+    uint64_t max_shift = 0;
+    uint64_t nb_histograms = 0;
+
+    if ((bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &version)) == NULL ||
+        (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &sub_buckets)) == NULL ||
+        (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &max_shift)) == NULL ||
+        (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &nb_histograms)) == NULL ||
+        version != PICOQUIC_HISTOGRAM_SNAPSHOT_VERSION || sub_buckets != PICOQUIC_HISTOGRAM_SUB_BUCKETS ||
+        max_shift != PICOQUIC_HISTOGRAM_MAX_SHIFT) {
+        return PICOQUIC_ERROR_INVALID_FILE;
+    }
+
+    for (uint64_t h = 0; h < nb_histograms; h++) {
+        picoquic_histogram_t decoded;
+        uint64_t histogram_id = 0;
+        uint64_t nb_buckets = 0;
+        uint64_t index = 0;
+
+        memset(&decoded, 0, sizeof(decoded));
+        if ((bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &histogram_id)) == NULL ||
+            (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &decoded.count)) == NULL ||
+            (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &decoded.sum)) == NULL ||
+            (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &decoded.min)) == NULL ||
+            (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &decoded.max)) == NULL ||
+            (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &nb_buckets)) == NULL ||
+            nb_buckets > PICOQUIC_HISTOGRAM_NB_BUCKETS) {
+            return PICOQUIC_ERROR_INVALID_FILE;
+        }
+
+        for (uint64_t b = 0; b < nb_buckets; b++) {
+            uint64_t skipped = 0;
+            uint64_t count = 0;
+
+            if ((bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &skipped)) == NULL ||
+                (bytes_next = picoquic_frames_varint_decode(bytes_next, bytes_max, &count)) == NULL ||
+                skipped >= PICOQUIC_HISTOGRAM_NB_BUCKETS - index) {
+                return PICOQUIC_ERROR_INVALID_FILE;
+            }
+            index += skipped;
+            decoded.buckets[index] = count;
+            index++;
+        }
+
+        if (histogram_id < picoquic_histogram_max) {
+            picoquic_histogram_merge(&histograms[histogram_id], &decoded);
+        }
+    }
+
+    return 0;
+}
+
+picoquic_histogram_t const* picoquic_get_histogram(picoquic_quic_t* quic, picoquic_histogram_id_t histogram_id)
+{
+#ifndef PICOQUIC_DISABLE_STATS
+    return (histogram_id < picoquic_histogram_max) ? &quic->histograms[histogram_id] : NULL;
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+    UNREFERENCED_PARAMETER(histogram_id);
+#endif
+    return NULL;
+#endif
+}
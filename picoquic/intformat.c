@@ -23,6 +23,7 @@
 #ifndef WIN32
 #include <sys/types.h>
 #endif
+#include "picoquic_utils.h"
 
 void picoformat_16(uint8_t* bytes, uint16_t n16)
 {
@@ -137,7 +138,9 @@ size_t picoquic_varint_decode(const uint8_t* bytes, size_t max_bytes, uint64_t*
 {
     size_t length = ((size_t)1) << ((bytes[0] & 0xC0) >> 6);
 
-    if (length > max_bytes) {
+    if (max_bytes >= 8) {
+        *n64 = picoquic_varint_decode_wide(bytes, length);
+    } else if (length > max_bytes) {
         length = 0;
         *n64 = 0;
     } else {
@@ -0,0 +1,382 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include "cc_common.h"
+
+/*
+Implementation of a "less than best effort" congestion control, following
+LEDBAT (RFC 6817) with the modifications of LEDBAT++
+(draft-irtf-iccrg-ledbat-plus-plus-01).
+
+The algorithm is meant for background transfers. It estimates the queuing
+delay as the difference between the current delay and the base delay, the
+minimum delay observed over the last 10 minutes. The window grows as long as
+the queuing delay stays below a target of 60 ms, and shrinks in proportion
+of the excess delay when the target is exceeded. This causes LEDBAT flows to
+yield to foreground flows such as Cubic or Reno, which keep growing until
+they see losses.
+
+When one way delay time stamps are negotiated, the delay samples are
+one way delays measured by picoquic_update_1wd, which are not affected
+by the queues on the return path. Otherwise, the algorithm uses the RTT.
+
+The LEDBAT++ changes are:
+
+* the increase gain is reduced to 1/min(16, ceil(2*target/base)), so that
+  LEDBAT flows on long paths ramp up more slowly than the foreground flows,
+
+* the window decrease is multiplicative, proportional to the window size,
+  and capped at half the window per round trip,
+
+* slow start exits when the queuing delay exceeds 3/4 of the target,
+
+* "periodic slowdowns" reduce the window to 2 packets for 2 RTT after the
+  initial slow start, and then at intervals of 9 times the duration of the
+  previous slowdown, so that competing LEDBAT flows can measure an accurate
+  base delay instead of each other's queues.
+*/
+
+#define LEDBAT_TARGET_DELAY 60000
+#define LEDBAT_BASE_HISTORY 10
+#define LEDBAT_BASE_INTERVAL 60000000
+#define LEDBAT_CURRENT_FILTER 4
+#define LEDBAT_MAX_GAIN_DIVISOR 16
+#define LEDBAT_SLOWDOWN_RTT 2
+#define LEDBAT_SLOWDOWN_INTERVAL_FACTOR 9
+
+typedef enum {
+    picoquic_ledbat_alg_slow_start = 0,
+    picoquic_ledbat_alg_congestion_avoidance,
+    picoquic_ledbat_alg_slowdown
+} picoquic_ledbat_alg_state_t;
+
+typedef struct st_picoquic_ledbat_state_t {
+    picoquic_ledbat_alg_state_t alg_state;
+    uint64_t ssthresh;
+    uint64_t residual_ack;
+    uint64_t recovery_start;
+    uint64_t recovery_sequence;
+    /* Delay estimates */
+    uint64_t base_history[LEDBAT_BASE_HISTORY];
+    uint64_t base_history_end;
+    uint64_t base_delay;
+    uint64_t current_history[LEDBAT_CURRENT_FILTER];
+    int current_index;
+    int nb_current;
+    uint64_t queuing_delay;
+    /* Bound on the decrease per round trip */
+    uint64_t decrease_round_sequence;
+    uint64_t decrease_floor;
+    /* Periodic slowdown */
+    uint64_t slowdown_start;
+    uint64_t slowdown_end;
+    uint64_t next_slowdown;
+    int is_slowdown_recovery;
+} picoquic_ledbat_state_t;
+
+static void picoquic_ledbat_init(picoquic_path_t* path_x, uint64_t current_time)
+{
+    /* Initialize the state of the congestion control algorithm */
+    picoquic_ledbat_state_t* ledbat_state = (picoquic_ledbat_state_t*)malloc(sizeof(picoquic_ledbat_state_t));
+
+    if (ledbat_state != NULL) {
+        memset(ledbat_state, 0, sizeof(picoquic_ledbat_state_t));
+        path_x->congestion_alg_state = (void*)ledbat_state;
+        ledbat_state->alg_state = picoquic_ledbat_alg_slow_start;
+        ledbat_state->ssthresh = UINT64_MAX;
+        ledbat_state->base_history_end = current_time + LEDBAT_BASE_INTERVAL;
+        path_x->cwin = PICOQUIC_CWIN_INITIAL;
+    }
+    else {
+        path_x->congestion_alg_state = NULL;
+    }
+}
+
+/* Update the base and current delays after a new delay sample.
+ * The base delay is the minimum of the per minute minima kept in the history.
+ * The current delay is the minimum of the last few samples, which filters
+ * the delay spikes caused by delayed acknowledgements or link jitter.
+ */
+static void picoquic_ledbat_update_delay(picoquic_ledbat_state_t* ledbat_state, uint64_t delay_sample, uint64_t current_time)
+{
+    uint64_t current_delay = UINT64_MAX;
+
+    if (current_time > ledbat_state->base_history_end) {
+        for (int i = LEDBAT_BASE_HISTORY - 1; i > 0; i--) {
+            ledbat_state->base_history[i] = ledbat_state->base_history[i - 1];
+        }
+        ledbat_state->base_history[0] = delay_sample;
+        ledbat_state->base_history_end = current_time + LEDBAT_BASE_INTERVAL;
+    }
+    else if (ledbat_state->base_history[0] == 0 || delay_sample < ledbat_state->base_history[0]) {
+        ledbat_state->base_history[0] = delay_sample;
+    }
+
+    ledbat_state->base_delay = ledbat_state->base_history[0];
+    for (int i = 1; i < LEDBAT_BASE_HISTORY; i++) {
+        if (ledbat_state->base_history[i] > 0 && ledbat_state->base_history[i] < ledbat_state->base_delay) {
+            ledbat_state->base_delay = ledbat_state->base_history[i];
+        }
+    }
+
+    ledbat_state->current_history[ledbat_state->current_index] = delay_sample;
+    ledbat_state->current_index = (ledbat_state->current_index + 1) % LEDBAT_CURRENT_FILTER;
+    if (ledbat_state->nb_current < LEDBAT_CURRENT_FILTER) {
+        ledbat_state->nb_current++;
+    }
+    for (int i = 0; i < ledbat_state->nb_current; i++) {
+        if (ledbat_state->current_history[i] < current_delay) {
+            current_delay = ledbat_state->current_history[i];
+        }
+    }
+
+    ledbat_state->queuing_delay = current_delay - ledbat_state->base_delay;
+}
+
+/* The LEDBAT++ gain is 1/min(16, ceil(2*target/base)). We return the divisor. */
+static uint64_t picoquic_ledbat_gain_divisor(picoquic_ledbat_state_t* ledbat_state)
+{
+    uint64_t divisor = LEDBAT_MAX_GAIN_DIVISOR;
+
+    if (ledbat_state->base_delay > 0) {
+        divisor = (2 * LEDBAT_TARGET_DELAY + ledbat_state->base_delay - 1) / ledbat_state->base_delay;
+        if (divisor > LEDBAT_MAX_GAIN_DIVISOR) {
+            divisor = LEDBAT_MAX_GAIN_DIVISOR;
+        }
+        else if (divisor == 0) {
+            divisor = 1;
+        }
+    }
+
+    return divisor;
+}
+
+static void picoquic_ledbat_exit_slow_start(picoquic_path_t* path_x, picoquic_ledbat_state_t* ledbat_state, uint64_t current_time)
+{
+    ledbat_state->alg_state = picoquic_ledbat_alg_congestion_avoidance;
+    ledbat_state->residual_ack = 0;
+    if (ledbat_state->is_slowdown_recovery) {
+        /* The next slowdown is scheduled so that slowdowns take about 10% of the time */
+        ledbat_state->next_slowdown = current_time +
+            LEDBAT_SLOWDOWN_INTERVAL_FACTOR * (current_time - ledbat_state->slowdown_start);
+        ledbat_state->is_slowdown_recovery = 0;
+    }
+    else if (ledbat_state->next_slowdown == 0) {
+        /* First slowdown happens 2 RTT after the initial slow start */
+        ledbat_state->next_slowdown = current_time + LEDBAT_SLOWDOWN_RTT * path_x->smoothed_rtt;
+    }
+}
+
+static void picoquic_ledbat_enter_recovery(
+    picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    picoquic_ledbat_state_t* ledbat_state,
+    uint64_t current_time)
+{
+    if (ledbat_state->alg_state == picoquic_ledbat_alg_slowdown) {
+        /* Window is already minimal, only lower the target of the next slow start */
+        ledbat_state->ssthresh /= 2;
+    }
+    else {
+        ledbat_state->ssthresh = path_x->cwin / 2;
+    }
+    if (ledbat_state->ssthresh < PICOQUIC_CWIN_MINIMUM) {
+        ledbat_state->ssthresh = PICOQUIC_CWIN_MINIMUM;
+    }
+
+    if (notification == picoquic_congestion_notification_timeout) {
+        path_x->cwin = PICOQUIC_CWIN_MINIMUM;
+    }
+    else if (ledbat_state->alg_state != picoquic_ledbat_alg_slowdown) {
+        path_x->cwin = ledbat_state->ssthresh;
+        if (ledbat_state->alg_state == picoquic_ledbat_alg_slow_start) {
+            picoquic_ledbat_exit_slow_start(path_x, ledbat_state, current_time);
+        }
+    }
+
+    ledbat_state->recovery_start = current_time;
+    ledbat_state->recovery_sequence = picoquic_cc_get_sequence_number(cnx);
+    ledbat_state->residual_ack = 0;
+}
+
+static void picoquic_ledbat_enter_slowdown(picoquic_path_t* path_x, picoquic_ledbat_state_t* ledbat_state, uint64_t current_time)
+{
+    ledbat_state->alg_state = picoquic_ledbat_alg_slowdown;
+    ledbat_state->ssthresh = path_x->cwin;
+    ledbat_state->slowdown_start = current_time;
+    ledbat_state->slowdown_end = current_time + LEDBAT_SLOWDOWN_RTT * path_x->smoothed_rtt;
+    path_x->cwin = PICOQUIC_CWIN_MINIMUM;
+}
+
+/* Window increase or decrease on acknowledgement, in congestion avoidance */
+static void picoquic_ledbat_congestion_avoidance(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_ledbat_state_t* ledbat_state, uint64_t nb_bytes_acknowledged)
+{
+    if (ledbat_state->queuing_delay < LEDBAT_TARGET_DELAY) {
+        if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
+            uint64_t complete_delta = nb_bytes_acknowledged * path_x->send_mtu / picoquic_ledbat_gain_divisor(ledbat_state) +
+                ledbat_state->residual_ack;
+            ledbat_state->residual_ack = complete_delta % path_x->cwin;
+            path_x->cwin += complete_delta / path_x->cwin;
+        }
+    }
+    else {
+        /* Decrease by W*(delay/target - 1) per RTT, i.e., per acknowledged byte
+         * by (delay - target)/target, but by no more than W/2 per round trip. */
+        uint64_t decrease = nb_bytes_acknowledged * (ledbat_state->queuing_delay - LEDBAT_TARGET_DELAY) / LEDBAT_TARGET_DELAY;
+
+        if (ledbat_state->decrease_round_sequence <= picoquic_cc_get_ack_number(cnx)) {
+            ledbat_state->decrease_round_sequence = picoquic_cc_get_sequence_number(cnx);
+            ledbat_state->decrease_floor = path_x->cwin / 2;
+        }
+        if (path_x->cwin < ledbat_state->decrease_floor + decrease) {
+            path_x->cwin = ledbat_state->decrease_floor;
+        }
+        else {
+            path_x->cwin -= decrease;
+        }
+        if (path_x->cwin < PICOQUIC_CWIN_MINIMUM) {
+            path_x->cwin = PICOQUIC_CWIN_MINIMUM;
+        }
+        ledbat_state->residual_ack = 0;
+    }
+}
+
+/*
+ * LEDBAT reacts to acknowledgements, losses, and delay measurements.
+ * Losses are handled as in New Reno, at most once per round trip.
+ */
+static void picoquic_ledbat_notify(
+    picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    uint64_t rtt_measurement,
+    uint64_t one_way_delay,
+    uint64_t nb_bytes_acknowledged,
+    uint64_t lost_packet_number,
+    uint64_t current_time)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(lost_packet_number);
+#endif
+    picoquic_ledbat_state_t* ledbat_state = (picoquic_ledbat_state_t*)path_x->congestion_alg_state;
+
+    if (ledbat_state != NULL) {
+        if (ledbat_state->alg_state == picoquic_ledbat_alg_slowdown && current_time >= ledbat_state->slowdown_end) {
+            /* End of the slowdown, slow start back to the previous window */
+            ledbat_state->alg_state = picoquic_ledbat_alg_slow_start;
+            ledbat_state->is_slowdown_recovery = 1;
+        }
+        else if (ledbat_state->alg_state == picoquic_ledbat_alg_congestion_avoidance &&
+            ledbat_state->next_slowdown != 0 && current_time >= ledbat_state->next_slowdown) {
+            picoquic_ledbat_enter_slowdown(path_x, ledbat_state, current_time);
+        }
+
+        switch (notification) {
+        case picoquic_congestion_notification_acknowledgement:
+            switch (ledbat_state->alg_state) {
+            case picoquic_ledbat_alg_slow_start:
+                if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
+                    path_x->cwin += nb_bytes_acknowledged / picoquic_ledbat_gain_divisor(ledbat_state);
+                }
+                if (path_x->cwin >= ledbat_state->ssthresh) {
+                    path_x->cwin = ledbat_state->ssthresh;
+                    picoquic_ledbat_exit_slow_start(path_x, ledbat_state, current_time);
+                }
+                break;
+            case picoquic_ledbat_alg_congestion_avoidance:
+                picoquic_ledbat_congestion_avoidance(cnx, path_x, ledbat_state, nb_bytes_acknowledged);
+                break;
+            case picoquic_ledbat_alg_slowdown:
+            default:
+                /* The window is frozen during the slowdown */
+                break;
+            }
+            break;
+        case picoquic_congestion_notification_ecn_ec:
+        case picoquic_congestion_notification_repeat:
+        case picoquic_congestion_notification_timeout:
+            if (current_time - ledbat_state->recovery_start > path_x->smoothed_rtt ||
+                ledbat_state->recovery_sequence <= picoquic_cc_get_ack_number(cnx)) {
+                picoquic_ledbat_enter_recovery(cnx, path_x, notification, ledbat_state, current_time);
+            }
+            break;
+        case picoquic_congestion_notification_rtt_measurement:
+            /* With time stamps, a zero one way delay means that no time stamp was received. */
+            if (cnx->is_time_stamp_enabled ? one_way_delay > 0 : rtt_measurement > 0) {
+                picoquic_ledbat_update_delay(ledbat_state,
+                    (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement, current_time);
+                if (ledbat_state->alg_state == picoquic_ledbat_alg_slow_start &&
+                    4 * ledbat_state->queuing_delay > 3 * LEDBAT_TARGET_DELAY) {
+                    ledbat_state->ssthresh = path_x->cwin;
+                    picoquic_ledbat_exit_slow_start(path_x, ledbat_state, current_time);
+                }
+            }
+            break;
+        case picoquic_congestion_notification_spurious_repeat:
+        case picoquic_congestion_notification_cwin_blocked:
+        case picoquic_congestion_notification_bw_measurement:
+        default:
+            /* ignore */
+            break;
+        }
+
+        /* Compute pacing data */
+        picoquic_update_pacing_data(cnx, path_x, ledbat_state->alg_state == picoquic_ledbat_alg_slow_start &&
+            ledbat_state->ssthresh == UINT64_MAX);
+    }
+}
+
+/* Release the state of the congestion control algorithm */
+static void picoquic_ledbat_delete(picoquic_path_t* path_x)
+{
+    if (path_x->congestion_alg_state != NULL) {
+        free(path_x->congestion_alg_state);
+        path_x->congestion_alg_state = NULL;
+    }
+}
+
+/* Observe the state of congestion control */
+
+static void picoquic_ledbat_observe(picoquic_path_t* path_x, uint64_t* cc_state, uint64_t* cc_param)
+{
+    picoquic_ledbat_state_t* ledbat_state = (picoquic_ledbat_state_t*)path_x->congestion_alg_state;
+    *cc_state = (uint64_t)ledbat_state->alg_state;
+    *cc_param = ledbat_state->queuing_delay;
+}
+
+/* Definition record for the LEDBAT algorithm */
+
+#define PICOQUIC_LEDBAT_ID "ledbat"
+
+picoquic_congestion_algorithm_t picoquic_ledbat_algorithm_struct = {
+    PICOQUIC_LEDBAT_ID,
+    picoquic_ledbat_init,
+    picoquic_ledbat_notify,
+    picoquic_ledbat_delete,
+    picoquic_ledbat_observe
+};
+
+picoquic_congestion_algorithm_t* picoquic_ledbat_algorithm = &picoquic_ledbat_algorithm_struct;
@@ -0,0 +1,205 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+#include "logcompress.h"
+
+#define PICOQUIC_LZ_MIN_MATCH 4
+#define PICOQUIC_LZ_HASH_BITS 12
+#define PICOQUIC_LZ_MAX_OFFSET 0xFFFF
+/* Keep the last bytes as literals, so the match search never reads past the end */
+#define PICOQUIC_LZ_LAST_LITERALS 5
+
+static uint32_t picoquic_lz_hash(const uint8_t* p)
+{
+    uint32_t v = ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761u) >> (32 - PICOQUIC_LZ_HASH_BITS);
+}
+
+static uint8_t* picoquic_lz_write_length(uint8_t* d, const uint8_t* d_max, size_t length)
+{
+    while (d != NULL && length >= 255) {
+        if (d >= d_max) {
+            d = NULL;
+        }
+        else {
+            *d++ = 255;
+            length -= 255;
+        }
+    }
+    if (d != NULL) {
+        if (d >= d_max) {
+            d = NULL;
+        }
+        else {
+            *d++ = (uint8_t)length;
+        }
+    }
+    return d;
+}
+
+static uint8_t* picoquic_lz_write_sequence(uint8_t* d, const uint8_t* d_max, const uint8_t* literals,
+    size_t nb_literals, size_t offset, size_t match_length)
+{
+    uint8_t* token = d;
+
+    if (d >= d_max) {
+        return NULL;
+    }
+    d++;
+    *token = (uint8_t)(((nb_literals < 15) ? nb_literals : 15) << 4);
+    if (nb_literals >= 15) {
+        d = picoquic_lz_write_length(d, d_max, nb_literals - 15);
+    }
+    if (d == NULL || d + nb_literals > d_max) {
+        return NULL;
+    }
+    memcpy(d, literals, nb_literals);
+    d += nb_literals;
+
+    if (match_length > 0) {
+        size_t ml = match_length - PICOQUIC_LZ_MIN_MATCH;
+
+        if (d + 2 > d_max) {
+            return NULL;
+        }
+        *d++ = (uint8_t)(offset & 0xFF);
+        *d++ = (uint8_t)(offset >> 8);
+        *token |= (uint8_t)((ml < 15) ? ml : 15);
+        if (ml >= 15) {
+            d = picoquic_lz_write_length(d, d_max, ml - 15);
+        }
+    }
+
+    return d;
+}
+
+size_t picoquic_lz_compress(const uint8_t* src, size_t src_length, uint8_t* dst, size_t dst_max)
+{
+    uint32_t table[1 << PICOQUIC_LZ_HASH_BITS];
+    const uint8_t* anchor = src;
+    const uint8_t* p = src;
+    const uint8_t* p_max = (src_length > PICOQUIC_LZ_LAST_LITERALS + PICOQUIC_LZ_MIN_MATCH) ?
+        src + src_length - PICOQUIC_LZ_LAST_LITERALS - PICOQUIC_LZ_MIN_MATCH : src;
+    const uint8_t* src_end = src + src_length;
+    uint8_t* d = dst;
+    const uint8_t* d_max = dst + dst_max;
+
+    /* Positions are stored plus one, so that zero means no entry */
+    memset(table, 0, sizeof(table));
+
+    while (d != NULL && p < p_max) {
+        uint32_t h = picoquic_lz_hash(p);
+        const uint8_t* candidate = (table[h] == 0) ? NULL : src + table[h] - 1;
+
+        table[h] = (uint32_t)(p - src) + 1;
+
+        if (candidate != NULL && (size_t)(p - candidate) <= PICOQUIC_LZ_MAX_OFFSET &&
+            memcmp(candidate, p, PICOQUIC_LZ_MIN_MATCH) == 0) {
+            const uint8_t* match_end = p + PICOQUIC_LZ_MIN_MATCH;
+            const uint8_t* c = candidate + PICOQUIC_LZ_MIN_MATCH;
+
+            while (match_end < src_end - PICOQUIC_LZ_LAST_LITERALS && *match_end == *c) {
+                match_end++;
+                c++;
+            }
+            d = picoquic_lz_write_sequence(d, d_max, anchor, (size_t)(p - anchor),
+                (size_t)(p - candidate), (size_t)(match_end - p));
+            p = match_end;
+            anchor = p;
+        }
+        else {
+            p++;
+        }
+    }
+
+    if (d != NULL) {
+        d = picoquic_lz_write_sequence(d, d_max, anchor, (size_t)(src_end - anchor), 0, 0);
+    }
+
+    return (d == NULL) ? 0 : (size_t)(d - dst);
+}
+
+static const uint8_t* picoquic_lz_read_length(const uint8_t* s, const uint8_t* s_max, size_t* length)
+{
+    uint8_t b;
+
+    do {
+        if (s >= s_max) {
+            return NULL;
+        }
+        b = *s++;
+        *length += b;
+    } while (b == 255);
+
+    return s;
+}
+
+int picoquic_lz_decompress(const uint8_t* src, size_t src_length, uint8_t* dst, size_t dst_length)
+{
+    const uint8_t* s = src;
+    const uint8_t* s_max = src + src_length;
+    uint8_t* d = dst;
+    uint8_t* d_max = dst + dst_length;
+
+    while (s != NULL && s < s_max) {
+        uint8_t token = *s++;
+        size_t nb_literals = token >> 4;
+        size_t match_length = token & 0x0F;
+        size_t offset;
+
+        if (nb_literals == 15) {
+            s = picoquic_lz_read_length(s, s_max, &nb_literals);
+        }
+        if (s == NULL || nb_literals > (size_t)(s_max - s) || nb_literals > (size_t)(d_max - d)) {
+            return -1;
+        }
+        memcpy(d, s, nb_literals);
+        d += nb_literals;
+        s += nb_literals;
+
+        if (s == s_max) {
+            /* Last sequence, only literals */
+            break;
+        }
+        if (s_max - s < 2) {
+            return -1;
+        }
+        offset = s[0] | (((size_t)s[1]) << 8);
+        s += 2;
+        if (match_length == 15) {
+            s = picoquic_lz_read_length(s, s_max, &match_length);
+            if (s == NULL) {
+                return -1;
+            }
+        }
+        match_length += PICOQUIC_LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(d - dst) || match_length > (size_t)(d_max - d)) {
+            return -1;
+        }
+        /* Byte by byte copy, since the match may overlap the output */
+        for (size_t i = 0; i < match_length; i++, d++) {
+            *d = *(d - offset);
+        }
+    }
+
+    return (d == d_max) ? 0 : -1;
+}
@@ -0,0 +1,85 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LOGCOMPRESS_H
+#define LOGCOMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary log format, version 2.
+ *
+ * The file starts with the same 16 bytes header as version 1, with the
+ * version set to 2. It is followed by a series of blocks, each starting
+ * with a block header:
+ *  - 4 bytes block type, "qblk" for records or "qidx" for the index,
+ *  - 4 bytes length of the decoded content,
+ *  - 4 bytes length of the stored content,
+ *  - 1 byte codec, none or LZ,
+ *  - 8 bytes base time of the records in the block.
+ *
+ * Records blocks contain a sequence of records, each encoded as:
+ *  - vint CID index in the block dictionary. If the index is equal to the
+ *    number of CIDs already in the dictionary, the CID follows and is added,
+ *  - vint time delta from the previous record, zigzag encoded, starting
+ *    from the base time of the block,
+ *  - vint length of the event, then the event type and content, as in
+ *    version 1 records.
+ * Blocks can thus be decoded independently of each other.
+ *
+ * When the log is closed, an index block lists for each CID the offsets of
+ * the blocks that contain its records. The file ends with the 8 bytes
+ * offset of the index block and the 4 bytes "qend". Logs that were not
+ * closed have no index, and are read sequentially.
+ */
+#define PICOQUIC_BINLOG_VERSION_1 0x01
+#define PICOQUIC_BINLOG_VERSION_2 0x02
+
+#define PICOQUIC_BINLOG_BLOCK_HEADER_SIZE 21
+#define PICOQUIC_BINLOG_BLOCK_RAW_MAX 0x10000
+#define PICOQUIC_BINLOG_BLOCK_CID_MAX 256
+#define PICOQUIC_BINLOG_TRAILER_SIZE 12
+
+#define PICOQUIC_BINLOG_CODEC_NONE 0
+#define PICOQUIC_BINLOG_CODEC_LZ 1
+
+/* LZ77 block codec, in the style of LZ4. Each sequence starts with a token
+ * giving the number of literals in the high nibble and the match length
+ * minus 4 in the low nibble, with 255-valued extension bytes when a nibble
+ * is 15. The literals follow, then a 2 bytes little endian match offset.
+ * The last sequence has only literals.
+ * Compression returns the compressed length, or 0 if the result would not
+ * fit in dst_max bytes. Decompression returns -1 if the input is malformed
+ * or does not decode to exactly dst_length bytes.
+ */
+size_t picoquic_lz_compress(const uint8_t* src, size_t src_length, uint8_t* dst, size_t dst_max);
+int picoquic_lz_decompress(const uint8_t* src, size_t src_length, uint8_t* dst, size_t dst_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOGCOMPRESS_H */
@@ -114,7 +114,7 @@ void picoquic_log_prefix_initial_cid64(FILE* F, uint64_t log_cnxid64)
     }
 }
 
-static void picoquic_log_address(FILE* F, struct sockaddr* addr_peer)
+void picoquic_log_address(FILE* F, struct sockaddr* addr_peer)
 {
     if (addr_peer->sa_family == AF_INET) {
         struct sockaddr_in* s4 = (struct sockaddr_in*)addr_peer;
@@ -1355,12 +1355,9 @@ void picoquic_log_frames(FILE* F, uint64_t cnx_id64, uint8_t* bytes, size_t leng
             break;
         case picoquic_frame_type_padding:
         case picoquic_frame_type_ping: {
-            int nb = 0;
+            int nb = (int)(picoquic_skip_repeated_bytes(bytes + byte_index, bytes + length) - (bytes + byte_index));
 
-            while (byte_index < length && bytes[byte_index] == frame_id) {
-                byte_index++;
-                nb++;
-            }
+            byte_index += nb;
 
             fprintf(F, "    %s, %d bytes\n", picoquic_log_frame_names(frame_id), nb);
             break;
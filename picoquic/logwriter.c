@@ -24,6 +24,7 @@
 */
 #include "logwriter.h"
 #include "bytestream.h"
+#include "logcompress.h"
 #include "tls_api.h"
 #include "picotls.h"
 
@@ -53,18 +54,21 @@ static const uint8_t* picoquic_log_length(const uint8_t* bytes, const uint8_t* b
     return len == 0 || *nsz != n64 ? NULL : bytes + len;
 }
 
-static void picoquic_binlog_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+/* Frames are logged with a length prefix. Frames that do not fit in the
+ * record buffer are not logged, so the record remains well formed. */
+static void picoquic_binlog_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     if (bytes != NULL && bytes_max != NULL) {
         size_t len = bytes_max - bytes;
-        uint8_t varlen[8];
-        size_t l_varlen = picoquic_varint_encode(varlen, 8, len);
-        fwrite(varlen, 1, l_varlen, f);
-        fwrite(bytes, 1, len, f);
+
+        if (bytestream_vint_len(len) + len <= bytestream_remain(msg)) {
+            (void)bytewrite_vint(msg, len);
+            (void)bytewrite_buffer(msg, bytes, len);
+        }
     }
 }
 
-static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_stream_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     uint8_t ftype = bytes[0];
@@ -93,7 +97,7 @@ static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, c
     }
 
     if (has_length) {
-        picoquic_binlog_frame(f, bytes_begin, bytes + extra_bytes);
+        picoquic_binlog_frame(msg, bytes_begin, bytes + extra_bytes);
     }
     else {
         uint8_t* log_next = log_buffer;
@@ -104,10 +108,10 @@ static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, c
         if ((log_next = picoquic_frames_varint_encode(log_next, log_buffer + 256, length)) != NULL) {
             memcpy(log_next, bytes, extra_bytes);
             log_next += extra_bytes;
-            picoquic_binlog_frame(f, log_buffer, log_next);
+            picoquic_binlog_frame(msg, log_buffer, log_next);
         }
         else {
-            picoquic_binlog_frame(f, log_buffer, log_buffer + l_head);
+            picoquic_binlog_frame(msg, log_buffer, log_buffer + l_head);
         }
     }
 
@@ -115,7 +119,7 @@ static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, c
     return bytes;
 }
 
-static const uint8_t* picoquic_log_ack_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_ack_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     uint8_t ftype = bytes[0];
@@ -140,11 +144,11 @@ static const uint8_t* picoquic_log_ack_frame(FILE* f, const uint8_t* bytes, cons
         bytes = picoquic_log_varint_skip(bytes, bytes_max);
     }
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_reset_stream_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_reset_stream_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t * bytes_begin = bytes;
 
@@ -153,11 +157,11 @@ static const uint8_t* picoquic_log_reset_stream_frame(FILE* f, const uint8_t* by
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_stop_sending_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_stop_sending_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -165,11 +169,11 @@ static const uint8_t* picoquic_log_stop_sending_frame(FILE* f, const uint8_t* by
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_close_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_close_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -180,11 +184,11 @@ static const uint8_t* picoquic_log_close_frame(FILE* f, const uint8_t* bytes, co
     bytes = picoquic_log_length(bytes, bytes_max, &length);
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_app_close_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_app_close_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -194,22 +198,22 @@ static const uint8_t* picoquic_log_app_close_frame(FILE* f, const uint8_t* bytes
     bytes = picoquic_log_length(bytes, bytes_max, &length);
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_max_data_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_max_data_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_max_stream_data_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_max_stream_data_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -217,33 +221,33 @@ static const uint8_t* picoquic_log_max_stream_data_frame(FILE* f, const uint8_t*
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_max_stream_id_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_max_stream_id_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_blocked_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_blocked_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_stream_blocked_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_stream_blocked_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -251,22 +255,22 @@ static const uint8_t* picoquic_log_stream_blocked_frame(FILE* f, const uint8_t*
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_streams_blocked_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_streams_blocked_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_new_connection_id_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_new_connection_id_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -279,22 +283,22 @@ static const uint8_t* picoquic_log_new_connection_id_frame(FILE* f, const uint8_
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, PICOQUIC_RESET_SECRET_SIZE);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_retire_connection_id_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_retire_connection_id_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_new_token_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_new_token_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -304,21 +308,21 @@ static const uint8_t* picoquic_log_new_token_frame(FILE* f, const uint8_t* bytes
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_path_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_path_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1 + 8);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_crypto_hs_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_crypto_hs_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -327,24 +331,24 @@ static const uint8_t* picoquic_log_crypto_hs_frame(FILE* f, const uint8_t* bytes
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_length(bytes, bytes_max, &length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
     return bytes;
 }
 
 
-static const uint8_t* picoquic_log_handshake_done_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_handshake_done_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_datagram_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_datagram_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     uint8_t ftype = bytes[0];
@@ -358,25 +362,25 @@ static const uint8_t* picoquic_log_datagram_frame(FILE* f, const uint8_t* bytes,
         length = bytes_max - bytes;
     }
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_time_stamp_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_time_stamp_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* frame type as varint */
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* time stamp as varint */
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
 
     return bytes;
 }
 
-static const uint8_t* picoquic_log_ack_frequency_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_ack_frequency_frame(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -385,24 +389,19 @@ static const uint8_t* picoquic_log_ack_frequency_frame(FILE* f, const uint8_t* b
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* Packet tolerance */
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* Max ACK delay */
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(msg, bytes_begin, bytes);
 
     return bytes;
 }
 
-static const uint8_t* picoquic_log_padding(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_padding(bytestream* msg, const uint8_t* bytes, const uint8_t* bytes_max)
 {
-    picoquic_binlog_frame(f, bytes, bytes + 1);
-
-    uint8_t ftype = bytes[0];
-    while (bytes < bytes_max && bytes[0] == ftype) {
-        bytes++;
-    }
+    picoquic_binlog_frame(msg, bytes, bytes + 1);
 
-    return bytes;
+    return picoquic_skip_repeated_bytes(bytes, bytes_max);
 }
 
-void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
+void picoquic_binlog_frames(bytestream* msg, const uint8_t* bytes, size_t length)
 {
     const uint8_t* bytes_max = bytes + length;
 
@@ -422,79 +421,79 @@ void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
         }
 
         if (PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
-            bytes = picoquic_log_stream_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_stream_frame(msg, bytes, bytes_max);
             continue;
         }
 
         switch (ftype) {
         case picoquic_frame_type_ack:
         case picoquic_frame_type_ack_ecn:
-            bytes = picoquic_log_ack_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_ack_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_retire_connection_id:
-            bytes = picoquic_log_retire_connection_id_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_retire_connection_id_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_padding:
         case picoquic_frame_type_ping:
-            bytes = picoquic_log_padding(f, bytes, bytes_max);
+            bytes = picoquic_log_padding(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_reset_stream:
-            bytes = picoquic_log_reset_stream_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_reset_stream_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_connection_close:
-            bytes = picoquic_log_close_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_close_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_application_close:
-            bytes = picoquic_log_app_close_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_app_close_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_max_data:
-            bytes = picoquic_log_max_data_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_max_data_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_max_stream_data:
-            bytes = picoquic_log_max_stream_data_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_max_stream_data_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_max_streams_bidir:
         case picoquic_frame_type_max_streams_unidir:
-            bytes = picoquic_log_max_stream_id_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_max_stream_id_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_data_blocked:
-            bytes = picoquic_log_blocked_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_blocked_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_stream_data_blocked:
-            bytes = picoquic_log_stream_blocked_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_stream_blocked_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_streams_blocked_bidir:
         case picoquic_frame_type_streams_blocked_unidir:
-            bytes = picoquic_log_streams_blocked_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_streams_blocked_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_new_connection_id:
-            bytes = picoquic_log_new_connection_id_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_new_connection_id_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_stop_sending:
-            bytes = picoquic_log_stop_sending_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_stop_sending_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_path_challenge:
         case picoquic_frame_type_path_response:
-            bytes = picoquic_log_path_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_path_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_crypto_hs:
-            bytes = picoquic_log_crypto_hs_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_crypto_hs_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_new_token:
-            bytes = picoquic_log_new_token_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_new_token_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_handshake_done:
-            bytes = picoquic_log_handshake_done_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_handshake_done_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_datagram:
         case picoquic_frame_type_datagram_l:
-            bytes = picoquic_log_datagram_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_datagram_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_ack_frequency:
-            bytes = picoquic_log_ack_frequency_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_ack_frequency_frame(msg, bytes, bytes_max);
             break;
         case picoquic_frame_type_time_stamp:
-            bytes = picoquic_log_time_stamp_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_time_stamp_frame(msg, bytes, bytes_max);
             break;
 
         default:
@@ -504,11 +503,766 @@ void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
     }
 }
 
-void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+/*
+ * Binary log records are queued in a ring buffer, drained by a background
+ * writer thread. The packet processing thread is the only producer and the
+ * writer thread the only consumer. The producer owns the head index and the
+ * consumer the tail index; each side reads the other index with acquire
+ * semantics and publishes its own with release semantics. Records are
+ * copied in the ring as a whole, with their length prefix, or dropped and
+ * counted if there is not enough space. The writer writes full blocks,
+ * aligned on the block size, and only writes the last partial block when
+ * a flush is requested or when the log is closed.
+ */
+#define PICOQUIC_BINLOG_BLOCK_SIZE 0x1000
+#define PICOQUIC_BINLOG_WAKE_THRESHOLD 0x10000
+#define PICOQUIC_BINLOG_WRITER_WAIT 10000 /* 10 ms */
+
+typedef struct st_picoquic_binlog_v2_t picoquic_binlog_v2_t;
+typedef struct st_picoquic_binlog_sink_t picoquic_binlog_sink_t;
+
+#ifdef _WINDOWS
+static uint64_t binlog_ring_load(volatile uint64_t* x)
+{
+    uint64_t v = *x;
+    MemoryBarrier();
+    return v;
+}
+
+static void binlog_ring_store(volatile uint64_t* x, uint64_t v)
+{
+    MemoryBarrier();
+    *x = v;
+}
+#else
+static uint64_t binlog_ring_load(volatile uint64_t* x)
+{
+    return __atomic_load_n(x, __ATOMIC_ACQUIRE);
+}
+
+static void binlog_ring_store(volatile uint64_t* x, uint64_t v)
+{
+    __atomic_store_n(x, v, __ATOMIC_RELEASE);
+}
+#endif
+
+struct st_picoquic_binlog_ring_t {
+    volatile uint64_t head;
+    uint8_t head_pad[56];
+    volatile uint64_t tail;
+    uint8_t tail_pad[56];
+    volatile uint64_t nb_dropped;
+    volatile uint64_t flush_requested;
+    volatile uint64_t is_closing;
+    size_t ring_size;
+    uint8_t* buffer;
+    FILE* f;
+    picoquic_binlog_v2_t* v2;
+    picoquic_binlog_sink_t* sink;
+    picoquic_thread_t writer_thread;
+    picoquic_event_t writer_event;
+};
+
+/*
+ * The records read from the ring can be split across several chunks. The
+ * splitter reassembles them and passes each complete record, without its
+ * length prefix, to the record function.
+ */
+typedef struct st_picoquic_binlog_splitter_t {
+    uint8_t pending[4 + BYTESTREAM_MAX_BUFFER_SIZE];
+    size_t pending_length;
+} picoquic_binlog_splitter_t;
+
+static void binlog_split_records(picoquic_binlog_splitter_t* splitter, const uint8_t* bytes, size_t length,
+    void (*record_fn)(void* record_ctx, const uint8_t* record, size_t record_length), void* record_ctx)
+{
+    while (length > 0) {
+        size_t needed = 4;
+        size_t copied;
+
+        if (splitter->pending_length == 0 && length >= 4 && length >= 4 + (size_t)PICOPARSE_32(bytes)) {
+            /* Complete record, no need to copy it */
+            size_t record_length = PICOPARSE_32(bytes);
+            record_fn(record_ctx, bytes + 4, record_length);
+            bytes += 4 + record_length;
+            length -= 4 + record_length;
+            continue;
+        }
+
+        if (splitter->pending_length >= 4) {
+            needed += PICOPARSE_32(splitter->pending);
+            if (needed > sizeof(splitter->pending)) {
+                /* Records are never that long: the stream is corrupted */
+                splitter->pending_length = 0;
+                return;
+            }
+        }
+        copied = needed - splitter->pending_length;
+        if (copied > length) {
+            copied = length;
+        }
+        memcpy(splitter->pending + splitter->pending_length, bytes, copied);
+        splitter->pending_length += copied;
+        bytes += copied;
+        length -= copied;
+
+        if (splitter->pending_length > 4 && splitter->pending_length == 4 + PICOPARSE_32(splitter->pending)) {
+            record_fn(record_ctx, splitter->pending + 4, splitter->pending_length - 4);
+            splitter->pending_length = 0;
+        }
+    }
+}
+
+/*
+ * Records can also be passed to an application provided sink, see
+ * picoquic_set_binlog_sink().
+ */
+struct st_picoquic_binlog_sink_t {
+    picoquic_binlog_sink_fn sink_fn;
+    void* sink_ctx;
+    picoquic_binlog_splitter_t splitter;
+};
+
+/*
+ * Version 2 encoding of the binary log, see logcompress.h.
+ * The encoder receives the same length prefixed records as the version 1
+ * file, possibly split across several chunks when they are read from the
+ * ring buffer, and assembles them in blocks. It runs in the writer thread,
+ * or in the packet processing thread if there is no ring.
+ */
+typedef struct st_picoquic_binlog_index_t {
+    picoquic_connection_id_t cid;
+    size_t nb_blocks;
+    size_t nb_alloc;
+    uint64_t* block_offsets;
+} picoquic_binlog_index_t;
+
+struct st_picoquic_binlog_v2_t {
+    FILE* f;
+    uint64_t file_offset;
+    /* Record received in several chunks */
+    picoquic_binlog_splitter_t splitter;
+    /* Block being assembled, and its CID dictionary */
+    uint8_t raw[PICOQUIC_BINLOG_BLOCK_RAW_MAX];
+    size_t raw_length;
+    uint64_t base_time;
+    uint64_t last_time;
+    size_t nb_cids;
+    picoquic_binlog_index_t* cids[PICOQUIC_BINLOG_BLOCK_CID_MAX];
+    uint8_t stored[PICOQUIC_BINLOG_BLOCK_HEADER_SIZE + PICOQUIC_BINLOG_BLOCK_RAW_MAX];
+    /* Block offsets per CID */
+    picohash_table* index;
+};
+
+static uint64_t binlog_index_hash(const void* key)
+{
+    return picoquic_connection_id_hash(&((const picoquic_binlog_index_t*)key)->cid);
+}
+
+static int binlog_index_compare(const void* key0, const void* key1)
+{
+    return picoquic_compare_connection_id(&((const picoquic_binlog_index_t*)key0)->cid,
+        &((const picoquic_binlog_index_t*)key1)->cid);
+}
+
+static picoquic_binlog_v2_t* binlog_v2_create(FILE* f)
+{
+    picoquic_binlog_v2_t* v2 = (picoquic_binlog_v2_t*)malloc(sizeof(picoquic_binlog_v2_t));
+
+    if (v2 != NULL) {
+        memset(v2, 0, sizeof(picoquic_binlog_v2_t));
+        v2->f = f;
+        v2->file_offset = 16;
+        v2->index = picohash_create(1024, binlog_index_hash, binlog_index_compare);
+        if (v2->index == NULL) {
+            free(v2);
+            v2 = NULL;
+        }
+    }
+
+    return v2;
+}
+
+static void binlog_v2_write_block(picoquic_binlog_v2_t* v2, uint32_t block_type, const uint8_t* content,
+    size_t raw_length, size_t stored_length, uint8_t codec, uint64_t base_time)
+{
+    uint8_t header[PICOQUIC_BINLOG_BLOCK_HEADER_SIZE];
+
+    picoformat_32(header, block_type);
+    picoformat_32(header + 4, (uint32_t)raw_length);
+    picoformat_32(header + 8, (uint32_t)stored_length);
+    header[12] = codec;
+    picoformat_64(header + 13, base_time);
+
+    (void)fwrite(header, sizeof(header), 1, v2->f);
+    if (stored_length > 0) {
+        (void)fwrite(content, stored_length, 1, v2->f);
+    }
+    v2->file_offset += sizeof(header) + stored_length;
+}
+
+static void binlog_v2_flush_block(picoquic_binlog_v2_t* v2)
+{
+    if (v2->raw_length > 0) {
+        size_t stored_length = picoquic_lz_compress(v2->raw, v2->raw_length, v2->stored, v2->raw_length);
+
+        if (stored_length == 0) {
+            binlog_v2_write_block(v2, FOURCC('q', 'b', 'l', 'k'), v2->raw, v2->raw_length,
+                v2->raw_length, PICOQUIC_BINLOG_CODEC_NONE, v2->base_time);
+        }
+        else {
+            binlog_v2_write_block(v2, FOURCC('q', 'b', 'l', 'k'), v2->stored, v2->raw_length,
+                stored_length, PICOQUIC_BINLOG_CODEC_LZ, v2->base_time);
+        }
+        v2->raw_length = 0;
+        v2->nb_cids = 0;
+    }
+}
+
+/* Find the CID in the block dictionary, or add it and note that the
+ * current block contains records for that CID. */
+static int binlog_v2_cid_index(picoquic_binlog_v2_t* v2, const picoquic_connection_id_t* cid, size_t* cid_index)
+{
+    picoquic_binlog_index_t key;
+    picoquic_binlog_index_t* entry;
+    picohash_item* item;
+
+    for (size_t i = 0; i < v2->nb_cids; i++) {
+        if (picoquic_compare_connection_id(cid, &v2->cids[i]->cid) == 0) {
+            *cid_index = i;
+            return 0;
+        }
+    }
+
+    key.cid = *cid;
+    item = picohash_retrieve(v2->index, &key);
+    if (item != NULL) {
+        entry = (picoquic_binlog_index_t*)item->key;
+    }
+    else if ((entry = (picoquic_binlog_index_t*)malloc(sizeof(picoquic_binlog_index_t))) == NULL) {
+        return -1;
+    }
+    else {
+        memset(entry, 0, sizeof(picoquic_binlog_index_t));
+        entry->cid = *cid;
+        if (picohash_insert(v2->index, entry) != 0) {
+            free(entry);
+            return -1;
+        }
+    }
+
+    if (entry->nb_blocks >= entry->nb_alloc) {
+        size_t nb_alloc = (entry->nb_alloc == 0) ? 4 : 2 * entry->nb_alloc;
+        uint64_t* offsets = (uint64_t*)realloc(entry->block_offsets, nb_alloc * sizeof(uint64_t));
+
+        if (offsets == NULL) {
+            return -1;
+        }
+        entry->block_offsets = offsets;
+        entry->nb_alloc = nb_alloc;
+    }
+    /* The block will be written at the current end of file */
+    entry->block_offsets[entry->nb_blocks++] = v2->file_offset;
+
+    *cid_index = v2->nb_cids;
+    v2->cids[v2->nb_cids++] = entry;
+
+    return 0;
+}
+
+static void binlog_v2_add_record(void* v2_ctx, const uint8_t* record, size_t length)
+{
+    picoquic_binlog_v2_t* v2 = (picoquic_binlog_v2_t*)v2_ctx;
+    bytestream stream;
+    bytestream* s = bytestream_ref_init(&stream, record, length);
+    picoquic_connection_id_t cid;
+    uint64_t time_stamp = 0;
+    size_t rest_length;
+    size_t cid_index = 0;
+    size_t known_cids;
+    int64_t delta;
+    uint8_t* bytes;
+    uint8_t* bytes_max;
+
+    if (byteread_cid(s, &cid) != 0 || byteread_vint(s, &time_stamp) != 0) {
+        /* Not a valid record */
+        return;
+    }
+    rest_length = bytestream_remain(s);
+
+    /* Start a new block if the record might not fit, or if the dictionary is full */
+    if (v2->raw_length + 3 * 8 + 1 + PICOQUIC_CONNECTION_ID_MAX_SIZE + rest_length > PICOQUIC_BINLOG_BLOCK_RAW_MAX ||
+        v2->nb_cids >= PICOQUIC_BINLOG_BLOCK_CID_MAX) {
+        binlog_v2_flush_block(v2);
+    }
+    if (v2->raw_length == 0) {
+        v2->base_time = time_stamp;
+        v2->last_time = time_stamp;
+    }
+
+    known_cids = v2->nb_cids;
+    if (binlog_v2_cid_index(v2, &cid, &cid_index) != 0) {
+        return;
+    }
+
+    bytes = v2->raw + v2->raw_length;
+    bytes_max = v2->raw + PICOQUIC_BINLOG_BLOCK_RAW_MAX;
+    bytes += picoquic_varint_encode(bytes, bytes_max - bytes, cid_index);
+    if (cid_index == known_cids) {
+        *bytes++ = cid.id_len;
+        memcpy(bytes, cid.id, cid.id_len);
+        bytes += cid.id_len;
+    }
+    delta = (int64_t)(time_stamp - v2->last_time);
+    bytes += picoquic_varint_encode(bytes, bytes_max - bytes, (((uint64_t)delta) << 1) ^ (uint64_t)(delta >> 63));
+    bytes += picoquic_varint_encode(bytes, bytes_max - bytes, rest_length);
+    memcpy(bytes, bytestream_ptr(s), rest_length);
+    bytes += rest_length;
+
+    v2->raw_length = bytes - v2->raw;
+    v2->last_time = time_stamp;
+}
+
+/* Accept a series of length prefixed records, possibly split in several chunks */
+static void binlog_v2_write(picoquic_binlog_v2_t* v2, const uint8_t* bytes, size_t length)
+{
+    binlog_split_records(&v2->splitter, bytes, length, binlog_v2_add_record, v2);
+}
+
+/* Write the last block, the index and the trailer, then free the encoder */
+static void binlog_v2_close(picoquic_binlog_v2_t* v2)
+{
+    size_t index_size = 8;
+    uint8_t* index_bytes;
+    uint64_t index_offset;
+
+    binlog_v2_flush_block(v2);
+
+    for (size_t i = 0; i < v2->index->nb_bin; i++) {
+        for (picohash_item* item = v2->index->hash_bin[i]; item != NULL; item = item->next_in_bin) {
+            picoquic_binlog_index_t* entry = (picoquic_binlog_index_t*)item->key;
+            index_size += 1 + entry->cid.id_len + 8 + 8 * entry->nb_blocks;
+        }
+    }
+
+    index_offset = v2->file_offset;
+    index_bytes = (uint8_t*)malloc(index_size);
+    if (index_bytes != NULL) {
+        uint8_t* bytes = index_bytes;
+        uint8_t* bytes_max = index_bytes + index_size;
+        uint8_t trailer[PICOQUIC_BINLOG_TRAILER_SIZE];
+
+        bytes += picoquic_varint_encode(bytes, bytes_max - bytes, v2->index->count);
+        for (size_t i = 0; i < v2->index->nb_bin; i++) {
+            for (picohash_item* item = v2->index->hash_bin[i]; item != NULL; item = item->next_in_bin) {
+                picoquic_binlog_index_t* entry = (picoquic_binlog_index_t*)item->key;
+                uint64_t previous = 0;
+
+                *bytes++ = entry->cid.id_len;
+                memcpy(bytes, entry->cid.id, entry->cid.id_len);
+                bytes += entry->cid.id_len;
+                bytes += picoquic_varint_encode(bytes, bytes_max - bytes, entry->nb_blocks);
+                for (size_t j = 0; j < entry->nb_blocks; j++) {
+                    bytes += picoquic_varint_encode(bytes, bytes_max - bytes, entry->block_offsets[j] - previous);
+                    previous = entry->block_offsets[j];
+                }
+            }
+        }
+        binlog_v2_write_block(v2, FOURCC('q', 'i', 'd', 'x'), index_bytes, bytes - index_bytes,
+            bytes - index_bytes, PICOQUIC_BINLOG_CODEC_NONE, 0);
+        free(index_bytes);
+
+        picoformat_64(trailer, index_offset);
+        picoformat_32(trailer + 8, FOURCC('q', 'e', 'n', 'd'));
+        (void)fwrite(trailer, sizeof(trailer), 1, v2->f);
+    }
+
+    for (size_t i = 0; i < v2->index->nb_bin; i++) {
+        for (picohash_item* item = v2->index->hash_bin[i]; item != NULL; item = item->next_in_bin) {
+            free(((picoquic_binlog_index_t*)item->key)->block_offsets);
+        }
+    }
+    picohash_delete(v2->index, 1);
+    free(v2);
+}
+
+picoquic_binlog_ring_t* binlog_ring_create(size_t ring_size)
+{
+    picoquic_binlog_ring_t* ring = (picoquic_binlog_ring_t*)malloc(sizeof(picoquic_binlog_ring_t));
+    size_t size = PICOQUIC_BINLOG_BLOCK_SIZE;
+
+    /* Use a power of 2, at least one block */
+    while (size < ring_size) {
+        size <<= 1;
+    }
+
+    if (ring != NULL) {
+        memset(ring, 0, sizeof(picoquic_binlog_ring_t));
+        ring->ring_size = size;
+        ring->buffer = (uint8_t*)malloc(size);
+        if (ring->buffer == NULL) {
+            free(ring);
+            ring = NULL;
+        }
+    }
+
+    return ring;
+}
+
+void binlog_ring_delete(picoquic_binlog_ring_t* ring)
+{
+    if (ring != NULL) {
+        free(ring->buffer);
+        free(ring);
+    }
+}
+
+int binlog_ring_push(picoquic_binlog_ring_t* ring, const uint8_t* bytes, size_t length)
+{
+    int ret = 0;
+    uint64_t head = ring->head;
+    uint64_t tail = binlog_ring_load(&ring->tail);
+
+    if (length > ring->ring_size - (size_t)(head - tail)) {
+        binlog_ring_store(&ring->nb_dropped, ring->nb_dropped + 1);
+        ret = -1;
+    }
+    else {
+        size_t offset = (size_t)(head & (ring->ring_size - 1));
+        size_t first = ring->ring_size - offset;
+
+        if (first > length) {
+            first = length;
+        }
+        memcpy(ring->buffer + offset, bytes, first);
+        if (first < length) {
+            memcpy(ring->buffer, bytes + first, length - first);
+        }
+        binlog_ring_store(&ring->head, head + length);
+    }
+
+    return ret;
+}
+
+/* Return the contiguous span that the writer can write. Unless flushing,
+ * the span ends at a block boundary. */
+size_t binlog_ring_peek(picoquic_binlog_ring_t* ring, const uint8_t** bytes, int flush)
+{
+    uint64_t tail = ring->tail;
+    uint64_t head = binlog_ring_load(&ring->head);
+    size_t offset = (size_t)(tail & (ring->ring_size - 1));
+    size_t length;
+
+    if (!flush) {
+        head &= ~((uint64_t)PICOQUIC_BINLOG_BLOCK_SIZE - 1);
+    }
+    length = (head > tail) ? (size_t)(head - tail) : 0;
+    if (length > ring->ring_size - offset) {
+        length = ring->ring_size - offset;
+    }
+    *bytes = ring->buffer + offset;
+
+    return length;
+}
+
+void binlog_ring_release(picoquic_binlog_ring_t* ring, size_t length)
+{
+    binlog_ring_store(&ring->tail, ring->tail + length);
+}
+
+uint64_t binlog_ring_dropped(picoquic_binlog_ring_t* ring)
+{
+    return (ring == NULL) ? 0 : binlog_ring_load(&ring->nb_dropped);
+}
+
+static void binlog_ring_drain(picoquic_binlog_ring_t* ring, int flush)
+{
+    const uint8_t* bytes;
+    size_t length;
+
+    while ((length = binlog_ring_peek(ring, &bytes, flush)) > 0) {
+        if (ring->v2 != NULL) {
+            binlog_v2_write(ring->v2, bytes, length);
+        }
+        else if (ring->f != NULL) {
+            (void)fwrite(bytes, 1, length, ring->f);
+        }
+        if (ring->sink != NULL) {
+            binlog_split_records(&ring->sink->splitter, bytes, length, ring->sink->sink_fn, ring->sink->sink_ctx);
+        }
+        binlog_ring_release(ring, length);
+    }
+    if (flush && ring->f != NULL) {
+        (void)fflush(ring->f);
+    }
+}
+
+static picoquic_thread_return_t binlog_writer_thread(void* arg)
+{
+    picoquic_binlog_ring_t* ring = (picoquic_binlog_ring_t*)arg;
+
+    while (!binlog_ring_load(&ring->is_closing)) {
+        (void)picoquic_wait_for_event(&ring->writer_event, PICOQUIC_BINLOG_WRITER_WAIT);
+        if (binlog_ring_load(&ring->flush_requested)) {
+            binlog_ring_store(&ring->flush_requested, 0);
+            binlog_ring_drain(ring, 1);
+        }
+        else {
+            binlog_ring_drain(ring, 0);
+        }
+    }
+    /* Write everything that was queued before closing */
+    binlog_ring_drain(ring, 1);
+
+    picoquic_thread_do_return;
+}
+
+/* Queue a complete record, or write it directly if there is no ring.
+ * The writer is woken up when the amount of queued data crosses the
+ * threshold; otherwise it polls the ring periodically. */
+static void binlog_write_bytes(picoquic_quic_t* quic, const uint8_t* bytes, size_t length)
+{
+    picoquic_binlog_ring_t* ring = quic->binlog_ring;
+
+    if (ring == NULL) {
+        if (quic->binlog_v2 != NULL) {
+            binlog_v2_write(quic->binlog_v2, bytes, length);
+        }
+        else if (quic->f_binlog != NULL) {
+            (void)fwrite(bytes, length, 1, quic->f_binlog);
+        }
+        if (quic->binlog_sink != NULL) {
+            /* Records are always complete when written directly */
+            quic->binlog_sink->sink_fn(quic->binlog_sink->sink_ctx, bytes + 4, length - 4);
+        }
+    }
+    else {
+        size_t queued = (size_t)(ring->head - binlog_ring_load(&ring->tail));
+
+        if (binlog_ring_push(ring, bytes, length) == 0 &&
+            queued < PICOQUIC_BINLOG_WAKE_THRESHOLD &&
+            queued + length >= PICOQUIC_BINLOG_WAKE_THRESHOLD) {
+            (void)picoquic_signal_event(&ring->writer_event);
+        }
+    }
+}
+
+static void binlog_write_record(picoquic_quic_t* quic, bytestream* msg)
+{
+    /* write the record length at the reserved spot */
+    picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
+    binlog_write_bytes(quic, bytestream_data(msg), bytestream_length(msg));
+}
+
+static void binlog_flush(picoquic_quic_t* quic)
+{
+    if (quic->binlog_ring == NULL) {
+        if (quic->f_binlog != NULL) {
+            (void)fflush(quic->f_binlog);
+        }
+    }
+    else {
+        binlog_ring_store(&quic->binlog_ring->flush_requested, 1);
+        (void)picoquic_signal_event(&quic->binlog_ring->writer_event);
+    }
+}
+
+/* All records start with a 32 bit length, filled when the record is written */
+static bytestream* binlog_record_init(bytestream_buf* stream_msg)
+{
+    bytestream* msg = bytestream_buf_init(stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    bytewrite_int32(msg, 0);
+    return msg;
+}
+
+/*
+ * Per connection logging policy.
+ * The records of connections that are not logged can be retained in a
+ * small ring, so that the events leading to an anomaly can be logged
+ * after the fact when a trigger fires.
+ */
+typedef struct st_picoquic_binlog_retro_record_t {
+    uint8_t* bytes;
+    size_t length;
+    size_t alloc;
+} picoquic_binlog_retro_record_t;
+
+typedef struct st_picoquic_binlog_retro_t {
+    size_t nb_slots;
+    size_t nb_used;
+    size_t next;
+    picoquic_binlog_retro_record_t* records;
+} picoquic_binlog_retro_t;
+
+static picoquic_binlog_retro_t* binlog_retro_create(size_t nb_slots)
+{
+    picoquic_binlog_retro_t* retro = (picoquic_binlog_retro_t*)malloc(sizeof(picoquic_binlog_retro_t));
+
+    if (retro != NULL) {
+        memset(retro, 0, sizeof(picoquic_binlog_retro_t));
+        retro->records = (picoquic_binlog_retro_record_t*)malloc(nb_slots * sizeof(picoquic_binlog_retro_record_t));
+        if (retro->records == NULL) {
+            free(retro);
+            retro = NULL;
+        }
+        else {
+            memset(retro->records, 0, nb_slots * sizeof(picoquic_binlog_retro_record_t));
+            retro->nb_slots = nb_slots;
+        }
+    }
+
+    return retro;
+}
+
+static void binlog_retro_delete(picoquic_cnx_t* cnx)
+{
+    picoquic_binlog_retro_t* retro = cnx->binlog_retro;
+
+    if (retro != NULL) {
+        for (size_t i = 0; i < retro->nb_slots; i++) {
+            free(retro->records[i].bytes);
+        }
+        free(retro->records);
+        free(retro);
+        cnx->binlog_retro = NULL;
+    }
+}
+
+/* Keep the record, overwriting the oldest one if the ring is full */
+static void binlog_retro_push(picoquic_cnx_t* cnx, bytestream* msg)
+{
+    picoquic_binlog_retro_record_t* record;
+    size_t length = bytestream_length(msg);
+
+    if (cnx->binlog_retro == NULL &&
+        (cnx->binlog_retro = binlog_retro_create(cnx->quic->binlog_retro_depth)) == NULL) {
+        return;
+    }
+
+    record = &cnx->binlog_retro->records[cnx->binlog_retro->next];
+    if (record->alloc < length) {
+        uint8_t* bytes = (uint8_t*)realloc(record->bytes, length);
+        if (bytes == NULL) {
+            return;
+        }
+        record->bytes = bytes;
+        record->alloc = length;
+    }
+    memcpy(record->bytes, bytestream_data(msg), length);
+    record->length = length;
+
+    cnx->binlog_retro->next = (cnx->binlog_retro->next + 1) % cnx->binlog_retro->nb_slots;
+    if (cnx->binlog_retro->nb_used < cnx->binlog_retro->nb_slots) {
+        cnx->binlog_retro->nb_used++;
+    }
+}
+
+/* Write the retained records, oldest first */
+static void binlog_retro_flush(picoquic_cnx_t* cnx)
+{
+    picoquic_binlog_retro_t* retro = cnx->binlog_retro;
+
+    if (retro != NULL) {
+        size_t index = (retro->next + retro->nb_slots - retro->nb_used) % retro->nb_slots;
+
+        for (size_t i = 0; i < retro->nb_used; i++) {
+            binlog_write_bytes(cnx->quic, retro->records[index].bytes, retro->records[index].length);
+            index = (index + 1) % retro->nb_slots;
+        }
+        binlog_retro_delete(cnx);
+    }
+}
+
+/* Whether the packet records of the connection are written to the log */
+int binlog_cnx_is_on(picoquic_cnx_t* cnx)
+{
+    return cnx->binlog_mode == picoquic_binlog_mode_full ||
+        (cnx->binlog_mode == picoquic_binlog_mode_first_packets &&
+        (cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE ||
+            cnx->quic->use_long_log));
+}
+
+/* Whether the packet records of the connection are written or retained */
+int binlog_cnx_is_wanted(picoquic_cnx_t* cnx)
+{
+    return binlog_cnx_is_on(cnx) || cnx->quic->binlog_retro_depth > 0;
+}
+
+/* Write the record of a connection, or retain it if the connection is not logged.
+ * Records that are not attached to a connection are always written. */
+static void binlog_write_cnx_record(picoquic_quic_t* quic, picoquic_cnx_t* cnx, bytestream* msg, int is_on)
+{
+    if (cnx == NULL || is_on) {
+        binlog_write_record(quic, msg);
+    }
+    else if (quic->binlog_retro_depth > 0) {
+        picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
+        binlog_retro_push(cnx, msg);
+    }
+}
+
+static int binlog_match_prefix(const picoquic_binlog_prefix_t* prefix, const struct sockaddr* addr)
+{
+    const uint8_t* a1;
+    const uint8_t* a2;
+    int nb_bits = prefix->prefix_bits;
+    int ret = 0;
+
+    if (addr->sa_family == prefix->addr.ss_family) {
+        if (addr->sa_family == AF_INET) {
+            a1 = (const uint8_t*)&((const struct sockaddr_in*)addr)->sin_addr;
+            a2 = (const uint8_t*)&((const struct sockaddr_in*)&prefix->addr)->sin_addr;
+        }
+        else {
+            a1 = (const uint8_t*)&((const struct sockaddr_in6*)addr)->sin6_addr;
+            a2 = (const uint8_t*)&((const struct sockaddr_in6*)&prefix->addr)->sin6_addr;
+        }
+        ret = 1;
+        while (ret && nb_bits >= 8) {
+            ret = (*a1++ == *a2++);
+            nb_bits -= 8;
+        }
+        if (ret && nb_bits > 0) {
+            uint8_t mask = (uint8_t)(0xFF << (8 - nb_bits));
+            ret = ((*a1 & mask) == (*a2 & mask));
+        }
+    }
+
+    return ret;
+}
+
+/* Apply the logging policy of the QUIC context to a new connection */
+void binlog_select_connection(picoquic_cnx_t* cnx)
+{
+    picoquic_quic_t* quic = cnx->quic;
+    picoquic_binlog_mode_enum mode = picoquic_binlog_mode_first_packets;
+
+    if (quic->binlog_sample_one_in > 1 || quic->binlog_nb_cid > 0 || quic->binlog_nb_prefix > 0) {
+        /* Mix the CID bits so that sampling does not depend on the CID structure */
+        uint64_t h = picoquic_val64_connection_id(cnx->initial_cnxid) * 0x9E3779B97F4A7C15ull;
+
+        if (quic->binlog_sample_one_in <= 1 || ((h >> 32) % quic->binlog_sample_one_in) != 0) {
+            mode = picoquic_binlog_mode_off;
+        }
+        for (size_t i = 0; mode != picoquic_binlog_mode_full && i < quic->binlog_nb_cid; i++) {
+            if (picoquic_compare_connection_id(&cnx->initial_cnxid, &quic->binlog_cid_list[i]) == 0) {
+                mode = picoquic_binlog_mode_full;
+            }
+        }
+        for (size_t i = 0; mode != picoquic_binlog_mode_full && i < quic->binlog_nb_prefix; i++) {
+            if (binlog_match_prefix(&quic->binlog_prefix_list[i], (struct sockaddr*)&cnx->path[0]->peer_addr)) {
+                mode = picoquic_binlog_mode_full;
+            }
+        }
+    }
+    cnx->binlog_mode = mode;
+}
+
+void binlog_pdu(picoquic_quic_t* quic, picoquic_cnx_t* cnx, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
     const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
 {
     bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    bytestream* msg = binlog_record_init(&stream_msg);
 
     /* Common chunk header */
     bytewrite_cid(msg, cid);
@@ -520,23 +1274,14 @@ void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uin
     bytewrite_vint(msg, packet_length);
     bytewrite_addr(msg, addr_local);
 
-    uint8_t head[4] = { 0 };
-    picoformat_32(head, (uint32_t)bytestream_length(msg));
-
-    (void)fwrite(head, sizeof(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_cnx_record(quic, cnx, msg, cnx == NULL || binlog_cnx_is_on(cnx));
 }
 
-void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+void binlog_packet(picoquic_quic_t* quic, picoquic_cnx_t* cnx, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
     const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
 {
-    long fpos0 = ftell(f);
-
-    uint8_t head[4] = { 0 };
-    (void)fwrite(head, 4, 1, f);
-
     bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    bytestream* msg = binlog_record_init(&stream_msg);
 
     /* Common chunk header */
     bytewrite_cid(msg, cid);
@@ -565,82 +1310,63 @@ void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, int receiving,
         bytewrite_buffer(msg, ph->token_bytes, ph->token_length);
     }
 
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
-
     /* frame information */
     if (ph->ptype == picoquic_packet_version_negotiation || ph->ptype == picoquic_packet_retry) {
-        picoquic_binlog_frame(f, bytes + ph->offset, bytes + bytes_max);
+        picoquic_binlog_frame(msg, bytes + ph->offset, bytes + bytes_max);
     }
     else if (ph->ptype != picoquic_packet_error) {
-        picoquic_binlog_frames(f, bytes + ph->offset, ph->payload_length);
+        picoquic_binlog_frames(msg, bytes + ph->offset, ph->payload_length);
     }
 
-    /* re-write chunk size field */
-    long fpos1 = ftell(f);
-
-    picoformat_32(head, (uint32_t)(fpos1 - fpos0 - 4));
-
-    (void)fseek(f, fpos0, SEEK_SET);
-    (void)fwrite(head, 4, 1, f);
-    (void)fseek(f, 0, SEEK_END);
+    binlog_write_cnx_record(quic, cnx, msg, cnx == NULL || binlog_cnx_is_on(cnx));
 }
 
-void binlog_outgoing_packet(FILE * f, picoquic_cnx_t* cnx,
-    uint8_t * bytes, uint64_t sequence_number, size_t pn_length, size_t length,
-    uint8_t* send_buffer, size_t send_length, uint64_t current_time)
+/* The header of outgoing packets is documented from the values used to
+ * build it, instead of parsing the header bytes again. The header is in
+ * clear text at this stage: only the first byte and the version are read.
+ */
+void binlog_outgoing_packet(picoquic_cnx_t* cnx, picoquic_packet_type_enum ptype,
+    const picoquic_connection_id_t* remote_cnxid, const picoquic_connection_id_t* local_cnxid,
+    uint8_t* bytes, uint64_t sequence_number, size_t header_length, size_t length,
+    const uint8_t* send_buffer, uint64_t current_time)
 {
-    picoquic_cnx_t* pcnx = cnx;
     picoquic_packet_header ph;
-    size_t checksum_length = 16;
-    struct sockaddr_in default_addr;
-
-    const picoquic_connection_id_t * cnxid = (cnx != NULL) ? &cnx->initial_cnxid : &picoquic_null_connection_id;
-
-    memset(&default_addr, 0, sizeof(struct sockaddr_in));
-    default_addr.sin_family = AF_INET;
-
-    picoquic_parse_packet_header((cnx == NULL) ? NULL : cnx->quic, send_buffer, send_length,
-        ((cnx == NULL || cnx->path[0] == NULL) ? (struct sockaddr *)&default_addr :
-        (struct sockaddr *)&cnx->path[0]->local_addr), &ph, &pcnx, 0);
-
-    if (cnx != NULL) {
-        picoquic_epoch_enum epoch = (ph.ptype == picoquic_packet_1rtt_protected) ? picoquic_epoch_1rtt :
-            ((ph.ptype == picoquic_packet_0rtt_protected) ? picoquic_epoch_0rtt :
-            ((ph.ptype == picoquic_packet_handshake) ? picoquic_epoch_handshake : picoquic_epoch_initial));
-        if (cnx->crypto_context[epoch].aead_encrypt != NULL) {
-            checksum_length = picoquic_get_checksum_length(cnx, epoch);
-        }
-    }
 
+    memset(&ph, 0, sizeof(ph));
+    ph.ptype = ptype;
     ph.pn64 = sequence_number;
-    ph.pn = (uint32_t)ph.pn64;
-    if (ph.ptype != picoquic_packet_retry) {
-        if (ph.pn_offset != 0) {
-            ph.offset = ph.pn_offset + pn_length; /* todo: should provide the actual length */
-            ph.payload_length -= pn_length;
-        }
+    ph.pn = (uint32_t)sequence_number;
+    ph.offset = header_length;
+    ph.payload_length = (uint16_t)((length > header_length) ? length - header_length : 0);
+
+    if (ptype == picoquic_packet_1rtt_protected) {
+        ph.dest_cnx_id = *remote_cnxid;
+        ph.spin = (send_buffer[0] >> 5) & 1;
+        ph.key_phase = (send_buffer[0] >> 2) & 1;
     }
-    if (ph.ptype != picoquic_packet_version_negotiation) {
-        if (ph.payload_length > checksum_length) {
-            ph.payload_length -= (uint16_t)checksum_length;
-        }
-        else {
-            ph.payload_length = 0;
+    else {
+        ph.dest_cnx_id = (cnx->client_mode && (ptype == picoquic_packet_initial ||
+            ptype == picoquic_packet_0rtt_protected) && picoquic_is_connection_id_null(remote_cnxid)) ?
+            cnx->initial_cnxid : *remote_cnxid;
+        ph.srce_cnx_id = *local_cnxid;
+        ph.vn = PICOPARSE_32(send_buffer + 1);
+        if (ptype == picoquic_packet_initial) {
+            ph.token_length = cnx->retry_token_length;
+            ph.token_bytes = cnx->retry_token;
         }
     }
 
-    binlog_packet(f, cnxid, 0, current_time, &ph, bytes, length);
+    binlog_packet(cnx->quic, cnx, &cnx->initial_cnxid, 0, current_time, &ph, bytes, length);
 }
 
-void binlog_packet_lost(FILE* f, picoquic_cnx_t* cnx,
+void binlog_packet_lost(picoquic_quic_t* quic, picoquic_cnx_t* cnx,
     picoquic_packet_type_enum ptype,  uint64_t sequence_number, char const * trigger,
     picoquic_connection_id_t * dcid, size_t packet_size,
     uint64_t current_time)
 {
     bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    bytestream* msg = binlog_record_init(&stream_msg);
 
-    bytewrite_int32(msg, 0);
     bytewrite_cid(msg, &cnx->initial_cnxid);
     bytewrite_vint(msg, current_time);
     bytewrite_vint(msg, picoquic_log_event_packet_lost);
@@ -656,19 +1382,17 @@ void binlog_packet_lost(FILE* f, picoquic_cnx_t* cnx,
     }
     bytewrite_vint(msg, packet_size);
 
-    /* write the frame length at the reserved spot, and save to log file*/
-    picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_cnx_record(quic, cnx, msg, binlog_cnx_is_on(cnx));
 }
 
 
-void binlog_transport_extension(FILE * f, picoquic_cnx_t* cnx, int is_local,
+void binlog_transport_extension(picoquic_quic_t* quic, picoquic_cnx_t* cnx, int is_local,
     uint8_t const * sni, size_t sni_len, uint8_t const* alpn, size_t alpn_len,
     const ptls_iovec_t* alpn_list, size_t alpn_count,
     size_t param_length, uint8_t * params)
 {
     bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    bytestream* msg = binlog_record_init(&stream_msg);
     bytewrite_cid(msg, &cnx->initial_cnxid);
     bytewrite_vint(msg, picoquic_get_quic_time(cnx->quic));
     bytewrite_vint(msg, picoquic_log_event_param_update);
@@ -697,19 +1421,14 @@ void binlog_transport_extension(FILE * f, picoquic_cnx_t* cnx, int is_local,
         bytewrite_buffer(msg, params, param_length);
     }
 
-    bytestream_buf stream_head;
-    bytestream* head = bytestream_buf_init(&stream_head, 4);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_cnx_record(quic, cnx, msg, cnx->binlog_mode != picoquic_binlog_mode_off);
 }
 
-void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
+void binlog_picotls_ticket(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id,
     uint8_t* ticket, uint16_t ticket_length)
 {
     bytestream_buf stream_msg;
-    bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    bytestream * msg = binlog_record_init(&stream_msg);
     bytewrite_cid(msg, &cnx_id);
     bytewrite_vint(msg, 0);
     bytewrite_vint(msg, picoquic_log_event_tls_key_update);
@@ -717,23 +1436,13 @@ void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
     bytewrite_vint(msg, ticket_length);
     bytewrite_buffer(msg, ticket, ticket_length);
 
-    bytestream_buf stream_head;
-    bytestream * head = bytestream_buf_init(&stream_head, 8);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_record(quic, msg);
 }
 
-void binlog_new_connection(picoquic_cnx_t * cnx)
+static void binlog_write_new_connection(picoquic_cnx_t * cnx)
 {
-    FILE * f = cnx->quic->f_binlog;
-    if (f == NULL) {
-        return;
-    }
-
     bytestream_buf stream_msg;
-    bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    bytestream * msg = binlog_record_init(&stream_msg);
     bytewrite_cid(msg, &cnx->initial_cnxid);
     bytewrite_vint(msg, cnx->start_time);
     bytewrite_vint(msg, picoquic_log_event_new_connection);
@@ -746,38 +1455,149 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
     bytewrite_cstr(msg, cnx->congestion_alg->congestion_algorithm_id);
     bytewrite_vint(msg, cnx->spin_policy);
 
-    bytestream_buf stream_head;
-    bytestream * head = bytestream_buf_init(&stream_head, 8);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
+    binlog_write_record(cnx->quic, msg);
+}
 
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+/* The new connection record is not retained: it is written when the
+ * connection is triggered, before the retained records. */
+void binlog_new_connection(picoquic_cnx_t * cnx)
+{
+    if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic) && cnx->binlog_mode != picoquic_binlog_mode_off) {
+        binlog_write_new_connection(cnx);
+    }
 }
 
-void binlog_close_connection(picoquic_cnx_t * cnx)
+#ifndef PICOQUIC_DISABLE_STATS
+/* Time in each send limit state, for the connection or for a stream. Like
+ * the close record, these summaries are written whatever the packet logging
+ * mode, unless the connection is not logged at all. Nothing is written if
+ * no time was accounted. */
+static void binlog_send_limits(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, uint64_t current_time)
 {
-    FILE * f = cnx->quic->f_binlog;
-    if (f == NULL) {
+    bytestream_buf stream_msg;
+    bytestream* msg;
+    picoquic_send_limits_t limits;
+    uint64_t total_time = 0;
+
+    if (stream == NULL) {
+        (void)picoquic_get_send_limits(cnx, current_time, &limits);
+    }
+    else {
+        picoquic_stream_send_limits(cnx, stream, current_time, &limits);
+    }
+
+    for (int i = 0; i < picoquic_send_limit_max; i++) {
+        total_time += limits.time_in_state[i];
+    }
+    if (total_time == 0) {
         return;
     }
 
-    bytestream_buf stream_msg;
-    bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    msg = binlog_record_init(&stream_msg);
     bytewrite_cid(msg, &cnx->initial_cnxid);
-    bytewrite_vint(msg, picoquic_get_quic_time(cnx->quic));
-    bytewrite_vint(msg, picoquic_log_event_connection_close);
+    bytewrite_vint(msg, current_time);
+    bytewrite_vint(msg, picoquic_log_event_send_limits);
+    if (stream == NULL) {
+        bytewrite_vint(msg, 0);
+    }
+    else {
+        bytewrite_vint(msg, 1);
+        bytewrite_vint(msg, stream->stream_id);
+    }
+    bytewrite_vint(msg, limits.current);
+    bytewrite_vint(msg, picoquic_send_limit_max);
+    for (int i = 0; i < picoquic_send_limit_max; i++) {
+        bytewrite_vint(msg, limits.time_in_state[i]);
+    }
+
+    binlog_write_record(cnx->quic, msg);
+}
+#endif
+
+/* Called when all the data of the stream was sent */
+void binlog_stream_send_limits(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+#ifndef PICOQUIC_DISABLE_STATS
+    if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic) && cnx->binlog_mode != picoquic_binlog_mode_off &&
+        stream->send_limits.state != picoquic_send_limit_max) {
+        binlog_send_limits(cnx, stream, cnx->send_limit_time);
+    }
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(stream);
+#endif
+#endif
+}
 
-    bytestream_buf stream_head;
-    bytestream * head = bytestream_buf_init(&stream_head, 8);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
+void binlog_close_connection(picoquic_cnx_t * cnx)
+{
+    if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic) && cnx->binlog_mode != picoquic_binlog_mode_off) {
+        bytestream_buf stream_msg;
+        bytestream * msg;
+#ifndef PICOQUIC_DISABLE_STATS
+        uint64_t current_time = picoquic_get_quic_time(cnx->quic);
+
+        /* Summaries of the streams that were not done, then of the connection */
+        for (picoquic_stream_head_t* stream = cnx->first_output_stream; stream != NULL; stream = stream->next_output_stream) {
+            if (stream->send_limits.state != picoquic_send_limit_max) {
+                binlog_send_limits(cnx, stream, current_time);
+            }
+        }
+        binlog_send_limits(cnx, NULL, current_time);
+#endif
+        msg = binlog_record_init(&stream_msg);
+        bytewrite_cid(msg, &cnx->initial_cnxid);
+        bytewrite_vint(msg, picoquic_get_quic_time(cnx->quic));
+        bytewrite_vint(msg, picoquic_log_event_connection_close);
 
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+        binlog_write_record(cnx->quic, msg);
 
-    fflush(f);
+        binlog_flush(cnx->quic);
+    }
+
+    binlog_retro_delete(cnx);
 }
 
-FILE* create_binlog(char const* binlog_file, uint64_t creation_time)
+void picoquic_binlog_trigger(picoquic_cnx_t* cnx)
+{
+    if (cnx->binlog_mode != picoquic_binlog_mode_full) {
+        if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic)) {
+            if (cnx->binlog_mode == picoquic_binlog_mode_off) {
+                binlog_write_new_connection(cnx);
+            }
+            binlog_retro_flush(cnx);
+        }
+        cnx->binlog_mode = picoquic_binlog_mode_full;
+    }
+}
+
+/* Trigger when too many spurious retransmissions are detected within the window */
+void binlog_count_spurious(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    if (current_time >= cnx->binlog_spurious_window_start + PICOQUIC_BINLOG_SPURIOUS_WINDOW) {
+        cnx->binlog_spurious_window_start = current_time;
+        cnx->binlog_spurious_in_window = 0;
+    }
+    cnx->binlog_spurious_in_window++;
+    if (cnx->binlog_spurious_in_window > cnx->quic->binlog_trigger_nb_spurious) {
+        picoquic_binlog_trigger(cnx);
+    }
+}
+
+/* Trigger on handshake failure, or if no progress was made for a long time
+ * while data is in flight */
+void binlog_check_triggers(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    if (cnx->cnx_state == picoquic_state_handshake_failure ||
+        cnx->cnx_state == picoquic_state_handshake_failure_resend ||
+        (cnx->quic->binlog_trigger_stall_delay > 0 && cnx->path[0]->bytes_in_transit > 0 &&
+            current_time > cnx->latest_progress_time + cnx->quic->binlog_trigger_stall_delay)) {
+        picoquic_binlog_trigger(cnx);
+    }
+}
+
+static FILE* binlog_create_file(char const* binlog_file, uint64_t creation_time, uint32_t version)
 {
     FILE* f_binlog = picoquic_file_open(binlog_file, "wb");
     if (f_binlog == NULL) {
@@ -788,7 +1608,7 @@ FILE* create_binlog(char const* binlog_file, uint64_t creation_time)
         bytestream_buf stream;
         bytestream* ps = bytestream_buf_init(&stream, 16);
         bytewrite_int32(ps, FOURCC('q', 'l', 'o', 'g'));
-        bytewrite_int32(ps, 0x01);
+        bytewrite_int32(ps, version);
         bytewrite_int64(ps, creation_time);
 
         if (fwrite(bytestream_data(ps), bytestream_length(ps), 1, f_binlog) <= 0) {
@@ -800,23 +1620,122 @@ FILE* create_binlog(char const* binlog_file, uint64_t creation_time)
     return f_binlog;
 }
 
+FILE* create_binlog(char const* binlog_file, uint64_t creation_time)
+{
+    return binlog_create_file(binlog_file, creation_time, PICOQUIC_BINLOG_VERSION_1);
+}
+
+/* Start the ring and its writer thread. If that fails, records are
+ * written directly to the file. */
+static void binlog_start_writer(picoquic_quic_t* quic)
+{
+    picoquic_binlog_ring_t* ring = binlog_ring_create(quic->binlog_ring_size);
+
+    if (ring != NULL) {
+        ring->f = quic->f_binlog;
+        ring->v2 = quic->binlog_v2;
+        ring->sink = quic->binlog_sink;
+        if (picoquic_create_event(&ring->writer_event) != 0) {
+            binlog_ring_delete(ring);
+        }
+        else if (picoquic_create_thread(&ring->writer_thread, binlog_writer_thread, ring) != 0) {
+            picoquic_delete_event(&ring->writer_event);
+            binlog_ring_delete(ring);
+        }
+        else {
+            quic->binlog_ring = ring;
+        }
+    }
+}
+
+static void binlog_stop_writer(picoquic_quic_t* quic)
+{
+    picoquic_binlog_ring_t* ring = quic->binlog_ring;
+
+    if (ring != NULL) {
+        binlog_ring_store(&ring->is_closing, 1);
+        (void)picoquic_signal_event(&ring->writer_event);
+        /* The writer must drain the ring, it cannot be terminated in the middle of a write */
+        picoquic_join_thread(&ring->writer_thread);
+        picoquic_delete_event(&ring->writer_event);
+        quic->binlog_nb_dropped += binlog_ring_dropped(ring);
+        binlog_ring_delete(ring);
+        quic->binlog_ring = NULL;
+    }
+}
+
+static void binlog_close_file(picoquic_quic_t* quic)
+{
+    if (quic->binlog_v2 != NULL) {
+        binlog_v2_close(quic->binlog_v2);
+        quic->binlog_v2 = NULL;
+    }
+    quic->f_binlog = picoquic_file_close(quic->f_binlog);
+}
+
+/* The sink is told that no more records will come, and can release its resources */
+static void binlog_close_sink(picoquic_quic_t* quic)
+{
+    if (quic->binlog_sink != NULL) {
+        quic->binlog_sink->sink_fn(quic->binlog_sink->sink_ctx, NULL, 0);
+        free(quic->binlog_sink);
+        quic->binlog_sink = NULL;
+    }
+}
+
+/* The file and the sink can be set independently. The writer thread is
+ * stopped while either is changed, and restarted if one of them is set. */
 int binlog_open(picoquic_quic_t* quic, char const* binlog_file)
 {
     int ret = 0;
 
-    binlog_close(quic);
+    binlog_stop_writer(quic);
+    binlog_close_file(quic);
     if (binlog_file != NULL) {
-        quic->f_binlog = create_binlog(binlog_file, picoquic_get_quic_time(quic));
+        quic->f_binlog = binlog_create_file(binlog_file, picoquic_get_quic_time(quic), quic->binlog_version);
         if (quic->f_binlog == NULL) {
             ret = -1;
         }
+        else if (quic->binlog_version == PICOQUIC_BINLOG_VERSION_2 &&
+            (quic->binlog_v2 = binlog_v2_create(quic->f_binlog)) == NULL) {
+            quic->f_binlog = picoquic_file_close(quic->f_binlog);
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+    }
+    if (PICOQUIC_BINLOG_IS_OPEN(quic) && quic->binlog_ring_size > 0) {
+        binlog_start_writer(quic);
+    }
+    return ret;
+}
+
+int binlog_set_sink(picoquic_quic_t* quic, picoquic_binlog_sink_fn sink_fn, void* sink_ctx)
+{
+    int ret = 0;
+
+    binlog_stop_writer(quic);
+    binlog_close_sink(quic);
+    if (sink_fn != NULL) {
+        quic->binlog_sink = (picoquic_binlog_sink_t*)malloc(sizeof(picoquic_binlog_sink_t));
+        if (quic->binlog_sink == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            memset(quic->binlog_sink, 0, sizeof(picoquic_binlog_sink_t));
+            quic->binlog_sink->sink_fn = sink_fn;
+            quic->binlog_sink->sink_ctx = sink_ctx;
+        }
+    }
+    if (PICOQUIC_BINLOG_IS_OPEN(quic) && quic->binlog_ring_size > 0) {
+        binlog_start_writer(quic);
     }
     return ret;
 }
 
 void binlog_close(picoquic_quic_t * quic)
 {
-    quic->f_binlog = picoquic_file_close(quic->f_binlog);
+    binlog_stop_writer(quic);
+    binlog_close_file(quic);
+    binlog_close_sink(quic);
 }
 
 /*
@@ -827,12 +1746,12 @@ void binlog_close(picoquic_quic_t * quic)
 
 void picoquic_cc_dump(picoquic_cnx_t* cnx, uint64_t current_time)
 {
-    if (cnx->quic->f_binlog == NULL) {
+    if (!PICOQUIC_BINLOG_IS_OPEN(cnx->quic)) {
         return;
     }
 
     bytestream_buf stream_msg;
-    bytestream* ps_msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    bytestream* ps_msg = binlog_record_init(&stream_msg);
     picoquic_packet_context_t* pkt_ctx = &cnx->pkt_ctx[picoquic_packet_context_application];
     picoquic_path_t* path = cnx->path[0];
 
@@ -883,13 +1802,7 @@ void picoquic_cc_dump(picoquic_cnx_t* cnx, uint64_t current_time)
     bytewrite_vint(ps_msg, path->max_bandwidth_estimate);
     bytewrite_vint(ps_msg, path->bytes_in_transit);
 
-    bytestream_buf stream_head;
-    bytestream* ps_head = bytestream_buf_init(&stream_head, BYTESTREAM_MAX_BUFFER_SIZE);
-
-    bytewrite_int32(ps_head, (uint32_t)bytestream_length(ps_msg));
-
-    (void)fwrite(bytestream_data(ps_head), bytestream_length(ps_head), 1, cnx->quic->f_binlog);
-    (void)fwrite(bytestream_data(ps_msg), bytestream_length(ps_msg), 1, cnx->quic->f_binlog);
+    binlog_write_cnx_record(cnx->quic, cnx, ps_msg, binlog_cnx_is_on(cnx));
 
     cnx->cwin_blocked = 0;
     cnx->flow_blocked = 0;
@@ -47,44 +47,67 @@ typedef enum {
     picoquic_log_event_alpn_update = 0x0037,
     picoquic_log_event_cc_update = 0x0038,
     picoquic_log_event_stream_update = 0x0039,
+    picoquic_log_event_send_limits = 0x003a,
 
     picoquic_log_event_frame_sent = 0x0082,
     picoquic_log_event_frame_recv = 0x0083,
 } picoquic_log_event_type;
 
 /* binary alternative to picoquic_log_packet_address() */
-void binlog_pdu(FILE * f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+void binlog_pdu(picoquic_quic_t* quic, picoquic_cnx_t* cnx, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
     const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length);
 
 /* binary alternative to picoquic_log_decrypted_segment() */
-void binlog_packet(FILE * f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+void binlog_packet(picoquic_quic_t* quic, picoquic_cnx_t* cnx, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
     const picoquic_packet_header * ph, const uint8_t* bytes, size_t bytes_max);
 
 /* binary alternative to picoquic_log_outgoing_segment() */
-void binlog_outgoing_packet(FILE * f, picoquic_cnx_t* cnx,
-    uint8_t * bytes, uint64_t sequence_number, size_t pn_length, size_t length,
-    uint8_t* send_buffer, size_t send_length, uint64_t current_time);
+void binlog_outgoing_packet(picoquic_cnx_t* cnx, picoquic_packet_type_enum ptype,
+    const picoquic_connection_id_t* remote_cnxid, const picoquic_connection_id_t* local_cnxid,
+    uint8_t* bytes, uint64_t sequence_number, size_t header_length, size_t length,
+    const uint8_t* send_buffer, uint64_t current_time);
 
 /* Logging packet lost events */
-void binlog_packet_lost(FILE* f, picoquic_cnx_t* cnx,
+void binlog_packet_lost(picoquic_quic_t* quic, picoquic_cnx_t* cnx,
     picoquic_packet_type_enum ptype, uint64_t sequence_number, char const* trigger,
     picoquic_connection_id_t* dcid, size_t packet_size,
     uint64_t current_time);
 
 /* binary alternative to picoquic_log_transport_extension() */
-void binlog_transport_extension(FILE * f, picoquic_cnx_t * cnx, int is_local,
+void binlog_transport_extension(picoquic_quic_t* quic, picoquic_cnx_t * cnx, int is_local,
     uint8_t const* sni, size_t sni_len, uint8_t const* alpn, size_t alpn_len,
     const ptls_iovec_t* alpn_list, size_t alpn_count,
     size_t param_length, uint8_t* params);
 
 /* binary alternative to picoquic_log_tls_ticket() */
-void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
+void binlog_picotls_ticket(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id,
     uint8_t* ticket, uint16_t ticket_length);
 
+/* Per connection logging policy, see picoquic_set_binlog_sampling() */
+void binlog_select_connection(picoquic_cnx_t* cnx);
+int binlog_cnx_is_on(picoquic_cnx_t* cnx);
+int binlog_cnx_is_wanted(picoquic_cnx_t* cnx);
+void binlog_count_spurious(picoquic_cnx_t* cnx, uint64_t current_time);
+void binlog_check_triggers(picoquic_cnx_t* cnx, uint64_t current_time);
+
 void binlog_new_connection(picoquic_cnx_t * cnx);
 void binlog_close_connection(picoquic_cnx_t * cnx);
+void binlog_stream_send_limits(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
 
 int binlog_open(picoquic_quic_t * quic, char const * binlog_file);
+int binlog_set_sink(picoquic_quic_t* quic, picoquic_binlog_sink_fn sink_fn, void* sink_ctx);
 void binlog_close(picoquic_quic_t * quic);
 
 void picoquic_cc_dump(picoquic_cnx_t * cnx, uint64_t current_time);
+
+/* Lock free ring buffer between the packet processing thread, which queues
+ * the binary log records, and the writer thread, which writes them to the
+ * log file. Records that do not fit in the ring are dropped and counted. */
+typedef struct st_picoquic_binlog_ring_t picoquic_binlog_ring_t;
+
+picoquic_binlog_ring_t* binlog_ring_create(size_t ring_size);
+void binlog_ring_delete(picoquic_binlog_ring_t* ring);
+int binlog_ring_push(picoquic_binlog_ring_t* ring, const uint8_t* bytes, size_t length);
+size_t binlog_ring_peek(picoquic_binlog_ring_t* ring, const uint8_t** bytes, int flush);
+void binlog_ring_release(picoquic_binlog_ring_t* ring, size_t length);
+uint64_t binlog_ring_dropped(picoquic_binlog_ring_t* ring);
@@ -37,7 +37,7 @@ typedef struct st_picoquic_newreno_state_t {
     uint64_t ssthresh;
     uint64_t recovery_start;
     uint64_t recovery_sequence;
-    picoquic_min_max_rtt_t rtt_filter;
+    picoquic_hystart_pp_t hystart;
 } picoquic_newreno_state_t;
 
 static void picoquic_newreno_init(picoquic_path_t* path_x, uint64_t current_time)
@@ -53,6 +53,7 @@ static void picoquic_newreno_init(picoquic_path_t* path_x, uint64_t current_time
         path_x->congestion_alg_state = (void*)nr_state;
         nr_state->alg_state = picoquic_newreno_alg_slow_start;
         nr_state->ssthresh = UINT64_MAX;
+        picoquic_hystart_pp_init(&nr_state->hystart);
         path_x->cwin = PICOQUIC_CWIN_INITIAL;
     }
     else {
@@ -84,6 +85,7 @@ static void picoquic_newreno_enter_recovery(
 
     nr_state->recovery_start = current_time;
     nr_state->recovery_sequence = picoquic_cc_get_sequence_number(cnx);
+    picoquic_hystart_pp_exit(&nr_state->hystart);
 
     nr_state->residual_ack = 0;
 }
@@ -116,7 +118,7 @@ static void picoquic_newreno_notify(
             switch (nr_state->alg_state) {
             case picoquic_newreno_alg_slow_start:
                 if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
-                    picoquic_hystart_increase(path_x, &nr_state->rtt_filter, nb_bytes_acknowledged);
+                    picoquic_hystart_pp_increase(&nr_state->hystart, path_x, nb_bytes_acknowledged);
                 }
 
                 /* if cnx->cwin exceeds SSTHRESH, exit and go to CA */
@@ -159,9 +161,8 @@ static void picoquic_newreno_notify(
             /* Using RTT increases as signal to get out of initial slow start */
             if (nr_state->alg_state == picoquic_newreno_alg_slow_start &&
                 nr_state->ssthresh == (uint64_t)((int64_t)-1) &&
-                picoquic_hystart_test(&nr_state->rtt_filter, (cnx->is_time_stamp_enabled)?one_way_delay:rtt_measurement, 
-                    cnx->path[0]->pacing_packet_time_microsec, current_time, 
-                    cnx->is_time_stamp_enabled)) {
+                picoquic_hystart_pp_test(&nr_state->hystart, cnx, path_x,
+                    (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement, current_time)) {
                 /* RTT increased too much, get out of slow start! */
                 nr_state->ssthresh = path_x->cwin;
                 nr_state->alg_state = picoquic_newreno_alg_congestion_avoidance;
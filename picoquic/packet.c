@@ -590,7 +590,7 @@ int picoquic_parse_header_and_decrypt(
                         if (*pcnx == NULL) {
                             DBG_PRINTF("%s", "Cannot create connection context\n");
                         }
-                        else if (quic->F_log) {
+                        else if ((*pcnx)->is_logging) {
                             picoquic_log_packet_address(quic->F_log, picoquic_val64_connection_id(ph->dest_cnx_id),
                                 *pcnx, addr_from, 1, length, current_time);
                             fflush(quic->F_log);
@@ -810,12 +810,13 @@ int picoquic_prepare_version_negotiation(
             sp->cnxid_log64 = picoquic_val64_connection_id(sp->initial_cid);
             sp->ptype = picoquic_packet_version_negotiation;
 
-            if (quic->F_log != NULL) {
+            if (PICOQUIC_TEXTLOG_PACKETS(quic)) {
                 picoquic_log_outgoing_segment(quic->F_log, 1, NULL,
                     bytes, 0, sp->length,
                     bytes, sp->length, 0);
             }
 
+            PICOQUIC_STATS_ADD(&quic->stats, nb_version_negotiation_sent, 1);
             picoquic_queue_stateless_packet(quic, sp);
         }
     }
@@ -937,12 +938,13 @@ void picoquic_queue_stateless_retry(picoquic_cnx_t* cnx,
         sp->if_index_local = if_index_to;
         sp->cnxid_log64 = picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx));
 
-        if (cnx->quic->F_log != NULL) {
+        if (cnx->is_logging) {
             picoquic_log_outgoing_segment(cnx->quic->F_log, 1, cnx,
                 bytes, 0, sp->length,
                 bytes, sp->length, pn_length);
         }
 
+        PICOQUIC_STATS_ADD(&cnx->quic->stats, nb_retry_sent, 1);
         picoquic_queue_stateless_packet(cnx->quic, sp);
     }
 }
@@ -1600,11 +1602,13 @@ int picoquic_find_incoming_path(picoquic_cnx_t* cnx, picoquic_packet_header* ph,
 
 /*
  * ECN Accounting. This is only called if the packet was processed successfully.
+ * Each packet of a coalesced datagram is counted, as required by RFC 9000
+ * section 13.4.1.
  */
 void picoquic_ecn_accounting(picoquic_cnx_t* cnx,
     unsigned char received_ecn, int path_id)
 {
-    if (path_id == 0) {
+    if (path_id == 0 || cnx->is_multipath_enabled) {
         switch (received_ecn & 0x03) {
         case 0x00:
             break;
@@ -1734,10 +1738,13 @@ int picoquic_incoming_encrypted(
                 ret = picoquic_tls_stream_process(cnx);
             }
 
-            if (ret == 0 && (cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE ||
-                cnx->quic->use_long_log)) {
+            if (ret == 0 && PICOQUIC_BINLOG_IS_OPEN(cnx->quic) && binlog_cnx_is_wanted(cnx)) {
                 picoquic_cc_dump(cnx, current_time);
             }
+
+            if (ret == 0) {
+                picoquic_cc_telemetry_check(cnx, current_time);
+            }
         }
     }
 
@@ -1815,6 +1822,7 @@ int picoquic_incoming_segment(
         current_time, &ph, &cnx, consumed, &new_context_created);
 
     picoquic_connection_id_t* log_cnxid = (cnx != NULL) ? &cnx->initial_cnxid : &ph.dest_cnx_id;
+    int is_logging = (cnx != NULL) ? cnx->is_logging : PICOQUIC_TEXTLOG_PACKETS(quic);
 
     /* Verify that the segment coalescing is for the same destination ID */
     if (ret == 0) {
@@ -1823,13 +1831,13 @@ int picoquic_incoming_segment(
             *previous_dest_id = ph.dest_cnx_id;
 
             /* if needed, log that the packet is received */
-            if (quic->F_log != NULL && (cnx == NULL || cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE || quic->use_long_log)) {
+            if (is_logging) {
                 picoquic_log_packet_address(quic->F_log,
                     picoquic_val64_connection_id((cnx == NULL) ? ph.dest_cnx_id : picoquic_get_logging_cnxid(cnx)),
                     cnx, addr_from, 1, packet_length, current_time);
             }
-            if (quic->f_binlog != NULL && (cnx == NULL || cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE || quic->use_long_log)) {
-                binlog_pdu(quic->f_binlog, log_cnxid, 1, current_time, addr_from, addr_to, packet_length);
+            if (PICOQUIC_BINLOG_IS_OPEN(quic) && (cnx == NULL || binlog_cnx_is_wanted(cnx))) {
+                binlog_pdu(quic, cnx, log_cnxid, 1, current_time, addr_from, addr_to, packet_length);
             }
         }
         else if (picoquic_compare_connection_id(previous_dest_id, &ph.dest_cnx_id) != 0) {
@@ -1839,8 +1847,7 @@ int picoquic_incoming_segment(
     else
     {
         /* Log packet arrival if not already there */
-        if (picoquic_is_connection_id_null(previous_dest_id) && quic->F_log != NULL && 
-            (cnx == NULL || cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE || quic->use_long_log)) {
+        if (picoquic_is_connection_id_null(previous_dest_id) && is_logging) {
             picoquic_log_packet_address(quic->F_log,
                 picoquic_val64_connection_id((cnx == NULL) ? ph.dest_cnx_id : picoquic_get_logging_cnxid(cnx)),
                 cnx, addr_from, 1, packet_length, current_time);
@@ -1853,12 +1860,25 @@ int picoquic_incoming_segment(
     }
 
     /* Log the incoming packet */
-    if (quic->F_log != NULL && (cnx == NULL || cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE || quic->use_long_log)) {
+    if (is_logging) {
         picoquic_log_decrypted_segment(quic->F_log, 1, cnx, 1, &ph, bytes, *consumed, ret);
     }
-    if (ret == 0 && quic->f_binlog != NULL && (quic->use_long_log || cnx == NULL ||
-         cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE)) {
-        binlog_packet(quic->f_binlog, log_cnxid, 1, current_time, &ph, bytes, *consumed);
+    if (ret == 0 && PICOQUIC_BINLOG_IS_OPEN(quic) && (cnx == NULL || binlog_cnx_is_wanted(cnx))) {
+        binlog_packet(quic, cnx, log_cnxid, 1, current_time, &ph, bytes, *consumed);
+    }
+
+    /* Count before processing, since the connection could be deleted */
+    if (ret == 0) {
+        if (ph.epoch < PICOQUIC_STATS_NB_EPOCHS) {
+            PICOQUIC_STATS_ADD(PICOQUIC_STATS_OF(quic, cnx), nb_packets_received[ph.epoch], 1);
+            PICOQUIC_STATS_ADD(PICOQUIC_STATS_OF(quic, cnx), nb_bytes_received[ph.epoch], *consumed);
+        }
+    }
+    else if (ret == PICOQUIC_ERROR_AEAD_CHECK) {
+        PICOQUIC_STATS_ADD(PICOQUIC_STATS_OF(quic, cnx), nb_decryption_failures, 1);
+    }
+    else if (ret == PICOQUIC_ERROR_DUPLICATE) {
+        PICOQUIC_STATS_ADD(PICOQUIC_STATS_OF(quic, cnx), nb_duplicate_packets, 1);
     }
 
     if (ret == 0) {
@@ -1880,6 +1900,7 @@ int picoquic_incoming_segment(
         else {
             switch (ph.ptype) {
             case picoquic_packet_version_negotiation:
+                PICOQUIC_STATS_ADD(&cnx->stats, nb_version_negotiation_received, 1);
                 ret = picoquic_incoming_version_negotiation(
                     cnx, bytes, length, addr_from, &ph, current_time);
                 break;
@@ -1912,6 +1933,7 @@ int picoquic_incoming_segment(
                 }
                 break;
             case picoquic_packet_retry:
+                PICOQUIC_STATS_ADD(&cnx->stats, nb_retry_received, 1);
                 ret = picoquic_incoming_retry(cnx, bytes, &ph, current_time);
                 break;
             case picoquic_packet_handshake:
@@ -2030,8 +2052,6 @@ int picoquic_incoming_packet(
             packet_length - consumed_index, packet_length,
             &consumed, addr_from, addr_to, if_index_to, received_ecn, current_time, &previous_destid);
 
-        received_ecn = 0; /* Avoid doublecounting ECN bits in coalesced packets */
-
         if (ret == 0) {
             consumed_index += consumed;
             if (consumed == 0) {
@@ -0,0 +1,116 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+
+/*
+ * Path schedulers, used when multipath is negotiated. The sender only calls
+ * the scheduler if at least two validated paths can send a packet now, i.e.,
+ * have an open congestion window and are authorized by the pacer. The scheduler
+ * returns the index of the selected path in the list of candidates.
+ */
+
+/* Min RTT: fill the lowest delay path first. Other paths are used when the
+ * congestion window of the faster paths is full, which adds their capacity
+ * without delaying the packets that the fast path could carry.
+ */
+static int picoquic_minrtt_select_path(picoquic_cnx_t* cnx,
+    picoquic_path_t** candidates, int nb_candidates, uint64_t current_time)
+{
+    int selected = 0;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(current_time);
+#endif
+
+    for (int i = 1; i < nb_candidates; i++) {
+        if (candidates[i]->smoothed_rtt < candidates[selected]->smoothed_rtt) {
+            selected = i;
+        }
+    }
+
+    return selected;
+}
+
+/* Weighted round robin, by virtual time: each path is charged the bytes it
+ * sends divided by its weight, and the candidate with the lowest charge is
+ * selected. Over time, the bytes are spread in proportion to the weights,
+ * without bursts. Paths are charged when the packet is sent rather than when
+ * selected, since the selected path does not always send a packet.
+ *
+ * A path that could not send for a while, e.g., because its congestion window
+ * was full, is not allowed to fall behind the others by more than a few
+ * packets, so it does not take all the traffic when it becomes available.
+ */
+#define PICOQUIC_WRR_CHARGE_SHIFT 8
+#define PICOQUIC_WRR_CHARGE_LAG_MAX ((uint64_t)(2 * PICOQUIC_MAX_PACKET_SIZE) << PICOQUIC_WRR_CHARGE_SHIFT)
+
+static int picoquic_wrr_select_path(picoquic_cnx_t* cnx,
+    picoquic_path_t** candidates, int nb_candidates, uint64_t current_time)
+{
+    int selected = 0;
+    uint64_t charge_max = 0;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(current_time);
+#endif
+
+    for (int i = 0; i < nb_candidates; i++) {
+        if (candidates[i]->scheduler_charge > charge_max) {
+            charge_max = candidates[i]->scheduler_charge;
+        }
+    }
+
+    for (int i = 0; i < nb_candidates; i++) {
+        if (charge_max > PICOQUIC_WRR_CHARGE_LAG_MAX &&
+            candidates[i]->scheduler_charge < charge_max - PICOQUIC_WRR_CHARGE_LAG_MAX) {
+            candidates[i]->scheduler_charge = charge_max - PICOQUIC_WRR_CHARGE_LAG_MAX;
+        }
+        if (candidates[i]->scheduler_charge < candidates[selected]->scheduler_charge) {
+            selected = i;
+        }
+    }
+
+    return selected;
+}
+
+static void picoquic_wrr_packet_sent(picoquic_cnx_t* cnx, picoquic_path_t* path_x, size_t length)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+#endif
+    path_x->scheduler_charge += ((uint64_t)length << PICOQUIC_WRR_CHARGE_SHIFT) / path_x->scheduler_weight;
+}
+
+picoquic_path_scheduler_t picoquic_minrtt_path_scheduler_struct = {
+    "minrtt",
+    picoquic_minrtt_select_path,
+    NULL
+};
+
+picoquic_path_scheduler_t picoquic_wrr_path_scheduler_struct = {
+    "wrr",
+    picoquic_wrr_select_path,
+    picoquic_wrr_packet_sent
+};
+
+picoquic_path_scheduler_t* picoquic_minrtt_path_scheduler = &picoquic_minrtt_path_scheduler_struct;
+picoquic_path_scheduler_t* picoquic_wrr_path_scheduler = &picoquic_wrr_path_scheduler_struct;
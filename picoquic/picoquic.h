@@ -228,6 +228,7 @@ typedef struct st_picoquic_tp_t {
     int enable_loss_bit;
     int enable_time_stamp;
     uint64_t min_ack_delay;
+    int enable_multipath;
 } picoquic_tp_t;
 
 /*
@@ -333,6 +334,30 @@ picoquic_connection_id_callback_ctx_t * picoquic_connection_id_callback_create_c
 
 void picoquic_connection_id_callback_free_ctx(void * cnx_id_cb_data);
 
+/* Routable connection IDs, in the style of the QUIC-LB "block cipher" algorithm.
+ * The first octet carries the configuration id in its two most significant bits.
+ * The next 16 octets are a single AES-128 block encrypting the server ID, the
+ * index of the connection in a slot table, a slot generation number and random
+ * bits. The receive path decrypts the CID and finds the connection directly in
+ * the slot table, falling back to the hash table if the CID does not match. A
+ * load balancer sharing the key can extract the server ID without keeping state.
+ * If cid_key is NULL, the reset seed of the context is used as key.
+ * Must be called before any connection is created in the context. If all slots
+ * are in use, new connections use the default CID generation.
+ */
+#define PICOQUIC_ROUTABLE_CID_LENGTH 17
+#define PICOQUIC_ROUTABLE_CID_KEY_SIZE 16
+
+int picoquic_set_routable_cid(picoquic_quic_t* quic, uint8_t config_id, uint16_t server_id,
+    const uint8_t* cid_key, uint32_t nb_slots);
+
+/* Stateless decoding of routable CID, e.g., by a load balancer.
+ * Return 0 if the CID has the expected length and configuration id. */
+void* picoquic_routable_cid_decoder_create(const uint8_t* cid_key);
+void picoquic_routable_cid_decoder_free(void* cid_decoder);
+int picoquic_routable_cid_decode(void* cid_decoder, uint8_t config_id, const picoquic_connection_id_t* cnx_id,
+    uint16_t* server_id, uint32_t* slot_index, uint32_t* slot_generation);
+
 /* The fuzzer function is used to inject error in packets randomly.
  * It is called just prior to sending a packet, and can randomly
  * change the content or length of the packet.
@@ -346,11 +371,72 @@ void picoquic_set_fuzz(picoquic_quic_t* quic, picoquic_fuzz_fn fuzz_fn, void * f
  */
 int picoquic_set_binlog(picoquic_quic_t * quic, char const * binlog_file);
 
+/* Binary log records are queued in a ring buffer and written to the file
+ * by a background thread, so that logging does not slow down the packet
+ * processing. If the ring is full, records are dropped and counted.
+ * Set the ring size before calling picoquic_set_binlog. A size of zero
+ * disables the ring and the thread: records are then written directly.
+ */
+void picoquic_set_binlog_ring_size(picoquic_quic_t* quic, size_t ring_size);
+
+/* Select the binary log format, before calling picoquic_set_binlog.
+ * Version 1, the default, is a flat sequence of records. Version 2 groups
+ * the records in compressed blocks, with a CID dictionary and delta encoded
+ * time stamps in each block, and ends with an index of the blocks of each
+ * connection. Both versions are read by the loglib tools.
+ */
+int picoquic_set_binlog_version(picoquic_quic_t* quic, uint32_t version);
+uint64_t picoquic_get_binlog_dropped(picoquic_quic_t* quic);
+
+/* Pass the binary log records to an application sink, in addition to or
+ * instead of the log file. The sink receives the records selected by the
+ * per connection policy below, in the format of the version 1 file
+ * without the length prefix: initial CID, time stamp, event type, then
+ * the event content. It is called from the writer thread if the ring is
+ * used, and from the packet processing thread otherwise. It is called a
+ * last time with a NULL record when it is replaced, removed by setting a
+ * NULL sink_fn, or when the QUIC context is deleted.
+ */
+typedef void (*picoquic_binlog_sink_fn)(void* sink_ctx, const uint8_t* record, size_t length);
+int picoquic_set_binlog_sink(picoquic_quic_t* quic, picoquic_binlog_sink_fn sink_fn, void* sink_ctx);
+
+/* Per connection binary logging policy. By default, every connection is
+ * logged, up to PICOQUIC_LOG_PACKET_MAX_SEQUENCE packets unless the log
+ * level is set. The policy is applied when the connection is created.
+ * - Sampling logs one connection in N, selected from the initial CID.
+ *   Zero or one logs all connections, unless CIDs or peer prefixes are
+ *   set, in which case only the matching connections are logged.
+ * - Connections whose initial CID was added to the CID list, or whose peer
+ *   address matches one of the prefixes, are logged in full.
+ * - If the retro depth is set, the last records of the connections that
+ *   are not logged are kept in memory.
+ * A trigger causes the retained records to be written, and the rest of the
+ * connection to be logged in full. Triggers fire on handshake failure, when
+ * more than nb_spurious_max spurious retransmissions are detected within a
+ * second, when no progress is made for stall_delay microseconds while data
+ * is in flight, or when the application calls picoquic_binlog_trigger.
+ * Zero values disable the spurious retransmission and stall triggers.
+ */
+void picoquic_set_binlog_sampling(picoquic_quic_t* quic, uint32_t one_in_n);
+int picoquic_add_binlog_cid(picoquic_quic_t* quic, const picoquic_connection_id_t* cid);
+int picoquic_add_binlog_peer_prefix(picoquic_quic_t* quic, const struct sockaddr* addr, int prefix_bits);
+void picoquic_set_binlog_retro_depth(picoquic_quic_t* quic, size_t nb_records);
+void picoquic_set_binlog_triggers(picoquic_quic_t* quic, uint64_t nb_spurious_max, uint64_t stall_delay);
+void picoquic_binlog_trigger(picoquic_cnx_t* cnx);
+
 /* Set the binary log file and start tracing into it.
  * Set to NULL value to stop text log.
  */
 int picoquic_set_textlog(picoquic_quic_t* quic, char const* textlog_file);
 
+/* Defer the packet trace of the text log. Formatting each packet and frame
+ * as text costs much more than appending a binary record. When deferred,
+ * sent and received packets are only recorded in the binary log, if one is
+ * set, and the text log only carries connection level messages. The packet
+ * trace can be produced later from the binary log with "picolog -f log".
+ */
+void picoquic_set_textlog_deferred(picoquic_quic_t* quic, int is_deferred);
+
 /* Log application messages or other messages to the text log.
  */
 void picoquic_log_app_message(picoquic_quic_t* quic, picoquic_connection_id_t * icid, const char* fmt, ...);
@@ -366,6 +452,20 @@ void picoquic_set_log_level(picoquic_quic_t* quic, int log_level);
  * picosocks.h */
 void picoquic_set_key_log_file(picoquic_quic_t* quic, char const* keylog_filename);
 
+/* Select the AEAD implementation used for 1-RTT packet protection.
+ * The handshake keys always use the default OpenSSL based implementation.
+ * The "fusion" backend (AES-NI, PCLMUL, aggregated GHASH) is only available
+ * if picotls was built with it and the CPU supports it; it only applies to
+ * the AES128-GCM cipher suite. If the backend is not supported, the default
+ * is kept and the call returns -1. */
+typedef enum {
+    picoquic_aead_backend_default = 0,
+    picoquic_aead_backend_fusion
+} picoquic_aead_backend_enum;
+
+int picoquic_set_aead_backend(picoquic_quic_t* quic, picoquic_aead_backend_enum backend);
+int picoquic_is_aead_backend_supported(picoquic_aead_backend_enum backend);
+
 /* Set the ESNI key.
  * May be called several times to set several keys.
  */
@@ -497,6 +597,14 @@ int picoquic_renew_connection_id(picoquic_cnx_t* cnx, int path_id);
 
 int picoquic_start_key_rotation(picoquic_cnx_t * cnx);
 
+/* Key rotation policy. If set, the sender starts a key rotation after sending
+ * the specified number of 1-RTT packets or bytes with the current key phase.
+ * A value of zero means no limit. The rotation is delayed if the previous one
+ * is not yet acknowledged. The "default" variant sets the policy used for new
+ * connections in the context. */
+void picoquic_set_default_key_rotation_policy(picoquic_quic_t* quic, uint64_t max_packets, uint64_t max_bytes);
+void picoquic_set_key_rotation_policy(picoquic_cnx_t* cnx, uint64_t max_packets, uint64_t max_bytes);
+
 picoquic_quic_t* picoquic_get_quic_ctx(picoquic_cnx_t* cnx);
 picoquic_cnx_t* picoquic_get_first_cnx(picoquic_quic_t* quic);
 picoquic_cnx_t* picoquic_get_next_cnx(picoquic_cnx_t* cnx);
@@ -774,9 +882,32 @@ extern picoquic_congestion_algorithm_t* picoquic_cubic_algorithm;
 extern picoquic_congestion_algorithm_t* picoquic_dcubic_algorithm;
 extern picoquic_congestion_algorithm_t* picoquic_fastcc_algorithm;
 extern picoquic_congestion_algorithm_t* picoquic_bbr_algorithm;
+extern picoquic_congestion_algorithm_t* picoquic_bbr2_algorithm;
+extern picoquic_congestion_algorithm_t* picoquic_ledbat_algorithm;
+extern picoquic_congestion_algorithm_t* picoquic_prague_algorithm;
 
 #define PICOQUIC_DEFAULT_CONGESTION_ALGORITHM picoquic_newreno_algorithm;
 
+/* Slow start statistics, maintained per path by the HyStart++ module
+ * shared by the loss based congestion controllers (newreno, cubic):
+ * - nb_rounds: number of round trips spent in slow start or conservative slow start,
+ * - nb_css_entries: number of times an RTT increase caused entry in conservative slow start,
+ * - nb_css_spurious: number of times conservative slow start was abandoned because the RTT went down,
+ * - nb_delay_exits: number of times slow start ended after conservative slow start completed,
+ * - exit_cwin: congestion window at the last slow start exit by delay,
+ * - exit_time: time of that exit.
+ */
+typedef struct st_picoquic_hystart_stats_t {
+    uint64_t nb_rounds;
+    uint64_t nb_css_entries;
+    uint64_t nb_css_spurious;
+    uint64_t nb_delay_exits;
+    uint64_t exit_cwin;
+    uint64_t exit_time;
+} picoquic_hystart_stats_t;
+
+void picoquic_get_hystart_stats(picoquic_cnx_t* cnx, picoquic_hystart_stats_t* stats);
+
 picoquic_congestion_algorithm_t const* picoquic_get_congestion_algorithm(char const* alg_name);
 
 void picoquic_set_default_congestion_algorithm(picoquic_quic_t* quic, picoquic_congestion_algorithm_t const* algo);
@@ -812,6 +943,369 @@ uint64_t picoquic_get_pacing_rate(picoquic_cnx_t* cnx);
 uint64_t picoquic_get_cwin(picoquic_cnx_t* cnx);
 uint64_t picoquic_get_rtt(picoquic_cnx_t* cnx);
 
+/* Congestion control telemetry.
+ *
+ * Applications that adapt their sending rate, e.g., adaptive bit rate video,
+ * can subscribe to snapshots of the congestion control state of the default
+ * path. Snapshots are produced after packets are received or sent:
+ * - periodically, at most once per "interval_microsec", or each time
+ *   packets are received or sent if the interval is zero,
+ * - immediately when losses are detected, or when the congestion algorithm
+ *   changes state (as reported by its "alg_observe" function).
+ *
+ * The telemetry function is called from the thread running the connection,
+ * and should return quickly. Applications that consume the snapshots in
+ * another thread can use a telemetry ring: "picoquic_cc_ring_push" is a
+ * telemetry function that copies the snapshots in a single producer, single
+ * consumer lock free ring, from which the other thread retrieves them with
+ * "picoquic_cc_ring_pop". If the ring is full, new snapshots are dropped and
+ * counted, the network thread never waits for the reader.
+ *
+ * Subscribing with a NULL function cancels the subscription.
+ */
+
+typedef enum {
+    picoquic_cc_telemetry_periodic = 0,
+    picoquic_cc_telemetry_loss,
+    picoquic_cc_telemetry_state_change
+} picoquic_cc_telemetry_trigger_t;
+
+typedef struct st_picoquic_cc_snapshot_t {
+    uint64_t current_time;
+    picoquic_cc_telemetry_trigger_t trigger;
+    uint64_t cwin;
+    uint64_t bytes_in_transit;
+    uint64_t pacing_rate; /* bytes per second */
+    uint64_t bandwidth_estimate; /* bytes per second */
+    uint64_t max_bandwidth_estimate; /* bytes per second */
+    uint64_t receive_rate_estimate; /* bytes per second */
+    uint64_t rtt_min;
+    uint64_t smoothed_rtt;
+    uint64_t rtt_variant;
+    uint64_t rtt_sample;
+    uint64_t send_mtu;
+    uint64_t nb_retransmission_total;
+    uint64_t nb_spurious;
+    uint64_t cc_state;
+    uint64_t cc_param;
+} picoquic_cc_snapshot_t;
+
+typedef void (*picoquic_cc_telemetry_fn)(picoquic_cnx_t* cnx, picoquic_cc_snapshot_t const* snapshot, void* telemetry_ctx);
+
+void picoquic_subscribe_cc_telemetry(picoquic_cnx_t* cnx, uint64_t interval_microsec,
+    picoquic_cc_telemetry_fn telemetry_fn, void* telemetry_ctx);
+void picoquic_get_cc_snapshot(picoquic_cnx_t* cnx, picoquic_cc_snapshot_t* snapshot, uint64_t current_time);
+
+typedef struct st_picoquic_cc_ring_t picoquic_cc_ring_t;
+
+picoquic_cc_ring_t* picoquic_cc_ring_create(size_t nb_slots);
+void picoquic_cc_ring_delete(picoquic_cc_ring_t* ring);
+void picoquic_cc_ring_push(picoquic_cnx_t* cnx, picoquic_cc_snapshot_t const* snapshot, void* ring);
+int picoquic_cc_ring_pop(picoquic_cc_ring_t* ring, picoquic_cc_snapshot_t* snapshot);
+uint64_t picoquic_cc_ring_dropped(picoquic_cc_ring_t* ring);
+
+/* Statistics.
+ *
+ * Counters are kept per connection, and per context for the events that
+ * are not attached to a connection: packet pool usage, stateless packets,
+ * retry and version negotiation packets sent by the server. When a
+ * connection is deleted, its counters are added to those of the context.
+ *
+ * "picoquic_get_stats" returns the counters of the connection if cnx is not
+ * NULL, or else the aggregate of the context and all its connections. It
+ * must be called from the thread running the context, which guarantees
+ * that the snapshot is consistent.
+ *
+ * Wake-ups are counted each time a connection is rescheduled after preparing
+ * packets, per source file of the last wake time update, using the file
+ * identifiers of SET_LAST_WAKE (0 if no update was recorded).
+ *
+ * The counters are compiled out if PICOQUIC_DISABLE_STATS is defined, in
+ * which case "picoquic_get_stats" returns zeroes and an error.
+ */
+#define PICOQUIC_STATS_NB_EPOCHS 4
+#define PICOQUIC_STATS_NB_WAKE_SOURCES 5
+
+typedef struct st_picoquic_stats_t {
+    uint64_t nb_packets_sent[PICOQUIC_STATS_NB_EPOCHS];
+    uint64_t nb_bytes_sent[PICOQUIC_STATS_NB_EPOCHS];
+    uint64_t nb_packets_received[PICOQUIC_STATS_NB_EPOCHS];
+    uint64_t nb_bytes_received[PICOQUIC_STATS_NB_EPOCHS];
+    uint64_t nb_decryption_failures;
+    uint64_t nb_duplicate_packets;
+    uint64_t nb_ack_frames_received;
+    uint64_t nb_ack_ranges_received;
+    uint64_t nb_packet_pool_hits;
+    uint64_t nb_packet_pool_misses;
+    uint64_t nb_stateless_packets;
+    uint64_t nb_retry_sent;
+    uint64_t nb_retry_received;
+    uint64_t nb_version_negotiation_sent;
+    uint64_t nb_version_negotiation_received;
+    uint64_t nb_packets_with_stream_frames; /* received packets carrying stream frames */
+    uint64_t nb_stream_frames_received;
+    uint64_t nb_wake_ups[PICOQUIC_STATS_NB_WAKE_SOURCES];
+} picoquic_stats_t;
+
+int picoquic_get_stats(picoquic_quic_t* quic, picoquic_cnx_t* cnx, picoquic_stats_t* stats);
+
+/* Latency histograms.
+ *
+ * Each context keeps log-linear histograms of latencies, in microseconds:
+ * - rtt: the RTT samples of all paths,
+ * - handshake: the time from the start of the connection to the ready state,
+ * - stream_first_byte: the time from the creation of a stream to the
+ *   arrival of its first data byte,
+ * - stream_completion: the time from the creation of a stream to the
+ *   delivery of all its data, up to the FIN,
+ * - ack_delay: the ACK delay reported by the peer for each RTT sample,
+ * - pacing_wait: the time during which a path was blocked by pacing.
+ *
+ * Values below 32 are recorded exactly. Larger values are recorded in
+ * 16 buckets per power of 2, which bounds the relative error to 1/16.
+ *
+ * The histograms are updated by the thread running the context, without
+ * locks. Other threads may read them at any time, e.g., to print live
+ * percentiles with "picoquic_histogram_value_at_percentile" or to export
+ * a binary snapshot with "picoquic_get_histogram_snapshot". A concurrent
+ * read may miss the latest samples, but never sees a torn counter.
+ *
+ * Servers running several contexts, one per worker thread, can merge the
+ * histograms with "picoquic_histogram_merge", or merge the snapshots of
+ * each context with "picoquic_histogram_snapshot_merge".
+ *
+ * The histograms of the context are compiled out if PICOQUIC_DISABLE_STATS
+ * is defined. "picoquic_get_histogram" then returns NULL, and
+ * "picoquic_get_histogram_snapshot" returns an error.
+ */
+typedef enum {
+    picoquic_histogram_rtt = 0,
+    picoquic_histogram_handshake,
+    picoquic_histogram_stream_first_byte,
+    picoquic_histogram_stream_completion,
+    picoquic_histogram_ack_delay,
+    picoquic_histogram_pacing_wait,
+    picoquic_histogram_max
+} picoquic_histogram_id_t;
+
+#define PICOQUIC_HISTOGRAM_SUB_BUCKETS 16
+#define PICOQUIC_HISTOGRAM_MAX_SHIFT 35
+#define PICOQUIC_HISTOGRAM_NB_BUCKETS ((PICOQUIC_HISTOGRAM_MAX_SHIFT + 2) * PICOQUIC_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct st_picoquic_histogram_t {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[PICOQUIC_HISTOGRAM_NB_BUCKETS];
+} picoquic_histogram_t;
+
+void picoquic_histogram_record(picoquic_histogram_t* histogram, uint64_t value);
+void picoquic_histogram_merge(picoquic_histogram_t* histogram, picoquic_histogram_t const* other);
+uint64_t picoquic_histogram_value_at_percentile(picoquic_histogram_t const* histogram, double percentile);
+
+picoquic_histogram_t const* picoquic_get_histogram(picoquic_quic_t* quic, picoquic_histogram_id_t histogram_id);
+int picoquic_get_histogram_snapshot(picoquic_quic_t* quic, uint8_t* bytes, size_t bytes_max, size_t* length);
+int picoquic_histogram_snapshot_merge(picoquic_histogram_t histograms[picoquic_histogram_max], const uint8_t* bytes, size_t length);
+
+/* Wake-up profiling.
+ *
+ * When profiling is enabled with "picoquic_set_wake_profiling", each call
+ * to picoquic_prepare_packet is attributed to the reason for which the
+ * connection was scheduled at that time:
+ * - input: a packet was received, or the application called the API,
+ * - send_more: the previous call sent a packet, and more may follow,
+ * - pacing: the pacing release time of the path,
+ * - ack: the ACK delay timer,
+ * - retransmit: the loss detection, retransmit or probe timers,
+ * - idle: the idle timeout, keep alive, handshake and closing timers,
+ * - data: stream or other data was ready, but did not fit in the packet,
+ * - challenge: the path challenge repeat timer,
+ * - other: path demotion, connection creation.
+ *
+ * For each reason, the profile counts the calls, the calls that did not
+ * produce a packet, the calls made before the scheduled time, and the calls
+ * made more than PICOQUIC_WAKE_PROFILE_LATE microseconds after it, along
+ * with the total delay of those late calls.
+ *
+ * The profile is compiled out if PICOQUIC_DISABLE_STATS is defined. In that
+ * case, "picoquic_get_wake_profile" returns zeroes and an error.
+ */
+typedef enum {
+    picoquic_wake_reason_other = 0,
+    picoquic_wake_reason_input,
+    picoquic_wake_reason_send_more,
+    picoquic_wake_reason_pacing,
+    picoquic_wake_reason_ack,
+    picoquic_wake_reason_retransmit,
+    picoquic_wake_reason_idle,
+    picoquic_wake_reason_data,
+    picoquic_wake_reason_challenge,
+    picoquic_wake_reason_max
+} picoquic_wake_reason_enum;
+
+#define PICOQUIC_WAKE_PROFILE_LATE 1000 /* 1 ms */
+
+typedef struct st_picoquic_wake_profile_t {
+    uint64_t nb_calls[picoquic_wake_reason_max];
+    uint64_t nb_empty[picoquic_wake_reason_max];
+    uint64_t nb_early[picoquic_wake_reason_max];
+    uint64_t nb_late[picoquic_wake_reason_max];
+    uint64_t late_delay[picoquic_wake_reason_max];
+} picoquic_wake_profile_t;
+
+void picoquic_set_wake_profiling(picoquic_quic_t* quic, int is_enabled);
+int picoquic_get_wake_profile(picoquic_quic_t* quic, picoquic_wake_profile_t* profile);
+char const* picoquic_wake_reason_name(picoquic_wake_reason_enum reason);
+
+/* Send limits.
+ *
+ * Each call to picoquic_prepare_packet notes what stopped the connection
+ * from sending more:
+ * - none: the connection is sending,
+ * - app: there is nothing to send, the application is the limit,
+ * - cwin: the bytes in transit fill the congestion window,
+ * - pacing: the pacing rate does not allow sending yet,
+ * - flow: the connection flow control credit granted by the peer is used,
+ * - stream_flow: the flow control credit of the pending streams is used,
+ * - amplification: the server has not yet validated the client address,
+ *   and can only send in response to the client's packets.
+ * The state holds until the next call, and the time spent in each state is
+ * accumulated, in microseconds.
+ *
+ * Streams are tracked when the scheduler examines them. A stream is app
+ * limited if it has no data to send, and flow or stream_flow limited if
+ * its data is blocked by flow control. Otherwise, the stream is ready, and
+ * its time is attributed to the state of the connection during that time.
+ * Tracking stops when all the data and the FIN of the stream are sent.
+ *
+ * The connection totals, and the totals of each stream when it is done,
+ * are also written to the binary log.
+ *
+ * The tracking is compiled out if PICOQUIC_DISABLE_STATS is defined. In
+ * that case the "get" functions return zeroes and an error.
+ */
+typedef enum {
+    picoquic_send_limit_none = 0,
+    picoquic_send_limit_app,
+    picoquic_send_limit_cwin,
+    picoquic_send_limit_pacing,
+    picoquic_send_limit_flow,
+    picoquic_send_limit_stream_flow,
+    picoquic_send_limit_amplification,
+    picoquic_send_limit_max
+} picoquic_send_limit_enum;
+
+typedef struct st_picoquic_send_limits_t {
+    picoquic_send_limit_enum current; /* picoquic_send_limit_max if the stream is not tracked */
+    uint64_t time_in_state[picoquic_send_limit_max];
+} picoquic_send_limits_t;
+
+int picoquic_get_send_limits(picoquic_cnx_t* cnx, uint64_t current_time, picoquic_send_limits_t* limits);
+int picoquic_get_stream_send_limits(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t current_time, picoquic_send_limits_t* limits);
+char const* picoquic_send_limit_name(picoquic_send_limit_enum limit);
+
+/* Pacing offload.
+ *
+ * Each packet prepared by picoquic_prepare_packet() or picoquic_prepare_next_packet()
+ * has an earliest departure time, in nanoseconds, expressed in the same time base
+ * as the "current_time" argument (i.e., current_time * 1000 for "now"). It can be
+ * retrieved with picoquic_get_last_departure_time() after the packet is prepared.
+ *
+ * By default, the horizon is zero: packets are only prepared when they can depart
+ * immediately, and the departure time is the current time. If the application
+ * passes departure times to the kernel, e.g., using SO_TXTIME with the fq qdisc,
+ * it can set a horizon so that packets are prepared up to that many microseconds
+ * ahead of their departure time, letting the kernel pace them precisely. The
+ * horizon applies to paths created after the call.
+ */
+void picoquic_set_pacing_horizon(picoquic_quic_t* quic, uint64_t horizon_microsec);
+uint64_t picoquic_get_last_departure_time(picoquic_quic_t* quic);
+
+/* Explicit Congestion Notification.
+ *
+ * By default, packets are sent as Not-ECT. The application may request that
+ * packets be marked ECT(0), for classic ECN, or ECT(1), for L4S. The marks
+ * are validated as specified in RFC 9000 section 13.4: the first packets are
+ * sent marked ("testing"), then marking stops until acknowledgements confirm
+ * that the path and the peer handle ECN correctly ("capable"). If the marks
+ * are bleached or mangled, or if all testing packets are lost, marking stops
+ * for the connection ("failed").
+ *
+ * The codepoint to use for the datagram just prepared by picoquic_prepare_packet()
+ * or picoquic_prepare_next_packet() is retrieved with picoquic_get_last_ecn_codepoint(),
+ * and should be applied when sending, e.g., by passing it to
+ * picoquic_send_through_socket_at().
+ *
+ * Classic congestion controllers treat CE marks like losses. The "prague"
+ * controller scales its response to the fraction of CE marks, as specified
+ * for L4S, and should be used with ECT(1).
+ */
+#define PICOQUIC_ECN_NOT_ECT 0
+#define PICOQUIC_ECN_ECT_1 1
+#define PICOQUIC_ECN_ECT_0 2
+#define PICOQUIC_ECN_CE 3
+
+typedef enum {
+    picoquic_ecn_state_testing = 0,
+    picoquic_ecn_state_unknown,
+    picoquic_ecn_state_capable,
+    picoquic_ecn_state_failed,
+    picoquic_ecn_state_disabled
+} picoquic_ecn_state_t;
+
+void picoquic_set_default_ecn_codepoint(picoquic_quic_t* quic, uint8_t ecn_codepoint);
+void picoquic_set_ecn_codepoint(picoquic_cnx_t* cnx, uint8_t ecn_codepoint);
+picoquic_ecn_state_t picoquic_get_ecn_state(picoquic_cnx_t* cnx);
+uint8_t picoquic_get_last_ecn_codepoint(picoquic_quic_t* quic);
+
+/* Multipath.
+ *
+ * By default, QUIC only uses one path at a time: a new path is validated and then
+ * replaces the default path ("migration"). If both endpoints set the "enable_multipath"
+ * transport parameter, all validated paths are used concurrently. Each path has its
+ * own RTT estimate, congestion control and pacing state, and losses are detected
+ * per path.
+ *
+ * Before each packet is sent, a path scheduler picks the path among those that are
+ * validated and whose congestion window and pacer allow sending. Two schedulers
+ * are provided:
+ * - "minrtt" (default): the path with the lowest smoothed RTT,
+ * - "wrr": weighted round robin, using weights set per path by the application,
+ *   e.g., to prefer Wi-Fi over cellular.
+ * Applications may provide their own scheduler. The "select_path" function receives
+ * the list of candidate paths, at least 2, and returns the index of the selected
+ * path in that list. The selected path does not always send a packet, e.g., if there
+ * is nothing to send. The optional "packet_sent" function is called for each packet
+ * sent on any path, and is where schedulers should account for the traffic.
+ */
+typedef int (*picoquic_path_scheduler_select)(picoquic_cnx_t* cnx,
+    picoquic_path_t** candidates, int nb_candidates, uint64_t current_time);
+typedef void (*picoquic_path_scheduler_sent)(picoquic_cnx_t* cnx, picoquic_path_t* path_x, size_t length);
+
+typedef struct st_picoquic_path_scheduler_t {
+    char const* path_scheduler_id;
+    picoquic_path_scheduler_select select_path;
+    picoquic_path_scheduler_sent packet_sent;
+} picoquic_path_scheduler_t;
+
+extern picoquic_path_scheduler_t* picoquic_minrtt_path_scheduler;
+extern picoquic_path_scheduler_t* picoquic_wrr_path_scheduler;
+
+picoquic_path_scheduler_t const* picoquic_get_path_scheduler(char const* scheduler_name);
+void picoquic_set_default_path_scheduler(picoquic_quic_t* quic, picoquic_path_scheduler_t const* scheduler);
+void picoquic_set_path_scheduler(picoquic_cnx_t* cnx, picoquic_path_scheduler_t const* scheduler);
+int picoquic_is_multipath_enabled(picoquic_cnx_t* cnx);
+/* Set the weight of the path matching the addresses, used by the "wrr" scheduler. Default is 1. */
+int picoquic_set_path_weight(picoquic_cnx_t* cnx, const struct sockaddr* addr_local,
+    const struct sockaddr* addr_peer, uint32_t weight);
+
+/* Path accessors, for use by path schedulers */
+uint64_t picoquic_get_path_rtt(picoquic_path_t* path_x);
+uint64_t picoquic_get_path_cwin(picoquic_path_t* path_x);
+uint64_t picoquic_get_path_bytes_in_transit(picoquic_path_t* path_x);
+uint32_t picoquic_get_path_weight(picoquic_path_t* path_x);
+
 
 
 #ifdef __cplusplus
@@ -61,7 +61,9 @@ extern "C" {
 #define PICOQUIC_ACK_DELAY_MAX_DEFAULT 25000ull /* 25 ms, per protocol spec */
 #define PICOQUIC_ACK_DELAY_MIN 1000ull /* 1 ms */
 #define PICOQUIC_ACK_DELAY_MIN_MAX_VALUE 0xFFFFFFull /* max value that can be negotiated by peers */
-#define PICOQUIC_RACK_DELAY 10000ull /* 10 ms */
+#define PICOQUIC_LOSS_PACKET_THRESHOLD 3 /* RFC 9002, kPacketThreshold */
+#define PICOQUIC_LOSS_TIME_GRANULARITY 1000ull /* 1 ms, RFC 9002 kGranularity */
+#define PICOQUIC_PTO_NEW_DATA_MAX 4 /* probe timeouts answered with new data before repeating old data */
 #define PICOQUIC_MAX_ACK_DELAY_MAX_MS 0x4000ull /* 2<14 ms */
 #define PICOQUIC_TOKEN_DELAY_LONG (24*60*60*1000000ull) /* 24 hours */
 #define PICOQUIC_TOKEN_DELAY_SHORT (2*60*1000000ull) /* 2 minutes */
@@ -71,6 +73,8 @@ extern "C" {
 #define PICOQUIC_BANDWIDTH_MEDIUM 2000000 /* 16 Mbps, threshold for coalescing 10 packets per ACK */
 #define PICOQUIC_MAX_BANDWIDTH_TIME_INTERVAL_MIN 1000
 #define PICOQUIC_MAX_BANDWIDTH_TIME_INTERVAL_MAX 15000
+#define PICOQUIC_BINLOG_RING_SIZE_DEFAULT 0x400000 /* 4 MB */
+#define PICOQUIC_BINLOG_SPURIOUS_WINDOW 1000000ull /* one second */
 
 #define PICOQUIC_SPURIOUS_RETRANSMIT_DELAY_MAX 1000000ull /* one second */
 
@@ -317,6 +321,7 @@ typedef struct st_picoquic_packet_t {
     uint64_t delivered_prior;
     uint64_t delivered_time_prior;
     uint64_t delivered_sent_prior;
+    uint64_t path_packet_number;
     size_t length;
     size_t checksum_overhead;
     size_t offset;
@@ -328,6 +333,8 @@ typedef struct st_picoquic_packet_t {
     unsigned int is_mtu_probe : 1;
     unsigned int is_ack_trap : 1;
     unsigned int delivered_app_limited : 1;
+    unsigned int delivered_is_set : 1;
+    unsigned int ecn_codepoint : 2;
 
     uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
 } picoquic_packet_t;
@@ -435,15 +442,56 @@ typedef enum {
     picoquic_tp_enable_loss_bit_old = 0x1055,
     picoquic_tp_enable_loss_bit = 0x1057,
     picoquic_tp_min_ack_delay = 0xDE1A,
-    picoquic_tp_enable_time_stamp = 0x7157
+    picoquic_tp_enable_time_stamp = 0x7157,
+    picoquic_tp_enable_multipath = 0xbabf
 } picoquic_tp_enum;
 
+/* Connection slot, used to retrieve connections from routable CID */
+typedef struct st_picoquic_cid_slot_t {
+    struct st_picoquic_cnx_t* cnx;
+    uint32_t generation;
+    uint32_t next_free;
+} picoquic_cid_slot_t;
+
+#define PICOQUIC_CID_SLOT_NONE UINT32_MAX
+
+/* Binary log policy of a connection.
+ * By default, the first packets of a connection are logged, or all of them
+ * if long logs are requested. Connections that are not selected by the
+ * sampling policy are not logged, unless a trigger fires. Connections that
+ * match a CID or a peer prefix, or that were triggered, are logged in full.
+ */
+typedef enum {
+    picoquic_binlog_mode_first_packets = 0,
+    picoquic_binlog_mode_off,
+    picoquic_binlog_mode_full
+} picoquic_binlog_mode_enum;
+
+typedef struct st_picoquic_binlog_prefix_t {
+    struct sockaddr_storage addr;
+    int prefix_bits;
+} picoquic_binlog_prefix_t;
+
 /* QUIC context, defining the tables of connections,
  * open sockets, etc.
  */
 typedef struct st_picoquic_quic_t {
     void * F_log;
     FILE * f_binlog;
+    struct st_picoquic_binlog_ring_t* binlog_ring;
+    size_t binlog_ring_size;
+    uint64_t binlog_nb_dropped;
+    uint32_t binlog_version;
+    struct st_picoquic_binlog_v2_t* binlog_v2;
+    struct st_picoquic_binlog_sink_t* binlog_sink;
+    uint32_t binlog_sample_one_in;
+    size_t binlog_retro_depth;
+    uint64_t binlog_trigger_nb_spurious;
+    uint64_t binlog_trigger_stall_delay;
+    picoquic_connection_id_t* binlog_cid_list;
+    size_t binlog_nb_cid;
+    picoquic_binlog_prefix_t* binlog_prefix_list;
+    size_t binlog_nb_prefix;
     void* tls_master_ctx;
     struct st_ptls_key_exchange_context_t * esni_key_exchange[16];
     picoquic_stream_data_cb_fn default_callback_fn;
@@ -462,6 +510,13 @@ typedef struct st_picoquic_quic_t {
     uint32_t padding_minsize_default;
     uint32_t sequence_hole_pseudo_period; /* Optimistic ack defense */
     picoquic_spinbit_version_enum default_spin_policy;
+    picoquic_aead_backend_enum aead_backend; /* AEAD implementation used for 1-RTT keys */
+    uint64_t key_rotation_packets_default; /* Rotate 1-RTT keys after that many packets, 0 if no limit */
+    uint64_t key_rotation_bytes_default; /* Rotate 1-RTT keys after that many bytes, 0 if no limit */
+    uint64_t pacing_horizon_nanosec; /* How far ahead of time packets may be released to the kernel, 0 if no offload */
+    uint64_t last_departure_time_nanosec; /* Departure time of the last prepared packet */
+    uint8_t default_ecn_codepoint; /* ECN codepoint requested for new connections, 0 if none */
+    uint8_t last_ecn_codepoint; /* ECN codepoint of the last prepared datagram */
     /* Flags */
     unsigned int check_token : 1;
     unsigned int provide_token : 1;
@@ -471,12 +526,15 @@ typedef struct st_picoquic_quic_t {
     unsigned int is_cert_store_not_empty : 1;
     unsigned int use_long_log : 1;
     unsigned int should_close_log : 1;
+    unsigned int is_textlog_deferred : 1;
+    unsigned int is_wake_profiling : 1;
     unsigned int dont_coalesce_init : 1; /* test option to turn of packet coalescing on server */
 
 
     picoquic_stateless_packet_t* pending_stateless_packet;
 
     picoquic_congestion_algorithm_t const* default_congestion_alg;
+    picoquic_path_scheduler_t const* default_path_scheduler;
 
     struct st_picoquic_cnx_t* cnx_list;
     struct st_picoquic_cnx_t* cnx_last;
@@ -491,6 +549,15 @@ typedef struct st_picoquic_quic_t {
     picohash_table* table_cnx_by_icid;
     picohash_table* table_cnx_by_secret;
 
+    /* Routable CID: encryption contexts and table of connection slots */
+    void* cid_route_enc;
+    void* cid_route_dec;
+    picoquic_cid_slot_t* cid_slots;
+    uint32_t nb_cid_slots;
+    uint32_t cid_slot_free_first;
+    uint16_t cid_server_id;
+    uint8_t cid_config_id;
+
     picoquic_packet_t * p_first_packet;
     size_t nb_packets_in_pool;
 
@@ -513,8 +580,52 @@ typedef struct st_picoquic_quic_t {
     void* fuzz_ctx;
     int wake_file;
     int wake_line;
+#ifndef PICOQUIC_DISABLE_STATS
+    picoquic_stats_t stats;
+    picoquic_histogram_t histograms[picoquic_histogram_max];
+    picoquic_wake_profile_t wake_profile;
+#endif
 } picoquic_quic_t;
 
+/* Statistics counters. If PICOQUIC_DISABLE_STATS is defined, the counters
+ * are compiled out and the arguments are not evaluated. */
+#ifndef PICOQUIC_DISABLE_STATS
+#define PICOQUIC_STATS_ADD(stats, field, n) ((stats)->field += (n))
+#else
+#define PICOQUIC_STATS_ADD(stats, field, n) ((void)0)
+#endif
+#define PICOQUIC_STATS_OF(quic, cnx) (((cnx) != NULL) ? &(cnx)->stats : &(quic)->stats)
+#ifndef PICOQUIC_DISABLE_STATS
+#define PICOQUIC_HISTOGRAM_RECORD(quic, histogram_id, value) picoquic_histogram_record(&(quic)->histograms[histogram_id], (value))
+#else
+#define PICOQUIC_HISTOGRAM_RECORD(quic, histogram_id, value) ((void)(quic))
+#endif
+/* Same as SET_LAST_WAKE, also noting the reason for the wake time in the
+ * connection context, for the wake-up profile */
+#ifndef PICOQUIC_DISABLE_STATS
+#define SET_LAST_WAKE_REASON(cnx, file_id, reason) (SET_LAST_WAKE((cnx)->quic, file_id), (cnx)->wake_reason_next = (reason))
+#else
+#define SET_LAST_WAKE_REASON(cnx, file_id, reason) SET_LAST_WAKE((cnx)->quic, file_id)
+#endif
+
+/* Send limit tracking, see picoquic_get_send_limits. The limits found while
+ * preparing packets are flagged, and the state of the connection is set
+ * from the flags at the end of the call. */
+typedef struct st_picoquic_send_limit_track_t {
+    picoquic_send_limit_enum state;
+    uint64_t state_start;
+    uint64_t time_in_state[picoquic_send_limit_max];
+} picoquic_send_limit_track_t;
+
+#ifndef PICOQUIC_DISABLE_STATS
+#define PICOQUIC_SEND_LIMIT_FLAG(cnx, limit) ((cnx)->send_limit_flags |= (1u << (limit)))
+#define PICOQUIC_STREAM_SEND_LIMIT(cnx, stream, limit) (((stream)->send_limits.state != (limit)) ? \
+    picoquic_stream_send_limit_update((cnx), (stream), (limit)) : (void)0)
+#else
+#define PICOQUIC_SEND_LIMIT_FLAG(cnx, limit) ((void)0)
+#define PICOQUIC_STREAM_SEND_LIMIT(cnx, stream, limit) ((void)0)
+#endif
+
 picoquic_packet_context_enum picoquic_context_from_epoch(int epoch);
 
 /*
@@ -599,6 +710,12 @@ typedef struct st_picoquic_stream_head_t {
     unsigned int stream_data_blocked_sent : 1; /* If stream_data_blocked has been sent to peer, and no data sent on stream since */
     unsigned int is_output_stream : 1; /* If stream is listed in the output list */
     unsigned int is_closed : 1; /* Stream is closed, closure is accouted for */
+    unsigned int is_first_byte_received : 1; /* Time to first byte was recorded */
+    uint64_t creation_time; /* Reference for the stream latency histograms */
+#ifndef PICOQUIC_DISABLE_STATS
+    picoquic_send_limit_track_t send_limits; /* Time in each send limit state, see picoquic_get_send_limits */
+    uint64_t send_limit_cnx_base[picoquic_send_limit_max]; /* Connection times when the stream became ready */
+#endif
 } picoquic_stream_head_t;
 
 #define IS_CLIENT_STREAM_ID(id) (unsigned int)(((id) & 1) == 0)
@@ -644,6 +761,27 @@ typedef struct st_picoquic_local_cnxid_t {
     picoquic_connection_id_t cnx_id;
 } picoquic_local_cnxid_t;
 
+/*
+* Delivery rate sample, computed for each acknowledgement by the rate sampler
+* (see rate_sampler.c) and available to all congestion controllers. The
+* sample covers the interval between the sending of the most recently sent
+* of the acknowledged packets and the current acknowledgement.
+*/
+typedef struct st_picoquic_rate_sample_t {
+    uint64_t prior_delivered; /* Path delivered count when the sampled packet was sent */
+    uint64_t prior_time; /* Time of the last delivery before the sampled packet was sent */
+    uint64_t send_elapsed; /* Time to send the flight ending with the sampled packet */
+    uint64_t ack_elapsed; /* Time to acknowledge that flight */
+    uint64_t interval; /* Larger of send and ack elapsed time */
+    uint64_t delivered; /* Bytes delivered during the interval */
+    uint64_t acked_bytes; /* Bytes newly acknowledged by this acknowledgement */
+    uint64_t delivery_rate; /* In bytes per second, if valid */
+    unsigned int is_pending : 1; /* Packets were acknowledged, sample not yet generated */
+    unsigned int is_valid : 1; /* The interval is long enough to compute a rate */
+    unsigned int is_app_limited : 1; /* The sampled packet was sent while the path was app limited */
+    unsigned int has_prior : 1; /* The sampled packet recorded the delivery state when sent */
+} picoquic_rate_sample_t;
+
 /*
 * Per path context.
 * Path contexts are created:
@@ -695,7 +833,7 @@ typedef struct st_picoquic_path_t {
     unsigned int path_is_demoted : 1;
     unsigned int current_spin : 1;
     unsigned int path_is_registered : 1;
-    unsigned int last_bw_estimate_path_limited : 1;
+    unsigned int is_pacing_blocked : 1;
 
     /* number of retransmissions observed on path */
     uint64_t retrans_count;
@@ -720,11 +858,10 @@ typedef struct st_picoquic_path_t {
 
     /* Bandwidth measurement */
     uint64_t delivered; /* The total amount of data delivered so far on the path */
-    uint64_t delivered_last; /* Amount delivered by last bandwidth estimation */
     uint64_t delivered_time_last; /* time last delivered packet was delivered */
     uint64_t delivered_sent_last; /* time last delivered packet was sent */
-    uint64_t delivered_limited_index;
-    uint64_t delivered_last_packet;
+    uint64_t delivered_limited_index; /* If not zero, samples are app limited until delivered exceeds this value */
+    picoquic_rate_sample_t rate_sample; /* Delivery rate sample of the latest acknowledgement */
     uint64_t bandwidth_estimate; /* In bytes per second */
     uint64_t max_sample_acked_time; /* Time max sample was delivered */
     uint64_t max_sample_sent_time; /* Time max sample was sent */
@@ -744,23 +881,33 @@ typedef struct st_picoquic_path_t {
     uint64_t last_sender_limited_time;
     uint64_t last_time_acked_data_frame_sent;
     void* congestion_alg_state;
+    picoquic_hystart_stats_t hystart_stats;
 
     /*
-    * Pacing uses a set of per path variables:
+    * Pacing assigns an earliest departure time to each packet, using a set of per path variables:
     * - pacing_rate: bytes per second.
-    * - pacing_evaluation_time: last time the path was evaluated.
-    * - pacing_bucket_nanosec: number of nanoseconds of transmission time that are allowed.
-    * - pacing_bucket_max: maximum value (capacity) of the leaky bucket.
+    * - pacing_release_time_nanosec: virtual clock of the pacer. A full size packet may
+    *   depart at pacing_release_time_nanosec + pacing_packet_time_nanosec.
+    * - pacing_bucket_max: burst allowance, the pacer clock never lags current time by more than that.
     * - pacing_packet_time_nanosec: number of nanoseconds required to send a full size packet.
     * - pacing_packet_time_microsec: max of (packet_time_nano_sec/1024, 1) microsec.
+    * - pacing_horizon_nanosec: packets may be released that far ahead of their departure
+    *   time, when pacing is offloaded to the kernel.
     */
 
     uint64_t pacing_rate;
-    uint64_t pacing_evaluation_time;
-    int64_t pacing_bucket_nanosec;
+    int64_t pacing_release_time_nanosec;
     int64_t pacing_bucket_max;
     int64_t pacing_packet_time_nanosec;
     uint64_t pacing_packet_time_microsec;
+    uint64_t pacing_horizon_nanosec;
+    uint64_t pacing_blocked_time; /* Start of the current pacing wait, if is_pacing_blocked */
+
+    /* Multipath: per path packet numbers, used for loss detection, and scheduler state */
+    uint64_t path_packet_next;
+    uint64_t path_packet_acked;
+    uint32_t scheduler_weight;
+    uint64_t scheduler_charge;
 
     /* Loss bit data */
     uint64_t nb_losses_found;
@@ -811,10 +958,12 @@ typedef struct st_picoquic_packet_context_t {
     picoquic_packet_t* retransmit_oldest;
     picoquic_packet_t* retransmitted_newest;
     picoquic_packet_t* retransmitted_oldest;
+    uint64_t loss_timer; /* no packet can be declared lost before that time, 0 if unknown */
 
     unsigned int ack_needed : 1;
     unsigned int ack_of_ack_requested : 1;
     unsigned int ack_after_fin : 1;
+    unsigned int pto_probe_needed : 1; /* the probe timer expired, send new data even if the window is full */
 } picoquic_packet_context_t;
 
 /*
@@ -859,6 +1008,7 @@ typedef struct st_picoquic_cnx_t {
     unsigned int alt_path_challenge_needed : 1; /* If at least one alt path challenge is needed or in progress */
     unsigned int is_handshake_finished : 1; /* If there are no more packets to ack or retransmit in initial  or handshake contexts */
     unsigned int is_1rtt_received : 1; /* If at least one 1RTT packet has been received */
+    unsigned int is_logging : 1; /* Packets are traced in the text log, see picoquic_update_cnx_logging */
     unsigned int is_1rtt_acked : 1; /* If at least one 1RTT packet has been acked by the peer */
     unsigned int has_successful_probe : 1; /* At least one probe was successful */
     unsigned int grease_transport_parameters : 1; /* Exercise greasing of transport parameters */
@@ -872,6 +1022,7 @@ typedef struct st_picoquic_cnx_t {
     unsigned int is_ack_frequency_updated : 1; /* Should send an ack frequency frame asap. */
     unsigned int recycle_sooner_needed : 1; /* There may be a need to recycle "sooner" packets */
     unsigned int is_time_stamp_enabled : 1; /* Add time stamp before acks, read on incoming */
+    unsigned int is_multipath_enabled : 1; /* Use all validated paths concurrently */
     unsigned int is_pacing_update_requested : 1; /* Whether the application subscribed to pacing updates */
     unsigned int is_flow_control_limited : 1; /* Flow control window limited to initial value, mostly for tests */
 
@@ -920,6 +1071,9 @@ typedef struct st_picoquic_cnx_t {
     /* TLS context, TLS Send Buffer, streams, epochs */
     void* tls_ctx;
     uint64_t crypto_epoch_sequence;
+    uint64_t crypto_epoch_bytes; /* bytes sent with the current 1-RTT key phase */
+    uint64_t key_rotation_packets; /* Rotation policy, 0 if no limit */
+    uint64_t key_rotation_bytes;
     uint64_t crypto_rotation_sequence;
     uint64_t crypto_rotation_time_guard;
     struct st_ptls_buffer_t* tls_sendbuf;
@@ -944,6 +1098,15 @@ typedef struct st_picoquic_cnx_t {
     uint32_t nb_zero_rtt_received;
     uint64_t nb_retransmission_total;
     uint64_t nb_spurious;
+    uint64_t nb_crypto_key_rotations;
+#ifndef PICOQUIC_DISABLE_STATS
+    picoquic_stats_t stats;
+    picoquic_wake_reason_enum wake_reason; /* Reason for the scheduled wake time */
+    picoquic_wake_reason_enum wake_reason_next; /* Reason for the wake time being computed */
+    picoquic_send_limit_track_t send_limits; /* Time in each send limit state */
+    uint64_t send_limit_time; /* Time of the current prepare packet call */
+    unsigned int send_limit_flags; /* Limits found during the current call, one bit per state */
+#endif
     unsigned int cwin_blocked : 1;
     unsigned int flow_blocked : 1;
     unsigned int stream_blocked : 1;
@@ -955,13 +1118,37 @@ typedef struct st_picoquic_cnx_t {
     uint64_t ecn_ect0_total_remote;
     uint64_t ecn_ect1_total_remote;
     uint64_t ecn_ce_total_remote;
+    /* ECN validation, RFC 9000 section 13.4.2 */
+    uint8_t ecn_codepoint; /* Codepoint requested by the application */
+    picoquic_ecn_state_t ecn_state;
+    uint64_t ecn_ect0_sent;
+    uint64_t ecn_ect1_sent;
+    uint64_t ecn_testing_sent;
+    uint64_t ecn_testing_lost;
+    uint64_t ecn_marked_acked;
+    uint64_t ecn_newly_acked;
 
     /* Congestion algorithm */
     picoquic_congestion_algorithm_t const* congestion_alg;
+    picoquic_path_scheduler_t const* path_scheduler;
     uint64_t pacing_rate_signalled;
     uint64_t pacing_increase_threshold;
     uint64_t pacing_decrease_threshold;
 
+    /* Congestion control telemetry */
+    picoquic_cc_telemetry_fn cc_telemetry_fn;
+    void* cc_telemetry_ctx;
+    uint64_t cc_telemetry_interval;
+    uint64_t cc_telemetry_next_time;
+    uint64_t cc_telemetry_nb_retransmission;
+    uint64_t cc_telemetry_cc_state;
+
+    /* Binary log policy */
+    picoquic_binlog_mode_enum binlog_mode;
+    struct st_picoquic_binlog_retro_t* binlog_retro;
+    uint64_t binlog_spurious_window_start;
+    uint64_t binlog_spurious_in_window;
+
     /* Flow control information */
     uint64_t data_sent;
     uint64_t data_received;
@@ -1006,6 +1193,7 @@ typedef struct st_picoquic_cnx_t {
     uint64_t local_cnxid_sequence_next;
     int nb_local_cnxid;
     picoquic_local_cnxid_t* local_cnxid_first;
+    uint32_t cid_slot; /* Index in the routable CID slot table, or PICOQUIC_CID_SLOT_NONE */
 
     /* Management of ACK frequency */
     uint64_t ack_frequency_sequence_local;
@@ -1025,10 +1213,6 @@ typedef struct st_picoquic_packet_data_t {
     uint64_t last_ack_delay; /* ACK Delay in ACK frame */
     uint64_t last_time_stamp_received;
     uint64_t largest_sent_time; /* Send time of ACKed packet (largest number acked) */
-    uint64_t delivered_prior; /* Amount delivered prior to that packet */
-    uint64_t delivered_time_prior; /* Time last delivery before acked packet sent */
-    uint64_t delivered_sent_prior; /* Time this last delivery packet was sent */
-    int rs_is_path_limited; /* Whether the path was app limited when packet was sent */
 } picoquic_packet_data_t;
 
 /* Load the stash of retry tokens. */
@@ -1092,15 +1276,20 @@ picoquic_cnx_t* picoquic_cnx_by_secret(picoquic_quic_t* quic, uint8_t* reset_sec
 
 /* Reset the pacing data after CWIN is updated */
 void picoquic_update_pacing_data(picoquic_cnx_t* cnx, picoquic_path_t * path_x, int slow_start);
-void picoquic_update_pacing_after_send(picoquic_path_t* path_x, uint64_t current_time);
-int picoquic_is_sending_authorized_by_pacing(picoquic_path_t* path_x, uint64_t current_time, uint64_t* next_time);
+uint64_t picoquic_update_pacing_after_send(picoquic_path_t* path_x, uint64_t current_time);
+int picoquic_is_sending_authorized_by_pacing(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time, uint64_t* next_time);
 /* Reset pacing data if congestion algorithm computes it directly */
-void picoquic_update_pacing_rate(picoquic_cnx_t* cnx, picoquic_path_t* path_x, double pacing_rate, uint64_t quantum);
+void picoquic_update_pacing_rate(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t pacing_rate, uint64_t quantum);
+/* Deliver congestion control telemetry to the subscribed application, if any */
+void picoquic_cc_telemetry_check(picoquic_cnx_t* cnx, uint64_t current_time);
 
 /* Next time is used to order the list of available connections,
         * so ready connections are polled first */
 void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time);
 
+/* Start key rotation if required by policy, precompute the keys of the next phase */
+void picoquic_manage_key_rotation(picoquic_cnx_t* cnx);
+
 /* Integer parsing macros */
 #define PICOPARSE_16(b) ((((uint16_t)(b)[0]) << 8) | (uint16_t)((b)[1]))
 #define PICOPARSE_24(b) ((((uint32_t)PICOPARSE_16(b)) << 8) | (uint32_t)((b)[2]))
@@ -1158,6 +1347,13 @@ uint64_t picoquic_get_packet_number64(uint64_t highest, uint64_t mask, uint32_t
 
 void picoquic_log_pn_dec_trial(picoquic_cnx_t* cnx); /* For debugging potential PN_ENC corruption */
 
+/* ECN validation */
+#define PICOQUIC_ECN_TESTING_PACKETS 10
+uint8_t picoquic_ecn_codepoint_to_send(picoquic_cnx_t* cnx);
+void picoquic_ecn_packet_sent(picoquic_cnx_t* cnx, picoquic_packet_t* packet, uint8_t ecn_codepoint);
+void picoquic_ecn_packet_lost(picoquic_cnx_t* cnx, picoquic_packet_t* packet);
+void picoquic_ecn_validate(picoquic_cnx_t* cnx, int is_ecn);
+
 void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx, picoquic_packet_t * packet, int ret,
     size_t length, size_t header_length, size_t checksum_overhead,
     size_t * send_length, uint8_t * send_buffer, size_t send_buffer_max,
@@ -1194,6 +1390,10 @@ void picoquic_log_packet_address(FILE* F, uint64_t log_cnxid64, picoquic_cnx_t*
     struct sockaddr* addr_peer, int receiving, size_t length, uint64_t current_time);
 
 void picoquic_log_prefix_initial_cid64(FILE* F, uint64_t log_cnxid64);
+void picoquic_log_address(FILE* F, struct sockaddr* addr_peer);
+void picoquic_log_packet_header(FILE* F, uint64_t log_cnxid64, picoquic_packet_header* ph, int receiving);
+void picoquic_log_frames(FILE* F, uint64_t cnx_id64, uint8_t* bytes, size_t length);
+char const* picoquic_log_frame_names(uint64_t frame_type);
 
 void picoquic_log_error_packet(FILE* F, uint8_t* bytes, size_t bytes_max, int ret);
 void picoquic_log_processing(FILE* F, picoquic_cnx_t* cnx, size_t length, int ret);
@@ -1211,6 +1411,9 @@ void picoquic_log_time(FILE* F, picoquic_cnx_t* cnx, uint64_t current_time,
     const char* label1, const char* label2);
 
 #define PICOQUIC_SET_LOG(quic, F) (quic)->F_log = (void*)(F)
+#define PICOQUIC_TEXTLOG_PACKETS(quic) ((quic)->F_log != NULL && !(quic)->is_textlog_deferred)
+#define PICOQUIC_BINLOG_IS_OPEN(quic) ((quic)->f_binlog != NULL || (quic)->binlog_sink != NULL)
+void picoquic_update_cnx_logging(picoquic_cnx_t* cnx);
 
 /* handling of ACK logic */
 int picoquic_is_ack_needed(picoquic_cnx_t* cnx, uint64_t current_time, uint64_t * next_wake_time, picoquic_packet_context_enum pc);
@@ -1242,6 +1445,29 @@ uint64_t picoquic_compute_ack_gap(picoquic_cnx_t* cnx, uint64_t data_rate);
 
 uint64_t picoquic_compute_ack_delay_max(uint64_t rtt, uint64_t remote_min_ack_delay);
 
+/* Delivery rate sampler, shared by all congestion controllers.
+ * - packet_sent records the path delivery state in each sent packet,
+ * - packet_acked accounts each newly acknowledged packet,
+ * - generate closes the sample after all acknowledgements in a packet are processed,
+ * - app_limited marks that the application did not have enough data to fill the window.
+ */
+void picoquic_rate_sampler_packet_sent(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* packet, uint64_t current_time);
+void picoquic_rate_sampler_packet_acked(picoquic_path_t* path_x, picoquic_packet_t* packet, uint64_t current_time);
+void picoquic_rate_sampler_generate(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time);
+void picoquic_rate_sampler_app_limited(picoquic_path_t* path_x);
+
+/* Send limit tracking, see picoquic_get_send_limits.
+ * - init sets the initial state of a connection or stream,
+ * - update sets the state of the connection at the end of picoquic_prepare_packet,
+ * - stream_send_limit_update notes the state of a stream examined by the scheduler,
+ * - stream_send_limits returns the times of a stream, as picoquic_get_stream_send_limits.
+ */
+void picoquic_send_limit_init(picoquic_send_limit_track_t* track, picoquic_send_limit_enum state, uint64_t current_time);
+void picoquic_send_limit_update(picoquic_cnx_t* cnx, size_t send_length, uint64_t current_time);
+void picoquic_stream_send_limit_update(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, picoquic_send_limit_enum limit);
+void picoquic_stream_send_limits(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, uint64_t current_time, picoquic_send_limits_t* limits);
+void picoquic_estimate_max_path_bandwidth(picoquic_path_t* path_x, uint64_t send_time, uint64_t delivery_time);
+
 /* Update the path RTT upon receiving an explict or implicit acknowledgement */
 void picoquic_update_path_rtt(picoquic_cnx_t* cnx, picoquic_path_t * old_path, uint64_t send_time,
     uint64_t current_time, uint64_t ack_delay);
@@ -1324,6 +1550,11 @@ uint8_t* picoquic_format_max_streams_frame_if_needed(picoquic_cnx_t* cnx, uint8_
 void picoquic_clear_stream(picoquic_stream_head_t* stream);
 void picoquic_delete_stream(picoquic_cnx_t * cnx, picoquic_stream_head_t * stream);
 picoquic_local_cnxid_t* picoquic_create_local_cnxid(picoquic_cnx_t* cnx, picoquic_connection_id_t* suggested_value);
+void picoquic_clear_routable_cid(picoquic_quic_t* quic);
+uint32_t picoquic_cid_slot_alloc(picoquic_quic_t* quic, picoquic_cnx_t* cnx);
+void picoquic_cid_slot_free(picoquic_quic_t* quic, uint32_t slot);
+void picoquic_create_routable_cnx_id(picoquic_quic_t* quic, uint32_t slot, picoquic_connection_id_t* cnx_id);
+picoquic_cnx_t* picoquic_cnx_by_routable_id(picoquic_quic_t* quic, const picoquic_connection_id_t* cnx_id);
 void picoquic_delete_local_cnxid(picoquic_cnx_t* cnx, picoquic_local_cnxid_t* l_cid);
 void picoquic_retire_local_cnxid(picoquic_cnx_t* cnx, uint64_t sequence);
 picoquic_local_cnxid_t* picoquic_find_local_cnxid(picoquic_cnx_t* cnx, picoquic_connection_id_t* cnxid);
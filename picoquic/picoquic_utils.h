@@ -23,6 +23,8 @@
 #define PICOQUIC_UTILS_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include "picoquic.h"
 
@@ -145,6 +147,7 @@ FILE * picoquic_file_close(FILE * F);
 
 /* Skip and decoding functions */
 uint8_t* picoquic_frames_fixed_skip(uint8_t * bytes, const uint8_t * bytes_max, size_t size);
+const uint8_t* picoquic_skip_repeated_bytes(const uint8_t* bytes, const uint8_t* bytes_max);
 uint8_t* picoquic_frames_varint_skip(uint8_t * bytes, const uint8_t * bytes_max);
 uint8_t* picoquic_frames_varint_decode(uint8_t * bytes, const uint8_t * bytes_max, uint64_t * n64);
 uint8_t* picoquic_frames_varlen_decode(uint8_t * bytes, const uint8_t * bytes_max, size_t * n);
@@ -157,6 +160,30 @@ uint8_t* picoquic_frames_cid_decode(uint8_t * bytes, const uint8_t * bytes_max,
 
 #define VARINT_LEN(bytes) ((size_t)1 << (((bytes)[0] & 0xC0) >> 6))
 
+/* Branch free decoding of a varint of known length, used when at least 8 bytes
+ * are available: load 8 bytes in network order, shift the varint into the low
+ * bits, and mask the 2-bit length prefix.
+ */
+static inline uint64_t picoquic_varint_decode_wide(const uint8_t* bytes, size_t length)
+{
+    uint64_t v;
+#if defined(_MSC_VER)
+    memcpy(&v, bytes, sizeof(v));
+    v = _byteswap_uint64(v);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&v, bytes, sizeof(v));
+    v = __builtin_bswap64(v);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(&v, bytes, sizeof(v));
+#else
+    v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | bytes[i];
+    }
+#endif
+    return (v >> (64 - 8 * length)) & (UINT64_MAX >> (66 - 8 * length));
+}
+
 /* Encoding functions of the form uint8_t * picoquic_frame_XXX_encode(uint8_t * bytes, uint8_t * bytes-max, ...)
  */
 uint8_t* picoquic_frames_varint_encode(uint8_t* bytes, const uint8_t* bytes_max, uint64_t n64);
@@ -199,6 +226,8 @@ typedef struct st_picoquic_event_t {
 
 int picoquic_create_thread(picoquic_thread_t* thread, picoquic_thread_fn thread_fn, void* arg);
 void picoquic_delete_thread(picoquic_thread_t* thread);
+/* Unlike picoquic_delete_thread, never terminates the thread, for threads that must finish their work */
+void picoquic_join_thread(picoquic_thread_t* thread);
 
 int picoquic_create_mutex(picoquic_mutex_t* mutex);
 int picoquic_delete_mutex(picoquic_mutex_t* mutex);
@@ -233,6 +262,7 @@ typedef struct st_picoquictest_sim_packet_t {
     struct st_picoquictest_sim_packet_t* next_packet;
     uint64_t arrival_time;
     size_t length;
+    unsigned char ecn_mark;
     struct sockaddr_storage addr_from;
     struct sockaddr_storage addr_to;
     uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
@@ -249,6 +279,11 @@ typedef struct st_picoquictest_sim_link_t {
     uint64_t packets_sent;
     uint64_t jitter;
     uint64_t jitter_seed;
+    uint64_t ecn_threshold; /* Classic AQM: mark ECT(0) packets CE if queue delay above threshold */
+    uint64_t l4s_threshold; /* L4S AQM: mark ECT(1) packets CE if queue delay above threshold */
+    uint64_t packets_ce_marked;
+    int ecn_bleach; /* If set, clear the ECN bits of all packets */
+    int reorder; /* If set, packets are delivered by order of arrival time, which jitter may reorder */
     picoquictest_sim_packet_t* first_packet;
     picoquictest_sim_packet_t* last_packet;
 } picoquictest_sim_link_t;
@@ -21,6 +21,10 @@
 
 #include "picosocks.h"
 #include "picoquic_utils.h"
+#if defined(__linux__)
+#include <time.h>
+#include <linux/net_tstamp.h>
+#endif
 
 int picoquic_bind_to_port(SOCKET_TYPE fd, int af, int port)
 {
@@ -90,18 +94,18 @@ static int picoquic_socket_set_pkt_info(SOCKET_TYPE sd, int af)
     return ret;
 }
 
-int picoquic_socket_set_ecn_options(SOCKET_TYPE sd, int af, int * recv_set, int * send_set)
+int picoquic_socket_set_ecn_options(SOCKET_TYPE sd, int af, uint8_t ecn_codepoint, int * recv_set, int * send_set)
 {
     int ret = -1;
 #ifdef _WINDOWS
 
     if (af == AF_INET6) {
 
-        /* Request setting ECN_1 in outgoing packets */
+        /* Request setting the ECN codepoint in outgoing packets */
 #if defined(IPV6_TCLASS)
         {
-            DWORD ecn = 2;
-            /* Request setting ECN_1 in outgoing packets */
+            DWORD ecn = ecn_codepoint & 0x03;
+            /* Request setting the ECN codepoint in outgoing packets */
             ret = setsockopt(sd, IPPROTO_IPV6, IPV6_TCLASS, (char *)&ecn, sizeof(ecn));
             if (ret < 0) {
                 DBG_PRINTF("setsockopt IPV6_TCLASS (0x%x) fails, errno: %d\n", ecn, GetLastError());
@@ -147,8 +151,8 @@ int picoquic_socket_set_ecn_options(SOCKET_TYPE sd, int af, int * recv_set, int
     else {
 #if defined(IP_TOS)
         {
-            DWORD ecn = 2;
-            /* Request setting ECN_1 in outgoing packets */
+            DWORD ecn = ecn_codepoint & 0x03;
+            /* Request setting the ECN codepoint in outgoing packets */
             ret = setsockopt(sd, IPPROTO_IP, IP_TOS, (char *)&ecn, sizeof(ecn));
             if (ret < 0) {
                 DBG_PRINTF("setsockopt IP_TOS (0x%x) fails, errno: %d\n", ecn, GetLastError());
@@ -203,8 +207,8 @@ int picoquic_socket_set_ecn_options(SOCKET_TYPE sd, int af, int * recv_set, int
     if (af == AF_INET6) {
 #if defined(IPV6_TCLASS)
         {
-            unsigned int ecn = 2; /* ECN_ECT_0 */
-            /* Request setting ECN_1 in outgoing packets */
+            unsigned int ecn = ecn_codepoint & 0x03;
+            /* Request setting the ECN codepoint in outgoing packets */
             if (setsockopt(sd, IPPROTO_IPV6, IPV6_TCLASS, &ecn, sizeof(ecn)) < 0) {
                 DBG_PRINTF("setsockopt IPV6_TCLASS (0x%x) fails, errno: %d\n", ecn, errno);
                 *send_set = 0;
@@ -241,8 +245,8 @@ int picoquic_socket_set_ecn_options(SOCKET_TYPE sd, int af, int * recv_set, int
     else {
 #if defined(IP_TOS)
         {
-            unsigned int ecn = 2;
-            /* Request setting ECN_1 in outgoing packets */
+            unsigned int ecn = ecn_codepoint & 0x03;
+            /* Request setting the ECN codepoint in outgoing packets */
             if (setsockopt(sd, IPPROTO_IP, IP_TOS, &ecn, sizeof(ecn)) < 0) {
                 DBG_PRINTF("setsockopt IPv4 IP_TOS (0x%x) fails, errno: %d\n", ecn, errno);
                 *send_set = 0;
@@ -761,13 +765,63 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
 }
 #endif
 
+/* Request that the departure time of packets be passed to the kernel,
+ * using the monotonic clock. The fq qdisc holds each packet until its
+ * departure time. Returns -1 if SO_TXTIME is not supported.
+ */
+int picoquic_socket_set_txtime(SOCKET_TYPE sd)
+{
+    int ret = -1;
+#if defined(SO_TXTIME) && !defined(_WINDOWS)
+    struct sock_txtime txtime_cfg;
+
+    memset(&txtime_cfg, 0, sizeof(txtime_cfg));
+    txtime_cfg.clockid = CLOCK_MONOTONIC;
+    txtime_cfg.flags = 0;
+
+    if (setsockopt(sd, SOL_SOCKET, SO_TXTIME, &txtime_cfg, sizeof(txtime_cfg)) < 0) {
+        DBG_PRINTF("setsockopt SO_TXTIME fails, errno: %d\n", errno);
+    }
+    else {
+        ret = 0;
+    }
+#else
+    (void)sd;
+#endif
+    return ret;
+}
+
+/* Convert a departure time in the picoquic time base, in nanoseconds, to a
+ * kernel transmit time. Returns 0 if the packet can depart immediately.
+ */
+static uint64_t picoquic_get_txtime(uint64_t departure_time, uint64_t current_time)
+{
+    uint64_t txtime = 0;
+#if defined(SO_TXTIME) && !defined(_WINDOWS)
+    uint64_t now_nanosec = current_time * 1000;
+
+    if (departure_time > now_nanosec) {
+        struct timespec ts;
+
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+            txtime = ((uint64_t)ts.tv_sec) * 1000000000ull + (uint64_t)ts.tv_nsec + (departure_time - now_nanosec);
+        }
+    }
+#else
+    (void)departure_time;
+    (void)current_time;
+#endif
+    return txtime;
+}
+
 int picoquic_sendmsg(SOCKET_TYPE fd,
     struct sockaddr* addr_dest,
     socklen_t dest_length,
     struct sockaddr* addr_from,
     socklen_t from_length,
     unsigned long dest_if,
-    const char* bytes, int length)
+    const char* bytes, int length,
+    uint64_t txtime, int ecn_codepoint)
 #ifdef _WINDOWS
 {
     GUID WSASendMsg_GUID = WSAID_WSASENDMSG;
@@ -783,6 +837,8 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
     int last_error;
     WSACMSGHDR* cmsg;
 
+    (void)txtime;
+
     ret = WSAIoctl(fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
         &WSASendMsg_GUID, sizeof WSASendMsg_GUID,
         &WSASendMsg, sizeof WSASendMsg,
@@ -863,6 +919,32 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
             }
         }
 
+        if (ecn_codepoint >= 0) {
+            /* Set the ECN bits of this datagram, overriding the socket default */
+            WSACMSGHDR* cmsg_e = (WSACMSGHDR*)(cmsg_buffer + control_length);
+
+            memset(cmsg_e, 0, WSA_CMSG_SPACE(sizeof(int)));
+            if (addr_dest->sa_family == AF_INET6) {
+                cmsg_e->cmsg_level = IPPROTO_IPV6;
+#ifdef IPV6_ECN
+                cmsg_e->cmsg_type = IPV6_ECN;
+#else
+                cmsg_e->cmsg_type = IPV6_TCLASS;
+#endif
+            }
+            else {
+                cmsg_e->cmsg_level = IPPROTO_IP;
+#ifdef IP_ECN
+                cmsg_e->cmsg_type = IP_ECN;
+#else
+                cmsg_e->cmsg_type = IP_TOS;
+#endif
+            }
+            cmsg_e->cmsg_len = WSA_CMSG_LEN(sizeof(int));
+            *((int *)WSA_CMSG_DATA(cmsg_e)) = ecn_codepoint & 0x03;
+            control_length += WSA_CMSG_SPACE(sizeof(int));
+        }
+
         msg.Control.len = control_length;
         if (control_length == 0) {
             msg.Control.buf = NULL;
@@ -1020,6 +1102,40 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
 
     }
 
+#ifdef SCM_TXTIME
+    if (txtime != 0) {
+        struct cmsghdr* cmsg_t = (struct cmsghdr*)(cmsg_buffer + control_length);
+
+        memset(cmsg_t, 0, CMSG_SPACE(sizeof(uint64_t)));
+        cmsg_t->cmsg_level = SOL_SOCKET;
+        cmsg_t->cmsg_type = SCM_TXTIME;
+        cmsg_t->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        memcpy(CMSG_DATA(cmsg_t), &txtime, sizeof(uint64_t));
+        control_length += CMSG_SPACE(sizeof(uint64_t));
+    }
+#else
+    (void)txtime;
+#endif
+
+    if (ecn_codepoint >= 0) {
+        /* Set the ECN bits of this datagram, overriding the socket default */
+        struct cmsghdr* cmsg_e = (struct cmsghdr*)(cmsg_buffer + control_length);
+        int tos = ecn_codepoint & 0x03;
+
+        memset(cmsg_e, 0, CMSG_SPACE(sizeof(int)));
+        if (addr_dest->sa_family == AF_INET6) {
+            cmsg_e->cmsg_level = IPPROTO_IPV6;
+            cmsg_e->cmsg_type = IPV6_TCLASS;
+        }
+        else {
+            cmsg_e->cmsg_level = IPPROTO_IP;
+            cmsg_e->cmsg_type = IP_TOS;
+        }
+        cmsg_e->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg_e), &tos, sizeof(int));
+        control_length += CMSG_SPACE(sizeof(int));
+    }
+
     msg.msg_controllen = control_length;
     if (control_length == 0) {
         msg.msg_control = NULL;
@@ -1117,9 +1233,20 @@ int picoquic_send_through_socket(
     struct sockaddr* addr_dest,
     struct sockaddr* addr_from, unsigned long from_if,
     const char* bytes, int length)
+{
+    return picoquic_send_through_socket_at(fd, addr_dest, addr_from, from_if, bytes, length, 0, 0, -1);
+}
+
+int picoquic_send_through_socket_at(
+    SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    struct sockaddr* addr_from, unsigned long from_if,
+    const char* bytes, int length,
+    uint64_t departure_time, uint64_t current_time, int ecn_codepoint)
 {
     int sent = picoquic_sendmsg(fd, addr_dest, picoquic_addr_length(addr_dest),
-        addr_from, picoquic_addr_length(addr_from), from_if, bytes, length);
+        addr_from, (addr_from == NULL) ? 0 : picoquic_addr_length(addr_from), from_if, bytes, length,
+        picoquic_get_txtime(departure_time, current_time), ecn_codepoint);
 
 #ifndef DISABLE_DEBUG_PRINTF
     if (sent <= 0) {
@@ -1141,11 +1268,22 @@ int picoquic_send_through_server_sockets(
     struct sockaddr* addr_dest,
     struct sockaddr* addr_from, unsigned long from_if,
     const char* bytes, int length)
+{
+    return picoquic_send_through_server_sockets_at(sockets, addr_dest, addr_from, from_if, bytes, length, 0, 0, -1);
+}
+
+int picoquic_send_through_server_sockets_at(
+    picoquic_server_sockets_t* sockets,
+    struct sockaddr* addr_dest,
+    struct sockaddr* addr_from, unsigned long from_if,
+    const char* bytes, int length,
+    uint64_t departure_time, uint64_t current_time, int ecn_codepoint)
 {
     /* Both Linux and Windows use separate sockets for V4 and V6 */
     int socket_index = (addr_dest->sa_family == AF_INET) ? 1 : 0;
 
-    return picoquic_send_through_socket(sockets->s_socket[socket_index], addr_dest, addr_from, from_if, bytes, length);
+    return picoquic_send_through_socket_at(sockets->s_socket[socket_index], addr_dest, addr_from, from_if, bytes, length,
+        departure_time, current_time, ecn_codepoint);
 }
 
 int picoquic_get_server_address(const char* ip_address_text, int server_port,
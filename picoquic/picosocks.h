@@ -152,7 +152,9 @@ int picoquic_open_server_sockets(picoquic_server_sockets_t* sockets, int port);
 
 void picoquic_close_server_sockets(picoquic_server_sockets_t* sockets);
 
-int picoquic_socket_set_ecn_options(SOCKET_TYPE sd, int af, int * recv_set, int * send_set);
+/* Enable the reception of ECN marks, and set the ECN codepoint of outgoing packets,
+ * e.g., to the one configured with picoquic_set_default_ecn_codepoint() */
+int picoquic_socket_set_ecn_options(SOCKET_TYPE sd, int af, uint8_t ecn_codepoint, int * recv_set, int * send_set);
 
 int picoquic_select(SOCKET_TYPE* sockets, int nb_sockets,
     struct sockaddr_storage* addr_from,
@@ -171,12 +173,36 @@ int picoquic_send_through_socket(
     struct sockaddr* addr_from, unsigned long from_if,
     const char* bytes, int length);
 
+/* Pacing offload. After picoquic_socket_set_txtime() succeeds, packets sent with
+ * picoquic_send_through_socket_at() are held by the kernel until their departure
+ * time, as returned by picoquic_get_last_departure_time(). The departure time is
+ * in nanoseconds, in the time base of "current_time" (microseconds).
+ * If ecn_codepoint is not negative, it sets the ECN bits of the datagram, e.g. to
+ * the value returned by picoquic_get_last_ecn_codepoint(), overriding the value
+ * set with picoquic_socket_set_ecn_options().
+ */
+int picoquic_socket_set_txtime(SOCKET_TYPE sd);
+
+int picoquic_send_through_socket_at(
+    SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    struct sockaddr* addr_from, unsigned long from_if,
+    const char* bytes, int length,
+    uint64_t departure_time, uint64_t current_time, int ecn_codepoint);
+
 int picoquic_send_through_server_sockets(
     picoquic_server_sockets_t* sockets,
     struct sockaddr* addr_dest, 
     struct sockaddr* addr_from, unsigned long from_if,
     const char* bytes, int length);
 
+int picoquic_send_through_server_sockets_at(
+    picoquic_server_sockets_t* sockets,
+    struct sockaddr* addr_dest,
+    struct sockaddr* addr_from, unsigned long from_if,
+    const char* bytes, int length,
+    uint64_t departure_time, uint64_t current_time, int ecn_codepoint);
+
 int picoquic_get_server_address(const char* ip_address_text, int server_port,
     struct sockaddr_storage* server_address,
     int* server_addr_length,
@@ -0,0 +1,268 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include "cc_common.h"
+
+/*
+Implementation of a scalable congestion control for L4S, following the
+DCTCP algorithm (RFC 8257) as adapted by TCP Prague
+(draft-briscoe-iccrg-prague-congestion-control).
+
+L4S bottlenecks mark packets sent with ECT(1) as "congestion experienced"
+as soon as a shallow queue builds up. Instead of halving the window on each
+CE mark, as classic controllers do, the sender maintains an estimate "alpha"
+of the fraction of packets that were marked, updated once per round trip as
+a moving average with gain 1/16. On the first CE mark of a round trip, the
+window is reduced by alpha/2. A few marks per round trip thus cause small
+reductions, which keeps the queue short without losing throughput.
+
+The window increases by one packet per round trip, as in Reno. Alpha starts
+at 1, so that the first CE mark causes the window to be halved, ending slow
+start just like a loss would. Losses and timeouts are treated as in New Reno,
+which is the fallback behavior when the path does not support L4S.
+
+The peer's ECN counts are only meaningful if the application asked for ECT(1)
+marks, see picoquic_set_ecn_codepoint().
+*/
+
+#define PRAGUE_ALPHA_SHIFT 10
+#define PRAGUE_ALPHA_ONE (1 << PRAGUE_ALPHA_SHIFT)
+#define PRAGUE_G_SHIFT 4
+
+typedef enum {
+    picoquic_prague_alg_slow_start = 0,
+    picoquic_prague_alg_congestion_avoidance
+} picoquic_prague_alg_state_t;
+
+typedef struct st_picoquic_prague_state_t {
+    picoquic_prague_alg_state_t alg_state;
+    uint64_t residual_ack;
+    uint64_t ssthresh;
+    uint64_t recovery_start;
+    uint64_t recovery_sequence;
+    uint64_t alpha;
+    uint64_t round_sequence;
+    uint64_t round_ce_start;
+    uint64_t round_ecn_start;
+    picoquic_hystart_pp_t hystart;
+} picoquic_prague_state_t;
+
+static void picoquic_prague_init(picoquic_path_t* path_x, uint64_t current_time)
+{
+    picoquic_prague_state_t* pr_state = (picoquic_prague_state_t*)malloc(sizeof(picoquic_prague_state_t));
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(current_time);
+#endif
+
+    if (pr_state != NULL) {
+        memset(pr_state, 0, sizeof(picoquic_prague_state_t));
+        path_x->congestion_alg_state = (void*)pr_state;
+        pr_state->alg_state = picoquic_prague_alg_slow_start;
+        pr_state->ssthresh = UINT64_MAX;
+        pr_state->alpha = PRAGUE_ALPHA_ONE;
+        picoquic_hystart_pp_init(&pr_state->hystart);
+        path_x->cwin = PICOQUIC_CWIN_INITIAL;
+    }
+    else {
+        path_x->congestion_alg_state = NULL;
+    }
+}
+
+/* Once per round trip, update alpha with the fraction of packets that the
+ * peer reported as CE marked during the round.
+ */
+static void picoquic_prague_update_alpha(picoquic_cnx_t* cnx, picoquic_prague_state_t* pr_state)
+{
+    uint64_t ecn_total = cnx->ecn_ect0_total_remote + cnx->ecn_ect1_total_remote + cnx->ecn_ce_total_remote;
+
+    if (picoquic_cc_get_ack_number(cnx) >= pr_state->round_sequence) {
+        uint64_t delta_ecn = ecn_total - pr_state->round_ecn_start;
+
+        if (delta_ecn > 0) {
+            uint64_t delta_ce = cnx->ecn_ce_total_remote - pr_state->round_ce_start;
+            uint64_t fraction = (delta_ce << PRAGUE_ALPHA_SHIFT) / delta_ecn;
+
+            if (fraction > PRAGUE_ALPHA_ONE) {
+                fraction = PRAGUE_ALPHA_ONE;
+            }
+            if (fraction >= pr_state->alpha) {
+                pr_state->alpha += (fraction - pr_state->alpha) >> PRAGUE_G_SHIFT;
+            }
+            else {
+                pr_state->alpha -= (pr_state->alpha - fraction) >> PRAGUE_G_SHIFT;
+            }
+        }
+        pr_state->round_sequence = picoquic_cc_get_sequence_number(cnx);
+        pr_state->round_ce_start = cnx->ecn_ce_total_remote;
+        pr_state->round_ecn_start = ecn_total;
+    }
+}
+
+static int picoquic_prague_is_in_recovery(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_prague_state_t* pr_state, uint64_t current_time)
+{
+    return (current_time - pr_state->recovery_start <= path_x->smoothed_rtt &&
+        pr_state->recovery_sequence > picoquic_cc_get_ack_number(cnx));
+}
+
+static void picoquic_prague_enter_recovery(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification, picoquic_prague_state_t* pr_state, uint64_t current_time)
+{
+    if (notification == picoquic_congestion_notification_ecn_ec) {
+        /* Reduce the window in proportion of the fraction of CE marks */
+        uint64_t reduction = (path_x->cwin * pr_state->alpha) >> (PRAGUE_ALPHA_SHIFT + 1);
+        pr_state->ssthresh = path_x->cwin - reduction;
+    }
+    else {
+        pr_state->ssthresh = path_x->cwin / 2;
+    }
+    if (pr_state->ssthresh < PICOQUIC_CWIN_MINIMUM) {
+        pr_state->ssthresh = PICOQUIC_CWIN_MINIMUM;
+    }
+
+    if (notification == picoquic_congestion_notification_timeout) {
+        path_x->cwin = PICOQUIC_CWIN_MINIMUM;
+        pr_state->alg_state = picoquic_prague_alg_slow_start;
+    }
+    else {
+        path_x->cwin = pr_state->ssthresh;
+        pr_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+    }
+
+    pr_state->recovery_start = current_time;
+    pr_state->recovery_sequence = picoquic_cc_get_sequence_number(cnx);
+    picoquic_hystart_pp_exit(&pr_state->hystart);
+    pr_state->residual_ack = 0;
+}
+
+/* L4S bottlenecks mark packets as soon as the queue exceeds a fraction of a
+ * millisecond, so the default pacing quantum of a quarter window would cause
+ * spurious marks. Prague paces packets in bursts of at most 2 packets.
+ */
+static void picoquic_prague_update_pacing(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_prague_state_t* pr_state)
+{
+    if (path_x->smoothed_rtt == 0) {
+        picoquic_update_pacing_data(cnx, path_x, 1);
+    }
+    else {
+        uint64_t pacing_rate = (path_x->cwin * 1000000) / path_x->smoothed_rtt;
+
+        pacing_rate = (pr_state->alg_state == picoquic_prague_alg_slow_start) ? 2 * pacing_rate : (pacing_rate * 6) / 5;
+        picoquic_update_pacing_rate(cnx, path_x, pacing_rate, 2ull * path_x->send_mtu);
+    }
+}
+
+static void picoquic_prague_notify(
+    picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    uint64_t rtt_measurement,
+    uint64_t one_way_delay,
+    uint64_t nb_bytes_acknowledged,
+    uint64_t lost_packet_number,
+    uint64_t current_time)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(lost_packet_number);
+#endif
+    picoquic_prague_state_t* pr_state = (picoquic_prague_state_t*)path_x->congestion_alg_state;
+
+    if (pr_state != NULL) {
+        switch (notification) {
+        case picoquic_congestion_notification_acknowledgement:
+            picoquic_prague_update_alpha(cnx, pr_state);
+            if (pr_state->alg_state == picoquic_prague_alg_slow_start) {
+                if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
+                    picoquic_hystart_pp_increase(&pr_state->hystart, path_x, nb_bytes_acknowledged);
+                }
+                if (path_x->cwin >= pr_state->ssthresh) {
+                    pr_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+                }
+            }
+            else {
+                uint64_t complete_delta = nb_bytes_acknowledged * path_x->send_mtu + pr_state->residual_ack;
+                pr_state->residual_ack = complete_delta % path_x->cwin;
+                path_x->cwin += complete_delta / path_x->cwin;
+            }
+            break;
+        case picoquic_congestion_notification_ecn_ec:
+        case picoquic_congestion_notification_repeat:
+        case picoquic_congestion_notification_timeout:
+            if (!picoquic_prague_is_in_recovery(cnx, path_x, pr_state, current_time)) {
+                picoquic_prague_enter_recovery(cnx, path_x, notification, pr_state, current_time);
+            }
+            break;
+        case picoquic_congestion_notification_spurious_repeat:
+            if (picoquic_prague_is_in_recovery(cnx, path_x, pr_state, current_time) &&
+                path_x->cwin < 2 * pr_state->ssthresh) {
+                path_x->cwin = 2 * pr_state->ssthresh;
+                pr_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+            }
+            break;
+        case picoquic_congestion_notification_rtt_measurement:
+            if (pr_state->alg_state == picoquic_prague_alg_slow_start &&
+                pr_state->ssthresh == UINT64_MAX &&
+                picoquic_hystart_pp_test(&pr_state->hystart, cnx, path_x,
+                    (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement, current_time)) {
+                pr_state->ssthresh = path_x->cwin;
+                pr_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+            }
+            break;
+        default:
+            /* ignore */
+            break;
+        }
+
+        picoquic_prague_update_pacing(cnx, path_x, pr_state);
+    }
+}
+
+static void picoquic_prague_delete(picoquic_path_t* path_x)
+{
+    if (path_x->congestion_alg_state != NULL) {
+        free(path_x->congestion_alg_state);
+        path_x->congestion_alg_state = NULL;
+    }
+}
+
+/* Observe the state of congestion control: the parameter is alpha, in 1/1024th */
+static void picoquic_prague_observe(picoquic_path_t* path_x, uint64_t* cc_state, uint64_t* cc_param)
+{
+    picoquic_prague_state_t* pr_state = (picoquic_prague_state_t*)path_x->congestion_alg_state;
+    *cc_state = (uint64_t)pr_state->alg_state;
+    *cc_param = pr_state->alpha;
+}
+
+#define PICOQUIC_PRAGUE_ID "prague"
+
+picoquic_congestion_algorithm_t picoquic_prague_algorithm_struct = {
+    PICOQUIC_PRAGUE_ID,
+    picoquic_prague_init,
+    picoquic_prague_notify,
+    picoquic_prague_delete,
+    picoquic_prague_observe
+};
+
+picoquic_congestion_algorithm_t* picoquic_prague_algorithm = &picoquic_prague_algorithm_struct;
@@ -23,6 +23,7 @@
 #include "picoquic.h"
 #include "picoquic_internal.h"
 #include "logwriter.h"
+#include "logcompress.h"
 #include "tls_api.h"
 #include <stdlib.h>
 #include <string.h>
@@ -225,6 +226,7 @@ picoquic_quic_t* picoquic_create(uint32_t nb_connections,
         quic->default_callback_fn = default_callback_fn;
         quic->default_callback_ctx = default_callback_ctx;
         quic->default_congestion_alg = PICOQUIC_DEFAULT_CONGESTION_ALGORITHM;
+        quic->default_path_scheduler = picoquic_minrtt_path_scheduler;
         quic->default_alpn = picoquic_string_duplicate(default_alpn);
         quic->cnx_id_callback_fn = cnx_id_callback;
         quic->cnx_id_callback_ctx = cnx_id_callback_ctx;
@@ -232,6 +234,8 @@ picoquic_quic_t* picoquic_create(uint32_t nb_connections,
         quic->local_cnxid_length = 8; /* TODO: should be lower on clients-only implementation */
         quic->padding_multiple_default = 0; /* TODO: consider default = 128 */
         quic->padding_minsize_default = PICOQUIC_RESET_PACKET_MIN_SIZE;
+        quic->binlog_ring_size = PICOQUIC_BINLOG_RING_SIZE_DEFAULT;
+        quic->binlog_version = PICOQUIC_BINLOG_VERSION_1;
 
         if (cnx_id_callback != NULL) {
             quic->unconditional_cnx_id = 1;
@@ -415,6 +419,8 @@ void picoquic_free(picoquic_quic_t* quic)
             picohash_delete(quic->table_cnx_by_secret, 1);
         }
 
+        picoquic_clear_routable_cid(quic);
+
         if (quic->verify_certificate_ctx != NULL &&
             quic->free_verify_certificate_callback_fn != NULL) {
             (quic->free_verify_certificate_callback_fn)(quic->verify_certificate_ctx);
@@ -440,6 +446,16 @@ void picoquic_free(picoquic_quic_t* quic)
 
         binlog_close(quic);
 
+        if (quic->binlog_cid_list != NULL) {
+            free(quic->binlog_cid_list);
+            quic->binlog_cid_list = NULL;
+        }
+
+        if (quic->binlog_prefix_list != NULL) {
+            free(quic->binlog_prefix_list);
+            quic->binlog_prefix_list = NULL;
+        }
+
         free(quic);
     }
 }
@@ -481,6 +497,7 @@ void picoquic_queue_stateless_packet(picoquic_quic_t* quic, picoquic_stateless_p
 {
     picoquic_stateless_packet_t** pnext = &quic->pending_stateless_packet;
 
+    PICOQUIC_STATS_ADD(&quic->stats, nb_stateless_packets, 1);
     while ((*pnext) != NULL) {
         pnext = &(*pnext)->next_packet;
     }
@@ -497,12 +514,12 @@ picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t*
         quic->pending_stateless_packet = sp->next_packet;
         sp->next_packet = NULL;
 
-        if (quic->F_log != NULL) {
+        if (PICOQUIC_TEXTLOG_PACKETS(quic)) {
             picoquic_log_packet_address(quic->F_log, sp->cnxid_log64,
                 NULL, (struct sockaddr*)&sp->addr_to, 0, sp->length, picoquic_get_quic_time(quic));
         }
-        if (quic->f_binlog != NULL) {
-            binlog_pdu(quic->f_binlog, &sp->initial_cid, 0, picoquic_get_quic_time(quic),
+        if (PICOQUIC_BINLOG_IS_OPEN(quic)) {
+            binlog_pdu(quic, NULL, &sp->initial_cid, 0, picoquic_get_quic_time(quic),
                 (struct sockaddr*)&sp->addr_to, (struct sockaddr*) & sp->addr_local, sp->length);
         }
     }
@@ -518,6 +535,24 @@ int picoquic_cnx_is_still_logging(picoquic_cnx_t* cnx)
     return ret;
 }
 
+/* The packet trace condition is evaluated when it may change: when the
+ * connection is created, when the text log or the log level is set, and
+ * after each packet sent while the connection is logging, since the trace
+ * stops after PICOQUIC_LOG_PACKET_MAX_SEQUENCE packets. The packet path
+ * only tests the resulting flag.
+ */
+void picoquic_update_cnx_logging(picoquic_cnx_t* cnx)
+{
+    cnx->is_logging = PICOQUIC_TEXTLOG_PACKETS(cnx->quic) && picoquic_cnx_is_still_logging(cnx);
+}
+
+static void picoquic_update_all_cnx_logging(picoquic_quic_t* quic)
+{
+    for (picoquic_cnx_t* cnx = quic->cnx_list; cnx != NULL; cnx = cnx->next_in_table) {
+        picoquic_update_cnx_logging(cnx);
+    }
+}
+
 /* Connection context creation and registration */
 int picoquic_register_cnx_id(picoquic_quic_t* quic, picoquic_cnx_t* cnx, picoquic_local_cnxid_t* l_cid)
 {
@@ -819,6 +854,10 @@ void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx,
 {
     picoquic_remove_cnx_from_wake_list(cnx);
     cnx->next_wake_time = next_time;
+#ifndef PICOQUIC_DISABLE_STATS
+    /* Wake times set outside of picoquic_prepare_packet follow an input */
+    cnx->wake_reason = picoquic_wake_reason_input;
+#endif
     picoquic_insert_cnx_by_wake_time(quic, cnx);
 }
 
@@ -961,11 +1000,14 @@ int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, const struct
             path_x->congestion_alg_state = NULL;
 
             /* Initialize per path pacing state */
-            path_x->pacing_evaluation_time = start_time;
-            path_x->pacing_bucket_nanosec = 16;
+            path_x->pacing_release_time_nanosec = (int64_t)(start_time * 1000) - 16;
             path_x->pacing_bucket_max = 16;
             path_x->pacing_packet_time_nanosec = 1;
             path_x->pacing_packet_time_microsec = 1;
+            path_x->pacing_horizon_nanosec = cnx->quic->pacing_horizon_nanosec;
+
+            /* Initialize the scheduler state */
+            path_x->scheduler_weight = 1;
 
             /* Initialize the MTU */
             path_x->send_mtu = (peer_addr == NULL || peer_addr->sa_family == AF_INET) ? PICOQUIC_INITIAL_MTU_IPV4 : PICOQUIC_INITIAL_MTU_IPV6;
@@ -1090,7 +1132,7 @@ void picoquic_delete_abandoned_paths(picoquic_cnx_t* cnx, uint64_t current_time,
                 is_demotion_in_progress |= 1;
                 if (*next_wake_time > cnx->path[path_index_current]->demotion_time) {
                     *next_wake_time = cnx->path[path_index_current]->demotion_time;
-                    SET_LAST_WAKE(cnx->quic, PICOQUIC_QUICCTX);
+                    SET_LAST_WAKE_REASON(cnx, PICOQUIC_QUICCTX, picoquic_wake_reason_other);
                 }
             }
 
@@ -1149,8 +1191,8 @@ void picoquic_promote_path_to_default(picoquic_cnx_t* cnx, int path_index, uint6
             picoquic_log_path_promotion(cnx->quic->F_log, cnx, path_index, current_time);
         }
 
-        /* Set the congestion algorithm for the new path */
-        if (cnx->congestion_alg != NULL) {
+        /* Set the congestion algorithm for the new path, unless already used for multipath */
+        if (cnx->congestion_alg != NULL && path_x->congestion_alg_state == NULL) {
             cnx->congestion_alg->alg_init(path_x, current_time);
         }
 
@@ -1752,6 +1794,11 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
         int is_output_stream = 0;
         memset(stream, 0, sizeof(picoquic_stream_head_t));
         stream->stream_id = stream_id;
+#ifndef PICOQUIC_DISABLE_STATS
+        stream->creation_time = picoquic_get_quic_time(cnx->quic);
+        /* Tracked after the scheduler first examines the stream */
+        picoquic_send_limit_init(&stream->send_limits, picoquic_send_limit_max, stream->creation_time);
+#endif
 
         if (IS_LOCAL_STREAM_ID(stream_id, cnx->client_mode)) {
             if (IS_BIDIR_STREAM_ID(stream_id)) {
@@ -1884,6 +1931,9 @@ picoquic_local_cnxid_t* picoquic_create_local_cnxid(picoquic_cnx_t* cnx, picoqui
                 if (i == 0 && suggested_value != NULL) {
                     l_cid->cnx_id = *suggested_value;
                 }
+                else if (cnx->cid_slot != PICOQUIC_CID_SLOT_NONE) {
+                    picoquic_create_routable_cnx_id(cnx->quic, cnx->cid_slot, &l_cid->cnx_id);
+                }
                 else {
                     picoquic_create_random_cnx_id(cnx->quic, &l_cid->cnx_id, cnx->quic->local_cnxid_length);
 
@@ -2033,6 +2083,9 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         memset(cnx, 0, sizeof(picoquic_cnx_t));
         cnx->start_time = start_time;
         cnx->client_mode = client_mode;
+#ifndef PICOQUIC_DISABLE_STATS
+        picoquic_send_limit_init(&cnx->send_limits, picoquic_send_limit_app, start_time);
+#endif
         if (client_mode) {
             if (picoquic_is_connection_id_null(&initial_cnx_id)) {
                 picoquic_create_random_cnx_id(quic, &initial_cnx_id, 8);
@@ -2040,6 +2093,8 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         }
         cnx->initial_cnxid = initial_cnx_id;
         cnx->quic = quic;
+        /* Reserve a slot if using routable CID */
+        cnx->cid_slot = picoquic_cid_slot_alloc(quic, cnx);
         /* Create the connection ID number 0 */
         cnxid0 = picoquic_create_local_cnxid(cnx, NULL);
         
@@ -2047,6 +2102,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         ret = picoquic_create_path(cnx, start_time, NULL, addr_to);
 
         if (ret != 0 || cnxid0 == NULL) {
+            picoquic_cid_slot_free(quic, cnx->cid_slot);
             free(cnx);
             cnx = NULL;
         } else {
@@ -2107,6 +2163,8 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
 
         /* Initialize spin policy, ensure that at least 1/8th of connections do not spin */
         cnx->spin_policy = quic->default_spin_policy;
+        cnx->key_rotation_packets = quic->key_rotation_packets_default;
+        cnx->key_rotation_bytes = quic->key_rotation_bytes_default;
         if (cnx->spin_policy == picoquic_spinbit_basic) {
             uint8_t rand256 = (uint8_t)picoquic_public_random_64();
             if (rand256 < PICOQUIC_SPIN_RESERVE_MOD_256) {
@@ -2125,6 +2183,8 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         cnx->callback_fn = quic->default_callback_fn;
         cnx->callback_ctx = quic->default_callback_ctx;
         cnx->congestion_alg = quic->default_congestion_alg;
+        cnx->path_scheduler = quic->default_path_scheduler;
+        picoquic_set_ecn_codepoint(cnx, quic->default_ecn_codepoint);
 
         if (cnx->client_mode) {
             if (preferred_version == 0) {
@@ -2252,6 +2312,8 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
     }
 
     if (cnx != NULL) {
+        picoquic_update_cnx_logging(cnx);
+        binlog_select_connection(cnx);
         binlog_new_connection(cnx);
     }
 
@@ -2505,6 +2567,174 @@ void picoquic_connection_id_callback(picoquic_quic_t * quic, picoquic_connection
     }
 }
 
+/* Routable CID management.
+ * Connections get a slot in the table when created, and release it when deleted.
+ * The slot generation is incremented on release, so that CID issued for a
+ * previous occupant of the slot are not routed to the new one.
+ */
+
+void picoquic_clear_routable_cid(picoquic_quic_t* quic)
+{
+    picoquic_cid_free_block_cipher_ctx(quic->cid_route_enc);
+    quic->cid_route_enc = NULL;
+    picoquic_cid_free_block_cipher_ctx(quic->cid_route_dec);
+    quic->cid_route_dec = NULL;
+    if (quic->cid_slots != NULL) {
+        free(quic->cid_slots);
+        quic->cid_slots = NULL;
+    }
+    quic->nb_cid_slots = 0;
+    quic->cid_slot_free_first = PICOQUIC_CID_SLOT_NONE;
+}
+
+int picoquic_set_routable_cid(picoquic_quic_t* quic, uint8_t config_id, uint16_t server_id,
+    const uint8_t* cid_key, uint32_t nb_slots)
+{
+    int ret = 0;
+
+    if (quic->cnx_list != NULL || config_id > 2 || nb_slots == 0 || nb_slots == PICOQUIC_CID_SLOT_NONE) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else {
+        picoquic_clear_routable_cid(quic);
+
+        quic->cid_slots = (picoquic_cid_slot_t*)malloc(sizeof(picoquic_cid_slot_t) * (size_t)nb_slots);
+
+        if (quic->cid_slots == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            if (cid_key == NULL) {
+                cid_key = quic->reset_seed;
+            }
+
+            for (uint32_t i = 0; i < nb_slots; i++) {
+                quic->cid_slots[i].cnx = NULL;
+                quic->cid_slots[i].generation = 0;
+                quic->cid_slots[i].next_free = (i + 1 < nb_slots) ? i + 1 : PICOQUIC_CID_SLOT_NONE;
+            }
+            quic->nb_cid_slots = nb_slots;
+            quic->cid_slot_free_first = 0;
+            quic->cid_server_id = server_id;
+            quic->cid_config_id = config_id;
+
+            if ((ret = picoquic_cid_get_block_cipher_ctx(&quic->cid_route_enc, 1, cid_key)) == 0) {
+                ret = picoquic_cid_get_block_cipher_ctx(&quic->cid_route_dec, 0, cid_key);
+            }
+        }
+
+        if (ret == 0) {
+            quic->local_cnxid_length = PICOQUIC_ROUTABLE_CID_LENGTH;
+        }
+        else {
+            picoquic_clear_routable_cid(quic);
+        }
+    }
+
+    return ret;
+}
+
+uint32_t picoquic_cid_slot_alloc(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
+{
+    uint32_t slot = PICOQUIC_CID_SLOT_NONE;
+
+    if (quic->cid_slots != NULL && quic->cid_slot_free_first != PICOQUIC_CID_SLOT_NONE) {
+        slot = quic->cid_slot_free_first;
+        quic->cid_slot_free_first = quic->cid_slots[slot].next_free;
+        quic->cid_slots[slot].next_free = PICOQUIC_CID_SLOT_NONE;
+        quic->cid_slots[slot].cnx = cnx;
+    }
+
+    return slot;
+}
+
+void picoquic_cid_slot_free(picoquic_quic_t* quic, uint32_t slot)
+{
+    if (slot < quic->nb_cid_slots) {
+        quic->cid_slots[slot].cnx = NULL;
+        quic->cid_slots[slot].generation++;
+        quic->cid_slots[slot].next_free = quic->cid_slot_free_first;
+        quic->cid_slot_free_first = slot;
+    }
+}
+
+void picoquic_create_routable_cnx_id(picoquic_quic_t* quic, uint32_t slot, picoquic_connection_id_t* cnx_id)
+{
+    uint8_t block[16];
+
+    picoformat_16(block, quic->cid_server_id);
+    picoformat_32(block + 2, slot);
+    picoformat_32(block + 6, quic->cid_slots[slot].generation);
+    picoquic_public_random(block + 10, 6);
+    picoquic_public_random(cnx_id->id, 1);
+    cnx_id->id[0] = (uint8_t)((quic->cid_config_id << 6) | (cnx_id->id[0] & 0x3F));
+    picoquic_cid_block_cipher_transform(quic->cid_route_enc, cnx_id->id + 1, block);
+    cnx_id->id_len = PICOQUIC_ROUTABLE_CID_LENGTH;
+}
+
+void* picoquic_routable_cid_decoder_create(const uint8_t* cid_key)
+{
+    void* cid_decoder = NULL;
+
+    if (picoquic_cid_get_block_cipher_ctx(&cid_decoder, 0, cid_key) != 0) {
+        cid_decoder = NULL;
+    }
+
+    return cid_decoder;
+}
+
+void picoquic_routable_cid_decoder_free(void* cid_decoder)
+{
+    picoquic_cid_free_block_cipher_ctx(cid_decoder);
+}
+
+int picoquic_routable_cid_decode(void* cid_decoder, uint8_t config_id, const picoquic_connection_id_t* cnx_id,
+    uint16_t* server_id, uint32_t* slot_index, uint32_t* slot_generation)
+{
+    int ret = -1;
+
+    if (cid_decoder != NULL && cnx_id->id_len == PICOQUIC_ROUTABLE_CID_LENGTH && (cnx_id->id[0] >> 6) == config_id) {
+        uint8_t block[16];
+
+        picoquic_cid_block_cipher_transform(cid_decoder, block, cnx_id->id + 1);
+        *server_id = PICOPARSE_16(block);
+        *slot_index = PICOPARSE_32(block + 2);
+        *slot_generation = PICOPARSE_32(block + 6);
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/* Retrieve the connection directly from the slot table.
+ * The connection must still own the CID, which is verified by going through
+ * its short list of local CID. If any check fails, the caller falls back to the
+ * hash table, which handles the CID created when all slots were in use.
+ */
+picoquic_cnx_t* picoquic_cnx_by_routable_id(picoquic_quic_t* quic, const picoquic_connection_id_t* cnx_id)
+{
+    picoquic_cnx_t* cnx = NULL;
+    uint16_t server_id;
+    uint32_t slot;
+    uint32_t generation;
+
+    if (picoquic_routable_cid_decode(quic->cid_route_dec, quic->cid_config_id, cnx_id, &server_id, &slot, &generation) == 0 &&
+        server_id == quic->cid_server_id && slot < quic->nb_cid_slots &&
+        quic->cid_slots[slot].generation == generation && quic->cid_slots[slot].cnx != NULL) {
+        picoquic_local_cnxid_t* l_cid = quic->cid_slots[slot].cnx->local_cnxid_first;
+
+        while (l_cid != NULL) {
+            if (l_cid->first_cnx_id != NULL && picoquic_compare_connection_id(&l_cid->cnx_id, cnx_id) == 0) {
+                cnx = quic->cid_slots[slot].cnx;
+                break;
+            }
+            l_cid = l_cid->next;
+        }
+    }
+
+    return cnx;
+}
+
 picoquic_connection_id_callback_ctx_t * picoquic_connection_id_callback_create_ctx(
     char const * select_type, char const * default_value_hex, char const * mask_hex)
 {
@@ -2563,6 +2793,93 @@ int picoquic_set_binlog(picoquic_quic_t * quic, char const * binlog_file)
     return binlog_open(quic, binlog_file);
 }
 
+void picoquic_set_binlog_ring_size(picoquic_quic_t* quic, size_t ring_size)
+{
+    quic->binlog_ring_size = ring_size;
+}
+
+int picoquic_set_binlog_version(picoquic_quic_t* quic, uint32_t version)
+{
+    int ret = 0;
+
+    if (version == PICOQUIC_BINLOG_VERSION_1 || version == PICOQUIC_BINLOG_VERSION_2) {
+        quic->binlog_version = version;
+    }
+    else {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+
+    return ret;
+}
+
+int picoquic_set_binlog_sink(picoquic_quic_t* quic, picoquic_binlog_sink_fn sink_fn, void* sink_ctx)
+{
+    return binlog_set_sink(quic, sink_fn, sink_ctx);
+}
+
+uint64_t picoquic_get_binlog_dropped(picoquic_quic_t* quic)
+{
+    return quic->binlog_nb_dropped + binlog_ring_dropped(quic->binlog_ring);
+}
+
+void picoquic_set_binlog_sampling(picoquic_quic_t* quic, uint32_t one_in_n)
+{
+    quic->binlog_sample_one_in = one_in_n;
+}
+
+int picoquic_add_binlog_cid(picoquic_quic_t* quic, const picoquic_connection_id_t* cid)
+{
+    int ret = 0;
+    picoquic_connection_id_t* new_list = (picoquic_connection_id_t*)realloc(quic->binlog_cid_list,
+        (quic->binlog_nb_cid + 1) * sizeof(picoquic_connection_id_t));
+
+    if (new_list == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        new_list[quic->binlog_nb_cid] = *cid;
+        quic->binlog_cid_list = new_list;
+        quic->binlog_nb_cid++;
+    }
+
+    return ret;
+}
+
+int picoquic_add_binlog_peer_prefix(picoquic_quic_t* quic, const struct sockaddr* addr, int prefix_bits)
+{
+    int ret = 0;
+    int max_bits = (addr->sa_family == AF_INET6) ? 128 : 32;
+    picoquic_binlog_prefix_t* new_list;
+
+    if ((addr->sa_family != AF_INET && addr->sa_family != AF_INET6) || prefix_bits < 0 || prefix_bits > max_bits) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else if ((new_list = (picoquic_binlog_prefix_t*)realloc(quic->binlog_prefix_list,
+        (quic->binlog_nb_prefix + 1) * sizeof(picoquic_binlog_prefix_t))) == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(&new_list[quic->binlog_nb_prefix], 0, sizeof(picoquic_binlog_prefix_t));
+        picoquic_store_addr(&new_list[quic->binlog_nb_prefix].addr, addr);
+        new_list[quic->binlog_nb_prefix].prefix_bits = prefix_bits;
+        quic->binlog_prefix_list = new_list;
+        quic->binlog_nb_prefix++;
+    }
+
+    return ret;
+}
+
+void picoquic_set_binlog_retro_depth(picoquic_quic_t* quic, size_t nb_records)
+{
+    quic->binlog_retro_depth = nb_records;
+}
+
+void picoquic_set_binlog_triggers(picoquic_quic_t* quic, uint64_t nb_spurious_max, uint64_t stall_delay)
+{
+    quic->binlog_trigger_nb_spurious = nb_spurious_max;
+    quic->binlog_trigger_stall_delay = stall_delay;
+}
+
 int picoquic_set_textlog(picoquic_quic_t* quic, char const* textlog_file)
 {
     int ret = 0;
@@ -2584,6 +2901,7 @@ int picoquic_set_textlog(picoquic_quic_t* quic, char const* textlog_file)
             quic->should_close_log = 1;
         }
     }
+    picoquic_update_all_cnx_logging(quic);
 
     return ret;
 }
@@ -2592,6 +2910,13 @@ void picoquic_set_log_level(picoquic_quic_t* quic, int log_level)
 {
     /* Only two level for now: log first 100 packets, or log everything. */
     quic->use_long_log = (log_level > 0) ? 1 : 0;
+    picoquic_update_all_cnx_logging(quic);
+}
+
+void picoquic_set_textlog_deferred(picoquic_quic_t* quic, int is_deferred)
+{
+    quic->is_textlog_deferred = (is_deferred) ? 1 : 0;
+    picoquic_update_all_cnx_logging(quic);
 }
 
 int picoquic_set_default_connection_id_length(picoquic_quic_t* quic, uint8_t cid_length)
@@ -2871,12 +3196,50 @@ int picoquic_start_key_rotation(picoquic_cnx_t* cnx)
     if (ret == 0) {
         picoquic_apply_rotated_keys(cnx, 1);
         picoquic_crypto_context_free(&cnx->crypto_context_old);
-        cnx->crypto_epoch_sequence = cnx->pkt_ctx[picoquic_packet_context_application].send_sequence;
     }
 
     return ret;
 }
 
+void picoquic_set_default_key_rotation_policy(picoquic_quic_t* quic, uint64_t max_packets, uint64_t max_bytes)
+{
+    quic->key_rotation_packets_default = max_packets;
+    quic->key_rotation_bytes_default = max_bytes;
+}
+
+void picoquic_set_key_rotation_policy(picoquic_cnx_t* cnx, uint64_t max_packets, uint64_t max_bytes)
+{
+    cnx->key_rotation_packets = max_packets;
+    cnx->key_rotation_bytes = max_bytes;
+}
+
+/* Key rotation management, called from the sending path.
+ * If the policy requires it, start a new rotation. Then, if no rotation is
+ * in progress, derive the keys of the next phase and keep them in the
+ * "new" crypto context. When a packet with the flipped key phase arrives,
+ * the receive path can try decryption without having to derive keys.
+ */
+void picoquic_manage_key_rotation(picoquic_cnx_t* cnx)
+{
+    if (cnx->cnx_state != picoquic_state_ready ||
+        cnx->crypto_context[picoquic_epoch_1rtt].aead_decrypt == NULL) {
+        return;
+    }
+
+    if (cnx->key_phase_enc == cnx->key_phase_dec &&
+        ((cnx->key_rotation_packets > 0 &&
+            cnx->pkt_ctx[picoquic_packet_context_application].send_sequence >= cnx->crypto_epoch_sequence + cnx->key_rotation_packets) ||
+        (cnx->key_rotation_bytes > 0 && cnx->crypto_epoch_bytes >= cnx->key_rotation_bytes))) {
+        /* Will fail harmlessly if the previous rotation is not yet acknowledged */
+        (void)picoquic_start_key_rotation(cnx);
+    }
+
+    if (cnx->crypto_context_new.aead_encrypt == NULL &&
+        cnx->crypto_context_new.aead_decrypt == NULL) {
+        (void)picoquic_compute_new_rotated_keys(cnx);
+    }
+}
+
 void picoquic_delete_sooner_packets(picoquic_cnx_t* cnx)
 {
     picoquic_stateless_packet_t* packet = cnx->first_sooner;
@@ -2889,6 +3252,106 @@ void picoquic_delete_sooner_packets(picoquic_cnx_t* cnx)
     cnx->first_sooner = NULL;
 }
 
+#ifndef PICOQUIC_DISABLE_STATS
+static void picoquic_stats_add(picoquic_stats_t* total, const picoquic_stats_t* stats)
+{
+    /* All the counters are uint64_t */
+    uint64_t* t = (uint64_t*)total;
+    const uint64_t* s = (const uint64_t*)stats;
+
+    for (size_t i = 0; i < sizeof(picoquic_stats_t) / sizeof(uint64_t); i++) {
+        t[i] += s[i];
+    }
+}
+#endif
+
+int picoquic_get_stats(picoquic_quic_t* quic, picoquic_cnx_t* cnx, picoquic_stats_t* stats)
+{
+    int ret = 0;
+
+#ifndef PICOQUIC_DISABLE_STATS
+    if (cnx != NULL) {
+        *stats = cnx->stats;
+    }
+    else {
+        *stats = quic->stats;
+        for (picoquic_cnx_t* next = quic->cnx_list; next != NULL; next = next->next_in_table) {
+            picoquic_stats_add(stats, &next->stats);
+        }
+    }
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+    UNREFERENCED_PARAMETER(cnx);
+#endif
+    memset(stats, 0, sizeof(picoquic_stats_t));
+    ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+#endif
+
+    return ret;
+}
+
+void picoquic_set_wake_profiling(picoquic_quic_t* quic, int is_enabled)
+{
+    quic->is_wake_profiling = (is_enabled) ? 1 : 0;
+}
+
+int picoquic_get_wake_profile(picoquic_quic_t* quic, picoquic_wake_profile_t* profile)
+{
+    int ret = 0;
+
+#ifndef PICOQUIC_DISABLE_STATS
+    *profile = quic->wake_profile;
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+#endif
+    memset(profile, 0, sizeof(picoquic_wake_profile_t));
+    ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+#endif
+
+    return ret;
+}
+
+char const* picoquic_wake_reason_name(picoquic_wake_reason_enum reason)
+{
+    char const* reason_name = "unknown";
+
+    switch (reason) {
+    case picoquic_wake_reason_other:
+        reason_name = "other";
+        break;
+    case picoquic_wake_reason_input:
+        reason_name = "input";
+        break;
+    case picoquic_wake_reason_send_more:
+        reason_name = "send_more";
+        break;
+    case picoquic_wake_reason_pacing:
+        reason_name = "pacing";
+        break;
+    case picoquic_wake_reason_ack:
+        reason_name = "ack";
+        break;
+    case picoquic_wake_reason_retransmit:
+        reason_name = "retransmit";
+        break;
+    case picoquic_wake_reason_idle:
+        reason_name = "idle";
+        break;
+    case picoquic_wake_reason_data:
+        reason_name = "data";
+        break;
+    case picoquic_wake_reason_challenge:
+        reason_name = "challenge";
+        break;
+    default:
+        break;
+    }
+
+    return reason_name;
+}
+
 void picoquic_delete_cnx(picoquic_cnx_t* cnx)
 {
     picoquic_cnxid_stash_t* stashed_cnxid;
@@ -2924,12 +3387,15 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
 
         picoquic_remove_cnx_from_list(cnx);
         picoquic_remove_cnx_from_wake_list(cnx);
+        picoquic_cid_slot_free(cnx->quic, cnx->cid_slot);
+        cnx->cid_slot = PICOQUIC_CID_SLOT_NONE;
 
         for (int i = 0; i < 4; i++) {
             picoquic_crypto_context_free(&cnx->crypto_context[i]);
         }
 
         picoquic_crypto_context_free(&cnx->crypto_context_new);
+        picoquic_crypto_context_free(&cnx->crypto_context_old);
 
         for (picoquic_packet_context_enum pc = 0;
             pc < picoquic_nb_packet_context; pc++) {
@@ -2973,6 +3439,11 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             free(stashed_cnxid);
         }
 
+#ifndef PICOQUIC_DISABLE_STATS
+        /* Keep the counters of deleted connections in the context totals */
+        picoquic_stats_add(&cnx->quic->stats, &cnx->stats);
+#endif
+
         free(cnx);
     }
 }
@@ -2987,16 +3458,23 @@ int picoquic_is_handshake_error(uint16_t error_code)
 picoquic_cnx_t* picoquic_cnx_by_id(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id)
 {
     picoquic_cnx_t* ret = NULL;
-    picohash_item* item;
-    picoquic_cnx_id_key_t key;
 
-    memset(&key, 0, sizeof(key));
-    key.cnx_id = cnx_id;
+    if (quic->cid_slots != NULL) {
+        ret = picoquic_cnx_by_routable_id(quic, &cnx_id);
+    }
+
+    if (ret == NULL) {
+        picohash_item* item;
+        picoquic_cnx_id_key_t key;
 
-    item = picohash_retrieve(quic->table_cnx_by_id, &key);
+        memset(&key, 0, sizeof(key));
+        key.cnx_id = cnx_id;
 
-    if (item != NULL) {
-        ret = ((picoquic_cnx_id_key_t*)item->key)->cnx;
+        item = picohash_retrieve(quic->table_cnx_by_id, &key);
+
+        if (item != NULL) {
+            ret = ((picoquic_cnx_id_key_t*)item->key)->cnx;
+        }
     }
     return ret;
 }
@@ -3075,6 +3553,15 @@ picoquic_congestion_algorithm_t const* picoquic_get_congestion_algorithm(char co
         else if (strcmp(alg_name, "bbr") == 0) {
             alg = picoquic_bbr_algorithm;
         }
+        else if (strcmp(alg_name, "bbr2") == 0) {
+            alg = picoquic_bbr2_algorithm;
+        }
+        else if (strcmp(alg_name, "ledbat") == 0) {
+            alg = picoquic_ledbat_algorithm;
+        }
+        else if (strcmp(alg_name, "prague") == 0) {
+            alg = picoquic_prague_algorithm;
+        }
         else {
             alg = NULL;
         }
@@ -3137,6 +3624,123 @@ uint64_t picoquic_get_pacing_rate(picoquic_cnx_t* cnx)
     return cnx->path[0]->pacing_rate;
 }
 
+void picoquic_set_pacing_horizon(picoquic_quic_t* quic, uint64_t horizon_microsec)
+{
+    quic->pacing_horizon_nanosec = horizon_microsec * 1000;
+}
+
+uint64_t picoquic_get_last_departure_time(picoquic_quic_t* quic)
+{
+    return quic->last_departure_time_nanosec;
+}
+
+/*
+ * Set the path scheduler, used when multipath is negotiated
+ */
+
+picoquic_path_scheduler_t const* picoquic_get_path_scheduler(char const* scheduler_name)
+{
+    picoquic_path_scheduler_t const* scheduler = NULL;
+
+    if (scheduler_name != NULL) {
+        if (strcmp(scheduler_name, "minrtt") == 0) {
+            scheduler = picoquic_minrtt_path_scheduler;
+        }
+        else if (strcmp(scheduler_name, "wrr") == 0) {
+            scheduler = picoquic_wrr_path_scheduler;
+        }
+    }
+    return scheduler;
+}
+
+void picoquic_set_default_path_scheduler(picoquic_quic_t* quic, picoquic_path_scheduler_t const* scheduler)
+{
+    quic->default_path_scheduler = scheduler;
+}
+
+void picoquic_set_path_scheduler(picoquic_cnx_t* cnx, picoquic_path_scheduler_t const* scheduler)
+{
+    cnx->path_scheduler = scheduler;
+}
+
+int picoquic_is_multipath_enabled(picoquic_cnx_t* cnx)
+{
+    return cnx->is_multipath_enabled;
+}
+
+int picoquic_set_path_weight(picoquic_cnx_t* cnx, const struct sockaddr* addr_local,
+    const struct sockaddr* addr_peer, uint32_t weight)
+{
+    int partial_match = -1;
+    int path_id = picoquic_find_path_by_address(cnx, addr_local, addr_peer, &partial_match);
+
+    if (path_id < 0) {
+        path_id = partial_match;
+    }
+
+    if (path_id < 0) {
+        return -1;
+    }
+
+    cnx->path[path_id]->scheduler_weight = (weight == 0) ? 1 : weight;
+    return 0;
+}
+
+uint64_t picoquic_get_path_rtt(picoquic_path_t* path_x)
+{
+    return path_x->smoothed_rtt;
+}
+
+uint64_t picoquic_get_path_cwin(picoquic_path_t* path_x)
+{
+    return path_x->cwin;
+}
+
+uint64_t picoquic_get_path_bytes_in_transit(picoquic_path_t* path_x)
+{
+    return path_x->bytes_in_transit;
+}
+
+uint32_t picoquic_get_path_weight(picoquic_path_t* path_x)
+{
+    return path_x->scheduler_weight;
+}
+
+void picoquic_set_default_ecn_codepoint(picoquic_quic_t* quic, uint8_t ecn_codepoint)
+{
+    quic->default_ecn_codepoint = ecn_codepoint & 0x03;
+}
+
+/* Setting the codepoint restarts the ECN validation. The counts of marked
+ * packets are kept, since the peer reports cumulative values. Requesting CE
+ * makes no sense and is treated as a request for ECT(0). */
+void picoquic_set_ecn_codepoint(picoquic_cnx_t* cnx, uint8_t ecn_codepoint)
+{
+    ecn_codepoint &= 0x03;
+    if (ecn_codepoint == PICOQUIC_ECN_CE) {
+        ecn_codepoint = PICOQUIC_ECN_ECT_0;
+    }
+    cnx->ecn_codepoint = ecn_codepoint;
+    cnx->ecn_state = (ecn_codepoint == PICOQUIC_ECN_NOT_ECT) ? picoquic_ecn_state_disabled : picoquic_ecn_state_testing;
+    cnx->ecn_testing_sent = 0;
+    cnx->ecn_testing_lost = 0;
+}
+
+picoquic_ecn_state_t picoquic_get_ecn_state(picoquic_cnx_t* cnx)
+{
+    return cnx->ecn_state;
+}
+
+uint8_t picoquic_get_last_ecn_codepoint(picoquic_quic_t* quic)
+{
+    return quic->last_ecn_codepoint;
+}
+
+void picoquic_get_hystart_stats(picoquic_cnx_t* cnx, picoquic_hystart_stats_t* stats)
+{
+    *stats = cnx->path[0]->hystart_stats;
+}
+
 uint64_t picoquic_get_cwin(picoquic_cnx_t* cnx)
 {
     return cnx->path[0]->cwin;
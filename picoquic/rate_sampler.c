@@ -0,0 +1,176 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+
+/*
+ * Delivery rate sampling, modeled after "tcp_rate.c" in Linux and
+ * draft-cheng-iccrg-delivery-rate-estimation.
+ *
+ * Each packet records, when sent, the number of bytes delivered so far on
+ * the path, the time of the last delivery, and the send time of the packet
+ * whose delivery was last accounted. When an acknowledgement arrives, the
+ * most recently sent of the acknowledged packets defines the sample: the
+ * bytes delivered since that packet was sent, divided by the longer of the
+ * send and acknowledgement intervals of the flight. Taking the longer of the
+ * two filters ACK compression; requiring at least one min RTT filters the
+ * bursts of acknowledgements caused by ACK decimation, since each sample then
+ * covers at least a full flight.
+ *
+ * A path is app limited when the application does not fill the congestion
+ * window. Packets sent while app limited are marked, and so are the samples
+ * that they produce, until the data in flight when the condition was noted
+ * is delivered. Controllers should not lower their bandwidth estimate based
+ * on app limited samples.
+ */
+
+void picoquic_rate_sampler_packet_sent(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* packet, uint64_t current_time)
+{
+    if (path_x->bytes_in_transit == 0) {
+        /* Start of a new flight: the delivery interval starts now */
+        path_x->delivered_time_last = current_time;
+        path_x->delivered_sent_last = current_time;
+    }
+
+    packet->delivered_prior = path_x->delivered;
+    packet->delivered_time_prior = path_x->delivered_time_last;
+    packet->delivered_sent_prior = path_x->delivered_sent_last;
+    packet->delivered_app_limited = (cnx->cnx_state < picoquic_state_ready || path_x->delivered_limited_index != 0);
+    packet->delivered_is_set = 1;
+}
+
+void picoquic_rate_sampler_packet_acked(picoquic_path_t* path_x, picoquic_packet_t* packet, uint64_t current_time)
+{
+    picoquic_rate_sample_t* rs = &path_x->rate_sample;
+    int is_first = !rs->is_pending;
+
+    path_x->delivered += packet->length;
+    path_x->delivered_time_last = current_time;
+
+    if (is_first) {
+        rs->is_pending = 1;
+        rs->acked_bytes = 0;
+    }
+    rs->acked_bytes += packet->length;
+
+    /* Sample the most recently sent packet, for which the flight is the shortest */
+    if (is_first || packet->send_time >= path_x->delivered_sent_last) {
+        rs->prior_delivered = packet->delivered_prior;
+        rs->prior_time = packet->delivered_time_prior;
+        rs->is_app_limited = packet->delivered_app_limited;
+        rs->has_prior = packet->delivered_is_set;
+        rs->send_elapsed = packet->send_time - packet->delivered_sent_prior;
+        path_x->delivered_sent_last = packet->send_time;
+    }
+}
+
+void picoquic_rate_sampler_generate(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time)
+{
+    picoquic_rate_sample_t* rs = &path_x->rate_sample;
+
+    if (!rs->is_pending) {
+        return;
+    }
+    rs->is_pending = 0;
+    rs->is_valid = 0;
+
+    if (path_x->delivered_limited_index != 0 && path_x->delivered > path_x->delivered_limited_index) {
+        /* The data in flight when the path became app limited is delivered */
+        path_x->delivered_limited_index = 0;
+    }
+
+    if (!rs->has_prior) {
+        /* The packet was sent before the sampler was started. The prior
+         * time cannot be used as a marker, since simulations start at 0. */
+        return;
+    }
+
+    rs->delivered = path_x->delivered - rs->prior_delivered;
+    rs->ack_elapsed = current_time - rs->prior_time;
+    rs->interval = (rs->send_elapsed > rs->ack_elapsed) ? rs->send_elapsed : rs->ack_elapsed;
+
+    if (rs->interval > PICOQUIC_BANDWIDTH_TIME_INTERVAL_MIN && rs->interval >= path_x->rtt_min) {
+        rs->delivery_rate = (rs->delivered * 1000000) / rs->interval;
+        rs->is_valid = 1;
+
+        if (!rs->is_app_limited || rs->delivery_rate > path_x->bandwidth_estimate) {
+            path_x->bandwidth_estimate = rs->delivery_rate;
+            if (path_x == cnx->path[0]) {
+                if (cnx->is_ack_frequency_negotiated &&
+                    cnx->ack_gap_local != picoquic_compute_ack_gap(cnx, rs->delivery_rate)) {
+                    cnx->is_ack_frequency_updated = 1;
+                }
+            }
+        }
+    }
+}
+
+/* Mark the path as app limited until the data now in flight is delivered.
+ * The value is never zero, since zero means not limited. */
+void picoquic_rate_sampler_app_limited(picoquic_path_t* path_x)
+{
+    path_x->delivered_limited_index = path_x->delivered + path_x->bytes_in_transit;
+    if (path_x->delivered_limited_index == 0) {
+        path_x->delivered_limited_index = 1;
+    }
+}
+
+/* The max bandwidth estimate measures the peak rate over short intervals,
+ * including app limited periods. It is used by the delay based startup
+ * variants to size the window after exiting slow start. */
+void picoquic_estimate_max_path_bandwidth(picoquic_path_t* path_x, uint64_t send_time, uint64_t delivery_time)
+{
+    /* Test whether there is enough time since the last max bandwidth estimate */
+    if (send_time >= path_x->max_sample_sent_time) {
+        if (path_x->max_sample_sent_time == 0) {
+            /* No sample set yet, need to initialize the variables */
+            path_x->max_sample_delivered = path_x->delivered;
+            path_x->max_sample_acked_time = delivery_time;
+            path_x->max_sample_sent_time = send_time;
+        }
+        else {
+            /* Compute a max bandwidth estimate */
+            uint64_t receive_interval = delivery_time - path_x->max_sample_acked_time;
+
+            if (receive_interval > PICOQUIC_MAX_BANDWIDTH_TIME_INTERVAL_MIN) {
+                uint64_t delivered = path_x->delivered - path_x->max_sample_delivered;
+                uint64_t send_interval = send_time - path_x->max_sample_sent_time;
+                uint64_t bw_estimate;
+
+                if (send_interval > receive_interval) {
+                    receive_interval = send_interval;
+                }
+
+                bw_estimate = delivered * 1000000;
+                bw_estimate /= receive_interval;
+                /* Retain if larger than previous estimate */
+                if (bw_estimate > path_x->max_bandwidth_estimate) {
+                    path_x->max_bandwidth_estimate = bw_estimate;
+                }
+
+                /* Change the reference point if estimate duration is long enough */
+                path_x->max_sample_delivered = path_x->delivered;
+                path_x->max_sample_acked_time = delivery_time;
+                path_x->max_sample_sent_time = send_time;
+            }
+        }
+    }
+}
@@ -0,0 +1,239 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+#include "picoquic_internal.h"
+
+/*
+ * Time in send limit states, see picoquic_get_send_limits.
+ *
+ * The connection state is only changed at the end of picoquic_prepare_packet,
+ * from the limits flagged during the call. The state then holds until the
+ * next call, which the wake time schedules when the limit is expected to
+ * lift: pacing release, acknowledgement of data in flight, or input.
+ *
+ * The connection flow limits are noted by the stream scheduler, and only
+ * count if the congestion window and the pacing allowed sending. If a packet
+ * was sent, the connection is not limited, whatever was flagged.
+ *
+ * A stream that is ready to send is limited by the connection. Instead of
+ * updating all ready streams at each change of the connection state, the
+ * stream keeps a copy of the connection times when it became ready, and
+ * adds the difference when it leaves that state.
+ */
+#ifndef PICOQUIC_DISABLE_STATS
+static void picoquic_send_limit_times(const picoquic_send_limit_track_t* track, uint64_t current_time, uint64_t* times)
+{
+    memcpy(times, track->time_in_state, sizeof(track->time_in_state));
+    if (track->state < picoquic_send_limit_max && current_time > track->state_start) {
+        times[track->state] += current_time - track->state_start;
+    }
+}
+
+static void picoquic_send_limit_set(picoquic_send_limit_track_t* track, picoquic_send_limit_enum state, uint64_t current_time)
+{
+    if (track->state < picoquic_send_limit_max && current_time > track->state_start) {
+        track->time_in_state[track->state] += current_time - track->state_start;
+    }
+    track->state = state;
+    track->state_start = current_time;
+}
+
+static void picoquic_stream_send_limit_times(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, uint64_t current_time, uint64_t* times)
+{
+    if (stream->send_limits.state == picoquic_send_limit_none) {
+        uint64_t cnx_times[picoquic_send_limit_max];
+
+        picoquic_send_limit_times(&cnx->send_limits, current_time, cnx_times);
+        for (int i = 0; i < picoquic_send_limit_max; i++) {
+            times[i] = stream->send_limits.time_in_state[i] + cnx_times[i] - stream->send_limit_cnx_base[i];
+        }
+    }
+    else {
+        picoquic_send_limit_times(&stream->send_limits, current_time, times);
+    }
+}
+#endif
+
+void picoquic_send_limit_init(picoquic_send_limit_track_t* track, picoquic_send_limit_enum state, uint64_t current_time)
+{
+    memset(track, 0, sizeof(picoquic_send_limit_track_t));
+    track->state = state;
+    track->state_start = current_time;
+}
+
+void picoquic_send_limit_update(picoquic_cnx_t* cnx, size_t send_length, uint64_t current_time)
+{
+#ifndef PICOQUIC_DISABLE_STATS
+    picoquic_send_limit_enum state;
+    unsigned int flags = cnx->send_limit_flags;
+
+    if (send_length > 0) {
+        state = picoquic_send_limit_none;
+    }
+    else if (!cnx->client_mode && !cnx->initial_validated) {
+        state = picoquic_send_limit_amplification;
+    }
+    else if (flags & (1u << picoquic_send_limit_cwin)) {
+        state = picoquic_send_limit_cwin;
+    }
+    else if (flags & (1u << picoquic_send_limit_pacing)) {
+        state = picoquic_send_limit_pacing;
+    }
+    else if (flags & (1u << picoquic_send_limit_flow)) {
+        state = picoquic_send_limit_flow;
+    }
+    else if (flags & (1u << picoquic_send_limit_stream_flow)) {
+        state = picoquic_send_limit_stream_flow;
+    }
+    else {
+        state = picoquic_send_limit_app;
+    }
+    cnx->send_limit_flags = 0;
+
+    if (state != cnx->send_limits.state) {
+        picoquic_send_limit_set(&cnx->send_limits, state, current_time);
+    }
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(send_length);
+    UNREFERENCED_PARAMETER(current_time);
+#endif
+#endif
+}
+
+void picoquic_stream_send_limit_update(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, picoquic_send_limit_enum limit)
+{
+#ifndef PICOQUIC_DISABLE_STATS
+    uint64_t current_time = cnx->send_limit_time;
+
+    if (stream->send_limits.state == picoquic_send_limit_none) {
+        /* Collect the times of the connection while the stream was ready */
+        picoquic_stream_send_limit_times(cnx, stream, current_time, stream->send_limits.time_in_state);
+        stream->send_limits.state = picoquic_send_limit_max;
+    }
+    picoquic_send_limit_set(&stream->send_limits, limit, current_time);
+    if (limit == picoquic_send_limit_none) {
+        picoquic_send_limit_times(&cnx->send_limits, current_time, stream->send_limit_cnx_base);
+    }
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(stream);
+    UNREFERENCED_PARAMETER(limit);
+#endif
+#endif
+}
+
+int picoquic_get_send_limits(picoquic_cnx_t* cnx, uint64_t current_time, picoquic_send_limits_t* limits)
+{
+    int ret = 0;
+
+#ifndef PICOQUIC_DISABLE_STATS
+    limits->current = cnx->send_limits.state;
+    picoquic_send_limit_times(&cnx->send_limits, current_time, limits->time_in_state);
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(current_time);
+#endif
+    memset(limits, 0, sizeof(picoquic_send_limits_t));
+    ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+#endif
+
+    return ret;
+}
+
+void picoquic_stream_send_limits(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, uint64_t current_time, picoquic_send_limits_t* limits)
+{
+#ifndef PICOQUIC_DISABLE_STATS
+    limits->current = stream->send_limits.state;
+    picoquic_stream_send_limit_times(cnx, stream, current_time, limits->time_in_state);
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(stream);
+    UNREFERENCED_PARAMETER(current_time);
+#endif
+    memset(limits, 0, sizeof(picoquic_send_limits_t));
+#endif
+}
+
+int picoquic_get_stream_send_limits(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t current_time, picoquic_send_limits_t* limits)
+{
+    int ret = 0;
+
+#ifndef PICOQUIC_DISABLE_STATS
+    picoquic_stream_head_t* stream = picoquic_find_stream(cnx, stream_id);
+
+    if (stream == NULL) {
+        memset(limits, 0, sizeof(picoquic_send_limits_t));
+        ret = PICOQUIC_ERROR_INVALID_STREAM_ID;
+    }
+    else {
+        picoquic_stream_send_limits(cnx, stream, current_time, limits);
+    }
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(stream_id);
+    UNREFERENCED_PARAMETER(current_time);
+#endif
+    memset(limits, 0, sizeof(picoquic_send_limits_t));
+    ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+#endif
+
+    return ret;
+}
+
+char const* picoquic_send_limit_name(picoquic_send_limit_enum limit)
+{
+    char const* limit_name = "unknown";
+
+    switch (limit) {
+    case picoquic_send_limit_none:
+        limit_name = "none";
+        break;
+    case picoquic_send_limit_app:
+        limit_name = "app";
+        break;
+    case picoquic_send_limit_cwin:
+        limit_name = "cwin";
+        break;
+    case picoquic_send_limit_pacing:
+        limit_name = "pacing";
+        break;
+    case picoquic_send_limit_flow:
+        limit_name = "flow";
+        break;
+    case picoquic_send_limit_stream_flow:
+        limit_name = "stream_flow";
+        break;
+    case picoquic_send_limit_amplification:
+        limit_name = "amplification";
+        break;
+    default:
+        break;
+    }
+
+    return limit_name;
+}
@@ -344,10 +344,12 @@ picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
     
     if (packet == NULL) {
         packet = (picoquic_packet_t*)malloc(sizeof(picoquic_packet_t));
+        PICOQUIC_STATS_ADD(&quic->stats, nb_packet_pool_misses, 1);
     }
     else {
         quic->p_first_packet = packet->next_packet;
         quic->nb_packets_in_pool--;
+        PICOQUIC_STATS_ADD(&quic->stats, nb_packet_pool_hits, 1);
     }
 
     if (packet != NULL) {
@@ -643,15 +645,15 @@ static size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     send_length += /* header_length */ h_length;
 
     /* if needed, log the segment before header protection is applied */
-    if (cnx->quic->F_log != NULL && (cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE || cnx->quic->use_long_log)) {
+    if (cnx->is_logging) {
         picoquic_log_outgoing_segment(cnx->quic->F_log, 1, cnx,
             bytes, sequence_number, length,
             send_buffer, send_length, pn_length);
     }
-    if (cnx->quic->f_binlog != NULL && (cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE || cnx->quic->use_long_log)) {
-        binlog_outgoing_packet(cnx->quic->f_binlog, cnx,
-            bytes, sequence_number, pn_length, length,
-            send_buffer, send_length, current_time);
+    if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic) && binlog_cnx_is_wanted(cnx)) {
+        binlog_outgoing_packet(cnx, ptype, remote_cnxid, local_cnxid,
+            bytes, sequence_number, h_length, length,
+            send_buffer, current_time);
     }
 
     /* Next, encrypt the PN -- The sample is located after the pn_offset */
@@ -677,52 +679,91 @@ static size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     return send_length;
 }
 
-/* Update the leaky bucket used for pacing.
+/* Bring the pacer clock up to date. The clock never lags the current time by more
+ * than the burst allowance, which caps the number of packets that can be sent
+ * back to back after an idle period.
  */
-static void picoquic_update_pacing_bucket(picoquic_path_t * path_x, uint64_t current_time)
+static void picoquic_update_pacing_release_time(picoquic_path_t * path_x, uint64_t current_time)
 {
-    if (current_time > path_x->pacing_evaluation_time) {
-        path_x->pacing_bucket_nanosec += (current_time - path_x->pacing_evaluation_time) * 1000;
-        path_x->pacing_evaluation_time = current_time;
-        if (path_x->pacing_bucket_nanosec > path_x->pacing_bucket_max) {
-            path_x->pacing_bucket_nanosec = path_x->pacing_bucket_max;
-        }
+    int64_t release_min = (int64_t)(current_time * 1000) - path_x->pacing_bucket_max;
+
+    if (path_x->pacing_release_time_nanosec < release_min) {
+        path_x->pacing_release_time_nanosec = release_min;
     }
 }
 
+/*
+ * Compute the first microsecond at which the pacer authorizes the next
+ * transmission, or 0 if it is authorized now. A full size packet may
+ * depart at the release time plus the packet time. If pacing is offloaded,
+ * the packet may be prepared up to the horizon ahead of that time. The
+ * path is not modified.
+ */
+static uint64_t picoquic_get_pacing_time(picoquic_path_t* path_x, uint64_t current_time)
+{
+    uint64_t next_pacing_time = 0;
+    int64_t release_min = (int64_t)(current_time * 1000) - path_x->pacing_bucket_max;
+    int64_t departure_nanosec = (path_x->pacing_release_time_nanosec < release_min) ?
+        release_min : path_x->pacing_release_time_nanosec;
+
+    departure_nanosec += path_x->pacing_packet_time_nanosec;
+
+    if (departure_nanosec > (int64_t)(current_time * 1000 + path_x->pacing_horizon_nanosec)) {
+        next_pacing_time = (uint64_t)(departure_nanosec - (int64_t)path_x->pacing_horizon_nanosec + 999) / 1000;
+    }
+
+    return next_pacing_time;
+}
+
 /*
  * Check pacing to see whether the next transmission is authorized.
- * If if is not, update the next wait time to reflect pacing.
- * -
+ * If it is not authorized, update the next wait time to the first
+ * microsecond at which it will be.
  */
-int picoquic_is_sending_authorized_by_pacing(picoquic_path_t * path_x, uint64_t current_time, uint64_t * next_time)
+int picoquic_is_sending_authorized_by_pacing(picoquic_cnx_t * cnx, picoquic_path_t * path_x, uint64_t current_time, uint64_t * next_time)
 {
     int ret = 1;
+    uint64_t next_pacing_time;
 
-    picoquic_update_pacing_bucket(path_x, current_time);
-    if (path_x->pacing_bucket_nanosec < path_x->pacing_packet_time_nanosec) {
-        int64_t bucket_required = (int64_t)path_x->pacing_packet_time_nanosec - path_x->pacing_bucket_nanosec;
+    picoquic_update_pacing_release_time(path_x, current_time);
+    next_pacing_time = picoquic_get_pacing_time(path_x, current_time);
 
-        uint64_t next_pacing_time = current_time + 1 + bucket_required / 1000;
+    if (next_pacing_time != 0) {
         if (next_pacing_time < *next_time) {
             *next_time = next_pacing_time;
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_pacing);
+        }
+        PICOQUIC_SEND_LIMIT_FLAG(cnx, picoquic_send_limit_pacing);
+        if (!path_x->is_pacing_blocked) {
+            path_x->is_pacing_blocked = 1;
+            path_x->pacing_blocked_time = current_time;
         }
         ret = 0;
     }
+    else if (path_x->is_pacing_blocked) {
+        /* The pacing wait is over */
+        path_x->is_pacing_blocked = 0;
+        PICOQUIC_HISTOGRAM_RECORD(cnx->quic, picoquic_histogram_pacing_wait, current_time - path_x->pacing_blocked_time);
+    }
 
     return ret;
 }
 
 /* Reset the pacing data after recomputing the pacing rate
  */
-void picoquic_update_pacing_rate(picoquic_cnx_t * cnx, picoquic_path_t* path_x, double pacing_rate, uint64_t quantum)
+void picoquic_update_pacing_rate(picoquic_cnx_t * cnx, picoquic_path_t* path_x, uint64_t pacing_rate, uint64_t quantum)
 {
-    double packet_time = (double)path_x->send_mtu / pacing_rate;
-    double quantum_time = (double)quantum / pacing_rate;
-
-    path_x->pacing_rate = (uint64_t)pacing_rate;
+    path_x->pacing_rate = pacing_rate;
 
-    path_x->pacing_packet_time_nanosec = (uint64_t)(packet_time * 1000000000.0);
+    if (pacing_rate == 0) {
+        path_x->pacing_packet_time_nanosec = 1000000000;
+        path_x->pacing_bucket_max = 0;
+    }
+    else {
+        path_x->pacing_packet_time_nanosec = ((uint64_t)path_x->send_mtu * 1000000000ull) / pacing_rate;
+        path_x->pacing_bucket_max = (quantum < UINT64_MAX / 1000000000ull) ?
+            (quantum * 1000000000ull) / pacing_rate : (quantum / pacing_rate) * 1000000000ull;
+    }
 
     if (path_x->pacing_packet_time_nanosec > 1000000000) {
         path_x->pacing_packet_time_nanosec = 1000000000;
@@ -736,15 +777,10 @@ void picoquic_update_pacing_rate(picoquic_cnx_t * cnx, picoquic_path_t* path_x,
         path_x->pacing_packet_time_microsec = (path_x->pacing_packet_time_nanosec + 1023ull) / 1000;
     }
 
-    path_x->pacing_bucket_max = (uint64_t)(quantum_time * 1000000000.0);
     if (path_x->pacing_bucket_max <= 0) {
         path_x->pacing_bucket_max = 16 * path_x->pacing_packet_time_nanosec;
     }
 
-    if (path_x->pacing_bucket_nanosec > path_x->pacing_bucket_max) {
-        path_x->pacing_bucket_nanosec = path_x->pacing_bucket_max;
-    }
-
     if (cnx->is_pacing_update_requested && path_x == cnx->path[0] &&
         cnx->callback_fn != NULL) {
         if ((path_x->pacing_rate > cnx->pacing_rate_signalled &&
@@ -766,18 +802,14 @@ void picoquic_update_pacing_data(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
 {
     uint64_t rtt_nanosec = path_x->smoothed_rtt * 1000;
 
-    if ((path_x->cwin < ((uint64_t)path_x->send_mtu) * 8) || rtt_nanosec <= 1000) {
-        /* Small windows, should only relie on ACK clocking */
-        path_x->pacing_bucket_max = rtt_nanosec;
+    if (rtt_nanosec <= 1000) {
+        /* No usable RTT estimate, only rely on ACK clocking */
+        path_x->pacing_bucket_max = 16;
         path_x->pacing_packet_time_nanosec = 1;
         path_x->pacing_packet_time_microsec = 1;
-
-        if (path_x->pacing_bucket_nanosec > path_x->pacing_bucket_max) {
-            path_x->pacing_bucket_nanosec = path_x->pacing_bucket_max;
-        }
     }
     else {
-        double pacing_rate = ((double)path_x->cwin / (double)rtt_nanosec) * 1000000000.0;
+        uint64_t pacing_rate = (path_x->cwin * 1000000ull) / path_x->smoothed_rtt;
         uint64_t quantum = path_x->cwin / 4;
 
         if (quantum < 2ull * path_x->send_mtu) {
@@ -790,7 +822,7 @@ void picoquic_update_pacing_data(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
                     quantum = quantum_min;
                 }
                 else {
-                    uint64_t quantum2 = (uint64_t)((pacing_rate * PICOQUIC_MAX_BANDWIDTH_TIME_INTERVAL_MAX) / 1000000.0);
+                    uint64_t quantum2 = (pacing_rate * PICOQUIC_MAX_BANDWIDTH_TIME_INTERVAL_MAX) / 1000000;
                     if (quantum2 > quantum_min) {
                         quantum = quantum2;
                     }
@@ -803,30 +835,83 @@ void picoquic_update_pacing_data(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
         }
 
         if (slow_start) {
-            pacing_rate *= 1.25;
+            pacing_rate += pacing_rate / 4;
         }
 
         picoquic_update_pacing_rate(cnx, path_x, pacing_rate, quantum);
     }
 }
 
-/* 
- * Update the pacing data after sending a packet.
+/*
+ * Update the pacing data after sending a packet, and return its departure time
+ * in nanoseconds. The pacer clock advances by the transmission time of a full
+ * size packet at the pacing rate.
  */
-void picoquic_update_pacing_after_send(picoquic_path_t * path_x, uint64_t current_time)
+uint64_t picoquic_update_pacing_after_send(picoquic_path_t * path_x, uint64_t current_time)
 {
-    picoquic_update_pacing_bucket(path_x, current_time);
+    int64_t now_nanosec = (int64_t)(current_time * 1000);
 
-#if 0
-    if (path_x->pacing_bucket_nanosec < path_x->pacing_packet_time_nanosec) {
-        path_x->pacing_bucket_nanosec = 0;
-    } else {
-        path_x->pacing_bucket_nanosec -= path_x->pacing_packet_time_nanosec;
+    picoquic_update_pacing_release_time(path_x, current_time);
+    path_x->pacing_release_time_nanosec += path_x->pacing_packet_time_nanosec;
+
+    return (uint64_t)((path_x->pacing_release_time_nanosec > now_nanosec) ? path_x->pacing_release_time_nanosec : now_nanosec);
+}
+
+/*
+ * Loss detection, per RFC 9002. A packet is declared lost if a packet sent after it
+ * on the same path was acknowledged, and either enough later packets were acknowledged
+ * (packet threshold) or it was sent long enough ago (time threshold). Both thresholds
+ * start at the values recommended in the RFC, and grow if the path shows reordering,
+ * i.e., if spurious retransmissions were detected. If nothing more recent was
+ * acknowledged, the probe timeout applies.
+ */
+
+static uint64_t picoquic_current_retransmit_timer(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_context_enum pc)
+{
+    uint64_t rto = path_x->retransmit_timer;
+
+    rto <<= cnx->pkt_ctx[pc].nb_retransmit;
+    if (cnx->cnx_state < picoquic_state_ready) {
+        if (rto > PICOQUIC_INITIAL_MAX_RETRANSMIT_TIMER) {
+            rto = PICOQUIC_INITIAL_MAX_RETRANSMIT_TIMER;
+        }
+    }
+    else if (rto > PICOQUIC_MAX_RETRANSMIT_TIMER) {
+        rto = PICOQUIC_MAX_RETRANSMIT_TIMER;
     }
-#else
-    path_x->pacing_bucket_nanosec -= path_x->pacing_packet_time_nanosec;
-#endif
 
+    return rto;
+}
+
+static uint64_t picoquic_loss_packet_threshold(picoquic_path_t* path_x)
+{
+    return (path_x->max_reorder_gap >= PICOQUIC_LOSS_PACKET_THRESHOLD) ?
+        path_x->max_reorder_gap + 1 : PICOQUIC_LOSS_PACKET_THRESHOLD;
+}
+
+static uint64_t picoquic_loss_time_threshold(picoquic_path_t* path_x)
+{
+    uint64_t rtt = (path_x->rtt_sample > path_x->smoothed_rtt) ? path_x->rtt_sample : path_x->smoothed_rtt;
+    uint64_t reorder_window = rtt >> 3;
+    uint64_t loss_delay;
+
+    if (path_x->max_reorder_delay + PICOQUIC_LOSS_TIME_GRANULARITY > reorder_window) {
+        /* Packets were repeated that were only late, overtaken by packets sent that much later */
+        reorder_window = path_x->max_reorder_delay + PICOQUIC_LOSS_TIME_GRANULARITY;
+    }
+
+    loss_delay = rtt + reorder_window;
+
+    if (loss_delay > path_x->retransmit_timer && reorder_window > (rtt >> 3)) {
+        /* But do not wait longer than the probe timeout */
+        loss_delay = path_x->retransmit_timer;
+    }
+
+    if (loss_delay < PICOQUIC_LOSS_TIME_GRANULARITY) {
+        loss_delay = PICOQUIC_LOSS_TIME_GRANULARITY;
+    }
+
+    return loss_delay;
 }
 
 /*
@@ -849,11 +934,69 @@ void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t * path_x
     }
     cnx->pkt_ctx[pc].retransmit_newest = packet;
 
+    /* The new packet cannot be declared lost before its probe timeout */
+    if (cnx->pkt_ctx[pc].loss_timer != 0) {
+        uint64_t pto_time = current_time + picoquic_current_retransmit_timer(cnx,
+            (cnx->is_multipath_enabled) ? path_x : cnx->path[0], pc);
+        if (pto_time < cnx->pkt_ctx[pc].loss_timer) {
+            cnx->pkt_ctx[pc].loss_timer = pto_time;
+        }
+    }
+
     if (!packet->is_ack_trap) {
         /* Account for bytes in transit, for congestion control */
         path_x->bytes_in_transit += length;
-        /* Update the pacing data */
-        picoquic_update_pacing_after_send(path_x, current_time);
+        /* Account for the traffic on the path, for the path scheduler */
+        if (cnx->is_multipath_enabled && cnx->path_scheduler != NULL && cnx->path_scheduler->packet_sent != NULL) {
+            cnx->path_scheduler->packet_sent(cnx, path_x, length);
+        }
+        /* Update the pacing data, and record the departure time of the packet */
+        uint64_t departure_time = picoquic_update_pacing_after_send(path_x, current_time);
+        if (departure_time > cnx->quic->last_departure_time_nanosec) {
+            cnx->quic->last_departure_time_nanosec = departure_time;
+        }
+    }
+}
+
+/*
+ * ECN marking. While testing or once validated, datagrams carry the codepoint
+ * requested by the application. Only 1-RTT packets sent on the default path are
+ * accounted for, because these are the only ones counted by the peer.
+ */
+
+uint8_t picoquic_ecn_codepoint_to_send(picoquic_cnx_t* cnx)
+{
+    return (cnx->ecn_state == picoquic_ecn_state_testing || cnx->ecn_state == picoquic_ecn_state_capable) ?
+        cnx->ecn_codepoint : PICOQUIC_ECN_NOT_ECT;
+}
+
+void picoquic_ecn_packet_sent(picoquic_cnx_t* cnx, picoquic_packet_t* packet, uint8_t ecn_codepoint)
+{
+    packet->ecn_codepoint = ecn_codepoint;
+    if (ecn_codepoint == PICOQUIC_ECN_ECT_0) {
+        cnx->ecn_ect0_sent++;
+    }
+    else if (ecn_codepoint == PICOQUIC_ECN_ECT_1) {
+        cnx->ecn_ect1_sent++;
+    }
+
+    if (ecn_codepoint != PICOQUIC_ECN_NOT_ECT && cnx->ecn_state == picoquic_ecn_state_testing) {
+        cnx->ecn_testing_sent++;
+        if (cnx->ecn_testing_sent >= PICOQUIC_ECN_TESTING_PACKETS) {
+            cnx->ecn_state = picoquic_ecn_state_unknown;
+        }
+    }
+}
+
+/* If all the packets sent during testing are lost, marked packets are probably dropped. */
+void picoquic_ecn_packet_lost(picoquic_cnx_t* cnx, picoquic_packet_t* packet)
+{
+    if (packet->ecn_codepoint != PICOQUIC_ECN_NOT_ECT &&
+        (cnx->ecn_state == picoquic_ecn_state_testing || cnx->ecn_state == picoquic_ecn_state_unknown)) {
+        cnx->ecn_testing_lost++;
+        if (cnx->ecn_testing_lost >= PICOQUIC_ECN_TESTING_PACKETS) {
+            cnx->ecn_state = picoquic_ecn_state_failed;
+        }
     }
 }
 
@@ -973,9 +1116,12 @@ void picoquic_insert_hole_in_send_sequence_if_needed(picoquic_cnx_t* cnx, uint64
                 packet->send_path = cnx->path[0];
                 packet->send_time = current_time;
                 packet->sequence_number = cnx->pkt_ctx[picoquic_packet_context_application].send_sequence++;
+                if (cnx->is_logging) {
+                    picoquic_update_cnx_logging(cnx);
+                }
                 picoquic_queue_for_retransmit(cnx, cnx->path[0], packet, 0, current_time);
                 *next_wake_time = current_time;
-                SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_retransmit);
                 /* Simulate local loss on the Q bit square function. */
                 cnx->path[0]->q_square++;
             }
@@ -1003,11 +1149,16 @@ void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx, picoquic_packet_t
     if (ret == 0 && length > 0) {
         packet->length = length;
         cnx->pkt_ctx[packet->pc].send_sequence++;
+        if (cnx->is_logging) {
+            /* The packet trace stops after the first packets, unless long logs are requested */
+            picoquic_update_cnx_logging(cnx);
+        }
         path_x->latest_sent_time = current_time;
-        packet->delivered_prior = path_x->delivered_last;
-        packet->delivered_time_prior = path_x->delivered_time_last;
-        packet->delivered_sent_prior = path_x->delivered_sent_last;
-        packet->delivered_app_limited = (cnx->cnx_state < picoquic_state_ready || path_x->delivered_limited_index != 0);
+        picoquic_rate_sampler_packet_sent(cnx, path_x, packet, current_time);
+        packet->path_packet_number = ++path_x->path_packet_next;
+        if (packet->ptype == picoquic_packet_1rtt_protected && (path_x == cnx->path[0] || cnx->is_multipath_enabled)) {
+            picoquic_ecn_packet_sent(cnx, packet, cnx->quic->last_ecn_codepoint);
+        }
 
         switch (packet->ptype) {
         case picoquic_packet_version_negotiation:
@@ -1047,6 +1198,7 @@ void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx, picoquic_packet_t
                 length, header_length,
                 send_buffer, send_buffer_max, cnx->crypto_context[picoquic_epoch_1rtt].aead_encrypt, cnx->crypto_context[picoquic_epoch_1rtt].pn_enc,
                 path_x, current_time);
+            cnx->crypto_epoch_bytes += length;
             break;
         default:
             /* Packet type error. Do nothing at all. */
@@ -1057,6 +1209,13 @@ void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx, picoquic_packet_t
         *send_length = length;
 
         if (length > 0) {
+#ifndef PICOQUIC_DISABLE_STATS
+            picoquic_epoch_enum epoch = (packet->ptype == picoquic_packet_1rtt_protected) ? picoquic_epoch_1rtt :
+                ((packet->ptype == picoquic_packet_0rtt_protected) ? picoquic_epoch_0rtt :
+                ((packet->ptype == picoquic_packet_handshake) ? picoquic_epoch_handshake : picoquic_epoch_initial));
+            PICOQUIC_STATS_ADD(&cnx->stats, nb_packets_sent[epoch], 1);
+            PICOQUIC_STATS_ADD(&cnx->stats, nb_bytes_sent[epoch], length);
+#endif
             packet->checksum_overhead = checksum_overhead;
             picoquic_queue_for_retransmit(cnx, path_x, packet, length, current_time);
         } else {
@@ -1077,23 +1236,6 @@ void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx, picoquic_packet_t
  * a different path, with different MTU.
  */
 
-static uint64_t picoquic_current_retransmit_timer(picoquic_cnx_t* cnx, picoquic_packet_context_enum pc)
-{
-    uint64_t rto = cnx->path[0]->retransmit_timer;
-
-    rto <<= cnx->pkt_ctx[pc].nb_retransmit;
-    if (cnx->cnx_state < picoquic_state_ready) {
-        if (rto > PICOQUIC_INITIAL_MAX_RETRANSMIT_TIMER) {
-            rto = PICOQUIC_INITIAL_MAX_RETRANSMIT_TIMER;
-        }
-    }
-    else if (rto > PICOQUIC_MAX_RETRANSMIT_TIMER) {
-        rto = PICOQUIC_MAX_RETRANSMIT_TIMER;
-    }
-
-    return rto;
-}
-
 static int picoquic_retransmit_needed_by_packet(picoquic_cnx_t* cnx,
     picoquic_packet_t* p, uint64_t current_time, uint64_t * next_retransmit_time, int* timer_based)
 {
@@ -1102,23 +1244,29 @@ static int picoquic_retransmit_needed_by_packet(picoquic_cnx_t* cnx,
     int64_t delta_seq = cnx->pkt_ctx[pc].highest_acknowledged - p->sequence_number;
     int should_retransmit = 0;
     int is_timer_based = 0;
+    picoquic_path_t* rack_path = cnx->path[0];
+
+    if (cnx->is_multipath_enabled && p->send_path != NULL && p->path_packet_number > 0) {
+        /* When several paths are used concurrently, packets sent on a slow path are routinely
+         * overtaken by packets sent on a faster one. The ordering and the timers are then
+         * evaluated per path, using the packets sent and acknowledged on that path. */
+        rack_path = p->send_path;
+        delta_seq = (int64_t)(rack_path->path_packet_acked - p->path_packet_number);
+    }
 
     if (delta_seq > 0) {
-        /* By default, we use timer based RACK logic to absorb out of order deliveries */
-        retransmit_time = p->send_time + cnx->path[0]->retransmit_timer; /* cnx->path[0]->smoothed_rtt + (cnx->path[0]->smoothed_rtt >> 3); */
-        /* RACK logic works best when the amount of reordering is not too large */
-        if (delta_seq < 3) {
-            uint64_t rack_timer_min = cnx->pkt_ctx[pc].highest_acknowledged_time +
-                cnx->remote_parameters.max_ack_delay + (cnx->path[0]->smoothed_rtt >> 2);
-            if (retransmit_time > rack_timer_min) {
-                retransmit_time = rack_timer_min;
-            }
+        if ((uint64_t)delta_seq >= picoquic_loss_packet_threshold(rack_path)) {
+            /* Enough packets sent later were acknowledged */
+            retransmit_time = p->send_time;
+        }
+        else {
+            retransmit_time = p->send_time + picoquic_loss_time_threshold(rack_path);
         }
     }
     else
     {
         /* There has not been any higher packet acknowledged, thus we fall back on timer logic. */
-        retransmit_time = p->send_time + picoquic_current_retransmit_timer(cnx, pc);
+        retransmit_time = p->send_time + picoquic_current_retransmit_timer(cnx, rack_path, pc);
         is_timer_based = 1;
     }
 
@@ -1127,7 +1275,7 @@ static int picoquic_retransmit_needed_by_packet(picoquic_cnx_t* cnx,
         if (cnx->cnx_state != picoquic_state_ready &&
             cnx->cnx_state != picoquic_state_client_ready_start) {
             /* Set the retransmit time ahead of current time since the connection is not ready */
-            retransmit_time = current_time + cnx->path[0]->smoothed_rtt + PICOQUIC_RACK_DELAY;
+            retransmit_time = current_time + picoquic_current_retransmit_timer(cnx, cnx->path[0], pc);
         } else if (!cnx->zero_rtt_data_accepted) {
             /* Zero RTT data was not accepted by the peer, the packets are considered lost */
             retransmit_time = current_time;
@@ -1238,6 +1386,18 @@ int picoquic_retransmit_needed(picoquic_cnx_t* cnx,
     picoquic_packet_t* old_p = cnx->pkt_ctx[pc].retransmit_oldest;
     size_t length = 0;
     picoquic_packet_type_enum incoming_type = packet->ptype;
+    uint64_t loss_timer = UINT64_MAX;
+
+    if (!cnx->initial_repeat_needed && cnx->cnx_state == picoquic_state_ready &&
+        current_time < cnx->pkt_ctx[pc].loss_timer) {
+        /* Nothing can be lost yet, no need to check the packets one by one */
+        if (cnx->pkt_ctx[pc].loss_timer < *next_wake_time) {
+            *next_wake_time = cnx->pkt_ctx[pc].loss_timer;
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_retransmit);
+        }
+        return 0;
+    }
+    cnx->pkt_ctx[pc].loss_timer = 0;
 
     /* TODO: while packets are pure ACK, drop them from retransmit queue */
     while (old_p != NULL) {
@@ -1258,6 +1418,9 @@ int picoquic_retransmit_needed(picoquic_cnx_t* cnx,
             picoquic_retransmit_needed_by_packet(cnx, old_p, current_time, &next_retransmit_time, &timer_based_retransmit);
 
         if (should_retransmit == 0) {
+            if (next_retransmit_time < loss_timer) {
+                loss_timer = next_retransmit_time;
+            }
             /*
              * Always retransmit in order. If not this one, then nothing.
              * But make an exception for 0-RTT packets.
@@ -1269,14 +1432,31 @@ int picoquic_retransmit_needed(picoquic_cnx_t* cnx,
             else {
                 if (next_retransmit_time < *next_wake_time) {
                     *next_wake_time = next_retransmit_time;
-                    SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                    SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_retransmit);
                 }
+                if (cnx->is_multipath_enabled) {
+                    /* Losses are detected per path, the next packet may have been sent on a different path */
+                    old_p = p_next;
+                    continue;
+                }
+                cnx->pkt_ctx[pc].loss_timer = loss_timer;
                 break;
             }
         } else if (old_p->is_ack_trap){
             picoquic_dequeue_retransmit_packet(cnx, old_p, 1);
             old_p = p_next;
             continue;
+        } else if (timer_based_retransmit && pc == picoquic_packet_context_application &&
+            cnx->cnx_state == picoquic_state_ready && cnx->pkt_ctx[pc].nb_retransmit < PICOQUIC_PTO_NEW_DATA_MAX &&
+            picoquic_find_ready_stream(cnx) != NULL) {
+            /* The probe timer expired. As recommended in RFC 9002, send new data as a probe
+             * rather than repeating this packet, which remains in flight. If the probe is
+             * acknowledged, the packet will then be found lost by the packet or time threshold. */
+            cnx->pkt_ctx[pc].nb_retransmit++;
+            cnx->pkt_ctx[pc].latest_retransmit_time = current_time;
+            cnx->pkt_ctx[pc].retransmit_sequence = cnx->pkt_ctx[pc].send_sequence;
+            cnx->pkt_ctx[pc].pto_probe_needed = 1;
+            break;
         } else {
             /* check if this is an ACK only packet */
             int packet_is_pure_ack = 1;
@@ -1337,7 +1517,7 @@ int picoquic_retransmit_needed(picoquic_cnx_t* cnx,
 
             if (should_retransmit != 0) {
                 if (packet->ptype == picoquic_packet_1rtt_protected &&
-                    !picoquic_is_sending_authorized_by_pacing(path_x, current_time, next_wake_time)) {
+                    !picoquic_is_sending_authorized_by_pacing(cnx, path_x, current_time, next_wake_time)) {
                     /* Cannot retransmit now, will have to wait. */
                     /* We do this test when we are almost sure that there is something to retransmit,
                      * so as to not cause a gratuitous "pacing" wakeup when there is nothing to send. */
@@ -1387,12 +1567,13 @@ int picoquic_retransmit_needed(picoquic_cnx_t* cnx,
                 /* If not pure ack, the packet will be placed in the "retransmitted" queue,
                  * in order to enable detection of spurious restransmissions */
 
-                if (cnx->quic->f_binlog != NULL) {
-                    binlog_packet_lost(cnx->quic->f_binlog, cnx, old_p->ptype, old_p->sequence_number,
+                if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic)) {
+                    binlog_packet_lost(cnx->quic, cnx, old_p->ptype, old_p->sequence_number,
                         (timer_based_retransmit == 0) ? "repeat" : "timer",
                         (old_p->send_path == NULL) ? NULL : &old_p->send_path->remote_cnxid,
                         old_p->length, current_time);
                 }
+                picoquic_ecn_packet_lost(cnx, old_p);
                 old_p = picoquic_dequeue_retransmit_packet(cnx, old_p, packet_is_pure_ack & do_not_detect_spurious);
 
                 /* If we have a good packet, return it */
@@ -1455,6 +1636,11 @@ int picoquic_retransmit_needed(picoquic_cnx_t* cnx,
         old_p = p_next;
     }
 
+    if (old_p == NULL) {
+        /* All the packets in the queue were checked */
+        cnx->pkt_ctx[pc].loss_timer = loss_timer;
+    }
+
     return (int)length;
 }
 
@@ -1671,7 +1857,7 @@ int picoquic_prepare_packet_0rtt(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
 
         if (more_data) {
             *next_wake_time = current_time;
-            SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_data);
         }
 
         if (stream_tried_and_failed) {
@@ -1904,7 +2090,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
 
     if (*next_wake_time > cnx->start_time + PICOQUIC_MICROSEC_HANDSHAKE_MAX) {
         *next_wake_time = cnx->start_time + PICOQUIC_MICROSEC_HANDSHAKE_MAX;
-        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
     }
 
     cnx->initial_validated = 1; /* always validated on client */
@@ -1977,13 +2163,13 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
                 }
                 else if (ack_time < *next_wake_time) {
                     *next_wake_time = ack_time;
-                    SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                    SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_ack);
                 }
             } else if (!force_handshake_padding && cnx->pkt_ctx[pc].retransmit_newest != NULL) {
                 /* There is a risk of deadlock if the server is doing DDOS mitigation
                  * and does not receive the Handshake sent by the client. If more than RTT has elapsed since
                  * the last handshake packet was sent, force another one to be sent. */
-                uint64_t rto = picoquic_current_retransmit_timer(cnx, picoquic_packet_context_handshake);
+                uint64_t rto = picoquic_current_retransmit_timer(cnx, cnx->path[0], picoquic_packet_context_handshake);
                 uint64_t repeat_time = cnx->pkt_ctx[pc].retransmit_newest->send_time + rto;
 
                 if (repeat_time <= current_time) {
@@ -1992,7 +2178,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
                 }
                 else if (repeat_time < *next_wake_time) {
                     *next_wake_time = repeat_time;
-                    SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                    SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_retransmit);
                 }
             }
         }
@@ -2158,7 +2344,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
                 /* schedule a wake time to repeat the probing. */
                 if (*next_wake_time > try_time_next) {
                     *next_wake_time = try_time_next;
-                    SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                    SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_retransmit);
                 }
             }
             else {
@@ -2186,7 +2372,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
     else {
         if (ret == 0 && more_data) {
             *next_wake_time = current_time;
-            SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_data);
         }
 
         if (ret == 0 && *is_initial_sent) {
@@ -2258,7 +2444,7 @@ int picoquic_prepare_packet_server_init(picoquic_cnx_t* cnx, picoquic_path_t * p
 
     if (*next_wake_time > cnx->start_time + PICOQUIC_MICROSEC_HANDSHAKE_MAX) {
         *next_wake_time = cnx->start_time + PICOQUIC_MICROSEC_HANDSHAKE_MAX;
-        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
     }
 
     /* The only purpose of the test below is to appease the static analyzer, so it
@@ -2369,7 +2555,7 @@ int picoquic_prepare_packet_server_init(picoquic_cnx_t* cnx, picoquic_path_t * p
 
     if (ret == 0 && length == 0 && more_data) {
         *next_wake_time = current_time;
-        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_data);
     }
 
     picoquic_finalize_and_protect_packet(cnx, packet,
@@ -2474,7 +2660,7 @@ int picoquic_prepare_packet_closing(picoquic_cnx_t* cnx, picoquic_path_t * path_
 
         cnx->cnx_state = picoquic_state_draining;
         *next_wake_time = exit_time;
-        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
     } else if (ret == 0 && cnx->cnx_state == picoquic_state_closing) {
         /* if more than 3*RTO is elapsed, move to disconnected */
         uint64_t exit_time = cnx->latest_progress_time + 3 * path_x->retransmit_timer;
@@ -2482,7 +2668,7 @@ int picoquic_prepare_packet_closing(picoquic_cnx_t* cnx, picoquic_path_t * path_
         if (current_time >= exit_time) {
             cnx->cnx_state = picoquic_state_disconnected;
             *next_wake_time = current_time;
-            SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
         }
         else if (current_time >= cnx->next_wake_time) {
             uint64_t delta_t = path_x->rtt_min;
@@ -2518,7 +2704,7 @@ int picoquic_prepare_packet_closing(picoquic_cnx_t* cnx, picoquic_path_t * path_
             }
 
             *next_wake_time = next_time;
-            SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
         }
     } else if (ret == 0 && cnx->cnx_state == picoquic_state_draining) {
         /* Nothing is ever sent in the draining state */
@@ -2528,11 +2714,11 @@ int picoquic_prepare_packet_closing(picoquic_cnx_t* cnx, picoquic_path_t * path_
         if (current_time >= exit_time) {
             cnx->cnx_state = picoquic_state_disconnected;
             *next_wake_time = current_time;
-            SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
         }
         else {
             *next_wake_time = exit_time;
-            SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
         }
         length = 0;
     } else if (ret == 0 && (cnx->cnx_state == picoquic_state_disconnecting || 
@@ -2584,7 +2770,7 @@ int picoquic_prepare_packet_closing(picoquic_cnx_t* cnx, picoquic_path_t * path_
         }
         cnx->latest_progress_time = current_time;
         *next_wake_time = current_time + delta_t;
-        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
         cnx->pkt_ctx[pc].ack_needed = 0;
 
         if (cnx->callback_fn) {
@@ -2642,6 +2828,7 @@ void picoquic_ready_state_transition(picoquic_cnx_t* cnx, uint64_t current_time)
      * The handshake is complete, all the handshake packets are implicitly acknowledged */
     cnx->cnx_state = picoquic_state_ready;
     cnx->is_handshake_finished = 1;
+    PICOQUIC_HISTOGRAM_RECORD(cnx->quic, picoquic_histogram_handshake, current_time - cnx->start_time);
     picoquic_implicit_handshake_ack(cnx, picoquic_packet_context_initial, current_time);
     picoquic_implicit_handshake_ack(cnx, picoquic_packet_context_handshake, current_time);
 
@@ -2825,7 +3012,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
                 else {
                     if (next_challenge_time < *next_wake_time) {
                         *next_wake_time = next_challenge_time;
-                        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_challenge);
                     }
                 }
             }
@@ -2844,7 +3031,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
                 /* There are no frames yet that would be exempt from pacing control, but if there
                  * was they should be sent here. */
 
-                if (picoquic_is_sending_authorized_by_pacing(path_x, current_time, next_wake_time)) {
+                if (picoquic_is_sending_authorized_by_pacing(cnx, path_x, current_time, next_wake_time)) {
                     /* Send here the frames that are not exempt from the pacing control,
                      * but are exempt for congestion control */
                     if (picoquic_is_ack_needed(cnx, current_time, next_wake_time, pc)) {
@@ -2855,6 +3042,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
                     length = bytes_next - bytes;
                     if (path_x->cwin < path_x->bytes_in_transit) {
                         cnx->cwin_blocked = 1;
+                        PICOQUIC_SEND_LIMIT_FLAG(cnx, picoquic_send_limit_cwin);
                         if (cnx->congestion_alg != NULL) {
                             cnx->congestion_alg->alg_notify(cnx, path_x,
                                 picoquic_congestion_notification_cwin_blocked,
@@ -2908,7 +3096,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
 
                             if (length <= header_length) {
                                 /* Mark the bandwidth estimation as application limited */
-                                path_x->delivered_limited_index = path_x->delivered;
+                                picoquic_rate_sampler_app_limited(path_x);
                                 /* Notify the peer if something is blocked */
                                 bytes_next = picoquic_format_blocked_frames(cnx, &bytes[length], bytes_max, &more_data, &is_pure_ack);
                                 length = bytes_next - bytes;
@@ -2963,7 +3151,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
                 }
                 else if (cnx->latest_progress_time + cnx->keep_alive_interval < *next_wake_time) {
                     *next_wake_time = cnx->latest_progress_time + cnx->keep_alive_interval;
-                    SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                    SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
                 }
             }
         }
@@ -2972,7 +3160,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
     if (ret == 0 && length > header_length) {
         if (more_data) {
             *next_wake_time = current_time;
-            SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_data);
             ret = 0;
         }
 
@@ -2993,12 +3181,12 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
 
     if (*send_length > 0) {
         *next_wake_time = current_time;
-        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_send_more);
 
-        if (cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE ||
-            cnx->quic->use_long_log) {
+        if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic) && binlog_cnx_is_wanted(cnx)) {
             picoquic_cc_dump(cnx, current_time);
         }
+        picoquic_cc_telemetry_check(cnx, current_time);
     }
 
     return ret;
@@ -3108,7 +3296,7 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
             else {
                 if (next_challenge_time < *next_wake_time) {
                     *next_wake_time = next_challenge_time;
-                    SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                    SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_challenge);
                 }
             }
         }
@@ -3128,7 +3316,7 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
             /* There are no frames yet that would be exempt from pacing control, but if there
              * was they should be sent here. */
 
-            if (picoquic_is_sending_authorized_by_pacing(path_x, current_time, next_wake_time)) {
+            if (picoquic_is_sending_authorized_by_pacing(cnx, path_x, current_time, next_wake_time)) {
                 /* Send here the frames that are not exempt from the pacing control,
                  * but are exempt for congestion control */
                 if (picoquic_is_ack_needed(cnx, current_time, next_wake_time, pc)) {
@@ -3178,8 +3366,9 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
                 /* Compute the length before entering the CC block */
                 length = bytes_next - bytes;
 
-                if (path_x->cwin < path_x->bytes_in_transit) {
+                if (path_x->cwin < path_x->bytes_in_transit && !cnx->pkt_ctx[pc].pto_probe_needed) {
                     cnx->cwin_blocked = 1;
+                    PICOQUIC_SEND_LIMIT_FLAG(cnx, picoquic_send_limit_cwin);
                     if (cnx->congestion_alg != NULL) {
                         cnx->congestion_alg->alg_notify(cnx, path_x,
                             picoquic_congestion_notification_cwin_blocked,
@@ -3233,7 +3422,7 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
                         if (length <= header_length || is_pure_ack) {
                             /* Mark the bandwidth estimation as application limited */
-                            path_x->delivered_limited_index = path_x->delivered;
+                            picoquic_rate_sampler_app_limited(path_x);
                             /* Notify the peer if something is blocked */
                             bytes_next = picoquic_format_blocked_frames(cnx, &bytes[length], bytes_max, &more_data, &is_pure_ack);
                             length = bytes_next - bytes;
@@ -3283,6 +3472,8 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
         if (is_pure_ack == 0)
         {
             cnx->latest_progress_time = current_time;
+            /* Any ack eliciting packet serves as probe */
+            cnx->pkt_ctx[pc].pto_probe_needed = 0;
         }
         else if (cnx->keep_alive_interval != 0) {
             /* If necessary, encode and send the keep alive packet.
@@ -3304,13 +3495,13 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
             }
             else if (cnx->latest_progress_time + cnx->keep_alive_interval < *next_wake_time) {
                 *next_wake_time = cnx->latest_progress_time + cnx->keep_alive_interval;
-                SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
             }
         }
 
         if (more_data) {
             *next_wake_time = current_time;
-            SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_data);
             ret = 0;
         }
     }
@@ -3333,12 +3524,14 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     if (*send_length > 0) {
         *next_wake_time = current_time;
-        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_send_more);
 
-        if (ret == 0 && (cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE ||
-            cnx->quic->use_long_log)) {
+        if (ret == 0 && PICOQUIC_BINLOG_IS_OPEN(cnx->quic) && binlog_cnx_is_wanted(cnx)) {
             picoquic_cc_dump(cnx, current_time);
         }
+        if (ret == 0) {
+            picoquic_cc_telemetry_check(cnx, current_time);
+        }
     }
 
     return ret;
@@ -3351,7 +3544,7 @@ static int picoquic_check_idle_timer(picoquic_cnx_t* cnx, uint64_t* next_wake_ti
     uint64_t idle_timer = 0;
 
     if (cnx->cnx_state >= picoquic_state_ready) {
-        uint64_t rto = picoquic_current_retransmit_timer(cnx, picoquic_packet_context_application);
+        uint64_t rto = picoquic_current_retransmit_timer(cnx, cnx->path[0], picoquic_packet_context_application);
         idle_timer = cnx->idle_timeout;
         if (idle_timer < 3 * rto) {
             idle_timer = 3 * rto;
@@ -3375,7 +3568,7 @@ static int picoquic_check_idle_timer(picoquic_cnx_t* cnx, uint64_t* next_wake_ti
         }
     } else if (idle_timer < *next_wake_time) {
         *next_wake_time = idle_timer;
-        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
     }
 
     return ret;
@@ -3388,6 +3581,10 @@ int picoquic_prepare_segment(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoq
 {
     int ret = 0;
 
+    if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic) && cnx->binlog_mode != picoquic_binlog_mode_full) {
+        binlog_check_triggers(cnx, current_time);
+    }
+
     if (ret == 0){
         /* Prepare header -- depend on connection state */
         /* TODO: 0-RTT work. */
@@ -3437,10 +3634,78 @@ int picoquic_prepare_segment(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoq
     return ret;
 }
 
+/*
+ * When multipath is negotiated, the validated paths are used concurrently.
+ * The candidates are the paths that could send a packet now, i.e., whose
+ * congestion window is open and whose pacer allows sending. If there is
+ * more than one, the path scheduler picks one. If there is none, the
+ * default path is returned, so acknowledgements can still be sent.
+ *
+ * The pacer of the candidates is checked without side effects: the pacing
+ * state, the send limits and the pacing wait histogram are only updated for
+ * the selected path, when the packet is prepared. If no path can send, the
+ * wake time is set to the earliest pacing time of the blocked paths.
+ */
+
+static int picoquic_schedule_next_path(picoquic_cnx_t* cnx, uint64_t current_time, uint64_t* next_wake_time)
+{
+    picoquic_path_t* candidates[PICOQUIC_NB_PATH_TARGET];
+    int candidate_id[PICOQUIC_NB_PATH_TARGET];
+    int nb_candidates = 0;
+    int path_id = 0;
+    uint64_t next_pacing_time_min = UINT64_MAX;
+
+    for (int i = 0; i < cnx->nb_paths && nb_candidates < PICOQUIC_NB_PATH_TARGET; i++) {
+        picoquic_path_t* path_x = cnx->path[i];
+
+        if (path_x->path_is_demoted || path_x->challenge_failed || (i > 0 && !path_x->challenge_verified)) {
+            continue;
+        }
+
+        if (path_x->congestion_alg_state == NULL && cnx->congestion_alg != NULL) {
+            cnx->congestion_alg->alg_init(path_x, current_time);
+        }
+
+        if (path_x->cwin > path_x->bytes_in_transit) {
+            uint64_t next_pacing_time = picoquic_get_pacing_time(path_x, current_time);
+
+            if (next_pacing_time == 0) {
+                candidates[nb_candidates] = path_x;
+                candidate_id[nb_candidates] = i;
+                nb_candidates++;
+            }
+            else if (next_pacing_time < next_pacing_time_min) {
+                next_pacing_time_min = next_pacing_time;
+            }
+        }
+    }
+
+    if (nb_candidates == 0) {
+        if (next_pacing_time_min < *next_wake_time) {
+            *next_wake_time = next_pacing_time_min;
+            SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_pacing);
+        }
+    }
+    else if (nb_candidates == 1) {
+        path_id = candidate_id[0];
+    }
+    else if (nb_candidates > 1 && cnx->path_scheduler != NULL) {
+        int selected = cnx->path_scheduler->select_path(cnx, candidates, nb_candidates, current_time);
+
+        if (selected >= 0 && selected < nb_candidates) {
+            path_id = candidate_id[selected];
+        }
+    }
+
+    return path_id;
+}
+
 /*
  * The version 1 of Quic only supports path migration, not full multipath.
  * This code finds whether there is a path being probed that could become the
  * default path, or that needs an immediate challenge sent or replied to.
+ * If multipath was negotiated, validated paths are not promoted but
+ * scheduled concurrently with the default path.
  *
  * If no other path is suitable, the code returns the default path.
  */
@@ -3454,7 +3719,13 @@ static int picoquic_select_next_path(picoquic_cnx_t * cnx, uint64_t current_time
             continue;
         }
         else if (cnx->path[i]->challenge_verified) {
-            /* TODO: selection logic if multiple paths are available! */
+            if (cnx->is_multipath_enabled) {
+                /* Keep the path, but reply to challenges without delay */
+                if (path_id < 0 && cnx->path[i]->response_required) {
+                    path_id = i;
+                }
+                continue;
+            }
             /* This path becomes the new default */
             picoquic_promote_path_to_default(cnx, i, current_time);
             path_id = 0;
@@ -3473,19 +3744,46 @@ static int picoquic_select_next_path(picoquic_cnx_t * cnx, uint64_t current_time
                 }
                 else if (next_challenge_time < *next_wake_time) {
                     *next_wake_time = next_challenge_time;
-                    SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                    SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_challenge);
                 }
             }
         }
     }
 
     if (path_id < 0) {
-        path_id = 0;
+        if (cnx->is_multipath_enabled && cnx->cnx_state == picoquic_state_ready) {
+            path_id = picoquic_schedule_next_path(cnx, current_time, next_wake_time);
+        }
+        else {
+            path_id = 0;
+        }
     }
 
     return path_id;
 }
 
+#ifndef PICOQUIC_DISABLE_STATS
+/* Attribute the prepare packet call to the reason for which the connection
+ * was scheduled, and note whether it was on time and produced a packet. */
+static void picoquic_wake_profile_record(picoquic_quic_t* quic, picoquic_wake_reason_enum reason,
+    uint64_t wake_time, uint64_t current_time, size_t send_length)
+{
+    picoquic_wake_profile_t* profile = &quic->wake_profile;
+
+    profile->nb_calls[reason]++;
+    if (send_length == 0) {
+        profile->nb_empty[reason]++;
+    }
+    if (current_time < wake_time) {
+        profile->nb_early[reason]++;
+    }
+    else if (current_time > wake_time + PICOQUIC_WAKE_PROFILE_LATE) {
+        profile->nb_late[reason]++;
+        profile->late_delay[reason] += current_time - wake_time;
+    }
+}
+#endif
+
 /* Prepare next packet to send, or nothing.. */
 int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length,
@@ -3498,8 +3796,14 @@ int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     struct sockaddr_storage addr_from_log;
     int is_initial_sent = 0;
     uint64_t next_wake_time = cnx->latest_progress_time + 2*PICOQUIC_MICROSEC_SILENCE_MAX;
+#ifndef PICOQUIC_DISABLE_STATS
+    uint64_t scheduled_wake_time = cnx->next_wake_time;
 
-    SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+    cnx->send_limit_time = current_time;
+    cnx->send_limit_flags = 0;
+#endif
+
+    SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_idle);
 
     if (cnx->recycle_sooner_needed) {
         picoquic_process_sooner_packets(cnx, current_time);
@@ -3508,6 +3812,8 @@ int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     memset(&addr_to_log, 0, sizeof(addr_to_log));
     memset(&addr_from_log, 0, sizeof(addr_from_log));
     *send_length = 0;
+    cnx->quic->last_departure_time_nanosec = current_time * 1000;
+    cnx->quic->last_ecn_codepoint = picoquic_ecn_codepoint_to_send(cnx);
 
     ret = picoquic_check_idle_timer(cnx, &next_wake_time, current_time);
 
@@ -3524,6 +3830,9 @@ int picoquic_prepare_packet(picoquic_cnx_t* cnx,
             picoquic_insert_hole_in_send_sequence_if_needed(cnx, current_time, &next_wake_time);
         }
 
+        /* Rotate keys if required, and prepare the next key phase outside of the receive path */
+        picoquic_manage_key_rotation(cnx);
+
         /* Select the next path, and the corresponding addresses */
         path_id = picoquic_select_next_path(cnx, current_time, &next_wake_time);
 
@@ -3605,23 +3914,35 @@ int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     }
 
     /* if needed, log that the packet is sent */
-    if (*send_length > 0 && cnx->quic->F_log != NULL && (cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE || cnx->quic->use_long_log)) {
+    if (*send_length > 0 && cnx->is_logging) {
         picoquic_log_packet_address(cnx->quic->F_log,
             picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx)),
             cnx, (struct sockaddr *)&addr_to_log, 0, *send_length, current_time);
     }
-    if (*send_length > 0 && cnx->quic->f_binlog != NULL && (cnx->pkt_ctx[picoquic_packet_context_application].send_sequence < PICOQUIC_LOG_PACKET_MAX_SEQUENCE || cnx->quic->use_long_log)) {
-        binlog_pdu(cnx->quic->f_binlog, &cnx->initial_cnxid, 0, current_time,
+    if (*send_length > 0 && PICOQUIC_BINLOG_IS_OPEN(cnx->quic) && binlog_cnx_is_wanted(cnx)) {
+        binlog_pdu(cnx->quic, cnx, &cnx->initial_cnxid, 0, current_time,
             (struct sockaddr *)&addr_to_log, (struct sockaddr*)& addr_from_log, *send_length);
     }
 
     /* Update the wake up time for the connection */
     if (*send_length > 0 || cnx->cnx_state == picoquic_state_disconnected ) {
         next_wake_time = current_time;
-        SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        SET_LAST_WAKE_REASON(cnx, PICOQUIC_SENDER, picoquic_wake_reason_send_more);
     }
-    
+
+    if (cnx->quic->wake_file >= 0 && cnx->quic->wake_file < PICOQUIC_STATS_NB_WAKE_SOURCES) {
+        PICOQUIC_STATS_ADD(&cnx->stats, nb_wake_ups[cnx->quic->wake_file], 1);
+    }
+#ifndef PICOQUIC_DISABLE_STATS
+    if (cnx->quic->is_wake_profiling) {
+        picoquic_wake_profile_record(cnx->quic, cnx->wake_reason, scheduled_wake_time, current_time, *send_length);
+    }
+    picoquic_send_limit_update(cnx, *send_length, current_time);
+#endif
     picoquic_reinsert_by_wake_time(cnx->quic, cnx, next_wake_time);
+#ifndef PICOQUIC_DISABLE_STATS
+    cnx->wake_reason = cnx->wake_reason_next;
+#endif
 
     return ret;
 }
@@ -3658,6 +3979,9 @@ int picoquic_prepare_next_packet(picoquic_quic_t* quic,
     int ret = 0;
     picoquic_stateless_packet_t* sp = picoquic_dequeue_stateless_packet(quic);
 
+    quic->last_departure_time_nanosec = current_time * 1000;
+    quic->last_ecn_codepoint = PICOQUIC_ECN_NOT_ECT;
+
     if (sp != NULL) {
         if (sp->length > send_buffer_max) {
             *send_length = 0;
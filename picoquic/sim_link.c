@@ -53,6 +53,11 @@ picoquictest_sim_link_t* picoquictest_sim_link_create(double data_rate_in_gps,
         link->loss_mask = loss_mask;
         link->jitter_seed = 0xDEADBEEFBABAC001ull;
         link->jitter = 0;
+        link->ecn_threshold = 0;
+        link->l4s_threshold = 0;
+        link->packets_ce_marked = 0;
+        link->ecn_bleach = 0;
+        link->reorder = 0;
     }
 
     return link;
@@ -77,6 +82,7 @@ picoquictest_sim_packet_t* picoquictest_sim_link_create_packet()
         packet->next_packet = NULL;
         packet->arrival_time = 0;
         packet->length = 0;
+        packet->ecn_mark = 0;
     }
 
     return packet;
@@ -139,6 +145,22 @@ static uint64_t picoquictest_sim_link_jitter(picoquictest_sim_link_t* link)
     return jitter;
 }
 
+/* Step marking AQM. L4S traffic (ECT(1)) is marked as soon as the queue
+ * exceeds a shallow threshold, classic ECN traffic (ECT(0)) when it exceeds
+ * a deeper one. Not-ECT traffic is only subject to tail drop.
+ */
+static void picoquictest_sim_link_ecn_mark(picoquictest_sim_link_t* link, picoquictest_sim_packet_t* packet,
+    uint64_t queue_delay)
+{
+    if (link->ecn_bleach) {
+        packet->ecn_mark = 0;
+    } else if ((packet->ecn_mark == 1 && link->l4s_threshold > 0 && queue_delay >= link->l4s_threshold) ||
+        (packet->ecn_mark == 2 && link->ecn_threshold > 0 && queue_delay >= link->ecn_threshold)) {
+        packet->ecn_mark = 3;
+        link->packets_ce_marked++;
+    }
+}
+
 void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_sim_packet_t* packet,
     uint64_t current_time)
 {
@@ -156,17 +178,30 @@ void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_si
             free(packet);
         } else {
             link->packets_sent++;
-            if (link->last_packet == NULL) {
-                link->first_packet = packet;
-            } else {
-                link->last_packet->next_packet = packet;
-            }
-            link->last_packet = packet;
+            picoquictest_sim_link_ecn_mark(link, packet, queue_delay);
             packet->next_packet = NULL;
             packet->arrival_time = link->queue_time + link->microsec_latency;
             if (link->jitter != 0) {
                 packet->arrival_time += picoquictest_sim_link_jitter(link);
             }
+            if (link->reorder && link->last_packet != NULL && link->last_packet->arrival_time > packet->arrival_time) {
+                /* Insert the packet before the first one that arrives later */
+                picoquictest_sim_packet_t** pp = &link->first_packet;
+
+                while ((*pp)->arrival_time <= packet->arrival_time) {
+                    pp = &(*pp)->next_packet;
+                }
+                packet->next_packet = *pp;
+                *pp = packet;
+            }
+            else {
+                if (link->last_packet == NULL) {
+                    link->first_packet = packet;
+                } else {
+                    link->last_packet->next_packet = packet;
+                }
+                link->last_packet = packet;
+            }
         }
     } else {
         /* simulate congestion loss on queue full */
@@ -28,6 +28,9 @@
 #include "picotls/openssl.h"
 #include "picotls/minicrypto.h"
 #include "picotls/ffx.h"
+#ifndef PTLS_WITHOUT_FUSION
+#include "picotls/fusion.h"
+#endif
 #include "tls_api.h"
 #include <openssl/pem.h>
 #include <openssl/err.h>
@@ -428,8 +431,8 @@ int picoquic_client_hello_call_back(ptls_on_client_hello_t* on_hello_cb_ctx,
         }
     }
 
-    if (quic->f_binlog != NULL && quic->cnx_in_progress != NULL) {
-        binlog_transport_extension(quic->f_binlog, quic->cnx_in_progress, 
+    if (PICOQUIC_BINLOG_IS_OPEN(quic) && quic->cnx_in_progress != NULL) {
+        binlog_transport_extension(quic, quic->cnx_in_progress, 
             0, params->server_name.base, params->server_name.len, alpn_found, alpn_found_length, 
             params->negotiated_protocols.list, params->negotiated_protocols.count,
             0, NULL);
@@ -696,6 +699,71 @@ static int picoquic_set_pn_enc_from_secret(void ** v_pn_enc, ptls_cipher_suite_t
 }
 
 
+/* Selection of the AEAD backend for 1-RTT keys.
+ * The fusion engine only implements AES128-GCM, so other suites always use the
+ * cipher negotiated by TLS. Header protection keys are derived from the same
+ * suite, using the CTR cipher associated with the selected AEAD.
+ */
+#ifndef PTLS_WITHOUT_FUSION
+static ptls_cipher_suite_t picoquic_fusion_aes128gcmsha256 = {
+    PTLS_CIPHER_SUITE_AES_128_GCM_SHA256, &ptls_fusion_aes128gcm, &ptls_openssl_sha256 };
+#endif
+
+int picoquic_is_aead_backend_supported(picoquic_aead_backend_enum backend)
+{
+    int is_supported = 0;
+
+    switch (backend) {
+    case picoquic_aead_backend_default:
+        is_supported = 1;
+        break;
+    case picoquic_aead_backend_fusion:
+#ifndef PTLS_WITHOUT_FUSION
+    {
+        /* The CPU check executes CPUID, so the result is cached */
+        static int fusion_supported = -1;
+        if (fusion_supported < 0) {
+            fusion_supported = ptls_fusion_is_supported_by_cpu() ? 1 : 0;
+        }
+        is_supported = fusion_supported;
+    }
+#endif
+        break;
+    default:
+        break;
+    }
+
+    return is_supported;
+}
+
+int picoquic_set_aead_backend(picoquic_quic_t* quic, picoquic_aead_backend_enum backend)
+{
+    int ret = 0;
+
+    if (picoquic_is_aead_backend_supported(backend)) {
+        quic->aead_backend = backend;
+    }
+    else {
+        quic->aead_backend = picoquic_aead_backend_default;
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static ptls_cipher_suite_t * picoquic_get_1rtt_cipher_suite(picoquic_aead_backend_enum backend, ptls_cipher_suite_t * cipher)
+{
+#ifndef PTLS_WITHOUT_FUSION
+    if (backend == picoquic_aead_backend_fusion && cipher->id == PTLS_CIPHER_SUITE_AES_128_GCM_SHA256 &&
+        picoquic_is_aead_backend_supported(backend)) {
+        cipher = &picoquic_fusion_aes128gcmsha256;
+    }
+#else
+    UNREFERENCED_PARAMETER(backend);
+#endif
+    return cipher;
+}
+
 static int picoquic_set_key_from_secret(ptls_cipher_suite_t * cipher, int is_enc, int is_rotation, picoquic_crypto_context_t * ctx, const void *secret)
 {
     int ret = 0;
@@ -756,7 +824,8 @@ static int picoquic_update_traffic_key_callback(ptls_update_traffic_key_t * self
     debug_dump(secret, (int)cipher->hash->digest_size);
 #endif
 
-    int ret = picoquic_set_key_from_secret(cipher, is_enc, 0, &cnx->crypto_context[epoch], secret);
+    int ret = picoquic_set_key_from_secret((epoch == 3) ? picoquic_get_1rtt_cipher_suite(cnx->quic->aead_backend, cipher) : cipher,
+        is_enc, 0, &cnx->crypto_context[epoch], secret);
     if (cnx->cnx_state < picoquic_state_ready) {
         cnx->recycle_sooner_needed = 1;
     }
@@ -925,6 +994,7 @@ int picoquic_compute_new_rotated_keys(picoquic_cnx_t * cnx)
     int ret = 0;
     picoquic_tls_ctx_t * tls_ctx = (picoquic_tls_ctx_t *)cnx->tls_ctx;
     ptls_cipher_suite_t * cipher = ptls_get_cipher(tls_ctx->tls);
+    ptls_cipher_suite_t * cipher_1rtt = picoquic_get_1rtt_cipher_suite(cnx->quic->aead_backend, cipher);
 
     /* Verify that the previous transition is complete */
     if (cnx->crypto_context_new.aead_decrypt != NULL ||
@@ -954,7 +1024,7 @@ int picoquic_compute_new_rotated_keys(picoquic_cnx_t * cnx)
     }
 
     if (ret == 0) {
-        ret = picoquic_set_key_from_secret(cipher, 1, 1, &cnx->crypto_context_new, tls_ctx->app_secret_enc);
+        ret = picoquic_set_key_from_secret(cipher_1rtt, 1, 1, &cnx->crypto_context_new, tls_ctx->app_secret_enc);
     }
 
     if (ret == 0) {
@@ -972,7 +1042,7 @@ int picoquic_compute_new_rotated_keys(picoquic_cnx_t * cnx)
     }
 
     if (ret == 0) {
-        ret = picoquic_set_key_from_secret(cipher, 0, 1, &cnx->crypto_context_new, tls_ctx->app_secret_dec);
+        ret = picoquic_set_key_from_secret(cipher_1rtt, 0, 1, &cnx->crypto_context_new, tls_ctx->app_secret_dec);
     }
 
     return (ret == 0)?0: PICOQUIC_ERROR_CANNOT_COMPUTE_KEY;
@@ -989,6 +1059,10 @@ void picoquic_apply_rotated_keys(picoquic_cnx_t * cnx, int is_enc)
         cnx->crypto_context_new.aead_encrypt = NULL;
 
         cnx->key_phase_enc ^= 1;
+        /* Start counting packets and bytes sent with the new key phase */
+        cnx->crypto_epoch_sequence = cnx->pkt_ctx[picoquic_packet_context_application].send_sequence;
+        cnx->crypto_epoch_bytes = 0;
+        cnx->nb_crypto_key_rotations++;
         picoquic_log_pn_dec_trial(cnx);
     }
     else {
@@ -1599,8 +1673,8 @@ int picoquic_initialize_tls_stream(picoquic_cnx_t* cnx, uint64_t current_time)
     if (cnx->quic->F_log != NULL) {
         picoquic_log_negotiated_alpn(cnx->quic->F_log, cnx, 0, 1, ctx->handshake_properties.client.negotiated_protocols.list, ctx->handshake_properties.client.negotiated_protocols.count);
     }
-    if (cnx->quic->f_binlog != NULL) {
-        binlog_transport_extension(cnx->quic->f_binlog, cnx,
+    if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic)) {
+        binlog_transport_extension(cnx->quic, cnx,
             1, (const uint8_t *)cnx->sni, (cnx->sni == NULL)?0:strlen(cnx->sni), NULL, 0,
             ctx->handshake_properties.client.negotiated_protocols.list, 
             ctx->handshake_properties.client.negotiated_protocols.count,
@@ -1729,6 +1803,21 @@ void * picoquic_setup_test_aead_context(int is_encrypt, const uint8_t * secret)
     return v_aead;
 }
 
+/* Setting of 1-RTT encryption contexts for a specific backend, for tests and benchmarks */
+void * picoquic_setup_backend_aead_context(picoquic_aead_backend_enum backend, ptls_cipher_suite_t * cipher, int is_encrypt, const uint8_t * secret)
+{
+    void * v_aead = NULL;
+
+    (void)picoquic_set_aead_from_secret(&v_aead, picoquic_get_1rtt_cipher_suite(backend, cipher), is_encrypt, secret);
+
+    return v_aead;
+}
+
+char const * picoquic_aead_get_name(void * aead_context)
+{
+    return ((ptls_aead_context_t*)aead_context)->algo->name;
+}
+
 int picoquic_server_setup_ticket_aead_contexts(picoquic_quic_t* quic,
     ptls_context_t* tls_ctx,
     const uint8_t* secret, size_t secret_length)
@@ -1914,8 +2003,8 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
                         if (alpn != NULL){
                             cnx->alpn = picoquic_string_duplicate(alpn);
 
-                            if (cnx->quic->f_binlog != NULL) {
-                                binlog_transport_extension(cnx->quic->f_binlog, cnx, 0, NULL, 0, 
+                            if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic)) {
+                                binlog_transport_extension(cnx->quic, cnx, 0, NULL, 0, 
                                     (const uint8_t *)alpn, strlen(alpn), NULL, 0, 0, NULL);
                             }
 
@@ -2446,6 +2535,34 @@ void picoquic_cid_decrypt_global(void *cid_enc, const picoquic_connection_id_t *
     picoquic_cid_encrypt_global(cid_enc, cid_in, cid_out);
 }
 
+/* Single block encryption, used for routable CID.
+ * The key is used as is, so that it can be shared with load balancers.
+ */
+void picoquic_cid_free_block_cipher_ctx(void * cid_enc)
+{
+    if (cid_enc != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t *)cid_enc);
+    }
+}
+
+int picoquic_cid_get_block_cipher_ctx(void ** v_cid_enc, int is_enc, const void * key)
+{
+    int ret = 0;
+
+    picoquic_cid_free_block_cipher_ctx(*v_cid_enc);
+
+    if ((*v_cid_enc = ptls_cipher_new(&ptls_openssl_aes128ecb, is_enc, key)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+    }
+
+    return ret;
+}
+
+void picoquic_cid_block_cipher_transform(void * cid_enc, uint8_t * output, const uint8_t * input)
+{
+    ptls_cipher_encrypt((ptls_cipher_context_t *)cid_enc, output, input, 16);
+}
+
 /* Support for encrypted SNI (ESNI).
  */
 
@@ -105,6 +105,8 @@ int picoquic_rotate_app_secret(ptls_cipher_suite_t * cipher, uint8_t * secret);
 void picoquic_crypto_context_free(picoquic_crypto_context_t * ctx);
 
 void * picoquic_setup_test_aead_context(int is_encrypt, const uint8_t * secret);
+void * picoquic_setup_backend_aead_context(picoquic_aead_backend_enum backend, ptls_cipher_suite_t * cipher, int is_encrypt, const uint8_t * secret);
+char const * picoquic_aead_get_name(void * aead_context);
 void * picoquic_pn_enc_create_for_test(const uint8_t * secret);
 
 int picoquic_compare_cleartext_aead_contexts(picoquic_cnx_t* cnx1, picoquic_cnx_t* cnx2);
@@ -147,6 +149,10 @@ int picoquic_cid_get_encrypt_global_ctx(void ** v_cid_enc, int is_enc, const voi
 void picoquic_cid_encrypt_global(void * cid_enc, const picoquic_connection_id_t * cid_in, picoquic_connection_id_t * cid_out);
 void picoquic_cid_decrypt_global(void * cid_ffx, const picoquic_connection_id_t * cid_in, picoquic_connection_id_t * cid_out);
 
+void picoquic_cid_free_block_cipher_ctx(void * cid_enc);
+int picoquic_cid_get_block_cipher_ctx(void ** v_cid_enc, int is_enc, const void * key);
+void picoquic_cid_block_cipher_transform(void * cid_enc, uint8_t * output, const uint8_t * input);
+
 int picoquic_esni_load_rr(char const * esni_rr_file_name, uint8_t *esnikeys, size_t esnikeys_max, size_t *esnikeys_len);
 struct st_ptls_esni_secret_t * picoquic_esni_secret(picoquic_cnx_t * cnx);
 
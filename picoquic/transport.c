@@ -561,6 +561,10 @@ int picoquic_prepare_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
         bytes = picoquic_transport_param_type_flag_encode(bytes, bytes_max, picoquic_tp_enable_time_stamp);
     }
 
+    if (cnx->local_parameters.enable_multipath > 0 && bytes != NULL) {
+        bytes = picoquic_transport_param_type_flag_encode(bytes, bytes_max, picoquic_tp_enable_multipath);
+    }
+
     if (bytes == NULL) {
         *consumed = 0;
         ret = PICOQUIC_ERROR_EXTENSION_BUFFER_TOO_SMALL;
@@ -571,8 +575,8 @@ int picoquic_prepare_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
             picoquic_log_transport_extension(cnx->quic->F_log, cnx, 0, 1, bytes_zero, *consumed);
         }
 
-        if (cnx->quic->f_binlog != NULL) {
-            binlog_transport_extension(cnx->quic->f_binlog, cnx, 1, NULL, 0, NULL, 0, NULL, 0, *consumed, bytes_zero);
+        if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic)) {
+            binlog_transport_extension(cnx->quic, cnx, 1, NULL, 0, NULL, 0, NULL, 0, *consumed, bytes_zero);
         }
     }
 
@@ -602,6 +606,7 @@ void picoquic_clear_transport_extensions(picoquic_cnx_t* cnx)
     cnx->remote_parameters.active_connection_id_limit = 0;
     cnx->remote_parameters.enable_loss_bit = 0;
     cnx->remote_parameters.enable_time_stamp = 0;
+    cnx->remote_parameters.enable_multipath = 0;
 }
 
 int picoquic_receive_transport_extensions_old(picoquic_cnx_t* cnx, int extension_mode,
@@ -915,8 +920,8 @@ int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
     if (cnx->quic->F_log) {
         picoquic_log_transport_extension(cnx->quic->F_log, cnx, 1, 1, bytes, bytes_max);
     }
-    if (cnx->quic->f_binlog != NULL) {
-        binlog_transport_extension(cnx->quic->f_binlog, cnx, 0, NULL, 0, NULL, 0, NULL, 0, bytes_max, bytes);
+    if (PICOQUIC_BINLOG_IS_OPEN(cnx->quic)) {
+        binlog_transport_extension(cnx->quic, cnx, 0, NULL, 0, NULL, 0, NULL, 0, bytes_max, bytes);
     }
 
     /* Set the parameters to default value zero */
@@ -1124,6 +1129,14 @@ int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
                         cnx->remote_parameters.enable_time_stamp = 1;
                     }
                     break;
+                case picoquic_tp_enable_multipath:
+                    if (extension_length != 0) {
+                        ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0);
+                    }
+                    else {
+                        cnx->remote_parameters.enable_multipath = 1;
+                    }
+                    break;
                 default:
                     /* ignore unknown extensions */
                     break;
@@ -1223,6 +1236,9 @@ int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
         cnx->is_time_stamp_enabled = 1;
     }
 
+    /* Multipath is only used if both parties support it */
+    cnx->is_multipath_enabled = cnx->local_parameters.enable_multipath && cnx->remote_parameters.enable_multipath;
+
     /* ACK Frequency is only enabled on server if negotiated by client */
     if (!cnx->client_mode && !cnx->is_ack_frequency_negotiated) {
         cnx->local_parameters.min_ack_delay = 0;
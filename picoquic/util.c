@@ -552,6 +552,32 @@ uint8_t* picoquic_frames_fixed_skip(uint8_t* bytes, const uint8_t* bytes_max, si
 }
 
 
+/* Skip a run of identical bytes, such as a sequence of padding or ping frames.
+ * The first byte is always skipped, the function returns a pointer to the
+ * first byte that differs, or to bytes_max. Long runs, e.g., padding
+ * of Initial packets, are compared 8 bytes at a time.
+ */
+const uint8_t* picoquic_skip_repeated_bytes(const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    uint8_t first_byte = *bytes++;
+    uint64_t pattern = 0x0101010101010101ull * first_byte;
+
+    while (bytes + 8 <= bytes_max) {
+        uint64_t w;
+        memcpy(&w, bytes, sizeof(w));
+        if (w != pattern) {
+            break;
+        }
+        bytes += 8;
+    }
+
+    while (bytes < bytes_max && *bytes == first_byte) {
+        bytes++;
+    }
+
+    return bytes;
+}
+
 uint8_t* picoquic_frames_varint_skip(uint8_t* bytes, const uint8_t* bytes_max)
 {
     return bytes < bytes_max ? picoquic_frames_fixed_skip(bytes, bytes_max, VARINT_LEN(bytes)) : NULL;
@@ -563,7 +589,12 @@ uint8_t* picoquic_frames_varint_decode(uint8_t* bytes, const uint8_t* bytes_max,
 {
     uint8_t length;
 
-    if (bytes < bytes_max && bytes + (length = (uint8_t)VARINT_LEN(bytes)) <= bytes_max) {
+    if (bytes + 8 <= bytes_max) {
+        length = (uint8_t)VARINT_LEN(bytes);
+        *n64 = picoquic_varint_decode_wide(bytes, length);
+        bytes += length;
+    }
+    else if (bytes < bytes_max && bytes + (length = (uint8_t)VARINT_LEN(bytes)) <= bytes_max) {
         uint64_t v = *bytes++ & 0x3F;
 
         while (--length > 0) {
@@ -877,6 +908,17 @@ void picoquic_delete_thread(picoquic_thread_t * thread)
 #endif
 }
 
+void picoquic_join_thread(picoquic_thread_t * thread)
+{
+#ifdef _WINDOWS
+    (void)WaitForSingleObject(*thread, INFINITE);
+    CloseHandle(*thread);
+    *thread = NULL;
+#else
+    (void)pthread_join(*thread, NULL);
+#endif
+}
+
 int picoquic_create_mutex(picoquic_mutex_t * mutex)
 {
 #ifdef _WINDOWS
@@ -54,11 +54,18 @@ static const picoquic_test_def_t test_table[] = {
     { "pn2pn64", pn2pn64test },
     { "intformat", intformattest },
     { "varint", varint_test },
+    { "varint_bench", varint_bench_test },
     { "sack", sacktest },
     { "skip_frames", skip_frame_test },
     { "parse_frames", parse_frame_test },
+    { "padding_skip", padding_skip_test },
+    { "frame_decode_bench", frame_decode_bench_test },
     { "logger", logger_test },
     { "binlog", binlog_test },
+    { "binlog_ring", binlog_ring_test },
+    { "binlog_policy", binlog_policy_test },
+    { "binlog_v2", binlog_v2_test },
+    { "binlog_map", binlog_map_test },
     { "TlsStreamFrame", TlsStreamFrameTest },
     { "StreamZeroFrame", StreamZeroFrameTest },
     { "stream_splay", stream_splay_test },
@@ -81,6 +88,9 @@ static const picoquic_test_def_t test_table[] = {
     { "cnxid_stash", cnxid_stash_test },
     { "new_cnxid", new_cnxid_test },
     { "pacing", pacing_test },
+    { "pacing_horizon", pacing_horizon_test },
+    { "rate_sampler", rate_sampler_test },
+    { "cubic_fixed_point", cubic_fixed_point_test },
     { "tls_api", tls_api_test },
     { "tls_api_inject_hs_ack", tls_api_inject_hs_ack_test },
     { "null_sni", null_sni_test },
@@ -173,11 +183,15 @@ static const picoquic_test_def_t test_table[] = {
     { "nat_handshake", nat_handshake_test },
     { "key_rotation_vector", key_rotation_vector_test },
     { "key_rotation_stress", key_rotation_stress_test },
+    { "key_rotation_auto", key_rotation_auto_test },
+    { "aead_backend_bench", aead_backend_bench_test },
     { "short_initial_cid", short_initial_cid_test },
     { "stream_id_max", stream_id_max_test },
     { "padding_test", padding_test },
     { "packet_trace", packet_trace_test },
     { "qlog_trace", qlog_trace_test },
+    { "textlog_deferred", textlog_deferred_test },
+    { "sqlog", sqlog_test },
     { "rebiding_stress", rebinding_stress_test },
     { "ready_to_send", ready_to_send_test },
     { "cubic", cubic_test },
@@ -187,6 +201,15 @@ static const picoquic_test_def_t test_table[] = {
     { "bbr", bbr_test },
     { "bbr_jitter", bbr_jitter_test },
     { "bbr_long", bbr_long_test },
+    { "bbr2", bbr2_test },
+    { "bbr2_jitter", bbr2_jitter_test },
+    { "bbr2_shallow_buffer", bbr2_shallow_buffer_test },
+    { "hystart_jitter", hystart_jitter_test },
+    { "ledbat", ledbat_test },
+    { "ecn_validation", ecn_validation_test },
+    { "l4s_prague", l4s_prague_test },
+    { "multipath", multipath_test },
+    { "reorder", reorder_test },
     { "bbr_performance", bbr_performance_test },
     { "bbr_slow_long", bbr_slow_long_test },
     { "gbps_performance", gbps_performance_test },
@@ -198,6 +221,7 @@ static const picoquic_test_def_t test_table[] = {
     { "satellite_small", satellite_small_test },
     { "satellite_small_up", satellite_small_up_test },
     { "cid_length", cid_length_test },
+    { "routable_cid", routable_cid_test },
     { "optimistic_ack", optimistic_ack_test },
     { "optimistic_hole", optimistic_hole_test },
     { "bad_coalesce", bad_coalesce_test },
@@ -207,6 +231,17 @@ static const picoquic_test_def_t test_table[] = {
     { "send_stream_blocked", send_stream_blocked_test },
     { "queue_network_input", queue_network_input_test },
     { "pacing_update", pacing_update_test },
+    { "cc_telemetry", cc_telemetry_test },
+    { "stats", stats_test },
+    { "histogram", histogram_test },
+    { "wake_profile", wake_profile_test },
+    { "send_limits", send_limits_test },
+    { "ack_delay_max_rtt", ack_delay_max_rtt_test },
+    { "binlog_trigger_spurious", binlog_trigger_spurious_test },
+    { "binlog_trigger_window", binlog_trigger_window_test },
+    { "binlog_trigger_stall", binlog_trigger_stall_test },
+    { "binlog_trigger_handshake", binlog_trigger_handshake_test },
+    { "binlog_trigger_close", binlog_trigger_close_test },
     { "direct_receive", direct_receive_test },
     { "app_limit_cc", app_limit_cc_test },
     { "initial_race", initial_race_test },
@@ -126,6 +126,27 @@ void print_address(FILE* F_log, struct sockaddr* address, char* label, picoquic_
     }
 }
 
+/* Print the wake-up profile of the context, if profiling was enabled */
+void print_wake_profile(FILE* F, picoquic_quic_t* quic)
+{
+    picoquic_wake_profile_t profile;
+
+    if (picoquic_get_wake_profile(quic, &profile) != 0) {
+        fprintf(F, "Wake-up profile not available.\n");
+    }
+    else {
+        fprintf(F, "%-12s %10s %10s %10s %10s %12s\n", "Wake reason", "calls", "empty", "early", "late", "avg late us");
+        for (int i = 0; i < picoquic_wake_reason_max; i++) {
+            if (profile.nb_calls[i] > 0) {
+                fprintf(F, "%-12s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %12" PRIu64 "\n",
+                    picoquic_wake_reason_name((picoquic_wake_reason_enum)i), profile.nb_calls[i], profile.nb_empty[i],
+                    profile.nb_early[i], profile.nb_late[i],
+                    (profile.nb_late[i] > 0) ? profile.late_delay[i] / profile.nb_late[i] : 0);
+            }
+        }
+    }
+}
+
 int quic_server(const char* server_name, int server_port,
     const char* pem_cert, const char* pem_key,
     int just_once, int do_retry, picoquic_connection_id_cb_fn cnx_id_callback,
@@ -133,7 +154,7 @@ int quic_server(const char* server_name, int server_port,
     int dest_if, int mtu_max, uint32_t proposed_version, 
     const char * esni_key_file_name, const char * esni_rr_file_name,
     char const * log_file, char const* bin_file, int use_long_log, 
-    picoquic_congestion_algorithm_t const * cc_algorithm, char const * web_folder)
+    picoquic_congestion_algorithm_t const * cc_algorithm, char const * web_folder, int wake_profile)
 {
     /* Start: start the QUIC process with cert and key files */
     int ret = 0;
@@ -197,8 +218,21 @@ int quic_server(const char* server_name, int server_port,
 
             picoquic_set_log_level(qserver, use_long_log);
 
+            picoquic_set_wake_profiling(qserver, wake_profile);
+
             picoquic_set_key_log_file_from_env(qserver);
 
+            for (int i = 0; i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+                int recv_set = 0;
+                int send_set = 0;
+                int sock_af = (i == 0) ? AF_INET6 : AF_INET;
+
+                if (picoquic_socket_set_ecn_options(server_sockets.s_socket[i], sock_af,
+                    qserver->default_ecn_codepoint, &recv_set, &send_set) != 0) {
+                    fprintf(stdout, "Cannot set ECN options on server socket, af = %d\n", sock_af);
+                }
+            }
+
             if (esni_key_file_name != NULL && esni_rr_file_name != NULL) {
                 ret = picoquic_esni_load_key(qserver, esni_key_file_name);
                 if (ret == 0) {
@@ -265,9 +299,10 @@ int quic_server(const char* server_name, int server_port,
                 if (ret == 0 && send_length > 0) {
                     loop_count_time = current_time;
                     nb_loops = 0;
-                    (void)picoquic_send_through_server_sockets(&server_sockets,
+                    (void)picoquic_send_through_server_sockets_at(&server_sockets,
                         (struct sockaddr*) & peer_addr, (struct sockaddr*) & local_addr, if_index,
-                        (const char*)send_buffer, (int)send_length);
+                        (const char*)send_buffer, (int)send_length,
+                        0, 0, picoquic_get_last_ecn_codepoint(qserver));
                 }
 
             } while (ret == 0 && send_length > 0);
@@ -283,6 +318,9 @@ int quic_server(const char* server_name, int server_port,
 
     /* Clean up */
     if (qserver != NULL) {
+        if (wake_profile) {
+            print_wake_profile(stdout, qserver);
+        }
         picoquic_free(qserver);
     }
 
@@ -345,6 +383,11 @@ int quic_client_migrate(picoquic_cnx_t * cnx, SOCKET_TYPE * fd, struct sockaddr
                 }
             }
             if (ret == 0) {
+                int recv_set = 0;
+                int send_set = 0;
+
+                (void)picoquic_socket_set_ecn_options(fd_m, server_address->sa_family,
+                    cnx->quic->default_ecn_codepoint, &recv_set, &send_set);
                 SOCKET_CLOSE(*fd);
                 *fd = fd_m;
             }
@@ -402,7 +445,7 @@ int quic_client(const char* ip_address_text, int server_port,
     int nb_packets_before_key_update, int mtu_max, char const * log_file, char const* bin_file,
     int client_cnx_id_length, char const * client_scenario_text, 
     int no_disk, int use_long_log, picoquic_congestion_algorithm_t const* cc_algorithm,
-    int large_client_hello, char const * out_dir)
+    int large_client_hello, char const * out_dir, int wake_profile)
 {
     /* Start: start the QUIC process with cert and key files */
     int ret = 0;
@@ -521,6 +564,17 @@ int quic_client(const char* ip_address_text, int server_port,
             picoquic_set_binlog(qclient, bin_file);
             picoquic_set_textlog(qclient, log_file);
             picoquic_set_log_level(qclient, use_long_log);
+            picoquic_set_wake_profiling(qclient, wake_profile);
+
+            {
+                int recv_set = 0;
+                int send_set = 0;
+
+                if (picoquic_socket_set_ecn_options(fd, server_address.ss_family,
+                    qclient->default_ecn_codepoint, &recv_set, &send_set) != 0) {
+                    fprintf(stdout, "Cannot set ECN options on client socket.\n");
+                }
+            }
         }
     }
 
@@ -600,8 +654,10 @@ int quic_client(const char* ip_address_text, int server_port,
                     send_buffer, sizeof(send_buffer), &send_length, NULL, NULL);
 
                 if (ret == 0 && send_length > 0) {
-                    bytes_sent = sendto(fd, (const char*)send_buffer, (int)send_length, 0,
-                        (struct sockaddr*) & server_address, server_addr_length);
+                    bytes_sent = picoquic_send_through_socket_at(fd,
+                        (struct sockaddr*) & server_address, NULL, 0,
+                        (const char*)send_buffer, (int)send_length,
+                        0, 0, picoquic_get_last_ecn_codepoint(qclient));
                     if (bytes_sent <= 0)
                     {
                         fprintf(stderr, "Cannot send first packet to server, returns %d\n", bytes_sent);
@@ -844,8 +900,10 @@ int quic_client(const char* ip_address_text, int server_port,
                     }
 
                     if (ret == 0 && send_length > 0) {
-                        bytes_sent = sendto(fd, (const char*)send_buffer, (int)send_length, 0,
-                            (struct sockaddr*) & x_to, picoquic_addr_length((struct sockaddr*) & x_to));
+                        bytes_sent = picoquic_send_through_socket_at(fd,
+                            (struct sockaddr*) & x_to, NULL, 0,
+                            (const char*)send_buffer, (int)send_length,
+                            0, 0, picoquic_get_last_ecn_codepoint(qclient));
 
                         if (bytes_sent <= 0)
                         {
@@ -890,6 +948,10 @@ int quic_client(const char* ip_address_text, int server_port,
             fprintf(stderr, "Could not save tokens to <%s>.\n", token_store_filename);
         }
 
+        if (wake_profile) {
+            print_wake_profile(stdout, qclient);
+        }
+
         picoquic_free(qclient);
     }
 
@@ -971,6 +1033,7 @@ void usage()
     fprintf(stderr, "  -w folder             Folder containing web pages served by server\n");
     fprintf(stderr, "  -l file               Log file, Log to stdout if file = \"n\". No logging if absent.\n");
     fprintf(stderr, "  -L                    Log all packets. If absent, log stops after 100 packets.\n");
+    fprintf(stderr, "  -P                    Profile wake-ups, and print the profile at exit.\n");
     fprintf(stderr, "  -p port               server port (default: %d)\n", default_server_port);
     fprintf(stderr, "  -m mtu_max            Largest mtu value that can be tried for discovery\n");
     fprintf(stderr, "  -n sni                sni (default: server name)\n");
@@ -985,7 +1048,8 @@ void usage()
     fprintf(stderr, "  -S solution_dir       Set the path to the source files to find the default files\n");
     fprintf(stderr, "  -I length             Length of CNX_ID used by the client, default=8\n");
     fprintf(stderr, "  -G cc_algorithm       Use the specified congestion control algorithm:\n");
-    fprintf(stderr, "                        reno, cubic or fast. Defaults to cubic.\n");
+    fprintf(stderr, "                        reno, cubic, dcubic, fast, bbr, bbr2, ledbat or prague.\n");
+    fprintf(stderr, "                        Defaults to bbr.\n");
     fprintf(stderr, "  -D                    no disk: do not save received files on disk.\n");
     fprintf(stderr, "  -Q                    send a large client hello in order to test post quantum\n");
     fprintf(stderr, "                        readiness.\n");
@@ -1035,6 +1099,7 @@ int main(int argc, char** argv)
     int client_cnx_id_length = 8;
     int no_disk = 0;
     int use_long_log = 0;
+    int wake_profile = 0;
     picoquic_connection_id_callback_ctx_t * cnx_id_cbdata = NULL;
     uint64_t* reset_seed = NULL;
     uint64_t reset_seed_x[2];
@@ -1052,7 +1117,7 @@ int main(int argc, char** argv)
 
     /* Get the parameters */
     int opt;
-    while ((opt = getopt(argc, argv, "c:k:K:p:u:v:o:w:f:i:s:e:E:l:b:m:n:a:t:S:I:G:1rhzDLQ")) != -1) {
+    while ((opt = getopt(argc, argv, "c:k:K:p:u:v:o:w:f:i:s:e:E:l:b:m:n:a:t:S:I:G:1rhzDLPQ")) != -1) {
         switch (opt) {
         case 'c':
             server_cert_file = optarg;
@@ -1175,6 +1240,9 @@ int main(int argc, char** argv)
         case 'D':
             no_disk = 1;
             break;
+        case 'P':
+            wake_profile = 1;
+            break;
         case 'Q':
             large_client_hello = 1;
             break;
@@ -1229,14 +1297,14 @@ int main(int argc, char** argv)
             (cnx_id_cbdata == NULL) ? NULL : (void*)cnx_id_cbdata,
             (uint8_t*)reset_seed, dest_if, mtu_max, proposed_version,
             esni_key_file, esni_rr_file,
-            log_file, bin_file, use_long_log, cc_algorithm, www_dir);
+            log_file, bin_file, use_long_log, cc_algorithm, www_dir, wake_profile);
         printf("Server exit with code = %d\n", ret);
     } else {
         /* Run as client */
         printf("Starting Picoquic (v%s) connection to server = %s, port = %d\n", PICOQUIC_VERSION, server_name, server_port);
         ret = quic_client(server_name, server_port, sni, esni_rr_file, alpn, root_trust_file, proposed_version, force_zero_share, 
             force_migration, nb_packets_before_update, mtu_max, log_file, bin_file, client_cnx_id_length, client_scenario,
-            no_disk, use_long_log, cc_algorithm, large_client_hello, out_dir);
+            no_disk, use_long_log, cc_algorithm, large_client_hello, out_dir, wake_profile);
 
         printf("Client exit with code = %d\n", ret);
     }
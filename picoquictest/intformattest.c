@@ -20,6 +20,9 @@
 */
 
 #include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static const uint64_t test_number[] = {
@@ -318,4 +321,111 @@ int varint_test()
     }
  
     return ret;
-}
\ No newline at end of file
+}
+/* Varint decoding benchmark.
+ * Compare the byte by byte decoding loop, which was used before the
+ * 8 byte load was introduced, with the current decoding functions.
+ */
+#define VARINT_BENCH_NB_VALUES 4096
+#define VARINT_BENCH_NB_ROUNDS 256
+
+static uint8_t* varint_bench_reference_decode(uint8_t* bytes, const uint8_t* bytes_max, uint64_t* n64)
+{
+    uint8_t length;
+
+    if (bytes < bytes_max && bytes + (length = (uint8_t)VARINT_LEN(bytes)) <= bytes_max) {
+        uint64_t v = *bytes++ & 0x3F;
+
+        while (--length > 0) {
+            v <<= 8;
+            v += *bytes++;
+        }
+
+        *n64 = v;
+    }
+    else {
+        bytes = NULL;
+    }
+
+    return bytes;
+}
+
+typedef uint8_t* (*varint_bench_decode_fn)(uint8_t* bytes, const uint8_t* bytes_max, uint64_t* n64);
+
+static uint64_t varint_bench_run(uint8_t* buffer, const uint8_t* buffer_max, int is_reference, uint64_t* nb_decoded)
+{
+    uint64_t checksum = 0;
+    /* Call both decoders through a pointer, so the comparison is not biased by inlining. */
+    volatile varint_bench_decode_fn decode_fn = (is_reference) ? varint_bench_reference_decode : picoquic_frames_varint_decode;
+
+    *nb_decoded = 0;
+    for (int round = 0; round < VARINT_BENCH_NB_ROUNDS; round++) {
+        uint8_t* bytes = buffer;
+
+        while (bytes != NULL && bytes < buffer_max) {
+            uint64_t n64 = 0;
+            bytes = decode_fn(bytes, buffer_max, &n64);
+            checksum += n64;
+            *nb_decoded += 1;
+        }
+    }
+
+    return checksum;
+}
+
+int varint_bench_test()
+{
+    int ret = 0;
+    size_t buffer_size = VARINT_BENCH_NB_VALUES * 8;
+    uint8_t* buffer = (uint8_t*)malloc(buffer_size);
+    uint8_t* bytes = buffer;
+    uint64_t random_context = 0x0123456789ABCDEFull;
+    uint64_t checksum[2];
+    double rate[2];
+
+    if (buffer == NULL) {
+        ret = -1;
+    }
+    else {
+        /* Mix of lengths representative of frame fields: mostly short values */
+        for (int i = 0; i < VARINT_BENCH_NB_VALUES; i++) {
+            uint64_t r = picoquic_test_random(&random_context);
+            uint64_t v;
+            switch (r & 7) {
+            case 0: case 1: case 2:
+                v = (r >> 8) & 0x3F;
+                break;
+            case 3: case 4:
+                v = (r >> 8) & 0x3FFF;
+                break;
+            case 5: case 6:
+                v = (r >> 8) & 0x3FFFFFFF;
+                break;
+            default:
+                v = (r >> 8);
+                break;
+            }
+            bytes += picoquic_varint_encode(bytes, buffer + buffer_size - bytes, v);
+        }
+
+        for (int is_reference = 1; is_reference >= 0; is_reference--) {
+            uint64_t nb_decoded = 0;
+            uint64_t start_time = picoquic_current_time();
+            uint64_t elapsed;
+
+            checksum[is_reference] = varint_bench_run(buffer, bytes, is_reference, &nb_decoded);
+            elapsed = picoquic_current_time() - start_time;
+            rate[is_reference] = (elapsed > 0) ? ((double)nb_decoded) / ((double)elapsed) : 0.0;
+            printf("Varint decode (%s): %.1f million values/s\n", (is_reference) ? "byte loop" : "current", rate[is_reference]);
+        }
+
+        if (checksum[0] != checksum[1]) {
+            DBG_PRINTF("Varint bench checksums differ: 0x%" PRIx64 " vs 0x%" PRIx64 "\n", checksum[0], checksum[1]);
+            ret = -1;
+        }
+
+        free(buffer);
+    }
+
+    return ret;
+}
@@ -78,12 +78,17 @@ int tls_api_two_connections_test();
 int cleartext_aead_test();
 int tls_api_multiple_versions_test();
 int varint_test();
+int varint_bench_test();
 int tls_api_client_losses_test();
 int tls_api_server_losses_test();
 int skip_frame_test();
 int keep_alive_test();
 int logger_test();
 int binlog_test();
+int binlog_ring_test();
+int binlog_policy_test();
+int binlog_v2_test();
+int binlog_map_test();
 int socket_test();
 int ticket_store_test();
 int token_store_test();
@@ -121,6 +126,8 @@ int zero_rtt_no_coal_test();
 int zero_rtt_many_losses_test();
 int zero_rtt_long_test();
 int parse_frame_test();
+int padding_skip_test();
+int frame_decode_bench_test();
 int stress_test();
 int splay_test();
 int TlsStreamFrameTest();
@@ -147,12 +154,16 @@ int false_migration_test();
 int nat_handshake_test();
 int key_rotation_vector_test();
 int key_rotation_stress_test();
+int key_rotation_auto_test();
+int aead_backend_bench_test();
 int short_initial_cid_test();
 int stream_id_max_test();
 int stream_id_to_rank_test();
 int padding_test();
 int packet_trace_test();
 int qlog_trace_test();
+int textlog_deferred_test();
+int sqlog_test();
 int rebinding_stress_test();
 int many_short_loss_test();
 int ready_to_send_test();
@@ -167,6 +178,7 @@ int satellite_small_test();
 int satellite_small_up_test();
 int long_rtt_test();
 int cid_length_test();
+int routable_cid_test();
 int initial_server_close_test();
 int h3zero_integer_test();
 int qpack_huffman_test();
@@ -203,6 +215,15 @@ int fastcc_jitter_test();
 int bbr_test();
 int bbr_jitter_test();
 int bbr_long_test();
+int bbr2_test();
+int bbr2_jitter_test();
+int bbr2_shallow_buffer_test();
+int hystart_jitter_test();
+int ledbat_test();
+int ecn_validation_test();
+int l4s_prague_test();
+int multipath_test();
+int reorder_test();
 int bbr_performance_test();
 int bbr_slow_long_test();
 int gbps_performance_test();
@@ -213,10 +234,24 @@ int blackhole_test();
 int no_ack_frequency_test();
 int connection_drop_test();
 int pacing_update_test();
+int cc_telemetry_test();
+int stats_test();
+int histogram_test();
+int wake_profile_test();
+int send_limits_test();
+int ack_delay_max_rtt_test();
+int binlog_trigger_spurious_test();
+int binlog_trigger_window_test();
+int binlog_trigger_stall_test();
+int binlog_trigger_handshake_test();
+int binlog_trigger_close_test();
 int direct_receive_test();
 int app_limit_cc_test();
 int initial_race_test();
 int pacing_test();
+int pacing_horizon_test();
+int rate_sampler_test();
+int cubic_fixed_point_test();
 
 int h3zero_post_test();
 int h09_post_test();
@@ -25,8 +25,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bytestream.h"
 #include "logreader.h"
+#include "logwriter.h"
 #include "qlog.h"
+#include "logcompress.h"
+#include "cidset.h"
 
 /*
  * Test of the skip frame API.
@@ -478,14 +482,125 @@ int parse_frame_test()
     return ret;
 }
 
+/* Test that runs of padding or ping frames are skipped exactly,
+ * whatever the alignment and the length of the run.
+ */
+int padding_skip_test()
+{
+    int ret = 0;
+    uint8_t buffer[64];
+
+    for (int frame_byte = 0; ret == 0 && frame_byte < 2; frame_byte++) {
+        for (size_t start = 0; ret == 0 && start < 8; start++) {
+            for (size_t run = 1; ret == 0 && start + run <= sizeof(buffer); run++) {
+                for (int sharp_end = 0; ret == 0 && sharp_end < 2; sharp_end++) {
+                    size_t bytes_max = (sharp_end) ? start + run : sizeof(buffer);
+                    const uint8_t* next;
+
+                    memset(buffer, 0xFF, sizeof(buffer));
+                    memset(buffer + start, frame_byte, run);
+
+                    next = picoquic_skip_repeated_bytes(buffer + start, buffer + bytes_max);
+                    if (next != buffer + start + run) {
+                        DBG_PRINTF("Skip run of %d, start %d, length %d, end %d: skipped %d\n",
+                            frame_byte, (int)start, (int)run, sharp_end, (int)(next - buffer - start));
+                        ret = -1;
+                    }
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Frame decoding benchmark.
+ * Decode repeatedly a 1-RTT packet with the most common shape, i.e., a
+ * STREAM frame, an ACK frame and padding, and report the rate in frames per second.
+ */
+#define FRAME_BENCH_NB_PACKETS 100000
+#define FRAME_BENCH_PACKET_LENGTH 1200
+
+int frame_decode_bench_test()
+{
+    int ret = 0;
+    uint8_t buffer[PICOQUIC_MAX_PACKET_SIZE];
+    size_t byte_max = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_in saddr;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_quic_t* qclient = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    memset(buffer, 0, sizeof(buffer));
+
+    if (qclient == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else if ((cnx = picoquic_create_cnx(qclient, picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*) & saddr, simulated_time, 0, "test-sni", "test-alpn", 1)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC CNX context\n");
+        ret = -1;
+    }
+    else {
+        uint64_t start_time;
+        uint64_t elapsed;
+
+        cnx->pkt_ctx[0].send_sequence = 0x0102030406;
+
+        memcpy(buffer, test_frame_type_stream_range_max, sizeof(test_frame_type_stream_range_max));
+        byte_max = sizeof(test_frame_type_stream_range_max);
+        memcpy(buffer + byte_max, test_frame_type_ack, sizeof(test_frame_type_ack));
+        byte_max += sizeof(test_frame_type_ack);
+        /* The rest of the packet is padding, already set to zero. */
+        byte_max = FRAME_BENCH_PACKET_LENGTH;
+
+        start_time = picoquic_current_time();
+        for (int i = 0; ret == 0 && i < FRAME_BENCH_NB_PACKETS; i++) {
+            ret = picoquic_decode_frames(cnx, cnx->path[0], buffer, byte_max, 3, NULL, NULL, simulated_time);
+        }
+        elapsed = picoquic_current_time() - start_time;
+
+        if (ret != 0) {
+            DBG_PRINTF("Frame decoding bench fails, ret = %d\n", ret);
+        }
+        else {
+            printf("Frame decode: %.3f million frames/s\n",
+                (elapsed > 0) ? ((double)(3 * FRAME_BENCH_NB_PACKETS)) / ((double)elapsed) : 0.0);
+        }
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+
+    if (qclient != NULL) {
+        picoquic_free(qclient);
+    }
+
+    return ret;
+}
+
 void picoquic_log_frames(FILE* F, uint64_t cnx_id64, uint8_t* bytes, size_t length);
-void picoquic_binlog_frames(FILE* F, uint8_t* bytes, size_t length);
+void picoquic_binlog_frames(bytestream* msg, const uint8_t* bytes, size_t length);
 
 static char const* log_test_file = "log_test.txt";
 static char const* log_fuzz_test_file = "log_fuzz_test.txt";
 static char const* log_packet_test_file = "log_fuzz_test.txt";
 static char const* binlog_test_file = "binlog_test.log";
-static char const* binlog_fuzz_test_file = "binlog_fuzz_test.log";
+static char const* binlog_sync_test_file = "binlog_sync_test.log";
+static char const* binlog_ring_test_file = "binlog_ring_test.log";
+static char const* binlog_policy_test_file = "binlog_policy_test.log";
+static char const* binlog_v1_test_file = "binlog_v1_test.log";
+static char const* binlog_v2_test_file = "binlog_v2_test.log";
+static char const* binlog_v2_cut_test_file = "binlog_v2_cut_test.log";
+static char const* binlog_v1_records_file = "binlog_v1_records.log";
+static char const* binlog_v2_records_file = "binlog_v2_records.log";
+static char const* binlog_v1_qlog_file = "binlog_v1_test.qlog";
+static char const* binlog_v2_qlog_file = "binlog_v2_test.qlog";
 static char const* qlog_test_file = "01020304.qlog";
 
 #define LOG_TEST_REF "picoquictest" PICOQUIC_FILE_SEPARATOR "log_test_ref.txt"
@@ -747,9 +862,6 @@ FILE* create_binlog(char const* binlog_file, uint64_t creation_time);
 
 void binlog_new_connection(picoquic_cnx_t* cnx);
 
-void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
-    const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max);
-
 int binlog_test()
 {
     uint8_t buffer[PICOQUIC_MAX_PACKET_SIZE];
@@ -809,7 +921,7 @@ int binlog_test()
                 ph.offset = 0;
                 ph.payload_length = test_skip_list[i].len;
 
-                binlog_packet(quic->f_binlog, &initial_cid, 0, 0, &ph, test_skip_list[i].val, test_skip_list[i].len);
+                binlog_packet(quic, NULL, &initial_cid, 0, 0, &ph, test_skip_list[i].val, test_skip_list[i].len);
             }
 
             picoquic_delete_cnx(cnx);
@@ -848,25 +960,913 @@ int binlog_test()
     /* Do a minimal fuzz test */
     for (size_t i = 0; ret == 0 && i < 100; i++) {
         size_t bytes_max = format_random_packet(buffer, sizeof(buffer), &random_context);
-        FILE* F;
-
-        if ((F = picoquic_file_open(binlog_fuzz_test_file, "wb")) == NULL) {
-            DBG_PRINTF("failed to open file:%s\n", log_fuzz_test_file);
-            ret = PICOQUIC_ERROR_INVALID_FILE;
-            break;
-        }
+        bytestream_buf stream_msg;
 
-        picoquic_binlog_frames(F, buffer, bytes_max);
+        picoquic_binlog_frames(bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE), buffer, bytes_max);
 
         /* Attempt to log fuzzed packets, and hope nothing crashes */
         for (size_t j = 0; j < 100; j++) {
-            fflush(F);
             skip_test_fuzz_packet(fuzz_buffer, buffer, bytes_max, &random_context);
-            picoquic_binlog_frames(F, fuzz_buffer, bytes_max);
+            picoquic_binlog_frames(bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE), fuzz_buffer, bytes_max);
+        }
+    }
+
+    return ret;
+}
+
+/* Test of the binary log ring buffer, then verify that logging through
+ * the ring and the writer thread produces the same file as direct writes.
+ */
+static int binlog_ring_check_span(picoquic_binlog_ring_t* ring, int flush, size_t expected, uint8_t* next_val)
+{
+    const uint8_t* bytes;
+    size_t length = binlog_ring_peek(ring, &bytes, flush);
+    int ret = 0;
+
+    if (length != expected) {
+        DBG_PRINTF("Ring peek returns %zu bytes instead of %zu\n", length, expected);
+        ret = -1;
+    }
+    else {
+        for (size_t i = 0; i < length; i++) {
+            if (bytes[i] != *next_val) {
+                DBG_PRINTF("Unexpected byte in ring at %zu\n", i);
+                ret = -1;
+                break;
+            }
+            *next_val += 1;
+        }
+        binlog_ring_release(ring, length);
+    }
+
+    return ret;
+}
+
+static int binlog_ring_unit_test()
+{
+    int ret = 0;
+    uint8_t record[1000];
+    uint8_t push_val = 0;
+    uint8_t read_val = 0;
+    picoquic_binlog_ring_t* ring = binlog_ring_create(1000);
+
+    if (ring == NULL) {
+        return -1;
+    }
+
+    /* The ring is rounded to 4096 bytes: the fifth record does not fit */
+    for (int i = 0; ret == 0 && i < 5; i++) {
+        for (size_t j = 0; j < sizeof(record); j++) {
+            record[j] = push_val++;
+        }
+        if (binlog_ring_push(ring, record, sizeof(record)) != ((i < 4) ? 0 : -1)) {
+            DBG_PRINTF("Unexpected push result for record %d\n", i);
+            ret = -1;
+        }
+    }
+    push_val -= (uint8_t)sizeof(record);
+
+    if (ret == 0 && binlog_ring_dropped(ring) != 1) {
+        DBG_PRINTF("Expected 1 dropped record, got %" PRIu64 "\n", binlog_ring_dropped(ring));
+        ret = -1;
+    }
+    /* Without flush, only full blocks are written */
+    if (ret == 0) {
+        ret = binlog_ring_check_span(ring, 0, 0, &read_val);
+    }
+    if (ret == 0) {
+        ret = binlog_ring_check_span(ring, 1, 4000, &read_val);
+    }
+
+    /* Fill the ring again, wrapping around the end of the buffer */
+    for (int i = 0; ret == 0 && i < 5; i++) {
+        for (size_t j = 0; j < sizeof(record); j++) {
+            record[j] = push_val++;
+        }
+        if (binlog_ring_push(ring, record, sizeof(record)) != ((i < 4) ? 0 : -1)) {
+            DBG_PRINTF("Unexpected push result for record %d after wrap\n", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && binlog_ring_dropped(ring) != 2) {
+        DBG_PRINTF("Expected 2 dropped records, got %" PRIu64 "\n", binlog_ring_dropped(ring));
+        ret = -1;
+    }
+    /* Head is at 8000: the first full block ends at 4096, then 4096 to 8000 */
+    if (ret == 0) {
+        ret = binlog_ring_check_span(ring, 0, 96, &read_val);
+    }
+    if (ret == 0) {
+        ret = binlog_ring_check_span(ring, 0, 0, &read_val);
+    }
+    if (ret == 0) {
+        ret = binlog_ring_check_span(ring, 1, 3904, &read_val);
+    }
+    if (ret == 0) {
+        ret = binlog_ring_check_span(ring, 1, 0, &read_val);
+    }
+
+    binlog_ring_delete(ring);
+
+    return ret;
+}
+
+static int binlog_ring_write_file(char const* file_name, size_t ring_size, uint64_t* nb_dropped)
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    const picoquic_connection_id_t initial_cid = {
+        { 1, 2, 3, 4 }, 4
+    };
+    const picoquic_connection_id_t dest_cid = {
+        { 5, 6, 7, 8 }, 4
+    };
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        picoquic_set_binlog_ring_size(quic, ring_size);
+        picoquic_set_binlog(quic, file_name);
+        picoquic_set_default_spinbit_policy(quic, picoquic_spinbit_null);
+
+        if (quic->f_binlog == NULL || (quic->binlog_ring == NULL) != (ring_size == 0)) {
+            DBG_PRINTF("Cannot start binary log, ring size %zu\n", ring_size);
+            ret = -1;
+        }
+        else {
+            struct sockaddr_in saddr;
+            memset(&saddr, 0, sizeof(struct sockaddr_in));
+            picoquic_cnx_t* cnx = picoquic_create_cnx(quic, initial_cid, dest_cid, (struct sockaddr*) & saddr,
+                simulated_time, 0, "test-sni", "test-alpn", 1);
+
+            if (cnx == NULL) {
+                DBG_PRINTF("%s", "Cannot create QUIC CNX context\n");
+                ret = -1;
+            }
+            else {
+                for (int round = 0; round < 100; round++) {
+                    for (size_t i = 0; i < nb_test_skip_list; i++) {
+                        picoquic_packet_header ph;
+                        memset(&ph, 0, sizeof(ph));
+
+                        ph.ptype = picoquic_packet_1rtt_protected;
+                        ph.pn64 = round * nb_test_skip_list + i;
+                        ph.dest_cnx_id = initial_cid;
+                        ph.srce_cnx_id = dest_cid;
+                        ph.offset = 0;
+                        ph.payload_length = test_skip_list[i].len;
+
+                        binlog_packet(quic, NULL, &initial_cid, 0, ph.pn64, &ph, test_skip_list[i].val, test_skip_list[i].len);
+                    }
+                }
+                picoquic_delete_cnx(cnx);
+            }
+        }
+        picoquic_set_binlog(quic, NULL);
+        *nb_dropped = picoquic_get_binlog_dropped(quic);
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+int binlog_ring_test()
+{
+    int ret = binlog_ring_unit_test();
+    uint64_t nb_dropped_sync = 0;
+    uint64_t nb_dropped_ring = 0;
+
+    if (ret == 0) {
+        ret = binlog_ring_write_file(binlog_sync_test_file, 0, &nb_dropped_sync);
+    }
+    if (ret == 0) {
+        ret = binlog_ring_write_file(binlog_ring_test_file, PICOQUIC_BINLOG_RING_SIZE_DEFAULT, &nb_dropped_ring);
+    }
+    if (ret == 0 && (nb_dropped_sync != 0 || nb_dropped_ring != 0)) {
+        DBG_PRINTF("Unexpected drops, sync: %" PRIu64 ", ring: %" PRIu64 "\n", nb_dropped_sync, nb_dropped_ring);
+        ret = -1;
+    }
+    if (ret == 0 && picoquic_test_compare_binary_files(binlog_ring_test_file, binlog_sync_test_file) != 0) {
+        DBG_PRINTF("%s", "Binary log written through the ring differs from direct writes.\n");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Test of the per connection logging policy: sampling, CID and prefix
+ * selection, and retroactive logging of the last records on trigger.
+ */
+typedef struct st_binlog_policy_count_t {
+    picoquic_connection_id_t cid;
+    int nb_new_connection;
+    int nb_packet;
+    int nb_close;
+    int nb_other;
+    uint64_t first_pn;
+} binlog_policy_count_t;
+
+static int binlog_policy_count_records(char const* file_name, binlog_policy_count_t* count)
+{
+    int ret = 0;
+    uint8_t head[16];
+    uint8_t record[BYTESTREAM_MAX_BUFFER_SIZE];
+    FILE* F = picoquic_file_open(file_name, "rb");
+
+    if (F == NULL || fread(head, sizeof(head), 1, F) != 1) {
+        ret = -1;
+    }
+
+    while (ret == 0 && fread(head, 4, 1, F) == 1) {
+        uint32_t length = PICOPARSE_32(head);
+        bytestream_buf stream;
+        bytestream* s = (bytestream*)&stream;
+        picoquic_connection_id_t cid;
+        uint64_t time_stamp = 0;
+        uint64_t event_type = 0;
+
+        if (length > sizeof(record) || fread(record, length, 1, F) != 1) {
+            ret = -1;
+            break;
+        }
+        s = bytestream_ref_init(s, record, length);
+        if (byteread_cid(s, &cid) != 0 || byteread_vint(s, &time_stamp) != 0 || byteread_vint(s, &event_type) != 0) {
+            ret = -1;
+        }
+        else if (picoquic_compare_connection_id(&cid, &count->cid) == 0) {
+            if (event_type == picoquic_log_event_new_connection) {
+                count->nb_new_connection++;
+            }
+            else if (event_type == picoquic_log_event_packet_sent) {
+                uint64_t pn64 = 0;
+                if (byteread_skip_vint(s) != 0 || bytestream_skip(s, 1) != 0 ||
+                    byteread_skip_vint(s) != 0 || byteread_skip_vint(s) != 0 ||
+                    byteread_vint(s, &pn64) != 0) {
+                    ret = -1;
+                }
+                else if (count->nb_packet++ == 0) {
+                    count->first_pn = pn64;
+                }
+            }
+            else if (event_type == picoquic_log_event_connection_close) {
+                count->nb_close++;
+            }
+            else {
+                count->nb_other++;
+            }
+        }
+    }
+
+    if (F != NULL) {
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+static picoquic_cnx_t* binlog_policy_create_cnx(picoquic_quic_t* quic, uint64_t cid_val, uint32_t addr_val)
+{
+    picoquic_connection_id_t initial_cid = { { 0 }, 8 };
+    struct sockaddr_in saddr;
+
+    picoformat_64(initial_cid.id, cid_val);
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(4433);
+    memcpy(&saddr.sin_addr, &addr_val, 4);
+
+    return picoquic_create_cnx(quic, initial_cid, picoquic_null_connection_id, (struct sockaddr*)&saddr,
+        0, 0, "test-sni", "test-alpn", 1);
+}
+
+static void binlog_policy_log_packets(picoquic_cnx_t* cnx, uint64_t first_pn, uint64_t nb_packets)
+{
+    for (uint64_t pn = first_pn; pn < first_pn + nb_packets; pn++) {
+        picoquic_packet_header ph;
+        size_t i = (size_t)(pn % nb_test_skip_list);
+
+        memset(&ph, 0, sizeof(ph));
+        ph.ptype = picoquic_packet_1rtt_protected;
+        ph.pn64 = pn;
+        ph.dest_cnx_id = cnx->initial_cnxid;
+        ph.payload_length = test_skip_list[i].len;
+
+        binlog_packet(cnx->quic, cnx, &cnx->initial_cnxid, 0, pn, &ph, test_skip_list[i].val, test_skip_list[i].len);
+    }
+}
+
+int binlog_policy_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    const picoquic_connection_id_t listed_cid = { { 0, 0, 0, 0, 0, 0, 0xcc, 0xcc }, 8 };
+    struct sockaddr_in prefix_addr;
+    uint8_t ip_10_16[4] = { 10, 16, 0, 1 };
+    uint8_t ip_10_32[4] = { 10, 32, 0, 1 };
+    uint32_t a_10_16;
+    uint32_t a_10_32;
+    binlog_policy_count_t triggered = { { { 0, 0, 0, 0, 0, 0, 0, 1 }, 8 }, 0, 0, 0, 0, 0 };
+    binlog_policy_count_t silent = { { { 0, 0, 0, 0, 0, 0, 0, 2 }, 8 }, 0, 0, 0, 0, 0 };
+    picoquic_quic_t* quic = picoquic_create(128, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+
+    memcpy(&a_10_16, ip_10_16, 4);
+    memcpy(&a_10_32, ip_10_32, 4);
+    memset(&prefix_addr, 0, sizeof(prefix_addr));
+    prefix_addr.sin_family = AF_INET;
+    memcpy(&prefix_addr.sin_addr, ip_10_16, 4);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        int nb_sampled = 0;
+
+        picoquic_set_binlog(quic, binlog_policy_test_file);
+        /* One in four connections is selected by sampling */
+        picoquic_set_binlog_sampling(quic, 4);
+        for (uint64_t i = 0; ret == 0 && i < 64; i++) {
+            picoquic_cnx_t* cnx = binlog_policy_create_cnx(quic, 0x1000 + i, a_10_32);
+            if (cnx == NULL) {
+                ret = -1;
+            }
+            else {
+                nb_sampled += (cnx->binlog_mode == picoquic_binlog_mode_first_packets);
+                picoquic_delete_cnx(cnx);
+            }
+        }
+        if (ret == 0 && (nb_sampled < 4 || nb_sampled > 32)) {
+            DBG_PRINTF("Sampled %d connections out of 64\n", nb_sampled);
+            ret = -1;
+        }
+
+        /* With selection lists and no sampling, only the matching connections are logged */
+        if (ret == 0) {
+            picoquic_set_binlog_sampling(quic, 0);
+            if (picoquic_add_binlog_cid(quic, &listed_cid) != 0 ||
+                picoquic_add_binlog_peer_prefix(quic, (struct sockaddr*)&prefix_addr, 12) != 0 ||
+                picoquic_add_binlog_peer_prefix(quic, (struct sockaddr*)&prefix_addr, 33) == 0) {
+                DBG_PRINTF("%s", "Cannot set the selection lists\n");
+                ret = -1;
+            }
+        }
+        if (ret == 0) {
+            uint64_t cid_val[3] = { 0xcccc, 0x2000, 0x2001 };
+            uint32_t addr_val[3] = { a_10_32, a_10_16, a_10_32 };
+            picoquic_binlog_mode_enum expected[3] = {
+                picoquic_binlog_mode_full, picoquic_binlog_mode_full, picoquic_binlog_mode_off };
+
+            for (int i = 0; ret == 0 && i < 3; i++) {
+                picoquic_cnx_t* cnx = binlog_policy_create_cnx(quic, cid_val[i], addr_val[i]);
+                if (cnx == NULL || cnx->binlog_mode != expected[i]) {
+                    DBG_PRINTF("Unexpected log mode for connection %d\n", i);
+                    ret = -1;
+                }
+                if (cnx != NULL) {
+                    picoquic_delete_cnx(cnx);
+                }
+            }
+        }
+
+        /* Keep the last 8 records of connections that are not logged */
+        if (ret == 0) {
+            picoquic_cnx_t* cnx1;
+            picoquic_cnx_t* cnx2;
+
+            picoquic_set_binlog_retro_depth(quic, 8);
+            cnx1 = binlog_policy_create_cnx(quic, 1, a_10_32);
+            cnx2 = binlog_policy_create_cnx(quic, 2, a_10_32);
+
+            if (cnx1 == NULL || cnx2 == NULL || cnx1->binlog_mode != picoquic_binlog_mode_off) {
+                ret = -1;
+            }
+            else {
+                binlog_policy_log_packets(cnx1, 0, 20);
+                binlog_policy_log_packets(cnx2, 0, 20);
+                picoquic_binlog_trigger(cnx1);
+                binlog_policy_log_packets(cnx1, 20, 5);
+                binlog_policy_log_packets(cnx2, 20, 5);
+            }
+            if (cnx1 != NULL) {
+                picoquic_delete_cnx(cnx1);
+            }
+            if (cnx2 != NULL) {
+                picoquic_delete_cnx(cnx2);
+            }
+        }
+
+        picoquic_free(quic);
+    }
+
+    if (ret == 0 && (binlog_policy_count_records(binlog_policy_test_file, &triggered) != 0 ||
+        binlog_policy_count_records(binlog_policy_test_file, &silent) != 0)) {
+        DBG_PRINTF("%s", "Cannot parse the binary log\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && (triggered.nb_new_connection != 1 || triggered.nb_packet != 13 ||
+        triggered.first_pn != 12 || triggered.nb_close != 1 || triggered.nb_other != 0)) {
+        DBG_PRINTF("Triggered connection, %d new, %d packets from %" PRIu64 ", %d close, %d other\n",
+            triggered.nb_new_connection, triggered.nb_packet, triggered.first_pn, triggered.nb_close, triggered.nb_other);
+        ret = -1;
+    }
+
+    if (ret == 0 && (silent.nb_new_connection + silent.nb_packet + silent.nb_close + silent.nb_other) != 0) {
+        DBG_PRINTF("%s", "Records found for a connection that was not logged\n");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Test of the compressed binary log format. The LZ codec is tested first
+ * on typical inputs and on malformed data, then the same records are logged
+ * in versions 1 and 2 of the format, and must be read back identically.
+ */
+static int binlog_v2_lz_test_one(const uint8_t* data, size_t length)
+{
+    int ret = 0;
+    size_t dst_max = length + length / 255 + 16;
+    uint8_t* compressed = (uint8_t*)malloc(dst_max);
+    uint8_t* decoded = (uint8_t*)malloc(length + 1);
+    size_t compressed_length = 0;
+
+    if (compressed == NULL || decoded == NULL) {
+        ret = -1;
+    }
+    else if ((compressed_length = picoquic_lz_compress(data, length, compressed, dst_max)) == 0) {
+        DBG_PRINTF("Cannot compress %zu bytes\n", length);
+        ret = -1;
+    }
+    else if (picoquic_lz_decompress(compressed, compressed_length, decoded, length) != 0 ||
+        memcmp(data, decoded, length) != 0) {
+        DBG_PRINTF("Cannot decompress %zu bytes\n", length);
+        ret = -1;
+    }
+    else if (picoquic_lz_decompress(compressed, compressed_length, decoded, length + 1) == 0 ||
+        (length > 0 && picoquic_lz_decompress(compressed, compressed_length, decoded, length - 1) == 0)) {
+        DBG_PRINTF("Wrong length accepted for %zu bytes\n", length);
+        ret = -1;
+    }
+    else if (compressed_length > 1 && picoquic_lz_decompress(compressed, compressed_length - 1, decoded, length) == 0) {
+        DBG_PRINTF("Truncated input accepted for %zu bytes\n", length);
+        ret = -1;
+    }
+    else if (length > 16 && picoquic_lz_compress(data, length, compressed, compressed_length - 1) != 0) {
+        DBG_PRINTF("Overflow not detected for %zu bytes\n", length);
+        ret = -1;
+    }
+
+    if (compressed != NULL) {
+        free(compressed);
+    }
+    if (decoded != NULL) {
+        free(decoded);
+    }
+
+    return ret;
+}
+
+static int binlog_v2_lz_test()
+{
+    int ret = 0;
+    size_t length = 0x4000;
+    uint8_t* data = (uint8_t*)malloc(length);
+    uint64_t random_context = 0xdeadbeefcafebabeull;
+
+    if (data == NULL) {
+        ret = -1;
+    }
+
+    /* Empty, short and highly repetitive inputs */
+    if (ret == 0) {
+        memset(data, 0, length);
+        ret = binlog_v2_lz_test_one(data, 0);
+        for (size_t l = 1; ret == 0 && l < 32; l++) {
+            ret = binlog_v2_lz_test_one(data, l);
+        }
+        if (ret == 0) {
+            ret = binlog_v2_lz_test_one(data, length);
+        }
+    }
+
+    /* Random data, which does not compress */
+    if (ret == 0) {
+        for (size_t i = 0; i < length; i++) {
+            data[i] = (uint8_t)picoquic_test_random(&random_context);
+        }
+        ret = binlog_v2_lz_test_one(data, length);
+    }
+
+    /* Frames from the skip list, repeated with small changes */
+    if (ret == 0) {
+        size_t l = 0;
+        while (l < length) {
+            for (size_t i = 0; i < nb_test_skip_list && l < length; i++) {
+                size_t c = length - l;
+                if (c > test_skip_list[i].len) {
+                    c = test_skip_list[i].len;
+                }
+                memcpy(data + l, test_skip_list[i].val, c);
+                data[l] ^= (uint8_t)(picoquic_test_random(&random_context) & 1);
+                l += c;
+            }
+        }
+        ret = binlog_v2_lz_test_one(data, length);
+    }
+
+    /* Corrupted input must be rejected without overflow */
+    if (ret == 0) {
+        uint8_t compressed[256];
+        uint8_t decoded[64];
+        const uint8_t bad_offset[] = { 0x1F, 'a', 0x02, 0x00 };
+        const uint8_t zero_offset[] = { 0x1F, 'a', 0x00, 0x00 };
+        const uint8_t long_literals[] = { 0xF0, 0xFF, 0xFF, 'a' };
+        size_t compressed_length = picoquic_lz_compress(data, sizeof(decoded), compressed, sizeof(compressed));
+
+        if (compressed_length == 0 ||
+            picoquic_lz_decompress(bad_offset, sizeof(bad_offset), decoded, 20) == 0 ||
+            picoquic_lz_decompress(zero_offset, sizeof(zero_offset), decoded, 20) == 0 ||
+            picoquic_lz_decompress(long_literals, sizeof(long_literals), decoded, sizeof(decoded)) == 0) {
+            DBG_PRINTF("%s", "Malformed compressed data accepted\n");
+            ret = -1;
+        }
+        for (size_t i = 0; ret == 0 && i < compressed_length; i++) {
+            /* Any single byte change must either fail or produce the expected length */
+            compressed[i] ^= 0x5A;
+            (void)picoquic_lz_decompress(compressed, compressed_length, decoded, sizeof(decoded));
+            compressed[i] ^= 0x5A;
+        }
+    }
+
+    if (data != NULL) {
+        free(data);
+    }
+
+    return ret;
+}
+
+static int binlog_v2_write_file(char const* file_name, uint32_t version, size_t ring_size)
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_connection_id_t initial_cid[3] = {
+        { { 1, 2, 3, 4 }, 4 },
+        { { 1, 2, 3, 5, 6, 7, 8, 9 }, 8 },
+        { { 9, 9, 9 }, 3 }
+    };
+    const picoquic_connection_id_t dest_cid = {
+        { 5, 6, 7, 8 }, 4
+    };
+    picoquic_cnx_t* cnx[3] = { NULL, NULL, NULL };
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        picoquic_set_binlog_ring_size(quic, ring_size);
+        if (picoquic_set_binlog_version(quic, version) != 0) {
+            DBG_PRINTF("Cannot set binary log version %u\n", version);
+            ret = -1;
+        }
+        else {
+            picoquic_set_binlog(quic, file_name);
+            picoquic_set_default_spinbit_policy(quic, picoquic_spinbit_null);
+        }
+
+        if (ret == 0 && quic->f_binlog == NULL) {
+            DBG_PRINTF("%s", "Cannot start binary log\n");
+            ret = -1;
+        }
+
+        for (int i = 0; ret == 0 && i < 3; i++) {
+            struct sockaddr_in saddr;
+            memset(&saddr, 0, sizeof(struct sockaddr_in));
+            cnx[i] = picoquic_create_cnx(quic, initial_cid[i], dest_cid, (struct sockaddr*) & saddr,
+                simulated_time, 0, "test-sni", "test-alpn", 1);
+            if (cnx[i] == NULL) {
+                DBG_PRINTF("%s", "Cannot create QUIC CNX context\n");
+                ret = -1;
+            }
+        }
+
+        for (int round = 0; ret == 0 && round < 100; round++) {
+            for (size_t i = 0; i < nb_test_skip_list; i++) {
+                for (int c = 0; c < 3; c++) {
+                    picoquic_packet_header ph;
+                    memset(&ph, 0, sizeof(ph));
+
+                    ph.ptype = picoquic_packet_1rtt_protected;
+                    ph.pn64 = round * nb_test_skip_list + i;
+                    ph.dest_cnx_id = initial_cid[c];
+                    ph.srce_cnx_id = dest_cid;
+                    ph.offset = 0;
+                    ph.payload_length = test_skip_list[i].len;
+                    /* The last connection only sends on some rounds, so its records are not in all blocks */
+                    if (c < 2 || (round % 20) == 0) {
+                        binlog_packet(quic, cnx[c], &initial_cid[c], c & 1, simulated_time, &ph,
+                            test_skip_list[i].val, test_skip_list[i].len);
+                    }
+                    simulated_time += 100 + (i % 7) * 10;
+                }
+            }
+        }
+
+        for (int i = 0; i < 3; i++) {
+            if (cnx[i] != NULL) {
+                picoquic_delete_cnx(cnx[i]);
+            }
+        }
+        picoquic_set_binlog(quic, NULL);
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Copy the records to a file in the version 1 format */
+static int binlog_v2_copy_record(bytestream* s, void* ptr)
+{
+    FILE* F = (FILE*)ptr;
+    uint8_t head[4];
+    size_t length = bytestream_size(s);
+
+    picoformat_32(head, (uint32_t)length);
+    return (fwrite(head, 4, 1, F) == 1 && fwrite(bytestream_data(s), length, 1, F) == 1) ? 0 : -1;
+}
+
+static int binlog_v2_copy_records(char const* binlog_name, char const* records_name)
+{
+    int ret = 0;
+    FILE* f_binlog = picoquic_file_open(binlog_name, "rb");
+    FILE* f_records = picoquic_file_open(records_name, "wb");
+
+    if (f_binlog == NULL || f_records == NULL) {
+        ret = -1;
+    }
+    else {
+        ret = fileread_binlog(f_binlog, binlog_v2_copy_record, f_records);
+    }
+    (void)picoquic_file_close(f_binlog);
+    (void)picoquic_file_close(f_records);
+
+    return ret;
+}
+
+static int binlog_v2_convert(char const* binlog_name, char const* qlog_name, const picoquic_connection_id_t* cid, size_t* nb_cids)
+{
+    int ret = 0;
+    uint64_t log_time = 0;
+    FILE* f_binlog = picoquic_open_cc_log_file_for_read(binlog_name, &log_time);
+    picohash_table* cids = cidset_create();
+
+    if (f_binlog == NULL || cids == NULL) {
+        ret = -1;
+    }
+    else if ((ret = binlog_list_cids(f_binlog, cids)) == 0) {
+        *nb_cids = cids->count;
+        ret = qlog_convert(cid, f_binlog, binlog_name, qlog_name, NULL);
+    }
+    (void)picoquic_file_close(f_binlog);
+    if (cids != NULL) {
+        cidset_delete(cids);
+    }
+
+    return ret;
+}
+
+static long binlog_v2_file_size(char const* file_name)
+{
+    long size = -1;
+    FILE* F = picoquic_file_open(file_name, "rb");
+
+    if (F != NULL) {
+        if (fseek(F, 0, SEEK_END) == 0) {
+            size = ftell(F);
         }
         (void)picoquic_file_close(F);
     }
 
+    return size;
+}
+
+/* Simulate a log that was not closed, by removing the index and trailer */
+static int binlog_v2_cut_index(char const* file_name, char const* cut_name)
+{
+    int ret = 0;
+    uint8_t trailer[PICOQUIC_BINLOG_TRAILER_SIZE];
+    uint8_t buffer[1024];
+    FILE* F = picoquic_file_open(file_name, "rb");
+    FILE* F_cut = picoquic_file_open(cut_name, "wb");
+    uint64_t index_offset = 0;
+
+    if (F == NULL || F_cut == NULL ||
+        fseek(F, -PICOQUIC_BINLOG_TRAILER_SIZE, SEEK_END) != 0 ||
+        fread(trailer, sizeof(trailer), 1, F) != 1 ||
+        PICOPARSE_32(trailer + 8) != FOURCC('q', 'e', 'n', 'd') ||
+        fseek(F, 0, SEEK_SET) != 0) {
+        ret = -1;
+    }
+    else {
+        index_offset = PICOPARSE_64(trailer);
+        while (ret == 0 && index_offset > 0) {
+            size_t l = (index_offset > sizeof(buffer)) ? sizeof(buffer) : (size_t)index_offset;
+            if (fread(buffer, l, 1, F) != 1 || fwrite(buffer, l, 1, F_cut) != 1) {
+                ret = -1;
+            }
+            index_offset -= l;
+        }
+    }
+    (void)picoquic_file_close(F);
+    (void)picoquic_file_close(F_cut);
+
+    return ret;
+}
+
+int binlog_v2_test()
+{
+    int ret = binlog_v2_lz_test();
+    const picoquic_connection_id_t selected_cid = { { 9, 9, 9 }, 3 };
+    size_t nb_cids_v1 = 0;
+    size_t nb_cids_v2 = 0;
+
+    if (ret == 0 && picoquic_set_binlog_version(NULL, 3) == 0) {
+        DBG_PRINTF("%s", "Unsupported binary log version accepted\n");
+        ret = -1;
+    }
+
+    for (int with_ring = 0; ret == 0 && with_ring < 2; with_ring++) {
+        size_t ring_size = (with_ring) ? PICOQUIC_BINLOG_RING_SIZE_DEFAULT : 0;
+
+        ret = binlog_v2_write_file(binlog_v1_test_file, PICOQUIC_BINLOG_VERSION_1, ring_size);
+        if (ret == 0) {
+            ret = binlog_v2_write_file(binlog_v2_test_file, PICOQUIC_BINLOG_VERSION_2, ring_size);
+        }
+
+        /* All the records are read back in the same order */
+        if (ret == 0 && (binlog_v2_copy_records(binlog_v1_test_file, binlog_v1_records_file) != 0 ||
+            binlog_v2_copy_records(binlog_v2_test_file, binlog_v2_records_file) != 0)) {
+            DBG_PRINTF("Cannot read the binary logs, ring: %d\n", with_ring);
+            ret = -1;
+        }
+        if (ret == 0 && picoquic_test_compare_binary_files(binlog_v1_records_file, binlog_v2_records_file) != 0) {
+            DBG_PRINTF("Records differ between versions, ring: %d\n", with_ring);
+            ret = -1;
+        }
+
+        /* The index selects the same records as the sequential filter */
+        if (ret == 0 && (binlog_v2_convert(binlog_v1_test_file, binlog_v1_qlog_file, &selected_cid, &nb_cids_v1) != 0 ||
+            binlog_v2_convert(binlog_v2_test_file, binlog_v2_qlog_file, &selected_cid, &nb_cids_v2) != 0)) {
+            DBG_PRINTF("Cannot convert the binary logs, ring: %d\n", with_ring);
+            ret = -1;
+        }
+        if (ret == 0 && (nb_cids_v1 != 3 || nb_cids_v2 != 3)) {
+            DBG_PRINTF("Found %zu CIDs in version 1, %zu in version 2\n", nb_cids_v1, nb_cids_v2);
+            ret = -1;
+        }
+        if (ret == 0 && picoquic_test_compare_text_files(binlog_v1_qlog_file, binlog_v2_qlog_file) != 0) {
+            DBG_PRINTF("QLOG differs between versions, ring: %d\n", with_ring);
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            long size_v1 = binlog_v2_file_size(binlog_v1_test_file);
+            long size_v2 = binlog_v2_file_size(binlog_v2_test_file);
+
+            DBG_PRINTF("Binary log size, version 1: %ld, version 2: %ld\n", size_v1, size_v2);
+            if (size_v2 <= 0 || size_v2 * 2 > size_v1) {
+                DBG_PRINTF("%s", "Insufficient compression\n");
+                ret = -1;
+            }
+        }
+    }
+
+    /* A log without index is still read sequentially */
+    if (ret == 0 && (binlog_v2_cut_index(binlog_v2_test_file, binlog_v2_cut_test_file) != 0 ||
+        binlog_v2_copy_records(binlog_v2_cut_test_file, binlog_v2_records_file) != 0 ||
+        binlog_v2_convert(binlog_v2_cut_test_file, binlog_v2_qlog_file, &selected_cid, &nb_cids_v2) != 0)) {
+        DBG_PRINTF("%s", "Cannot read the binary log without index\n");
+        ret = -1;
+    }
+    if (ret == 0 && (picoquic_test_compare_binary_files(binlog_v1_records_file, binlog_v2_records_file) != 0 ||
+        picoquic_test_compare_text_files(binlog_v1_qlog_file, binlog_v2_qlog_file) != 0 || nb_cids_v2 != 3)) {
+        DBG_PRINTF("%s", "Unexpected content in binary log without index\n");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Test of the memory mapped reader. The logs written for the version 2
+ * test are mapped and all connections converted in parallel, which must
+ * produce the same QLOG as the conversion from the file.
+ */
+static int binlog_map_qlog_name(char* name, size_t name_max, char const* prefix, const picoquic_connection_id_t* cid)
+{
+    char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
+    int ret = picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), cid);
+
+    if (ret == 0) {
+        ret = picoquic_sprintf(name, name_max, NULL, "%s_%s.qlog", prefix, cid_name);
+    }
+
+    return ret;
+}
+
+static int binlog_map_convert_cb(binlog_map_t* map, const picoquic_connection_id_t* cid, void* ptr)
+{
+    char qlog_name[256];
+    int ret = binlog_map_qlog_name(qlog_name, sizeof(qlog_name), "binlog_map", cid);
+
+    if (ret == 0) {
+        ret = qlog_convert_map(cid, map, (char const*)ptr, qlog_name, NULL);
+    }
+
+    return ret;
+}
+
+static int binlog_map_test_file(char const* binlog_name)
+{
+    int ret = 0;
+    binlog_map_t* map = binlog_map_open(binlog_name);
+
+    if (map == NULL) {
+        DBG_PRINTF("Cannot map %s\n", binlog_name);
+        ret = -1;
+    }
+    else {
+        if (binlog_map_nb_cids(map) != 3) {
+            DBG_PRINTF("Found %zu CIDs in %s\n", binlog_map_nb_cids(map), binlog_name);
+            ret = -1;
+        }
+        else {
+            ret = binlog_map_convert_all(map, 3, binlog_map_convert_cb, (void*)binlog_name);
+        }
+
+        for (size_t i = 0; ret == 0 && i < binlog_map_nb_cids(map); i++) {
+            const picoquic_connection_id_t* cid = binlog_map_cid(map, i);
+            char map_qlog_name[256];
+            char file_qlog_name[256];
+            uint64_t log_time = 0;
+            FILE* f_binlog = NULL;
+
+            if (binlog_map_qlog_name(map_qlog_name, sizeof(map_qlog_name), "binlog_map", cid) != 0 ||
+                binlog_map_qlog_name(file_qlog_name, sizeof(file_qlog_name), "binlog_file", cid) != 0 ||
+                (f_binlog = picoquic_open_cc_log_file_for_read(binlog_name, &log_time)) == NULL ||
+                qlog_convert(cid, f_binlog, binlog_name, file_qlog_name, NULL) != 0) {
+                DBG_PRINTF("Cannot convert %s\n", binlog_name);
+                ret = -1;
+            }
+            else if (picoquic_test_compare_text_files(map_qlog_name, file_qlog_name) != 0) {
+                DBG_PRINTF("Mapped conversion of %s differs, CID rank %zu\n", binlog_name, i);
+                ret = -1;
+            }
+            (void)picoquic_file_close(f_binlog);
+        }
+        binlog_map_close(map);
+    }
+
+    return ret;
+}
+
+int binlog_map_test()
+{
+    int ret = 0;
+
+    if (binlog_map_open("no_such_binlog.log") != NULL) {
+        DBG_PRINTF("%s", "Mapped a file that does not exist\n");
+        ret = -1;
+    }
+    if (ret == 0) {
+        ret = binlog_v2_write_file(binlog_v1_test_file, PICOQUIC_BINLOG_VERSION_1, 0);
+    }
+    if (ret == 0) {
+        ret = binlog_map_test_file(binlog_v1_test_file);
+    }
+    if (ret == 0) {
+        ret = binlog_v2_write_file(binlog_v2_test_file, PICOQUIC_BINLOG_VERSION_2, 0);
+    }
+    if (ret == 0) {
+        ret = binlog_map_test_file(binlog_v2_test_file);
+    }
+    if (ret == 0) {
+        ret = binlog_v2_cut_index(binlog_v2_test_file, binlog_v2_cut_test_file);
+    }
+    if (ret == 0) {
+        ret = binlog_map_test_file(binlog_v2_cut_test_file);
+    }
+
     return ret;
 }
 
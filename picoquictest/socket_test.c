@@ -204,7 +204,7 @@ int socket_ecn_test_one(int af_domain)
         int recv_set = 0;
         int send_set = 0;
 
-        ret = picoquic_socket_set_ecn_options(fd, af_domain, &recv_set, &send_set);
+        ret = picoquic_socket_set_ecn_options(fd, af_domain, PICOQUIC_ECN_ECT_0, &recv_set, &send_set);
 
         if (ret != 0) {
             DBG_PRINTF("Cannot set ECN options, af = %d, ret = %d\n", af_domain, ret);
@@ -20,7 +20,9 @@
 */
 
 #include "picoquic_internal.h"
+#include "cc_common.h"
 #include "picoquic_utils.h"
+#include "bytestream.h"
 #include "tls_api.h"
 #include "picoquictest_internal.h"
 #ifdef _WINDOWS
@@ -34,6 +36,7 @@
 #include "logwriter.h"
 #include "csv.h"
 #include "qlog.h"
+#include "textlog.h"
 
 #define RANDOM_PUBLIC_TEST_SEED 0xDEADBEEFCAFEC001ull
 
@@ -1162,6 +1165,7 @@ int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
                 }
                 else if (packet->length > 0) {
                     packet->length += coalesced_length;
+                    packet->ecn_mark = picoquic_get_last_ecn_codepoint(test_ctx->qclient);
                     /* queue in c_to_s */
                     if (packet->addr_from.ss_family == 0) {
                         memcpy(&packet->addr_from, &test_ctx->client_addr, sizeof(struct sockaddr_in));
@@ -1181,6 +1185,7 @@ int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
                     ret = -1;
                 }
                 else if (packet->length > 0) {
+                    packet->ecn_mark = picoquic_get_last_ecn_codepoint(test_ctx->qserver);
                     /* copy and queue in s to c */
                     if (packet->addr_from.ss_family == 0) {
                         memcpy(&packet->addr_from, &test_ctx->server_addr, sizeof(struct sockaddr_in));
@@ -1235,7 +1240,7 @@ int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
                     test_ctx->client_use_multiple_addresses)){
                 ret = picoquic_incoming_packet(test_ctx->qclient, packet->bytes, (uint32_t)packet->length,
                     (struct sockaddr*)&packet->addr_from,
-                    (struct sockaddr*)&packet->addr_to, 0, 0,
+                    (struct sockaddr*)&packet->addr_to, 0, packet->ecn_mark,
                     *simulated_time);
                 *was_active |= 1;
             }
@@ -1261,7 +1266,7 @@ int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
                 (struct sockaddr *)&packet->addr_to) == 0) {
                 ret = picoquic_incoming_packet(test_ctx->qserver, packet->bytes, (uint32_t)packet->length,
                     (struct sockaddr*)&packet->addr_from,
-                    (struct sockaddr*)&packet->addr_to, 0, 0,
+                    (struct sockaddr*)&packet->addr_to, 0, packet->ecn_mark,
                     *simulated_time);
             }
 
@@ -5729,6 +5734,136 @@ int key_rotation_stress_test()
     return key_rotation_stress_test_one(10);
 }
 
+/*
+ * Automatic key rotation: with the rotation policy, the client rotates its keys
+ * every 20 packets and the server every 16000 bytes. Verify that the next phase
+ * keys are precomputed once the connection is ready, and that the transfer
+ * completes with many rotations on both sides. The same transfer is also done
+ * without rotation, and the difference in CPU time is reported as a benchmark.
+ */
+
+static int key_rotation_auto_test_one(uint64_t client_packets, uint64_t server_bytes,
+    uint64_t * elapsed_time, uint64_t * nb_rotations)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t start_time = 0;
+    int nb_trials = 0;
+    int nb_inactive = 0;
+    int max_trials = 100000;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    if (ret == 0) {
+        picoquic_set_default_key_rotation_policy(test_ctx->qserver, 0, server_bytes);
+        picoquic_set_key_rotation_policy(test_ctx->cnx_client, client_packets, 0);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = wait_application_aead_ready(test_ctx, &simulated_time);
+    }
+
+    /* The next phase keys should be computed as soon as the server sends 1-RTT packets */
+    while (ret == 0 && nb_trials < 64 && test_ctx->cnx_server->crypto_context_new.aead_decrypt == NULL) {
+        int was_active = 0;
+        nb_trials++;
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+    }
+
+    if (ret == 0 && (test_ctx->cnx_server->crypto_context_new.aead_decrypt == NULL ||
+        test_ctx->cnx_server->crypto_context_new.aead_encrypt == NULL)) {
+        DBG_PRINTF("%s", "Next phase keys not precomputed on server\n");
+        ret = -1;
+    }
+
+    /* Prepare to send data */
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+        start_time = picoquic_current_time();
+    }
+
+    while (ret == 0 && nb_trials < max_trials && nb_inactive < 256 && TEST_CLIENT_READY && TEST_SERVER_READY) {
+        int was_active = 0;
+
+        nb_trials++;
+
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+
+        if (was_active) {
+            nb_inactive = 0;
+        }
+        else {
+            nb_inactive++;
+        }
+
+        if (test_ctx->test_finished) {
+            if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
+                break;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        *elapsed_time = picoquic_current_time() - start_time;
+
+        if (!test_ctx->test_finished) {
+            DBG_PRINTF("%s", "Data transfer did not complete\n");
+            ret = -1;
+        }
+        else {
+            *nb_rotations = test_ctx->cnx_client->nb_crypto_key_rotations + test_ctx->cnx_server->nb_crypto_key_rotations;
+            ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+            if (ret != 0) {
+                DBG_PRINTF("Connection close returns %d\n", ret);
+            }
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int key_rotation_auto_test()
+{
+    uint64_t base_time = 0;
+    uint64_t base_rotations = 0;
+    uint64_t rotation_time = 0;
+    uint64_t nb_rotations = 0;
+    int ret = key_rotation_auto_test_one(0, 0, &base_time, &base_rotations);
+
+    if (ret == 0 && base_rotations != 0) {
+        DBG_PRINTF("Unexpected %" PRIu64 " rotations without policy\n", base_rotations);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = key_rotation_auto_test_one(20, 16000, &rotation_time, &nb_rotations);
+    }
+
+    if (ret == 0) {
+        if (nb_rotations < 10) {
+            DBG_PRINTF("Only %" PRIu64 " key rotations\n", nb_rotations);
+            ret = -1;
+        }
+        else {
+            printf("Key rotations: %" PRIu64 ", transfer time %" PRIu64 " us vs. %" PRIu64 " us without rotation, %.1f us per rotation\n",
+                nb_rotations, rotation_time, base_time,
+                ((double)rotation_time - (double)base_time) / (double)nb_rotations);
+        }
+    }
+
+    return ret;
+}
 
 /*
  * False migration. Test that the client server connection resists injection of
@@ -6542,6 +6677,227 @@ int qlog_trace_test()
     return ret;
 }
 
+/*
+ * Test the deferred text log. The server only writes the packet trace in the
+ * binary log, and the text trace is then produced from the binary log. The
+ * client logs packets in the text log, until the packet trace limit.
+ */
+#define TEXTLOG_DEFERRED_TXT "textlog_deferred.txt"
+#define TEXTLOG_DEFERRED_BIN "textlog_deferred.bin"
+#define TEXTLOG_DEFERRED_CONV "textlog_deferred_conv.txt"
+#define TEXTLOG_DEFERRED_CLIENT "textlog_deferred_client.txt"
+
+static int textlog_deferred_count_lines(char const* file_name, char const* pattern, int* nb_lines)
+{
+    int ret = 0;
+    FILE* F = picoquic_file_open(file_name, "r");
+
+    *nb_lines = 0;
+
+    if (F == NULL) {
+        DBG_PRINTF("Cannot open %s", file_name);
+        ret = -1;
+    }
+    else {
+        char line[1024];
+
+        while (fgets(line, sizeof(line), F) != NULL) {
+            if (strstr(line, pattern) != NULL) {
+                *nb_lines += 1;
+            }
+        }
+        picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+int textlog_deferred_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_connection_id_t initial_cid = { {0x7e, 0x87, 0x10, 0x90, 5, 6, 7, 8}, 8 };
+    int nb_lines = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_set_binlog(test_ctx->qserver, TEXTLOG_DEFERRED_BIN);
+        ret = picoquic_set_textlog(test_ctx->qserver, TEXTLOG_DEFERRED_TXT);
+        if (ret == 0) {
+            picoquic_set_textlog_deferred(test_ctx->qserver, 1);
+            ret = picoquic_set_textlog(test_ctx->qclient, TEXTLOG_DEFERRED_CLIENT);
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            initial_cid, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, 0,
+            PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        }
+        else if (!test_ctx->cnx_client->is_logging) {
+            DBG_PRINTF("%s", "Client connection does not log packets.\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 20000, 1000000);
+    }
+
+    if (ret == 0) {
+        if (test_ctx->cnx_server == NULL || test_ctx->cnx_server->is_logging) {
+            DBG_PRINTF("%s", "Server connection logs packets as text.\n");
+            ret = -1;
+        }
+        else if (test_ctx->cnx_client->is_logging != picoquic_cnx_is_still_logging(test_ctx->cnx_client)) {
+            DBG_PRINTF("Client logging flag is %d after %" PRIu64 " packets.\n", test_ctx->cnx_client->is_logging,
+                test_ctx->cnx_client->pkt_ctx[picoquic_packet_context_application].send_sequence);
+            ret = -1;
+        }
+        else {
+            /* The server sent more than the maximum number of traced packets */
+            picoquic_set_textlog_deferred(test_ctx->qserver, 0);
+            if (test_ctx->cnx_server->is_logging) {
+                DBG_PRINTF("%s", "Server still logs packets after the trace limit.\n");
+                ret = -1;
+            }
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    if (ret == 0) {
+        ret = textlog_deferred_count_lines(TEXTLOG_DEFERRED_TXT, "packet type", &nb_lines);
+        if (ret == 0 && nb_lines != 0) {
+            DBG_PRINTF("Found %d packet lines in deferred text log.\n", nb_lines);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        uint64_t log_time = 0;
+        FILE* f_binlog = picoquic_open_cc_log_file_for_read(TEXTLOG_DEFERRED_BIN, &log_time);
+        if (f_binlog == NULL) {
+            ret = -1;
+        }
+        else {
+            ret = textlog_convert(&initial_cid, f_binlog, TEXTLOG_DEFERRED_BIN, TEXTLOG_DEFERRED_CONV, NULL);
+            picoquic_file_close(f_binlog);
+        }
+    }
+
+    if (ret == 0) {
+        ret = textlog_deferred_count_lines(TEXTLOG_DEFERRED_CONV, "Receiving packet type", &nb_lines);
+        if (ret == 0 && nb_lines == 0) {
+            DBG_PRINTF("%s", "No received packets in converted text log.\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = textlog_deferred_count_lines(TEXTLOG_DEFERRED_CONV, "    Stream 4,", &nb_lines);
+        if (ret == 0 && nb_lines == 0) {
+            DBG_PRINTF("%s", "No stream frames in converted text log.\n");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Streaming qlog: the client writes a JSON-SEQ file for its connection
+ * while it runs, without a binary log file.
+ */
+#define SQLOG_TEST_FILE "5e01090005060708.sqlog"
+
+int sqlog_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_connection_id_t initial_cid = { {0x5e, 0x01, 0x09, 0x00, 5, 6, 7, 8}, 8 };
+    int nb_lines = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = picoquic_set_sqlog(test_ctx->qclient, ".");
+    }
+
+    if (ret == 0) {
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            initial_cid, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, 0,
+            PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 20000, 1000000);
+    }
+
+    if (test_ctx != NULL) {
+        /* Deleting the context closes the sink and the files */
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    if (ret == 0) {
+        FILE* F = picoquic_file_open(SQLOG_TEST_FILE, "rb");
+        char header[256];
+
+        if (F == NULL) {
+            DBG_PRINTF("Cannot open %s\n", SQLOG_TEST_FILE);
+            ret = -1;
+        }
+        else {
+            if (fgets(header, sizeof(header), F) == NULL || header[0] != 0x1e ||
+                strstr(header, "\"qlog_format\": \"JSON-SEQ\"") == NULL) {
+                DBG_PRINTF("%s", "The sqlog file does not start with a JSON-SEQ header.\n");
+                ret = -1;
+            }
+            picoquic_file_close(F);
+        }
+    }
+
+    if (ret == 0) {
+        ret = textlog_deferred_count_lines(SQLOG_TEST_FILE, "\x1e[", &nb_lines);
+        if (ret == 0 && nb_lines == 0) {
+            DBG_PRINTF("%s", "No event records in sqlog file.\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = textlog_deferred_count_lines(SQLOG_TEST_FILE, "\"PACKET_SENT\"", &nb_lines);
+        if (ret == 0 && nb_lines == 0) {
+            DBG_PRINTF("%s", "No packet sent events in sqlog file.\n");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
 /*
  * Testing the flow controlled sending scenario 
  */
@@ -6648,6 +7004,16 @@ int bbr_jitter_test()
     return congestion_control_test(picoquic_bbr_algorithm, 3650000, 5000);
 }
 
+int bbr2_test()
+{
+    return congestion_control_test(picoquic_bbr2_algorithm, 3600000, 0);
+}
+
+int bbr2_jitter_test()
+{
+    return congestion_control_test(picoquic_bbr2_algorithm, 3750000, 5000);
+}
+
 int bbr_long_test()
 {
     uint64_t simulated_time = 0;
@@ -6837,72 +7203,45 @@ int gbps_performance_test()
 }
 
 
-/* This is similar to the long rtt test, but operating at a higher speed.
- * We allow for loss simulation and jitter simulation to simulate wi-fi + satellite.
- * Also, we want to check overhead targets, such as ratio of data bytes over control bytes.
- *
- * The satellite link that we define here corresponds to models suggested by 
- * John Border of Hughes: 250 Mbps for the server to client link, 3 Mbps for the client
- * to server link. We reverse the role, as our test sends data from the cleint to the
- * server. John suggested tested with a 1GB download; we compromise here to 100MB,
- * in order to execut the test in reasonable time. There should be two test
- * variants: 0% loss, and 1 %loss.
+/* Shallow buffer test.
+ * Download 10MB over a 10 Mbps link with a 20 ms one way latency, and a
+ * bottleneck buffer holding only 5 ms of data, i.e. about an eighth of the
+ * BDP. Report the completion time and the fraction of packets dropped at the
+ * bottleneck for Cubic, BBRv1 and BBRv2. BBRv2 should complete in
+ * reasonable time, while dropping fewer packets than BBRv1.
  */
-static int satellite_test_one(picoquic_congestion_algorithm_t* ccalgo, size_t data_size, uint64_t max_completion_time, 
-    uint64_t mbps_up, uint64_t mbps_down, uint64_t jitter, int has_loss)
+
+static int shallow_buffer_test_one(picoquic_congestion_algorithm_t* ccalgo, uint64_t max_completion_time,
+    uint64_t* completion_time, double* drop_rate)
 {
     uint64_t simulated_time = 0;
-    uint64_t latency = 300000;
-    uint64_t picoseq_per_byte_250 = (1000000ull * 8) / mbps_up;
-    uint64_t picoseq_per_byte_3 = (1000000ull * 8) / mbps_down;
-    picoquic_tp_t client_parameters;
+    uint64_t latency = 20000;
+    uint64_t buffer = 5000;
+    uint64_t mbps = 10;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = 0;
-
-    memset(&client_parameters, 0, sizeof(picoquic_tp_t));
-    picoquic_init_transport_parameters(&client_parameters, 1);
-    client_parameters.enable_time_stamp = 1;
-
-    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, &client_parameters, NULL);
+    int ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL);
 
     if (ret == 0 && test_ctx == NULL) {
         ret = -1;
     }
 
-    /* Simulate satellite links: 250 mbps, 300ms delay in each direction */
-    /* Set the congestion algorithm to specified value. Also, request a packet trace */
     if (ret == 0) {
-        char binlog_file_name[256];
-        size_t binlog_file_name_len = 0;
-        (void)picoquic_sprintf(binlog_file_name, sizeof(binlog_file_name), &binlog_file_name_len,
-            "satellite_%s_u%" PRIu64 "_d%" PRIu64 "_j%" PRIu64 "%s.bin", ccalgo->congestion_algorithm_id, 
-            mbps_up, mbps_down, jitter, (has_loss) ? "_loss" : "");
-
         picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
         picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
 
-        test_ctx->c_to_s_link->jitter = jitter;
         test_ctx->c_to_s_link->microsec_latency = latency;
-        test_ctx->c_to_s_link->picosec_per_byte = picoseq_per_byte_250;
+        test_ctx->c_to_s_link->picosec_per_byte = (1000000ull * 8) / mbps;
         test_ctx->s_to_c_link->microsec_latency = latency;
-        test_ctx->s_to_c_link->picosec_per_byte = picoseq_per_byte_3; 
-        test_ctx->s_to_c_link->jitter = jitter;
-        test_ctx->stream0_flow_release = 1;
-
-        picoquic_cnx_set_pmtud_required(test_ctx->cnx_client, 1);
+        test_ctx->s_to_c_link->picosec_per_byte = (1000000ull * 8) / mbps;
 
-        picoquic_set_binlog(test_ctx->qclient, binlog_file_name);
-        test_ctx->qclient->use_long_log = 1;
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time, test_scenario_10mb, sizeof(test_scenario_10mb),
+            0, 0, 0, buffer, max_completion_time);
 
-        if (ret == 0) {
-            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-                NULL, 0, data_size, (has_loss) ? 0x10000000:0, 0, 2 * latency, max_completion_time);
-        }
+        *completion_time = simulated_time - test_ctx->cnx_client->start_time;
+        *drop_rate = (test_ctx->s_to_c_link->packets_sent > 0) ?
+            ((double)test_ctx->s_to_c_link->packets_dropped) / ((double)test_ctx->s_to_c_link->packets_sent) : 0.0;
     }
 
-    /* Free the resource, which will close the log file.
-     */
-
     if (test_ctx != NULL) {
         tls_api_delete_ctx(test_ctx);
         test_ctx = NULL;
@@ -6911,82 +7250,75 @@ static int satellite_test_one(picoquic_congestion_algorithm_t* ccalgo, size_t da
     return ret;
 }
 
-int satellite_basic_test()
-{
-    /* Should be less than 7 sec per draft etosat. */
-    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 5400000, 250, 3, 0, 0);
-}
-
-int satellite_loss_test()
-{
-    /* Should be less than 10 sec per draft etosat. */
-    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 8200000, 250, 3, 0, 1);
-}
-
-int satellite_jitter_test()
+int bbr2_shallow_buffer_test()
 {
-    /* Should be less than 7 sec per draft etosat. */
-    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 6200000, 250, 3, 3000, 0);
-}
+    picoquic_congestion_algorithm_t* ccalgos[] = {
+        picoquic_cubic_algorithm,
+        picoquic_bbr_algorithm,
+        picoquic_bbr2_algorithm };
+    uint64_t completion_time[3];
+    double drop_rate[3];
+    int ret = 0;
 
-int satellite_medium_test()
-{
-    /* Should be less than 20 sec per draft etosat. */
-    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 18000000, 50, 10, 0, 0);
-}
+    for (size_t i = 0; ret == 0 && i < sizeof(ccalgos) / sizeof(picoquic_congestion_algorithm_t*); i++) {
+        ret = shallow_buffer_test_one(ccalgos[i], 20000000, &completion_time[i], &drop_rate[i]);
+        if (ret != 0) {
+            DBG_PRINTF("Shallow buffer test fails for <%s>\n", ccalgos[i]->congestion_algorithm_id);
+        }
+        else {
+            printf("Shallow buffer, %s: %" PRIu64 " us, %.2f%% dropped\n", ccalgos[i]->congestion_algorithm_id,
+                completion_time[i], 100.0 * drop_rate[i]);
+        }
+    }
 
-int satellite_small_test()
-{
-    /* Should be less than 85 sec per draft etosat. */
-    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 81000000, 10, 2, 0, 0);
-}
+    if (ret == 0 && drop_rate[2] > drop_rate[1]) {
+        DBG_PRINTF("BBRv2 drops %.2f%%, more than BBRv1 %.2f%%\n", 100.0 * drop_rate[2], 100.0 * drop_rate[1]);
+        ret = -1;
+    }
 
-int satellite_small_up_test()
-{
-    /* Should be less than 420 sec per draft etosat. */
-    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 400000000, 2, 10, 0, 0);
+    return ret;
 }
 
-/* Test that different CID length are properly supported */
-int cid_length_test_one(uint8_t length)
+/* Short transfers over a jittery path, such as Wi-Fi. Delay jitter shall not
+ * cause slow start to end prematurely: HyStart++ may enter conservative slow
+ * start, but the transfer shall complete close to the path capacity.
+ */
+static int hystart_jitter_test_one(picoquic_congestion_algorithm_t* ccalgo, uint64_t max_completion_time,
+    picoquic_hystart_stats_t* stats)
 {
     uint64_t simulated_time = 0;
+    uint64_t latency = 25000;
+    uint64_t jitter = 8000;
+    uint64_t mbps = 20;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+    int ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL);
 
     if (ret == 0 && test_ctx == NULL) {
         ret = -1;
     }
 
-    /* Set the CID length in the client context, then recreate the connection */
     if (ret == 0) {
-        /* Delete the old connection */
-        picoquic_delete_cnx(test_ctx->cnx_client);
-        test_ctx->cnx_client = NULL;
-        /* Change the default cnx_id length*/
-        test_ctx->qclient->local_cnxid_length = length;
-        /* re-create a client connection */
-        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
-            picoquic_null_connection_id, picoquic_null_connection_id,
-            (struct sockaddr*)&test_ctx->server_addr, 0,
-            PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
-        if (test_ctx->cnx_client == NULL) {
-            ret = -1;
-        }
-        else {
-            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-                test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 20000, 100000);
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
+        picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
 
-            if (ret == 0 &&
-                test_ctx->cnx_client->path[0]->p_local_cnxid->cnx_id.id_len != length) {
-                ret = -1;
-            }
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->c_to_s_link->picosec_per_byte = (1000000ull * 8) / mbps;
+        test_ctx->c_to_s_link->jitter = jitter;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->picosec_per_byte = (1000000ull * 8) / mbps;
+        test_ctx->s_to_c_link->jitter = jitter;
 
-            if (ret == 0 &&
-                test_ctx->cnx_server->path[0]->remote_cnxid.id_len != length) {
-                ret = -1;
-            }
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time, test_scenario_very_long, sizeof(test_scenario_very_long),
+            0, 0, 0, 2 * latency + 2 * jitter, max_completion_time);
+
+        if (test_ctx->cnx_server != NULL) {
+            picoquic_get_hystart_stats(test_ctx->cnx_server, stats);
+        }
+        else {
+            memset(stats, 0, sizeof(picoquic_hystart_stats_t));
         }
+        DBG_PRINTF("%s: completed at %" PRIu64 ", %" PRIu64 " rounds, %" PRIu64 " CSS, %" PRIu64 " spurious, %" PRIu64 " exits",
+            ccalgo->congestion_algorithm_id, simulated_time, stats->nb_rounds, stats->nb_css_entries, stats->nb_css_spurious, stats->nb_delay_exits);
     }
 
     if (test_ctx != NULL) {
@@ -6997,212 +7329,285 @@ int cid_length_test_one(uint8_t length)
     return ret;
 }
 
-int cid_length_test()
+int hystart_jitter_test()
 {
+    picoquic_congestion_algorithm_t* ccalgos[2] = { picoquic_newreno_algorithm, picoquic_cubic_algorithm };
     int ret = 0;
-    const uint8_t tested_length[] = { 0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20};
 
-    for (size_t i = 0; i < sizeof(tested_length); i++) {
-        ret = cid_length_test_one(tested_length[i]);
-        if (ret != 0) {
-            DBG_PRINTF("Test fails for cid_length = %d\n", tested_length[i]);
-            break;
+    for (size_t i = 0; ret == 0 && i < sizeof(ccalgos) / sizeof(picoquic_congestion_algorithm_t*); i++) {
+        picoquic_hystart_stats_t stats;
+
+        ret = hystart_jitter_test_one(ccalgos[i], 1500000, &stats);
+        if (ret == 0 && stats.nb_rounds == 0) {
+            DBG_PRINTF("%s: no slow start round recorded", ccalgos[i]->congestion_algorithm_id);
+            ret = -1;
+        }
+        else if (ret == 0 && stats.nb_delay_exits != 0) {
+            DBG_PRINTF("%s: jitter caused slow start exit at cwin %" PRIu64, ccalgos[i]->congestion_algorithm_id, stats.exit_cwin);
+            ret = -1;
         }
     }
 
     return ret;
 }
 
-/* Testing transmission behavior over large RTT links
+/* Background transfer test. A LEDBAT flow and a foreground flow share the
+ * same bottleneck link. The LEDBAT flow starts first, the foreground flow
+ * starts a few seconds later. While the foreground flow is active, the
+ * LEDBAT flow shall yield most of the capacity, then resume and complete
+ * once the foreground flow is done.
  */
-
-int long_rtt_test()
+typedef struct st_ledbat_test_flow_t {
+    picoquic_cnx_t* cnx;
+    uint64_t stream_id;
+    uint64_t start_time;
+    uint64_t completion_time;
+    size_t target;
+    size_t sent;
+    size_t received;
+} ledbat_test_flow_t;
+
+typedef struct st_ledbat_test_ctx_t {
+    ledbat_test_flow_t flow[2];
+} ledbat_test_ctx_t;
+
+static int ledbat_test_client_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
 {
     int ret = 0;
-    uint64_t simulated_time = 0;
-    uint64_t latency = 300000ull; /* assume that each direction is 300 ms, e.g. satellite link */
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    ledbat_test_flow_t* flow = (ledbat_test_flow_t*)callback_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(v_stream_ctx);
+#endif
 
-    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time,
-        0, NULL, NULL);
+    if (fin_or_event == picoquic_callback_prepare_to_send && stream_id == flow->stream_id) {
+        size_t available = flow->target - flow->sent;
+        int is_fin = 1;
+        uint8_t* buffer;
 
-    if (ret == 0) {
-        /* set the delay estimate, then launch the test */
-        test_ctx->c_to_s_link->microsec_latency = latency;
-        test_ctx->s_to_c_link->microsec_latency = latency;
+        if (available > length) {
+            available = length;
+            is_fin = 0;
+        }
+        buffer = picoquic_provide_stream_data_buffer(bytes, available, is_fin, !is_fin);
+        if (buffer == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(buffer, 0x5A, available);
+            flow->sent += available;
+        }
+    }
 
-        picoquic_set_binlog(test_ctx->qserver, "long_rtt_test.bin");
+    return ret;
+}
 
-        /* The transmission delay cannot be less than 2.6 sec:
-         * 3 handshakes at 1 RTT each = 1.8 sec, plus
-         * 1MB over a 10Mbps link = 0.8 sec. We observe
-         * 3.31 seconds instead, i.e. 1.51 sec for the
-         * data transmission. This is due to the slow start
-         * phase of the congestion control, which we accelerated
-         * but could not completely fix. */
-        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-            test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 2*latency,
-            3600000);
+static int ledbat_test_server_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    ledbat_test_ctx_t* ledbat_ctx = (ledbat_test_ctx_t*)callback_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(bytes);
+    UNREFERENCED_PARAMETER(v_stream_ctx);
+#endif
+
+    if (fin_or_event == picoquic_callback_stream_data || fin_or_event == picoquic_callback_stream_fin) {
+        for (int i = 0; i < 2; i++) {
+            if (ledbat_ctx->flow[i].stream_id == stream_id) {
+                ledbat_ctx->flow[i].received += length;
+                if (fin_or_event == picoquic_callback_stream_fin) {
+                    ledbat_ctx->flow[i].completion_time = picoquic_get_quic_time(cnx->quic);
+                }
+                break;
+            }
+        }
     }
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+    return 0;
+}
+
+static int ledbat_test_start_flow(picoquic_test_tls_api_ctx_t* test_ctx, ledbat_test_flow_t* flow,
+    picoquic_congestion_algorithm_t* ccalgo, int enable_time_stamp, uint64_t simulated_time)
+{
+    int ret = 0;
+
+    flow->cnx = picoquic_create_cnx(test_ctx->qclient,
+        picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*) & test_ctx->server_addr, simulated_time,
+        PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+    if (flow->cnx == NULL) {
+        ret = -1;
+    }
+    else {
+        flow->cnx->local_parameters.enable_time_stamp = enable_time_stamp;
+        picoquic_set_congestion_algorithm(flow->cnx, ccalgo);
+        picoquic_set_callback(flow->cnx, ledbat_test_client_callback, flow);
+        flow->start_time = simulated_time;
+        ret = picoquic_start_client_cnx(flow->cnx);
+        if (ret == 0) {
+            ret = picoquic_mark_active_stream(flow->cnx, flow->stream_id, 1, NULL);
+        }
     }
 
     return ret;
 }
 
-/*
- * Test the insertion of holes in the ACK sequence. We start a large
- * download, while setting the policy to insert a hole approximately
- * every 16 packets. We verify that the transfer completes. Then,
- * we repeat that test but inject optimistic acks, which should
- * break the connection.
- */
-int optimistic_ack_test_one(int shall_spoof_ack)
+static int ledbat_test_one(picoquic_congestion_algorithm_t* foreground_alg, int enable_time_stamp)
 {
-    int ret = 0;
     uint64_t simulated_time = 0;
-    int nb_holes = 0;
+    uint64_t latency = 20000;
+    uint64_t mbps = 10;
+    uint64_t foreground_start = 2000000;
+    uint64_t max_completion_time = 30000000;
+    size_t background_received_at_start = 0;
+    size_t background_received_at_end = 0;
+    uint64_t client_time = 0;
+    uint64_t server_time = UINT64_MAX;
+    picoquic_tp_t server_parameters;
+    ledbat_test_ctx_t ledbat_ctx;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret;
 
-    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time,
-        0, NULL, NULL);
-
-    if (ret == 0) {
-        char binlog_file_name[256];
-        size_t binlog_file_name_len;
-
-        /* set the optimistic ack policy*/
-        picoquic_set_optimistic_ack_policy(test_ctx->qserver, 29);
-        /* add a log request for debugging */
-        (void)picoquic_sprintf(binlog_file_name, sizeof(binlog_file_name), &binlog_file_name_len,
-            "optimistic_ack%s.bin", (shall_spoof_ack) ? "_spoof" : "");
-        picoquic_set_binlog(test_ctx->qserver, binlog_file_name);
+    memset(&ledbat_ctx, 0, sizeof(ledbat_test_ctx_t));
+    ledbat_ctx.flow[0].stream_id = 0;
+    ledbat_ctx.flow[0].target = 10000000;
+    ledbat_ctx.flow[1].stream_id = 4;
+    ledbat_ctx.flow[1].target = 10000000;
 
-        /* Reset the uniform random test */
-        picoquic_public_random_seed_64(RANDOM_PUBLIC_TEST_SEED, 1);
+    memset(&server_parameters, 0, sizeof(picoquic_tp_t));
+    picoquic_init_transport_parameters(&server_parameters, 0);
+    server_parameters.enable_time_stamp = enable_time_stamp;
 
-        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0,
-            0, 0);
+    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, &server_parameters);
 
-        if (ret != 0)
-        {
-            DBG_PRINTF("Connect scenario returns %d\n", ret);
-        }
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
     }
 
-    /* Prepare to send data */
     if (ret == 0) {
-        test_ctx->stream0_target = 0;
-        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+        /* The connection created by default is not used in this test */
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = NULL;
+        picoquic_set_default_callback(test_ctx->qserver, ledbat_test_server_callback, &ledbat_ctx);
 
-        if (ret != 0)
-        {
-            DBG_PRINTF("Init send receive scenario returns %d\n", ret);
-        }
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->c_to_s_link->picosec_per_byte = (1000000ull * 8) / mbps;
+        test_ctx->c_to_s_link->queue_delay_max = 200000;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->picosec_per_byte = (1000000ull * 8) / mbps;
+
+        ret = ledbat_test_start_flow(test_ctx, &ledbat_ctx.flow[0], picoquic_ledbat_algorithm, enable_time_stamp, simulated_time);
     }
 
-    /* Perform a data sending loop */
-    if (ret == 0) {
-        int nb_trials = 0;
-        int nb_inactive = 0;
-        uint64_t hole_number = 0;
+    /* Simulate both connections sharing the same links */
+    while (ret == 0 && (ledbat_ctx.flow[0].completion_time == 0 || ledbat_ctx.flow[1].completion_time == 0)) {
+        uint64_t next_time = UINT64_MAX;
+        int next_action = 0;
 
-        test_ctx->c_to_s_link->loss_mask = NULL;
-        test_ctx->s_to_c_link->loss_mask = NULL;
-
-        while (ret == 0 && nb_trials < 64000 && nb_inactive < 1024 && TEST_CLIENT_READY && TEST_SERVER_READY) {
-            int was_active = 0;
+        if (ledbat_ctx.flow[1].cnx == NULL && foreground_start < next_time) {
+            next_time = foreground_start;
+            next_action = 1;
+        }
+        if (client_time < next_time) {
+            next_time = client_time;
+            next_action = 2;
+        }
+        if (server_time < next_time) {
+            next_time = server_time;
+            next_action = 3;
+        }
+        if (picoquictest_sim_link_next_arrival(test_ctx->c_to_s_link, next_time) < next_time) {
+            next_time = picoquictest_sim_link_next_arrival(test_ctx->c_to_s_link, next_time);
+            next_action = 4;
+        }
+        if (picoquictest_sim_link_next_arrival(test_ctx->s_to_c_link, next_time) < next_time) {
+            next_time = picoquictest_sim_link_next_arrival(test_ctx->s_to_c_link, next_time);
+            next_action = 5;
+        }
 
-            nb_trials++;
+        if (next_time > max_completion_time) {
+            DBG_PRINTF("Simulation does not complete before %" PRIu64, max_completion_time);
+            ret = -1;
+            break;
+        }
+        if (next_time > simulated_time) {
+            simulated_time = next_time;
+        }
 
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+        if (next_action == 1) {
+            background_received_at_start = ledbat_ctx.flow[0].received;
+            ret = ledbat_test_start_flow(test_ctx, &ledbat_ctx.flow[1], foreground_alg, 0, simulated_time);
+            client_time = simulated_time;
+        }
+        else if (next_action == 2 || next_action == 3) {
+            picoquic_quic_t* qready = (next_action == 2) ? test_ctx->qclient : test_ctx->qserver;
+            picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
+            int if_index = 0;
 
-            if (ret < 0) {
-                DBG_PRINTF("Sim round number %d returns %d\n", nb_trials, ret);
-                break;
-            }
-            else if (test_ctx->cnx_server->nb_retransmission_total > 0) {
-                DBG_PRINTF("Unexpected retransmission at T=%d", (int)simulated_time);
+            if (packet == NULL) {
                 ret = -1;
-                break;
-            }
-
-            if (was_active) {
-                nb_inactive = 0;
             }
             else {
-                nb_inactive++;
-            }
-
-            if (test_ctx->test_finished) {
-                if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
-                    break;
+                ret = picoquic_prepare_next_packet(qready, simulated_time, packet->bytes, PICOQUIC_MAX_PACKET_SIZE,
+                    &packet->length, &packet->addr_to, &packet->addr_from, &if_index);
+                if (ret != 0 || packet->length == 0) {
+                    free(packet);
                 }
-            }
-
-            /* find whether there was a new hole inserted */
-            if (test_ctx->cnx_server != NULL) {
-                picoquic_packet_t * packet = test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].retransmit_oldest;
-
-                while (packet != NULL && packet->sequence_number > hole_number) {
-                    if (packet->is_ack_trap) {
-                        hole_number = packet->sequence_number;
-                        if (shall_spoof_ack) {
-                            ret = picoquic_record_pn_received(test_ctx->cnx_client, picoquic_packet_context_application,
-                                hole_number, simulated_time);
-                            if (ret != 0) {
-                                DBG_PRINTF("Record pn hole %d number returns %d\n", (int)hole_number, ret);
-                                break;
-                            }
-                        }
-                        nb_holes++;
-                        break;
+                else if (next_action == 2) {
+                    if (packet->addr_from.ss_family == 0) {
+                        picoquic_store_addr(&packet->addr_from, (struct sockaddr*) & test_ctx->client_addr);
                     }
-                    packet = packet->previous_packet;
+                    picoquictest_sim_link_submit(test_ctx->c_to_s_link, packet, simulated_time);
+                }
+                else {
+                    if (packet->addr_from.ss_family == 0) {
+                        picoquic_store_addr(&packet->addr_from, (struct sockaddr*) & test_ctx->server_addr);
+                    }
+                    picoquictest_sim_link_submit(test_ctx->s_to_c_link, packet, simulated_time);
                 }
             }
         }
+        else if (next_action == 4 || next_action == 5) {
+            picoquictest_sim_link_t* link = (next_action == 4) ? test_ctx->c_to_s_link : test_ctx->s_to_c_link;
+            picoquic_quic_t* qdest = (next_action == 4) ? test_ctx->qserver : test_ctx->qclient;
+            picoquictest_sim_packet_t* packet = picoquictest_sim_link_dequeue(link, simulated_time);
 
-        if (!test_ctx->test_finished) {
-            DBG_PRINTF("Data loop exit after %d rounds, %d inactive\n", nb_trials, nb_inactive);
+            if (packet != NULL) {
+                ret = picoquic_incoming_packet(qdest, packet->bytes, (uint32_t)packet->length,
+                    (struct sockaddr*) & packet->addr_from, (struct sockaddr*) & packet->addr_to, 0, 0, simulated_time);
+                free(packet);
+            }
         }
-
-        if (ret != 0)
-        {
-            DBG_PRINTF("Data sending loop returns %d\n", ret);
+        else {
+            DBG_PRINTF("%s", "Simulation stalled");
+            ret = -1;
         }
-        else if (test_ctx->cnx_server != NULL) {
-            DBG_PRINTF("Complete after %d packets sent, %d r. by client, %d retransmits, %d spurious.\n",
-                (int)(test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence - 1),
-                (int)test_ctx->cnx_client->pkt_ctx[picoquic_packet_context_application].first_sack_item.end_of_sack_range,
-                test_ctx->cnx_server->nb_retransmission_total,
-                test_ctx->cnx_server->nb_spurious);
+
+        client_time = picoquic_get_next_wake_time(test_ctx->qclient, simulated_time);
+        server_time = picoquic_get_next_wake_time(test_ctx->qserver, simulated_time);
+        if (ledbat_ctx.flow[1].completion_time != 0 && background_received_at_end == 0) {
+            background_received_at_end = ledbat_ctx.flow[0].received;
         }
     }
 
-    if (ret == 0 && nb_holes == 0) {
-        DBG_PRINTF("%s", "No holes inserted\n");
-        ret = -1;
-    }
+    if (ret == 0) {
+        uint64_t background_bytes = background_received_at_end - background_received_at_start;
+        uint64_t foreground_bytes = ledbat_ctx.flow[1].received;
 
-    if (shall_spoof_ack) {
-        if (ret == 0 && test_ctx->test_finished) {
-            DBG_PRINTF("Despite %d holes and spoofs, the transfer completed\n", nb_holes);
+        DBG_PRINTF("LEDBAT vs %s, ts=%d: background %" PRIu64 " bytes while foreground sends %" PRIu64 " bytes in %" PRIu64 "us, background done at %" PRIu64,
+            foreground_alg->congestion_algorithm_id, enable_time_stamp, background_bytes, foreground_bytes,
+            ledbat_ctx.flow[1].completion_time - ledbat_ctx.flow[1].start_time, ledbat_ctx.flow[0].completion_time);
+
+        if (ledbat_ctx.flow[0].received != ledbat_ctx.flow[0].target || foreground_bytes != ledbat_ctx.flow[1].target) {
+            DBG_PRINTF("%s", "Flows did not deliver all their data");
             ret = -1;
         }
-        else {
-            ret = 0;
-        }
-    }
-    else {
-        if (ret == 0) {
-            ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 0);
-            if (ret != 0) {
-                DBG_PRINTF("Scenario verification returns %d", ret);
-            }
+        else if (4 * background_bytes > foreground_bytes) {
+            DBG_PRINTF("%s", "Background flow does not yield to the foreground flow");
+            ret = -1;
         }
     }
 
@@ -7214,203 +7619,339 @@ int optimistic_ack_test_one(int shall_spoof_ack)
     return ret;
 }
 
-int optimistic_ack_test()
+int ledbat_test()
 {
-    int ret = optimistic_ack_test_one(1);
+    int ret = ledbat_test_one(picoquic_cubic_algorithm, 1);
+
+    if (ret == 0) {
+        ret = ledbat_test_one(picoquic_newreno_algorithm, 0);
+    }
 
     return ret;
 }
 
-int optimistic_hole_test()
+/* ECN tests. The server sends 1MB to the client over a 20 Mbps path, with the
+ * specified ECN codepoint and congestion control algorithm. The sim link acts
+ * as a step AQM: ECT(1) packets are marked CE when the queue delay exceeds the
+ * L4S threshold, ECT(0) packets when it exceeds the classic threshold. If
+ * "bleach" is set, the link clears the ECN bits.
+ */
+static int ecn_test_one(picoquic_congestion_algorithm_t* ccalgo, uint8_t ecn_codepoint,
+    uint64_t l4s_threshold, uint64_t ecn_threshold, int bleach, uint64_t max_completion_time,
+    picoquic_ecn_state_t* ecn_state, uint64_t* completion_time, uint64_t* nb_ce_marked, uint64_t* nb_dropped)
 {
-    int ret = optimistic_ack_test_one(0);
+    uint64_t simulated_time = 0;
+    uint64_t latency = 10000;
+    uint64_t mbps = 20;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
+        picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
+        picoquic_set_default_ecn_codepoint(test_ctx->qserver, ecn_codepoint);
+        picoquic_set_ecn_codepoint(test_ctx->cnx_client, ecn_codepoint);
+
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->c_to_s_link->picosec_per_byte = (1000000ull * 8) / mbps;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->picosec_per_byte = (1000000ull * 8) / mbps;
+        test_ctx->s_to_c_link->queue_delay_max = 4 * latency;
+        test_ctx->s_to_c_link->l4s_threshold = l4s_threshold;
+        test_ctx->s_to_c_link->ecn_threshold = ecn_threshold;
+        test_ctx->s_to_c_link->ecn_bleach = bleach;
+
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time, test_scenario_very_long, sizeof(test_scenario_very_long),
+            0, 0, 0, 2 * latency, max_completion_time);
+
+        *completion_time = simulated_time;
+        *nb_ce_marked = test_ctx->s_to_c_link->packets_ce_marked;
+        *nb_dropped = test_ctx->s_to_c_link->packets_dropped;
+        *ecn_state = (test_ctx->cnx_server == NULL) ? picoquic_ecn_state_disabled : picoquic_get_ecn_state(test_ctx->cnx_server);
+
+        DBG_PRINTF("%s, ECN %d: completed at %" PRIu64 ", state %d, %" PRIu64 " CE, %" PRIu64 " dropped",
+            ccalgo->congestion_algorithm_id, ecn_codepoint, simulated_time, *ecn_state, *nb_ce_marked, *nb_dropped);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
 
     return ret;
 }
 
-/*
- * test that local and remote addresses are properly documented during the
- * call setup process.
+/* Check ECN validation: marks are validated on a normal path, and disabled
+ * if the path bleaches them.
  */
-
-typedef struct st_tls_api_address_are_documented_t {
-    /* addresses returned by almost ready callback */
-    int nb_almost_ready;
-    struct sockaddr_storage local_addr_almost_ready;
-    struct sockaddr_storage remote_addr_almost_ready;
-    /* addresses returned by ready callback */
-    int nb_ready;
-    struct sockaddr_storage local_addr_ready;
-    struct sockaddr_storage remote_addr_ready;
-    /* Pointer to the underlying callback */
-    picoquic_stream_data_cb_fn callback_fn;
-    void * callback_ctx;
-} tls_api_address_are_documented_t;
-
-static int test_local_address_callback(picoquic_cnx_t* cnx,
-    uint64_t stream_id, uint8_t* bytes, size_t length,
-    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+int ecn_validation_test()
 {
-    int ret = 0;
-    struct sockaddr * local_addr;
-    struct sockaddr * remote_addr;
+    picoquic_ecn_state_t ecn_state;
+    uint64_t completion_time;
+    uint64_t nb_ce_marked;
+    uint64_t nb_dropped;
+    int ret = ecn_test_one(picoquic_newreno_algorithm, PICOQUIC_ECN_ECT_0, 0, 0, 0, 1000000,
+        &ecn_state, &completion_time, &nb_ce_marked, &nb_dropped);
 
-    tls_api_address_are_documented_t* cb_ctx = (tls_api_address_are_documented_t*)callback_ctx;
+    if (ret == 0 && ecn_state != picoquic_ecn_state_capable) {
+        DBG_PRINTF("ECN state is %d instead of capable", ecn_state);
+        ret = -1;
+    }
 
-    if (fin_or_event == picoquic_callback_almost_ready) {
-        picoquic_get_peer_addr(cnx, &remote_addr);
-        picoquic_get_local_addr(cnx, &local_addr);
-        cb_ctx->nb_almost_ready++;
-        if (cb_ctx->nb_almost_ready == 1) {
-            if (local_addr != NULL && local_addr->sa_family != 0) {
-                picoquic_store_addr(&cb_ctx->local_addr_almost_ready, local_addr);
-            }
-            if (remote_addr != NULL && remote_addr->sa_family != 0) {
-                picoquic_store_addr(&cb_ctx->remote_addr_almost_ready, remote_addr);
-            }
+    if (ret == 0) {
+        ret = ecn_test_one(picoquic_newreno_algorithm, PICOQUIC_ECN_ECT_0, 0, 0, 1, 1000000,
+            &ecn_state, &completion_time, &nb_ce_marked, &nb_dropped);
+        if (ret == 0 && ecn_state != picoquic_ecn_state_failed) {
+            DBG_PRINTF("ECN state is %d instead of failed after bleaching", ecn_state);
+            ret = -1;
         }
     }
-    else if (fin_or_event == picoquic_callback_ready) {
-        picoquic_get_peer_addr(cnx, &remote_addr);
-        picoquic_get_local_addr(cnx, &local_addr);
-        cb_ctx->nb_ready++;
-        if (cb_ctx->nb_ready == 1) {
-            if (local_addr != NULL && local_addr->sa_family != 0) {
-                picoquic_store_addr(&cb_ctx->local_addr_ready, local_addr);
-            }
-            if (remote_addr != NULL && remote_addr->sa_family != 0) {
-                picoquic_store_addr(&cb_ctx->remote_addr_ready, remote_addr);
-            }
-        }
-    };
-
-    if (cb_ctx->callback_fn != NULL) {
-        picoquic_stream_data_cb_fn new_fn;
-        void * new_ctx;
 
-        ret = (cb_ctx->callback_fn)(cnx, stream_id, bytes, length, fin_or_event, cb_ctx->callback_ctx, NULL);
+    return ret;
+}
 
-        /* Check that the callbacks were not reset during the last call */
-        new_fn = picoquic_get_callback_function(cnx);
-        new_ctx = picoquic_get_callback_context(cnx);
+/* L4S test. With a shallow marking threshold, Prague scales its response to
+ * the fraction of marks and keeps the link busy without losses, while New Reno,
+ * which treats each mark like a loss, takes longer to complete the transfer.
+ */
+int l4s_prague_test()
+{
+    picoquic_ecn_state_t ecn_state;
+    uint64_t prague_time;
+    uint64_t reno_time;
+    uint64_t nb_ce_marked;
+    uint64_t nb_dropped;
+    int ret = ecn_test_one(picoquic_prague_algorithm, PICOQUIC_ECN_ECT_1, 1000, 0, 0, 1000000,
+        &ecn_state, &prague_time, &nb_ce_marked, &nb_dropped);
+
+    if (ret == 0 && (ecn_state != picoquic_ecn_state_capable || nb_ce_marked == 0)) {
+        DBG_PRINTF("Prague: ECN state %d, %" PRIu64 " packets marked", ecn_state, nb_ce_marked);
+        ret = -1;
+    }
+    else if (ret == 0 && nb_dropped != 0) {
+        DBG_PRINTF("Prague: %" PRIu64 " packets dropped", nb_dropped);
+        ret = -1;
+    }
 
-        if (new_fn != test_local_address_callback || new_ctx != callback_ctx) {
-            cb_ctx->callback_fn = new_fn;
-            cb_ctx->callback_ctx = new_ctx;
-            picoquic_set_callback(cnx, test_local_address_callback, callback_ctx);
+    if (ret == 0) {
+        ret = ecn_test_one(picoquic_newreno_algorithm, PICOQUIC_ECN_ECT_1, 1000, 0, 0, 2000000,
+            &ecn_state, &reno_time, &nb_ce_marked, &nb_dropped);
+        if (ret == 0 && reno_time <= prague_time) {
+            DBG_PRINTF("Prague completes at %" PRIu64 ", New Reno at %" PRIu64, prague_time, reno_time);
+            ret = -1;
         }
     }
 
     return ret;
 }
 
-int document_addresses_check(tls_api_address_are_documented_t * test_cb_ctx,
-    struct sockaddr * local_addr_ref, struct sockaddr * remote_addr_ref)
+/* Multipath tests. The client is connected to the server through two disjoint
+ * paths, each with its own pair of links. Once the connection is established,
+ * the client probes the second path from a different address. If multipath is
+ * enabled, the server sends the responses over both paths. If a weight is set,
+ * it applies to the first path of the server, the second has weight 1.
+ */
+static int multipath_test_one(picoquic_path_scheduler_t const* scheduler, int enable_multipath,
+    uint64_t latency_second, uint32_t weight_first, test_api_stream_desc_t* scenario, size_t sizeof_scenario,
+    uint64_t* completion_time,
+    uint64_t* packets_on_first_path, uint64_t* packets_on_second_path)
 {
-    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint64_t latency = 10000;
+    uint64_t mbps = 10;
+    uint64_t max_completion_time = 4000000;
+    uint64_t client_time = 0;
+    uint64_t server_time = 0;
+    struct sockaddr_in client_addr_second;
+    picoquictest_sim_link_t* c_to_s_second = NULL;
+    picoquictest_sim_link_t* s_to_c_second = NULL;
+    picoquic_tp_t client_parameters;
+    picoquic_tp_t server_parameters;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int weight_set = (weight_first == 0);
+    int ret;
 
-    if (ret == 0 && test_cb_ctx->nb_almost_ready != 1) {
-        DBG_PRINTF("Expected 1 almost ready callback, got %d\n", test_cb_ctx->nb_ready);
+    memset(&client_parameters, 0, sizeof(picoquic_tp_t));
+    picoquic_init_transport_parameters(&client_parameters, 1);
+    client_parameters.enable_multipath = enable_multipath;
+    memset(&server_parameters, 0, sizeof(picoquic_tp_t));
+    picoquic_init_transport_parameters(&server_parameters, 0);
+    server_parameters.enable_multipath = enable_multipath;
+
+    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        &client_parameters, &server_parameters);
+
+    if (ret == 0 && test_ctx == NULL) {
         ret = -1;
     }
 
-    if (ret == 0 && test_cb_ctx->local_addr_almost_ready.ss_family == 0) {
-        DBG_PRINTF("%s", "Expected almost ready local address, got AF = 0\n");
-        ret = -1;
+    if (ret == 0) {
+        picoquic_set_default_path_scheduler(test_ctx->qserver, scheduler);
+        picoquic_set_path_scheduler(test_ctx->cnx_client, scheduler);
+
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->c_to_s_link->picosec_per_byte = (1000000ull * 8) / mbps;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->picosec_per_byte = (1000000ull * 8) / mbps;
+
+        c_to_s_second = picoquictest_sim_link_create(0.01, latency_second, NULL, 0, 0);
+        s_to_c_second = picoquictest_sim_link_create(0.01, latency_second, NULL, 0, 0);
+        if (c_to_s_second == NULL || s_to_c_second == NULL) {
+            ret = -1;
+        }
+        else {
+            c_to_s_second->picosec_per_byte = (1000000ull * 8) / mbps;
+            s_to_c_second->picosec_per_byte = (1000000ull * 8) / mbps;
+            memcpy(&client_addr_second, &test_ctx->client_addr, sizeof(struct sockaddr_in));
+            client_addr_second.sin_port += 17;
+            test_ctx->client_use_multiple_addresses = 1;
+        }
     }
 
-    if (ret == 0 && picoquic_compare_addr(local_addr_ref,
-        (struct sockaddr*)&test_cb_ctx->local_addr_almost_ready) != 0) {
-        DBG_PRINTF("%s", "Local address from almost ready callback does not match\n");
-        ret = -1;
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
+        /* The loss mask was local to the connection loop */
+        test_ctx->c_to_s_link->loss_mask = NULL;
+        test_ctx->s_to_c_link->loss_mask = NULL;
     }
 
-    if (ret == 0 && test_cb_ctx->remote_addr_almost_ready.ss_family == 0) {
-        DBG_PRINTF("%s", "Expected almost ready remote address, got AF = 0\n");
+    if (ret == 0 && picoquic_is_multipath_enabled(test_ctx->cnx_client) != enable_multipath) {
+        DBG_PRINTF("Multipath negotiation returns %d instead of %d", picoquic_is_multipath_enabled(test_ctx->cnx_client), enable_multipath);
         ret = -1;
     }
 
-    if (ret == 0 && picoquic_compare_addr(remote_addr_ref,
-        (struct sockaddr*)&test_cb_ctx->remote_addr_almost_ready) != 0) {
-        DBG_PRINTF("%s", "Local address from almost ready callback does not match\n");
-        ret = -1;
+    /* The probes cannot be decrypted before the server has received the client finished */
+    while (ret == 0 && test_ctx->cnx_server->cnx_state != picoquic_state_ready && simulated_time < max_completion_time) {
+        int was_active = 0;
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, max_completion_time, &was_active);
     }
 
-    if (ret == 0 && test_cb_ctx->nb_ready != 1) {
-        DBG_PRINTF("Expected 1 ready callback, got %d\n", test_cb_ctx->nb_ready);
-        ret = -1;
+    if (ret == 0 && enable_multipath) {
+        ret = picoquic_probe_new_path(test_ctx->cnx_client, (struct sockaddr*) & test_ctx->server_addr,
+            (struct sockaddr*) & client_addr_second, simulated_time);
     }
 
-    if (ret == 0 && test_cb_ctx->local_addr_ready.ss_family == 0) {
-        DBG_PRINTF("%s", "Expected ready local address, got AF = 0\n");
-        ret = -1;
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, scenario, sizeof_scenario);
     }
 
-    if (ret == 0 && picoquic_compare_addr(local_addr_ref,
-        (struct sockaddr*)&test_cb_ctx->local_addr_ready) != 0) {
-        DBG_PRINTF("%s", "Local address from ready callback does not match\n");
-        ret = -1;
-    }
+    /* Simulate the two paths, routing packets per client address */
+    while (ret == 0 && !test_ctx->test_finished) {
+        picoquictest_sim_link_t* links[4] = { test_ctx->c_to_s_link, c_to_s_second, test_ctx->s_to_c_link, s_to_c_second };
+        uint64_t next_time = UINT64_MAX;
+        int next_action = -1;
 
-    if (ret == 0 && test_cb_ctx->remote_addr_ready.ss_family == 0) {
-        DBG_PRINTF("%s", "Expected ready remote address, got AF = 0\n");
-        ret = -1;
-    }
+        client_time = test_ctx->cnx_client->next_wake_time;
+        server_time = (test_ctx->cnx_server == NULL) ? UINT64_MAX : test_ctx->cnx_server->next_wake_time;
 
-    if (ret == 0 && picoquic_compare_addr(remote_addr_ref,
-        (struct sockaddr*)&test_cb_ctx->remote_addr_ready) != 0) {
-        DBG_PRINTF("%s", "Local address from almost ready callback does not match\n");
-        ret = -1;
-    }
+        if (client_time < next_time) {
+            next_time = client_time;
+            next_action = 4;
+        }
+        if (server_time < next_time) {
+            next_time = server_time;
+            next_action = 5;
+        }
+        for (int i = 0; i < 4; i++) {
+            uint64_t arrival = picoquictest_sim_link_next_arrival(links[i], next_time);
+            if (arrival < next_time) {
+                next_time = arrival;
+                next_action = i;
+            }
+        }
 
-    return ret;
-}
+        if (next_time > max_completion_time) {
+            DBG_PRINTF("Simulation does not complete before %" PRIu64, max_completion_time);
+            ret = -1;
+            break;
+        }
+        if (next_time > simulated_time) {
+            simulated_time = next_time;
+        }
 
-int document_addresses_test()
-{
-    uint64_t simulated_time = 0; 
-    tls_api_address_are_documented_t client_address_callback_ctx, server_address_callback_ctx;
+        if (next_action == 4 || next_action == 5) {
+            picoquic_cnx_t* cnx = (next_action == 4) ? test_ctx->cnx_client : test_ctx->cnx_server;
+            picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
 
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+            if (packet == NULL) {
+                ret = -1;
+            }
+            else {
+                if (!weight_set && next_action == 5 && cnx->nb_paths > 1) {
+                    /* The server sends the response, weight its first path once the second exists */
+                    ret = picoquic_set_path_weight(cnx, (struct sockaddr*) & test_ctx->server_addr,
+                        (struct sockaddr*) & test_ctx->client_addr, weight_first);
+                    if (ret == 0) {
+                        ret = picoquic_set_path_weight(cnx, (struct sockaddr*) & test_ctx->server_addr,
+                            (struct sockaddr*) & client_addr_second, 1);
+                    }
+                    weight_set = 1;
+                }
+                if (ret == 0) {
+                    ret = picoquic_prepare_packet(cnx, simulated_time, packet->bytes, PICOQUIC_MAX_PACKET_SIZE,
+                        &packet->length, &packet->addr_to, &packet->addr_from);
+                }
+                if (ret != 0 || packet->length == 0) {
+                    free(packet);
+                }
+                else if (next_action == 4) {
+                    if (packet->addr_from.ss_family == 0) {
+                        picoquic_store_addr(&packet->addr_from, (struct sockaddr*) & test_ctx->client_addr);
+                    }
+                    picoquictest_sim_link_submit((picoquic_compare_addr((struct sockaddr*) & packet->addr_from,
+                        (struct sockaddr*) & client_addr_second) == 0) ? c_to_s_second : test_ctx->c_to_s_link,
+                        packet, simulated_time);
+                }
+                else {
+                    if (packet->addr_from.ss_family == 0) {
+                        picoquic_store_addr(&packet->addr_from, (struct sockaddr*) & test_ctx->server_addr);
+                    }
+                    picoquictest_sim_link_submit((picoquic_compare_addr((struct sockaddr*) & packet->addr_to,
+                        (struct sockaddr*) & client_addr_second) == 0) ? s_to_c_second : test_ctx->s_to_c_link,
+                        packet, simulated_time);
+                }
+            }
+        }
+        else if (next_action >= 0) {
+            picoquic_quic_t* qdest = (next_action < 2) ? test_ctx->qserver : test_ctx->qclient;
+            picoquictest_sim_packet_t* packet = picoquictest_sim_link_dequeue(links[next_action], simulated_time);
 
-    if (ret == 0 && test_ctx == NULL) {
-        ret = -1;
+            if (packet != NULL) {
+                ret = picoquic_incoming_packet(qdest, packet->bytes, (uint32_t)packet->length,
+                    (struct sockaddr*) & packet->addr_from, (struct sockaddr*) & packet->addr_to, 0, 0, simulated_time);
+                free(packet);
+            }
+        }
+        else {
+            DBG_PRINTF("%s", "Simulation stalled");
+            ret = -1;
+        }
     }
-    if (ret == 0) {
-        /* Set the call backs to intercept the almost ready and ready transitions */
-        memset(&client_address_callback_ctx, 0, sizeof(tls_api_address_are_documented_t));
-        client_address_callback_ctx.callback_fn = picoquic_get_callback_function(test_ctx->cnx_client);
-        client_address_callback_ctx.callback_ctx = picoquic_get_callback_context(test_ctx->cnx_client);
-        picoquic_set_callback(test_ctx->cnx_client, test_local_address_callback, &client_address_callback_ctx);
-
-        memset(&server_address_callback_ctx, 0, sizeof(tls_api_address_are_documented_t));
-        server_address_callback_ctx.callback_fn = picoquic_get_default_callback_function(test_ctx->qserver);
-        server_address_callback_ctx.callback_ctx = picoquic_get_default_callback_context(test_ctx->qserver);
-        picoquic_set_default_callback(test_ctx->qserver, test_local_address_callback, &server_address_callback_ctx);
 
-        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 20000, 3600000);
+    if (ret == 0) {
+        ret = tls_api_one_scenario_verify(test_ctx);
     }
 
-    /* Verify that the addresses and calls are what we expect */
     if (ret == 0) {
-        ret = document_addresses_check(&client_address_callback_ctx,
-            (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr);
-        if (ret != 0) {
-            DBG_PRINTF("%s", "Client addresses were not properly documented\n");
-        }
+        *completion_time = simulated_time;
+        *packets_on_first_path = test_ctx->s_to_c_link->packets_sent;
+        *packets_on_second_path = (s_to_c_second == NULL) ? 0 : s_to_c_second->packets_sent;
+        DBG_PRINTF("Multipath %d, %s, weight %u: completed at %" PRIu64 ", %" PRIu64 " packets on first path, %" PRIu64 " on second",
+            enable_multipath, scheduler->path_scheduler_id, weight_first, simulated_time, *packets_on_first_path,
+            *packets_on_second_path);
     }
 
-    if (ret == 0) {
-        ret = document_addresses_check(&server_address_callback_ctx,
-            (struct sockaddr*)&test_ctx->server_addr, (struct sockaddr*)&test_ctx->client_addr);
-        if (ret != 0) {
-            DBG_PRINTF("%s", "Server addresses were not properly documented\n");
-        }
+    if (c_to_s_second != NULL) {
+        picoquictest_sim_link_delete(c_to_s_second);
     }
 
-    /* Free the resource */
+    if (s_to_c_second != NULL) {
+        picoquictest_sim_link_delete(s_to_c_second);
+    }
 
     if (test_ctx != NULL) {
         tls_api_delete_ctx(test_ctx);
@@ -7420,156 +7961,186 @@ int document_addresses_test()
     return ret;
 }
 
-/*
- * Test whether a connection succeed when SNI is not specified.
- */
-
-int null_sni_test()
+static int multipath_test_scheduler(picoquic_path_scheduler_t const* scheduler, uint64_t latency_second)
 {
-    return tls_api_test_with_loss(NULL, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, PICOQUIC_TEST_ALPN);
-}
-
-/*
- * Test whether server redirection is applied properly
- */
+    uint64_t single_path_time = 0;
+    uint64_t multipath_time = 0;
+    uint64_t packets_on_first_path = 0;
+    uint64_t packets_on_second_path = 0;
+    int ret = multipath_test_one(scheduler, 0, latency_second, 0,
+        test_scenario_very_long, sizeof(test_scenario_very_long), &single_path_time, &packets_on_first_path, &packets_on_second_path);
 
-int preferred_address_test()
-{
-    int ret;
-    uint64_t simulated_time = 0;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    struct sockaddr_in server_preferred;
-    picoquic_tp_t server_parameters;
+    if (ret == 0) {
+        ret = multipath_test_one(scheduler, 1, latency_second, 0,
+            test_scenario_very_long, sizeof(test_scenario_very_long), &multipath_time, &packets_on_first_path, &packets_on_second_path);
+    }
 
+    if (ret == 0 && packets_on_second_path < 100) {
+        DBG_PRINTF("Only %" PRIu64 " packets sent on the second path", packets_on_second_path);
+        ret = -1;
+    }
 
-    server_preferred.sin_family = AF_INET;
-#ifdef _WINDOWS
-    server_preferred.sin_addr.S_un.S_addr = 0x0A00000B;
-#else
-    server_preferred.sin_addr.s_addr = 0x0A00000B;
-#endif
-    server_preferred.sin_port = 5678;
+    if (ret == 0 && 10 * multipath_time > 9 * single_path_time) {
+        DBG_PRINTF("Multipath completes at %" PRIu64 ", single path at %" PRIu64, multipath_time, single_path_time);
+        ret = -1;
+    }
 
-    memset(&server_parameters, 0, sizeof(picoquic_tp_t));
+    return ret;
+}
 
-    picoquic_init_transport_parameters(&server_parameters, 1);
+/* With weights 3 and 1, the weighted round robin scheduler shall send three
+ * times more bytes on the first path when both paths can send. This is first
+ * verified by calling the scheduler directly. In a simulated connection, the
+ * scheduler only chooses when both paths can send, so the responses are
+ * chained and small enough that neither path is limited by its congestion
+ * window. The handshake, the acknowledgements and the packets sent when the
+ * pacer blocks one of the paths are also counted, hence the tolerance.
+ */
+static test_api_stream_desc_t test_scenario_multipath_chain[] = {
+    { 4, 0, 32, 1000 },
+    { 8, 4, 32, 1000 },
+    { 12, 8, 32, 1000 },
+    { 16, 12, 32, 1000 },
+    { 20, 16, 32, 1000 },
+    { 24, 20, 32, 1000 },
+    { 28, 24, 32, 1000 },
+    { 32, 28, 32, 1000 },
+    { 36, 32, 32, 1000 },
+    { 40, 36, 32, 1000 },
+    { 44, 40, 32, 1000 },
+    { 48, 44, 32, 1000 },
+    { 52, 48, 32, 1000 },
+    { 56, 52, 32, 1000 },
+    { 60, 56, 32, 1000 },
+    { 64, 60, 32, 1000 }
+};
 
-    /* Create an alternate IP address, and use it as preferred address */
-    server_parameters.prefered_address.is_defined = 1;
-    memcpy(server_parameters.prefered_address.ipv4Address, &server_preferred.sin_addr, 4);
-    server_parameters.prefered_address.ipv4Port = ntohs(server_preferred.sin_port);
+static int multipath_test_wrr_weights()
+{
+    int ret = 0;
+    picoquic_path_t* paths = (picoquic_path_t*)malloc(2 * sizeof(picoquic_path_t));
+    picoquic_path_t* candidates[2];
+    int nb_sent[2] = { 0, 0 };
 
-    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        NULL, &server_parameters);
+    if (paths == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(paths, 0, 2 * sizeof(picoquic_path_t));
+        paths[0].scheduler_weight = 3;
+        paths[1].scheduler_weight = 1;
+        candidates[0] = &paths[0];
+        candidates[1] = &paths[1];
 
+        for (int i = 0; ret == 0 && i < 400; i++) {
+            int selected = picoquic_wrr_path_scheduler->select_path(NULL, candidates, 2, 0);
 
-    if (ret == 0) {
-        /* Run a basic test scenario */
+            if (selected < 0 || selected > 1) {
+                ret = -1;
+            }
+            else if ((i % 5) != 4) {
+                /* One selection in five does not send a packet, and is not charged */
+                nb_sent[selected]++;
+                picoquic_wrr_path_scheduler->packet_sent(NULL, candidates[selected], 1440);
+            }
+        }
 
-        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-            test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 0, 1500000);
+        free(paths);
     }
 
-    /* Verify that the client and server have both migrated to using the preferred address */
-    if (ret == 0 && picoquic_compare_addr((struct sockaddr*)&server_preferred,
-        (struct sockaddr*)&test_ctx->cnx_client->path[0]->peer_addr) != 0) {
-        DBG_PRINTF("%s", "Server address at client not updated\n");
+    if (ret == 0 && (nb_sent[0] < 3 * nb_sent[1] - 3 || nb_sent[0] > 3 * nb_sent[1] + 3)) {
+        DBG_PRINTF("Weighted round robin sends %d/%d, expected 3:1", nb_sent[0], nb_sent[1]);
         ret = -1;
     }
 
-    if (ret == 0 && test_ctx->cnx_server != NULL &&
-        picoquic_compare_addr((struct sockaddr*)&server_preferred,
-        (struct sockaddr*)&test_ctx->cnx_server->path[0]->local_addr) != 0) {
-        DBG_PRINTF("%s", "Server address not promoted\n");
-        ret = -1;
-    }
+    return ret;
+}
 
-    /* And then free the resource
-     */
+static int multipath_test_weighted()
+{
+    uint64_t completion_time = 0;
+    uint64_t packets_on_first_path = 0;
+    uint64_t packets_on_second_path = 0;
+    int ret = multipath_test_wrr_weights();
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+    if (ret == 0) {
+        ret = multipath_test_one(picoquic_wrr_path_scheduler, 1, 10000, 3,
+            test_scenario_multipath_chain, sizeof(test_scenario_multipath_chain), &completion_time,
+            &packets_on_first_path, &packets_on_second_path);
+    }
+
+    if (ret == 0 && (packets_on_second_path == 0 || 2 * packets_on_first_path < 3 * packets_on_second_path)) {
+        DBG_PRINTF("Packets per path %" PRIu64 "/%" PRIu64 ", expected more on the first path", packets_on_first_path, packets_on_second_path);
+        ret = -1;
     }
 
     return ret;
 }
 
-
-/* Test that the random public generation behaves in expected ways */
-int random_public_tester_test()
+int multipath_test()
 {
-#define RANDOM_PUBLIC_TEST_CONST 11
-#define RANDOM_PUBLIC_TEST_ROUNDS 100
-#define RANDOM_PUBLIC_CHI_SQUARE 18.31 /* Fail if significance of bias < P = 0.05 */
-    int ret = 0;
-    int r_count[RANDOM_PUBLIC_TEST_CONST];
-
-    picoquic_public_random_seed_64(RANDOM_PUBLIC_TEST_SEED, 1);
-
-    memset(r_count, 0, sizeof(r_count));
-
-    for (int i = 0; i < RANDOM_PUBLIC_TEST_CONST*RANDOM_PUBLIC_TEST_ROUNDS; i++) {
-        uint64_t x = picoquic_public_uniform_random(RANDOM_PUBLIC_TEST_CONST);
+    int ret = multipath_test_scheduler(picoquic_minrtt_path_scheduler, 15000);
 
-        if (x >= RANDOM_PUBLIC_TEST_CONST) {
-            DBG_PRINTF("Value %d >= %d\n", x, RANDOM_PUBLIC_TEST_CONST);
-            ret = -1;
-            break;
-        }
-        else {
-            r_count[x] += 1;
-        }
+    if (ret == 0) {
+        ret = multipath_test_scheduler(picoquic_wrr_path_scheduler, 10000);
     }
 
     if (ret == 0) {
-        double chi_squared = 0;
-
-        for (int i = 0; i < RANDOM_PUBLIC_TEST_CONST; i++) {
-            double delta = ((double)RANDOM_PUBLIC_TEST_ROUNDS - r_count[i]);
-            double d2 = delta * delta;
-            d2 /= ((double)RANDOM_PUBLIC_TEST_ROUNDS);
-            chi_squared += d2;
-        }
-
-        if (chi_squared > RANDOM_PUBLIC_CHI_SQUARE) {
-            DBG_PRINTF("Chi2 = %f, larger than %f\n", chi_squared, RANDOM_PUBLIC_CHI_SQUARE);
-            ret = -1;
-        }
+        ret = multipath_test_weighted();
     }
 
     return ret;
 }
 
-/*
- * Test whether connections can be established when the client hello is larger than a 
- * single packet. This is done by adding a "padding" transport parameter.
+/* Reordering test. The server sends 1MB over a 10 Mbps path whose jitter is
+ * large enough to reorder packets. Reordered packets shall not be repeated
+ * more than occasionally, while actual losses shall still be repaired
+ * without waiting for a timeout.
  */
-
-int large_client_hello_test()
+static int reorder_test_one(uint64_t jitter, uint64_t loss_pattern, uint64_t max_completion_time,
+    uint64_t* nb_retransmits, uint64_t* nb_spurious, uint64_t* nb_sent)
 {
     uint64_t simulated_time = 0;
+    uint64_t latency = 10000;
+    uint64_t mbps = 10;
+    uint64_t loss_mask = loss_pattern;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+    int ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL);
 
     if (ret == 0 && test_ctx == NULL) {
         ret = -1;
     }
 
-    /* Set the test large hello flag in the client connection
-     */
     if (ret == 0) {
-        test_ctx->cnx_client->test_large_chello = 1;
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->c_to_s_link->picosec_per_byte = (1000000ull * 8) / mbps;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->picosec_per_byte = (1000000ull * 8) / mbps;
+        test_ctx->s_to_c_link->jitter = jitter;
+        test_ctx->s_to_c_link->reorder = 1;
 
-        /* Run a basic test scenario
-         */
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
+    }
 
-        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 0, 250000);
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
     }
 
-    /* And then free the resource
-     */
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, max_completion_time);
+    }
+
+    if (ret == 0) {
+        *nb_retransmits = test_ctx->cnx_server->nb_retransmission_total;
+        *nb_spurious = test_ctx->cnx_server->nb_spurious;
+        *nb_sent = test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence;
+        DBG_PRINTF("Jitter %" PRIu64 ", losses %" PRIx64 ": completed at %" PRIu64 ", %" PRIu64 " sent, %" PRIu64 " retransmits, %" PRIu64 " spurious",
+            jitter, loss_pattern, simulated_time, *nb_sent, *nb_retransmits, *nb_spurious);
+    }
 
     if (test_ctx != NULL) {
         tls_api_delete_ctx(test_ctx);
@@ -7579,421 +8150,2474 @@ int large_client_hello_test()
     return ret;
 }
 
-/* DDOS Amplification Mitigation test
- *
- * In this test, the client sends a first packet (client hello) and then disappears.
- * This simulates an attempts to use the Quic server as an amplifier in a DDOS attack.
- * We want to verify that the server does not send out more than 3 times the amount
- * of data sent by the client.
- */
-
-int ddos_amplification_test()
+int reorder_test()
 {
-    uint64_t simulated_time = 0;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    uint32_t proposed_version = PICOQUIC_INTEROP_VERSION_LATEST;
-    int ret = tls_api_init_ctx(&test_ctx, proposed_version, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
-    picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
-    size_t data_sent_by_client = 0;
-    size_t data_sent_by_server = 0;
-    int nb_server_packets = 0;
-    int nb_loops = 0;
-    int nb_inactive = 0;
+    uint64_t nb_retransmits;
+    uint64_t nb_spurious;
+    uint64_t nb_sent;
+    int ret = reorder_test_one(3000, 0, 1500000, &nb_retransmits, &nb_spurious, &nb_sent);
 
-    if (ret != 0 || packet == NULL)
+    if (ret == 0 && 100 * nb_spurious > nb_sent) {
+        DBG_PRINTF("%" PRIu64 " spurious retransmissions for %" PRIu64 " packets", nb_spurious, nb_sent);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = reorder_test_one(3000, 0x0000000000000400ull, 2500000, &nb_retransmits, &nb_spurious, &nb_sent);
+        if (ret == 0 && nb_retransmits == 0) {
+            DBG_PRINTF("%s", "Losses were not repaired by retransmissions");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* This is similar to the long rtt test, but operating at a higher speed.
+ * We allow for loss simulation and jitter simulation to simulate wi-fi + satellite.
+ * Also, we want to check overhead targets, such as ratio of data bytes over control bytes.
+ *
+ * The satellite link that we define here corresponds to models suggested by 
+ * John Border of Hughes: 250 Mbps for the server to client link, 3 Mbps for the client
+ * to server link. We reverse the role, as our test sends data from the cleint to the
+ * server. John suggested tested with a 1GB download; we compromise here to 100MB,
+ * in order to execut the test in reasonable time. There should be two test
+ * variants: 0% loss, and 1 %loss.
+ */
+static int satellite_test_one(picoquic_congestion_algorithm_t* ccalgo, size_t data_size, uint64_t max_completion_time, 
+    uint64_t mbps_up, uint64_t mbps_down, uint64_t jitter, int has_loss)
+{
+    uint64_t simulated_time = 0;
+    uint64_t latency = 300000;
+    uint64_t picoseq_per_byte_250 = (1000000ull * 8) / mbps_up;
+    uint64_t picoseq_per_byte_3 = (1000000ull * 8) / mbps_down;
+    picoquic_tp_t client_parameters;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = 0;
+
+    memset(&client_parameters, 0, sizeof(picoquic_tp_t));
+    picoquic_init_transport_parameters(&client_parameters, 1);
+    client_parameters.enable_time_stamp = 1;
+
+    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, &client_parameters, NULL);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    /* Simulate satellite links: 250 mbps, 300ms delay in each direction */
+    /* Set the congestion algorithm to specified value. Also, request a packet trace */
+    if (ret == 0) {
+        char binlog_file_name[256];
+        size_t binlog_file_name_len = 0;
+        (void)picoquic_sprintf(binlog_file_name, sizeof(binlog_file_name), &binlog_file_name_len,
+            "satellite_%s_u%" PRIu64 "_d%" PRIu64 "_j%" PRIu64 "%s.bin", ccalgo->congestion_algorithm_id, 
+            mbps_up, mbps_down, jitter, (has_loss) ? "_loss" : "");
+
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
+        picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
+
+        test_ctx->c_to_s_link->jitter = jitter;
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->c_to_s_link->picosec_per_byte = picoseq_per_byte_250;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->picosec_per_byte = picoseq_per_byte_3; 
+        test_ctx->s_to_c_link->jitter = jitter;
+        test_ctx->stream0_flow_release = 1;
+
+        picoquic_cnx_set_pmtud_required(test_ctx->cnx_client, 1);
+
+        picoquic_set_binlog(test_ctx->qclient, binlog_file_name);
+        test_ctx->qclient->use_long_log = 1;
+
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+                NULL, 0, data_size, (has_loss) ? 0x10000000:0, 0, 2 * latency, max_completion_time);
+        }
+    }
+
+    /* Free the resource, which will close the log file.
+     */
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int satellite_basic_test()
+{
+    /* Should be less than 7 sec per draft etosat. */
+    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 5400000, 250, 3, 0, 0);
+}
+
+int satellite_loss_test()
+{
+    /* Should be less than 10 sec per draft etosat. */
+    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 8200000, 250, 3, 0, 1);
+}
+
+int satellite_jitter_test()
+{
+    /* Should be less than 7 sec per draft etosat. */
+    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 6200000, 250, 3, 3000, 0);
+}
+
+int satellite_medium_test()
+{
+    /* Should be less than 20 sec per draft etosat. */
+    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 18000000, 50, 10, 0, 0);
+}
+
+int satellite_small_test()
+{
+    /* Should be less than 85 sec per draft etosat. */
+    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 81000000, 10, 2, 0, 0);
+}
+
+int satellite_small_up_test()
+{
+    /* Should be less than 420 sec per draft etosat. */
+    return satellite_test_one(picoquic_bbr_algorithm, 100000000, 400000000, 2, 10, 0, 0);
+}
+
+/* Test that different CID length are properly supported */
+int cid_length_test_one(uint8_t length)
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    /* Set the CID length in the client context, then recreate the connection */
+    if (ret == 0) {
+        /* Delete the old connection */
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = NULL;
+        /* Change the default cnx_id length*/
+        test_ctx->qclient->local_cnxid_length = length;
+        /* re-create a client connection */
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, 0,
+            PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        }
+        else {
+            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+                test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 20000, 100000);
+
+            if (ret == 0 &&
+                test_ctx->cnx_client->path[0]->p_local_cnxid->cnx_id.id_len != length) {
+                ret = -1;
+            }
+
+            if (ret == 0 &&
+                test_ctx->cnx_server->path[0]->remote_cnxid.id_len != length) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int cid_length_test()
+{
+    int ret = 0;
+    const uint8_t tested_length[] = { 0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20};
+
+    for (size_t i = 0; i < sizeof(tested_length); i++) {
+        ret = cid_length_test_one(tested_length[i]);
+        if (ret != 0) {
+            DBG_PRINTF("Test fails for cid_length = %d\n", tested_length[i]);
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/* Test that the server can issue routable CID, that these CID
+ * decode to the expected server ID and slot, and that connection
+ * lookup stops finding them once the connection is deleted.
+ */
+int routable_cid_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    const uint8_t cid_key[PICOQUIC_ROUTABLE_CID_KEY_SIZE] = {
+        1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    const uint16_t server_id = 0x1234;
+    void* cid_decoder = picoquic_routable_cid_decoder_create(cid_key);
+    picoquic_connection_id_t saved_cid = picoquic_null_connection_id;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && (test_ctx == NULL || cid_decoder == NULL)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = picoquic_set_routable_cid(test_ctx->qserver, 1, server_id, cid_key, 16);
+        if (ret != 0) {
+            DBG_PRINTF("Cannot set routable CID, ret = 0x%x\n", ret);
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 20000, 100000);
+    }
+
+    if (ret == 0) {
+        picoquic_local_cnxid_t* l_cid = test_ctx->cnx_server->local_cnxid_first;
+        int nb_cid = 0;
+
+        while (ret == 0 && l_cid != NULL) {
+            uint16_t decoded_server_id = 0;
+            uint32_t slot = 0;
+            uint32_t generation = 0;
+
+            if (l_cid->cnx_id.id_len != PICOQUIC_ROUTABLE_CID_LENGTH) {
+                DBG_PRINTF("Unexpected CID length: %d\n", l_cid->cnx_id.id_len);
+                ret = -1;
+            }
+            else if (picoquic_routable_cid_decode(cid_decoder, 1, &l_cid->cnx_id, &decoded_server_id, &slot, &generation) != 0) {
+                DBG_PRINTF("%s", "Cannot decode routable CID\n");
+                ret = -1;
+            }
+            else if (decoded_server_id != server_id || slot != test_ctx->cnx_server->cid_slot) {
+                DBG_PRINTF("Decoded server ID 0x%x, slot %u, expected 0x%x, %u\n", decoded_server_id, slot,
+                    server_id, test_ctx->cnx_server->cid_slot);
+                ret = -1;
+            }
+            else if (picoquic_cnx_by_id(test_ctx->qserver, l_cid->cnx_id) != test_ctx->cnx_server) {
+                DBG_PRINTF("%s", "Cannot retrieve connection by routable CID\n");
+                ret = -1;
+            }
+            saved_cid = l_cid->cnx_id;
+            nb_cid++;
+            l_cid = l_cid->next;
+        }
+
+        if (ret == 0 && nb_cid < 2) {
+            DBG_PRINTF("Only %d CID created by the server\n", nb_cid);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Once the connection is deleted, its CID must not be routed to the next occupant of the slot */
+        picoquic_cnx_t* cnx_next = NULL;
+        picoquic_delete_cnx(test_ctx->cnx_server);
+        test_ctx->cnx_server = NULL;
+
+        cnx_next = picoquic_create_cnx(test_ctx->qserver, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->client_addr, simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1,
+            PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 0);
+
+        if (cnx_next == NULL) {
+            ret = -1;
+        }
+        else {
+            if (picoquic_cnx_by_id(test_ctx->qserver, saved_cid) != NULL) {
+                DBG_PRINTF("%s", "Stale routable CID still retrieves a connection\n");
+                ret = -1;
+            }
+            else if (picoquic_cnx_by_id(test_ctx->qserver, cnx_next->local_cnxid_first->cnx_id) != cnx_next) {
+                DBG_PRINTF("%s", "Cannot retrieve new connection by routable CID\n");
+                ret = -1;
+            }
+            picoquic_delete_cnx(cnx_next);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    picoquic_routable_cid_decoder_free(cid_decoder);
+
+    return ret;
+}
+
+/* Testing transmission behavior over large RTT links
+ */
+
+int long_rtt_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint64_t latency = 300000ull; /* assume that each direction is 300 ms, e.g. satellite link */
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+
+    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time,
+        0, NULL, NULL);
+
+    if (ret == 0) {
+        /* set the delay estimate, then launch the test */
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+
+        picoquic_set_binlog(test_ctx->qserver, "long_rtt_test.bin");
+
+        /* The transmission delay cannot be less than 2.6 sec:
+         * 3 handshakes at 1 RTT each = 1.8 sec, plus
+         * 1MB over a 10Mbps link = 0.8 sec. We observe
+         * 3.31 seconds instead, i.e. 1.51 sec for the
+         * data transmission. This is due to the slow start
+         * phase of the congestion control, which we accelerated
+         * but could not completely fix. */
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 2*latency,
+            3600000);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Test the insertion of holes in the ACK sequence. We start a large
+ * download, while setting the policy to insert a hole approximately
+ * every 16 packets. We verify that the transfer completes. Then,
+ * we repeat that test but inject optimistic acks, which should
+ * break the connection.
+ */
+int optimistic_ack_test_one(int shall_spoof_ack)
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    int nb_holes = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+
+    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time,
+        0, NULL, NULL);
+
+    if (ret == 0) {
+        char binlog_file_name[256];
+        size_t binlog_file_name_len;
+
+        /* set the optimistic ack policy*/
+        picoquic_set_optimistic_ack_policy(test_ctx->qserver, 29);
+        /* add a log request for debugging */
+        (void)picoquic_sprintf(binlog_file_name, sizeof(binlog_file_name), &binlog_file_name_len,
+            "optimistic_ack%s.bin", (shall_spoof_ack) ? "_spoof" : "");
+        picoquic_set_binlog(test_ctx->qserver, binlog_file_name);
+
+        /* Reset the uniform random test */
+        picoquic_public_random_seed_64(RANDOM_PUBLIC_TEST_SEED, 1);
+
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0,
+            0, 0);
+
+        if (ret != 0)
+        {
+            DBG_PRINTF("Connect scenario returns %d\n", ret);
+        }
+    }
+
+    /* Prepare to send data */
+    if (ret == 0) {
+        test_ctx->stream0_target = 0;
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+
+        if (ret != 0)
+        {
+            DBG_PRINTF("Init send receive scenario returns %d\n", ret);
+        }
+    }
+
+    /* Perform a data sending loop */
+    if (ret == 0) {
+        int nb_trials = 0;
+        int nb_inactive = 0;
+        uint64_t hole_number = 0;
+
+        test_ctx->c_to_s_link->loss_mask = NULL;
+        test_ctx->s_to_c_link->loss_mask = NULL;
+
+        while (ret == 0 && nb_trials < 64000 && nb_inactive < 1024 && TEST_CLIENT_READY && TEST_SERVER_READY) {
+            int was_active = 0;
+
+            nb_trials++;
+
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+
+            if (ret < 0) {
+                DBG_PRINTF("Sim round number %d returns %d\n", nb_trials, ret);
+                break;
+            }
+            else if (test_ctx->cnx_server->nb_retransmission_total > 0) {
+                DBG_PRINTF("Unexpected retransmission at T=%d", (int)simulated_time);
+                ret = -1;
+                break;
+            }
+
+            if (was_active) {
+                nb_inactive = 0;
+            }
+            else {
+                nb_inactive++;
+            }
+
+            if (test_ctx->test_finished) {
+                if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
+                    break;
+                }
+            }
+
+            /* find whether there was a new hole inserted */
+            if (test_ctx->cnx_server != NULL) {
+                picoquic_packet_t * packet = test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].retransmit_oldest;
+
+                while (packet != NULL && packet->sequence_number > hole_number) {
+                    if (packet->is_ack_trap) {
+                        hole_number = packet->sequence_number;
+                        if (shall_spoof_ack) {
+                            ret = picoquic_record_pn_received(test_ctx->cnx_client, picoquic_packet_context_application,
+                                hole_number, simulated_time);
+                            if (ret != 0) {
+                                DBG_PRINTF("Record pn hole %d number returns %d\n", (int)hole_number, ret);
+                                break;
+                            }
+                        }
+                        nb_holes++;
+                        break;
+                    }
+                    packet = packet->previous_packet;
+                }
+            }
+        }
+
+        if (!test_ctx->test_finished) {
+            DBG_PRINTF("Data loop exit after %d rounds, %d inactive\n", nb_trials, nb_inactive);
+        }
+
+        if (ret != 0)
+        {
+            DBG_PRINTF("Data sending loop returns %d\n", ret);
+        }
+        else if (test_ctx->cnx_server != NULL) {
+            DBG_PRINTF("Complete after %d packets sent, %d r. by client, %d retransmits, %d spurious.\n",
+                (int)(test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence - 1),
+                (int)test_ctx->cnx_client->pkt_ctx[picoquic_packet_context_application].first_sack_item.end_of_sack_range,
+                test_ctx->cnx_server->nb_retransmission_total,
+                test_ctx->cnx_server->nb_spurious);
+        }
+    }
+
+    if (ret == 0 && nb_holes == 0) {
+        DBG_PRINTF("%s", "No holes inserted\n");
+        ret = -1;
+    }
+
+    if (shall_spoof_ack) {
+        if (ret == 0 && test_ctx->test_finished) {
+            DBG_PRINTF("Despite %d holes and spoofs, the transfer completed\n", nb_holes);
+            ret = -1;
+        }
+        else {
+            ret = 0;
+        }
+    }
+    else {
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 0);
+            if (ret != 0) {
+                DBG_PRINTF("Scenario verification returns %d", ret);
+            }
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int optimistic_ack_test()
+{
+    int ret = optimistic_ack_test_one(1);
+
+    return ret;
+}
+
+int optimistic_hole_test()
+{
+    int ret = optimistic_ack_test_one(0);
+
+    return ret;
+}
+
+/*
+ * test that local and remote addresses are properly documented during the
+ * call setup process.
+ */
+
+typedef struct st_tls_api_address_are_documented_t {
+    /* addresses returned by almost ready callback */
+    int nb_almost_ready;
+    struct sockaddr_storage local_addr_almost_ready;
+    struct sockaddr_storage remote_addr_almost_ready;
+    /* addresses returned by ready callback */
+    int nb_ready;
+    struct sockaddr_storage local_addr_ready;
+    struct sockaddr_storage remote_addr_ready;
+    /* Pointer to the underlying callback */
+    picoquic_stream_data_cb_fn callback_fn;
+    void * callback_ctx;
+} tls_api_address_are_documented_t;
+
+static int test_local_address_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    int ret = 0;
+    struct sockaddr * local_addr;
+    struct sockaddr * remote_addr;
+
+    tls_api_address_are_documented_t* cb_ctx = (tls_api_address_are_documented_t*)callback_ctx;
+
+    if (fin_or_event == picoquic_callback_almost_ready) {
+        picoquic_get_peer_addr(cnx, &remote_addr);
+        picoquic_get_local_addr(cnx, &local_addr);
+        cb_ctx->nb_almost_ready++;
+        if (cb_ctx->nb_almost_ready == 1) {
+            if (local_addr != NULL && local_addr->sa_family != 0) {
+                picoquic_store_addr(&cb_ctx->local_addr_almost_ready, local_addr);
+            }
+            if (remote_addr != NULL && remote_addr->sa_family != 0) {
+                picoquic_store_addr(&cb_ctx->remote_addr_almost_ready, remote_addr);
+            }
+        }
+    }
+    else if (fin_or_event == picoquic_callback_ready) {
+        picoquic_get_peer_addr(cnx, &remote_addr);
+        picoquic_get_local_addr(cnx, &local_addr);
+        cb_ctx->nb_ready++;
+        if (cb_ctx->nb_ready == 1) {
+            if (local_addr != NULL && local_addr->sa_family != 0) {
+                picoquic_store_addr(&cb_ctx->local_addr_ready, local_addr);
+            }
+            if (remote_addr != NULL && remote_addr->sa_family != 0) {
+                picoquic_store_addr(&cb_ctx->remote_addr_ready, remote_addr);
+            }
+        }
+    };
+
+    if (cb_ctx->callback_fn != NULL) {
+        picoquic_stream_data_cb_fn new_fn;
+        void * new_ctx;
+
+        ret = (cb_ctx->callback_fn)(cnx, stream_id, bytes, length, fin_or_event, cb_ctx->callback_ctx, NULL);
+
+        /* Check that the callbacks were not reset during the last call */
+        new_fn = picoquic_get_callback_function(cnx);
+        new_ctx = picoquic_get_callback_context(cnx);
+
+        if (new_fn != test_local_address_callback || new_ctx != callback_ctx) {
+            cb_ctx->callback_fn = new_fn;
+            cb_ctx->callback_ctx = new_ctx;
+            picoquic_set_callback(cnx, test_local_address_callback, callback_ctx);
+        }
+    }
+
+    return ret;
+}
+
+int document_addresses_check(tls_api_address_are_documented_t * test_cb_ctx,
+    struct sockaddr * local_addr_ref, struct sockaddr * remote_addr_ref)
+{
+    int ret = 0;
+
+    if (ret == 0 && test_cb_ctx->nb_almost_ready != 1) {
+        DBG_PRINTF("Expected 1 almost ready callback, got %d\n", test_cb_ctx->nb_ready);
+        ret = -1;
+    }
+
+    if (ret == 0 && test_cb_ctx->local_addr_almost_ready.ss_family == 0) {
+        DBG_PRINTF("%s", "Expected almost ready local address, got AF = 0\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && picoquic_compare_addr(local_addr_ref,
+        (struct sockaddr*)&test_cb_ctx->local_addr_almost_ready) != 0) {
+        DBG_PRINTF("%s", "Local address from almost ready callback does not match\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && test_cb_ctx->remote_addr_almost_ready.ss_family == 0) {
+        DBG_PRINTF("%s", "Expected almost ready remote address, got AF = 0\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && picoquic_compare_addr(remote_addr_ref,
+        (struct sockaddr*)&test_cb_ctx->remote_addr_almost_ready) != 0) {
+        DBG_PRINTF("%s", "Local address from almost ready callback does not match\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && test_cb_ctx->nb_ready != 1) {
+        DBG_PRINTF("Expected 1 ready callback, got %d\n", test_cb_ctx->nb_ready);
+        ret = -1;
+    }
+
+    if (ret == 0 && test_cb_ctx->local_addr_ready.ss_family == 0) {
+        DBG_PRINTF("%s", "Expected ready local address, got AF = 0\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && picoquic_compare_addr(local_addr_ref,
+        (struct sockaddr*)&test_cb_ctx->local_addr_ready) != 0) {
+        DBG_PRINTF("%s", "Local address from ready callback does not match\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && test_cb_ctx->remote_addr_ready.ss_family == 0) {
+        DBG_PRINTF("%s", "Expected ready remote address, got AF = 0\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && picoquic_compare_addr(remote_addr_ref,
+        (struct sockaddr*)&test_cb_ctx->remote_addr_ready) != 0) {
+        DBG_PRINTF("%s", "Local address from almost ready callback does not match\n");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int document_addresses_test()
+{
+    uint64_t simulated_time = 0; 
+    tls_api_address_are_documented_t client_address_callback_ctx, server_address_callback_ctx;
+
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        /* Set the call backs to intercept the almost ready and ready transitions */
+        memset(&client_address_callback_ctx, 0, sizeof(tls_api_address_are_documented_t));
+        client_address_callback_ctx.callback_fn = picoquic_get_callback_function(test_ctx->cnx_client);
+        client_address_callback_ctx.callback_ctx = picoquic_get_callback_context(test_ctx->cnx_client);
+        picoquic_set_callback(test_ctx->cnx_client, test_local_address_callback, &client_address_callback_ctx);
+
+        memset(&server_address_callback_ctx, 0, sizeof(tls_api_address_are_documented_t));
+        server_address_callback_ctx.callback_fn = picoquic_get_default_callback_function(test_ctx->qserver);
+        server_address_callback_ctx.callback_ctx = picoquic_get_default_callback_context(test_ctx->qserver);
+        picoquic_set_default_callback(test_ctx->qserver, test_local_address_callback, &server_address_callback_ctx);
+
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 20000, 3600000);
+    }
+
+    /* Verify that the addresses and calls are what we expect */
+    if (ret == 0) {
+        ret = document_addresses_check(&client_address_callback_ctx,
+            (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr);
+        if (ret != 0) {
+            DBG_PRINTF("%s", "Client addresses were not properly documented\n");
+        }
+    }
+
+    if (ret == 0) {
+        ret = document_addresses_check(&server_address_callback_ctx,
+            (struct sockaddr*)&test_ctx->server_addr, (struct sockaddr*)&test_ctx->client_addr);
+        if (ret != 0) {
+            DBG_PRINTF("%s", "Server addresses were not properly documented\n");
+        }
+    }
+
+    /* Free the resource */
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Test whether a connection succeed when SNI is not specified.
+ */
+
+int null_sni_test()
+{
+    return tls_api_test_with_loss(NULL, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, PICOQUIC_TEST_ALPN);
+}
+
+/*
+ * Test whether server redirection is applied properly
+ */
+
+int preferred_address_test()
+{
+    int ret;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    struct sockaddr_in server_preferred;
+    picoquic_tp_t server_parameters;
+
+
+    server_preferred.sin_family = AF_INET;
+#ifdef _WINDOWS
+    server_preferred.sin_addr.S_un.S_addr = 0x0A00000B;
+#else
+    server_preferred.sin_addr.s_addr = 0x0A00000B;
+#endif
+    server_preferred.sin_port = 5678;
+
+    memset(&server_parameters, 0, sizeof(picoquic_tp_t));
+
+    picoquic_init_transport_parameters(&server_parameters, 1);
+
+    /* Create an alternate IP address, and use it as preferred address */
+    server_parameters.prefered_address.is_defined = 1;
+    memcpy(server_parameters.prefered_address.ipv4Address, &server_preferred.sin_addr, 4);
+    server_parameters.prefered_address.ipv4Port = ntohs(server_preferred.sin_port);
+
+    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        NULL, &server_parameters);
+
+
+    if (ret == 0) {
+        /* Run a basic test scenario */
+
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 0, 1500000);
+    }
+
+    /* Verify that the client and server have both migrated to using the preferred address */
+    if (ret == 0 && picoquic_compare_addr((struct sockaddr*)&server_preferred,
+        (struct sockaddr*)&test_ctx->cnx_client->path[0]->peer_addr) != 0) {
+        DBG_PRINTF("%s", "Server address at client not updated\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && test_ctx->cnx_server != NULL &&
+        picoquic_compare_addr((struct sockaddr*)&server_preferred,
+        (struct sockaddr*)&test_ctx->cnx_server->path[0]->local_addr) != 0) {
+        DBG_PRINTF("%s", "Server address not promoted\n");
+        ret = -1;
+    }
+
+    /* And then free the resource
+     */
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+
+/* Test that the random public generation behaves in expected ways */
+int random_public_tester_test()
+{
+#define RANDOM_PUBLIC_TEST_CONST 11
+#define RANDOM_PUBLIC_TEST_ROUNDS 100
+#define RANDOM_PUBLIC_CHI_SQUARE 18.31 /* Fail if significance of bias < P = 0.05 */
+    int ret = 0;
+    int r_count[RANDOM_PUBLIC_TEST_CONST];
+
+    picoquic_public_random_seed_64(RANDOM_PUBLIC_TEST_SEED, 1);
+
+    memset(r_count, 0, sizeof(r_count));
+
+    for (int i = 0; i < RANDOM_PUBLIC_TEST_CONST*RANDOM_PUBLIC_TEST_ROUNDS; i++) {
+        uint64_t x = picoquic_public_uniform_random(RANDOM_PUBLIC_TEST_CONST);
+
+        if (x >= RANDOM_PUBLIC_TEST_CONST) {
+            DBG_PRINTF("Value %d >= %d\n", x, RANDOM_PUBLIC_TEST_CONST);
+            ret = -1;
+            break;
+        }
+        else {
+            r_count[x] += 1;
+        }
+    }
+
+    if (ret == 0) {
+        double chi_squared = 0;
+
+        for (int i = 0; i < RANDOM_PUBLIC_TEST_CONST; i++) {
+            double delta = ((double)RANDOM_PUBLIC_TEST_ROUNDS - r_count[i]);
+            double d2 = delta * delta;
+            d2 /= ((double)RANDOM_PUBLIC_TEST_ROUNDS);
+            chi_squared += d2;
+        }
+
+        if (chi_squared > RANDOM_PUBLIC_CHI_SQUARE) {
+            DBG_PRINTF("Chi2 = %f, larger than %f\n", chi_squared, RANDOM_PUBLIC_CHI_SQUARE);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Test whether connections can be established when the client hello is larger than a 
+ * single packet. This is done by adding a "padding" transport parameter.
+ */
+
+int large_client_hello_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    /* Set the test large hello flag in the client connection
+     */
+    if (ret == 0) {
+        test_ctx->cnx_client->test_large_chello = 1;
+
+        /* Run a basic test scenario
+         */
+
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 0, 250000);
+    }
+
+    /* And then free the resource
+     */
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/* DDOS Amplification Mitigation test
+ *
+ * In this test, the client sends a first packet (client hello) and then disappears.
+ * This simulates an attempts to use the Quic server as an amplifier in a DDOS attack.
+ * We want to verify that the server does not send out more than 3 times the amount
+ * of data sent by the client.
+ */
+
+int ddos_amplification_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint32_t proposed_version = PICOQUIC_INTEROP_VERSION_LATEST;
+    int ret = tls_api_init_ctx(&test_ctx, proposed_version, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
+    size_t data_sent_by_client = 0;
+    size_t data_sent_by_server = 0;
+    int nb_server_packets = 0;
+    int nb_loops = 0;
+    int nb_inactive = 0;
+
+    if (ret != 0 || packet == NULL)
+    {
+        DBG_PRINTF("Could not create the QUIC test contexts for V=%x\n", proposed_version);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Prepare a first packet from the client to the server */
+        ret = picoquic_prepare_packet(test_ctx->cnx_client, simulated_time,
+            packet->bytes, PICOQUIC_MAX_PACKET_SIZE, &packet->length,
+            &packet->addr_to, &packet->addr_from);
+
+        if (packet->length == 0) {
+            ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+        }
+        if (ret != 0 )
+        {
+            DBG_PRINTF("Could not create first client packet, ret=%x\n", ret);
+        }
+        else {
+            data_sent_by_client += packet->length;
+
+            ret = picoquic_incoming_packet(test_ctx->qserver, packet->bytes, (uint32_t)packet->length,
+                (struct sockaddr*) & packet->addr_from,
+                (struct sockaddr*) & packet->addr_to, 0, 0,
+                simulated_time);
+
+            if (ret == 0) {
+                picoquic_cnx_t* next = test_ctx->qserver->cnx_list;
+
+                while (next != NULL && picoquic_compare_connection_id(&next->initial_cnxid, &test_ctx->cnx_client->initial_cnxid) != 0) {
+                    next = next->next_in_table;
+                }
+
+                if (next != NULL) {
+                    test_ctx->cnx_server = next;
+                } else {
+                    ret = -1;
+                    DBG_PRINTF("Could not create server side connection, ret = %d\n", ret);
+                }
+            }
+        }
+    }
+
+    while (ret == 0 && test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state != picoquic_state_disconnected && nb_loops < 1024 && nb_inactive < 256) {
+        /* Update the time to the next server time */
+        simulated_time = test_ctx->cnx_server->next_wake_time;
+        packet->length = 0;
+        nb_loops++;
+
+        ret = picoquic_prepare_packet(test_ctx->cnx_server, simulated_time,
+            packet->bytes, PICOQUIC_MAX_PACKET_SIZE, &packet->length,
+            &packet->addr_to, &packet->addr_from);
+
+        if (ret == PICOQUIC_ERROR_DISCONNECTED) {
+            ret = 0;
+        }
+
+        if (ret != 0)
+        {
+            DBG_PRINTF("Could not create server packet, ret=%x\n", ret);
+        }
+        else if (packet->length > 0) {
+            data_sent_by_server += packet->length;
+            nb_server_packets++;
+            nb_inactive = 0;
+        }
+        else {
+            nb_inactive++;
+        }
+    }
+
+    if (ret == 0 && test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state != picoquic_state_disconnected) {
+        DBG_PRINTF("Simulation was looping, closed before termination, loops: %d, inactive: %d\n", nb_loops, nb_inactive);
+        ret = -1;
+    }
+
+    if (ret == 0 && data_sent_by_server > 3*data_sent_by_client) {
+        DBG_PRINTF("Client sent %d bytes, server sent >3x more, %d bytes, %d packets\n", (int)data_sent_by_client, (int)data_sent_by_server, nb_server_packets);
+        ret = -1;
+    }
+
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    if (packet != NULL) {
+        free(packet);
+    }
+
+    return ret;
+}
+
+/* ESNI Test. */
+uint64_t demo_server_test_time_from_esni_rr(char const* esni_rr_file)
+{
+    uint8_t esnikeys[2048];
+    size_t esnikeys_len;
+    uint64_t not_before = 0;
+    uint64_t not_after = 0;
+    uint64_t esni_start = 0;
+    uint16_t version = 0;
+    uint16_t l;
+
+    /* Load the rr file */
+    if (picoquic_esni_load_rr(esni_rr_file, esnikeys, sizeof(esnikeys), &esnikeys_len) == 0)
+    {
+        size_t byte_index = 0;
+
+        if (byte_index + 2 <= esnikeys_len) {
+            version = PICOPARSE_16(&esnikeys[byte_index]);
+            byte_index += 2;
+        }
+        /* 4 bytes checksum */
+        byte_index += 4;
+        /* If > V2, 16 bits length + published SNI */
+        if (version != 0xFF01 && byte_index + 2 <= esnikeys_len) {
+            l = PICOPARSE_16(&esnikeys[byte_index]);
+            byte_index += (size_t)l + 2;
+        }
+        /* 16 bits length + key exchanges */
+        if (byte_index + 2 <= esnikeys_len) {
+            l = PICOPARSE_16(&esnikeys[byte_index]);
+            byte_index += (size_t)l + 2;
+        }
+        /* 16 bits length + ciphersuites */
+        if (byte_index + 2 <= esnikeys_len) {
+            l = PICOPARSE_16(&esnikeys[byte_index]);
+            byte_index += (size_t)l + 2;
+        }
+        /* 16 bits padded length */
+        byte_index += 2;
+        /* 64 bits not before */
+        if (byte_index + 8 <= esnikeys_len) {
+            not_before = PICOPARSE_64(&esnikeys[byte_index]);
+            byte_index += 8;
+        }
+        /* 64 bits not after */
+        if (byte_index + 8 <= esnikeys_len) {
+            not_after = PICOPARSE_64(&esnikeys[byte_index]);
+        }
+        else {
+            not_after = not_before;
+        }
+        /* 16 bits length + extensions. ignored */
+    }
+    esni_start = ((not_before + not_after) / 2) * 1000000;
+
+    return esni_start;
+}
+
+
+int esni_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    char test_server_esni_key_file[512];
+    char test_server_esni_rr_file[512];
+    int ret = 0;
+
+    /* Locate the esni record and key files */
+    ret = picoquic_get_input_path(test_server_esni_key_file, sizeof(test_server_esni_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_ESNI_KEY);
+
+    if (ret == 0) {
+        ret = picoquic_get_input_path(test_server_esni_rr_file, sizeof(test_server_esni_rr_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_ESNI_RR);
+    }
+
+    /* Set the simulated time to conform to the ESNI ticket */
+    if (ret == 0) {
+        simulated_time = demo_server_test_time_from_esni_rr(test_server_esni_rr_file);
+    }
+
+    /* Create the test context */
+    if (ret == 0) {
+        tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL);
+
+        if (ret == 0 && test_ctx == NULL) {
+            ret = -1;
+        }
+    }
+
+    /* Add the esni parameters to the server */
+    if (ret == 0) {
+        ret = picoquic_esni_load_key(test_ctx->qserver, test_server_esni_key_file);
+    }
+
+    if (ret == 0) {
+        ret = picoquic_esni_server_setup(test_ctx->qserver, test_server_esni_rr_file);
+    }
+
+    /* Add the SNI parameters to the client */
+    if (ret == 0) {
+        ret = picoquic_esni_client_from_file(test_ctx->cnx_client, test_server_esni_rr_file);
+    }
+
+    /* Perform the transmission test */
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 0, 250000);
+    }
+
+    /* Verify that ESNI was properly negotiated */
+    if (ret == 0) {
+        if (picoquic_esni_version(test_ctx->cnx_client) == 0) {
+            DBG_PRINTF("%s", "ESNI not negotiated for client connection.\n");
+            ret = -1;
+        }
+        else if (picoquic_esni_version(test_ctx->cnx_server) == 0) {
+            DBG_PRINTF("%s", "ESNI not negotiated for server connection.\n");
+            ret = -1;
+        }
+        else if (picoquic_esni_version(test_ctx->cnx_client) != picoquic_esni_version(test_ctx->cnx_server)) {
+            DBG_PRINTF("ESNI client version %d, server version %d.\n",
+                picoquic_esni_version(test_ctx->cnx_client), picoquic_esni_version(test_ctx->cnx_server));
+            ret = -1;
+        }
+        else if (memcmp(picoquic_esni_nonce(test_ctx->cnx_client), picoquic_esni_nonce(test_ctx->cnx_server), PTLS_ESNI_NONCE_SIZE) != 0) {
+            DBG_PRINTF("%s", "Client and server nonce do not match.\n");
+            ret = -1;
+        }
+    }
+
+    /* And then free the resource
+     */
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+
+}
+
+static int blackhole_test_one(picoquic_congestion_algorithm_t* ccalgo, uint64_t max_completion_time, uint64_t jitter)
+{
+    uint64_t simulated_time = 0;
+    uint64_t latency = 15000;
+    uint64_t picoseq_per_byte_10 = (1000000ull * 8) / 10;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = 0;
+
+    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    /* Simulate 10 ms link, 15ms latency, 2 seconds blackhole */
+    if (ret == 0) {
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
+        picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
+
+        test_ctx->c_to_s_link->jitter = jitter;
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->c_to_s_link->picosec_per_byte = picoseq_per_byte_10;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->picosec_per_byte = picoseq_per_byte_10;
+        test_ctx->s_to_c_link->jitter = jitter;
+        test_ctx->blackhole_end = 7000000;
+        test_ctx->blackhole_start = 5000000;
+
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body(test_ctx, &simulated_time, test_scenario_10mb, sizeof(test_scenario_10mb), 0, 0, 0, 2 * latency, max_completion_time);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int blackhole_test()
+{
+    int ret = blackhole_test_one(picoquic_bbr_algorithm, 15000000, 0);
+
+    return ret;
+}
+
+/* Verify that the code operates correctly when the ack frequency extension is no used
+ */
+
+int no_ack_frequency_test()
+{
+    int ret = 0;
+    picoquic_tp_t client_parameters;
+    picoquic_tp_t server_parameters;
+
+    for (int i = 1; ret == 0 && i <= 3; i++) {
+        memset(&client_parameters, 0, sizeof(picoquic_tp_t));
+        memset(&server_parameters, 0, sizeof(picoquic_tp_t));
+        picoquic_init_transport_parameters(&client_parameters, 1);
+        picoquic_init_transport_parameters(&server_parameters, 0);
+
+        client_parameters.min_ack_delay = ((uint64_t)(1u-(i & 1)))*1000u;
+        server_parameters.enable_loss_bit = (1 - ((i > 1) & 1))*1000;
+
+        ret = tls_api_one_scenario_test(test_scenario_very_long, sizeof(test_scenario_very_long), 0, 128, 0, 0, 0, 2000000, &client_parameters, &server_parameters);
+        if (ret != 0) {
+            DBG_PRINTF("No min ack delay test fails for client: %d, server: %d, ret = %d", i & 1, i >> 1, ret);
+        }
+    }
+
+    return ret;
+}
+
+/* Check that a connection does fail in a reasonable time after a transmission
+ * drops.
+ */
+
+static int connection_drop_test_one(picoquic_state_enum target_client_state, picoquic_state_enum target_server_state, int target_is_client)
+{
+    uint64_t simulated_time = 0;
+    uint64_t target_time = PICOQUIC_MICROSEC_HANDSHAKE_MAX;
+    const char* target_name = (target_is_client) ? "client" : "server";
+    picoquic_cnx_t* target_cnx = NULL;
+
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        int nb_trials = 0;
+        int nb_inactive = 0;
+
+        while (ret == 0 && nb_trials < 1024 && nb_inactive < 512 && (!TEST_CLIENT_READY || (test_ctx->cnx_server == NULL || !TEST_SERVER_READY))) {
+            int was_active = 0;
+            nb_trials++;
+
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+
+            if (test_ctx->cnx_client->cnx_state == picoquic_state_disconnected &&
+                (test_ctx->cnx_server == NULL || test_ctx->cnx_server->cnx_state == picoquic_state_disconnected)) {
+                break;
+            }
+
+            if (test_ctx->cnx_client->cnx_state >= target_client_state ||
+                (test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state >= target_server_state)) {
+                break;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        target_cnx = (target_is_client) ? test_ctx->cnx_client : test_ctx->cnx_server;
+
+        if (target_cnx == NULL) {
+            DBG_PRINTF("Target connection (%s) already dropped", target_name);
+            ret = -1;
+        }
+        else if (target_cnx->cnx_state >= picoquic_state_ready) {
+            DBG_PRINTF("Target connection (%s) already ready", target_name);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        int nb_trials = 0;
+        int nb_inactive = 0;
+        int disconnected_in_time = 0;
+
+        while (ret == 0 && nb_trials < 1024 && nb_inactive < 512) {
+            struct sockaddr_storage a_from;
+            struct sockaddr_storage a_to;
+            uint8_t packet[PICOQUIC_MAX_PACKET_SIZE];
+            size_t length = 0;
+
+            if (target_cnx->next_wake_time > simulated_time) {
+                simulated_time = target_cnx->next_wake_time;
+            }
+
+            if (simulated_time > target_time + target_cnx->start_time) {
+                break;
+            }
+
+            ret = picoquic_prepare_packet(target_cnx, simulated_time, packet, PICOQUIC_MAX_PACKET_SIZE,
+                &length, &a_to, &a_from);
+
+            if (ret == PICOQUIC_ERROR_DISCONNECTED) {
+                ret = 0;
+            }
+
+            if (target_cnx->cnx_state == picoquic_state_disconnected) {
+                disconnected_in_time = 1;
+                break;
+            }
+        }
+
+        if (ret == 0 && !disconnected_in_time) {
+            DBG_PRINTF("Connection not disconnected after %lld microsec", simulated_time);
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int connection_drop_test()
+{
+    int ret = 0;
+    picoquic_state_enum target_state[9] = {
+        picoquic_state_client_init_sent,
+        picoquic_state_client_renegotiate,
+        picoquic_state_client_init_resent,
+        picoquic_state_server_init,
+        picoquic_state_server_handshake,
+        picoquic_state_client_handshake_start,
+        picoquic_state_server_false_start,
+        picoquic_state_server_almost_ready,
+        picoquic_state_client_almost_ready
+    };
+    int target_is_client[9] = {
+        1, 1, 1, 0, 0, 1, 0, 0, 1 };
+
+    for (int i = 0; ret == 0 && i < 9; i++) {
+        picoquic_state_enum c_state = (target_is_client[i]) ? target_state[i] : picoquic_state_ready;
+        picoquic_state_enum s_state = (target_is_client[i]) ? picoquic_state_ready : target_state[i];
+
+        ret = connection_drop_test_one(c_state, s_state, target_is_client[i]);
+        if (ret == -1) {
+            DBG_PRINTF("connection drop test %d fails", i);
+        }
+    }
+
+    return ret;
+}
+
+/* testing the pacing rate update function and the congestion
+ * control parameter assessors.
+ */
+
+#ifdef _WINDOWS
+#define PACING_RATE_TEST_REF "picoquictest\\pacing_rate_ref.txt"
+#else
+#define PACING_RATE_TEST_REF "picoquictest/pacing_rate_ref.txt"
+#endif
+#define PACING_RATE_CSV "pacing_rate.csv"
+
+
+int pacing_update_test()
+{
+    uint64_t simulated_time = 0;
+
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        /* Open a file to log bandwidth updates and document it in context */
+        test_ctx->bw_update = picoquic_file_open(PACING_RATE_CSV, "w");
+        if (test_ctx->bw_update == NULL) {
+            DBG_PRINTF("Could not write file <%s>", PACING_RATE_CSV);
+            ret = -1;
+        }
+        else {
+            fprintf(test_ctx->bw_update, "Time, Pacing_rate_CB, Pacing_rate, CWIN, RTT\n");
+            /* Request bandwidth updates */
+            picoquic_subscribe_pacing_rate_updates(test_ctx->cnx_client, 0x8000, 0x10000);
+
+            /* Start a standard scenario, pushing 1MB from the client*/
+            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+                test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 1000000, 0, 0, 20000, 3600000);
+        }
+    }
+
+    /* Free the test contex, which closes the trace file  */
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    /* compare the trace to the expected value */
+    if (ret == 0)
     {
-        DBG_PRINTF("Could not create the QUIC test contexts for V=%x\n", proposed_version);
+        char pacing_rate_ref[512];
+
+        ret = picoquic_get_input_path(pacing_rate_ref, sizeof(pacing_rate_ref), picoquic_solution_dir, PACING_RATE_TEST_REF);
+
+        if (ret != 0) {
+            DBG_PRINTF("%s", "Cannot set the pacing rate test ref file name.\n");
+        }
+        else {
+            ret = picoquic_test_compare_text_files(PACING_RATE_CSV, pacing_rate_ref);
+        }
+    }
+
+    return ret;
+}
+
+/* Test the congestion control telemetry. The client pushes 1MB with a few
+ * losses, and subscribes to snapshots every 10ms through a telemetry ring.
+ * The snapshots shall be in time order, periodic snapshots shall respect
+ * the interval, and losses shall trigger immediate snapshots. A separate
+ * small ring checks that overflowing snapshots are dropped and counted.
+ */
+
+int cc_telemetry_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t interval = 10000;
+    picoquic_cc_ring_t* ring = picoquic_cc_ring_create(4096);
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = (ring == NULL) ? -1 : tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_subscribe_cc_telemetry(test_ctx->cnx_client, interval, picoquic_cc_ring_push, ring);
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 1000000, 0x20400, 0, 20000, 3600000);
+    }
+
+    if (ret == 0) {
+        picoquic_cc_snapshot_t snapshot;
+        uint64_t last_time = 0;
+        uint64_t last_periodic_time = 0;
+        uint64_t last_retransmit = 0;
+        int nb_snapshots = 0;
+        int nb_periodic = 0;
+        int nb_loss = 0;
+
+        while (ret == 0 && picoquic_cc_ring_pop(ring, &snapshot)) {
+            nb_snapshots++;
+            if (snapshot.current_time < last_time) {
+                DBG_PRINTF("Snapshot %d at %" PRIu64 ", before %" PRIu64, nb_snapshots, snapshot.current_time, last_time);
+                ret = -1;
+            }
+            else if (snapshot.cwin == 0 || snapshot.send_mtu == 0) {
+                DBG_PRINTF("Snapshot %d, cwin = %" PRIu64 ", mtu = %" PRIu64, nb_snapshots, snapshot.cwin, snapshot.send_mtu);
+                ret = -1;
+            }
+            else if (snapshot.trigger == picoquic_cc_telemetry_periodic) {
+                if (nb_periodic > 0 && snapshot.current_time < last_periodic_time + interval) {
+                    DBG_PRINTF("Periodic snapshot at %" PRIu64 ", previous %" PRIu64, snapshot.current_time, last_periodic_time);
+                    ret = -1;
+                }
+                nb_periodic++;
+                last_periodic_time = snapshot.current_time;
+            }
+            else if (snapshot.trigger == picoquic_cc_telemetry_loss) {
+                if (snapshot.nb_retransmission_total <= last_retransmit) {
+                    DBG_PRINTF("Loss snapshot with %" PRIu64 " retransmissions, previous %" PRIu64,
+                        snapshot.nb_retransmission_total, last_retransmit);
+                    ret = -1;
+                }
+                nb_loss++;
+            }
+            last_time = snapshot.current_time;
+            last_retransmit = snapshot.nb_retransmission_total;
+        }
+
+        if (ret == 0 && (nb_periodic < 10 || nb_loss == 0 || picoquic_cc_ring_dropped(ring) != 0)) {
+            DBG_PRINTF("%d snapshots, %d periodic, %d losses, %" PRIu64 " dropped",
+                nb_snapshots, nb_periodic, nb_loss, picoquic_cc_ring_dropped(ring));
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_cc_ring_t* small_ring = picoquic_cc_ring_create(4);
+        picoquic_cc_snapshot_t snapshot;
+
+        if (small_ring == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(&snapshot, 0, sizeof(snapshot));
+            for (uint64_t i = 0; i < 6; i++) {
+                snapshot.current_time = i;
+                picoquic_cc_ring_push(NULL, &snapshot, small_ring);
+            }
+            for (uint64_t i = 0; ret == 0 && i < 4; i++) {
+                if (!picoquic_cc_ring_pop(small_ring, &snapshot) || snapshot.current_time != i) {
+                    DBG_PRINTF("Small ring, cannot pop snapshot %" PRIu64, i);
+                    ret = -1;
+                }
+            }
+            if (ret == 0 && (picoquic_cc_ring_pop(small_ring, &snapshot) || picoquic_cc_ring_dropped(small_ring) != 2)) {
+                DBG_PRINTF("Small ring, %" PRIu64 " dropped, expected 2", picoquic_cc_ring_dropped(small_ring));
+                ret = -1;
+            }
+            picoquic_cc_ring_delete(small_ring);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    picoquic_cc_ring_delete(ring);
+
+    return ret;
+}
+
+/* Test the direct receive API
+ */
+
+int direct_receive_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint64_t loss_mask = 8;
+    uint64_t max_completion_microsec = 3500000;
+
+    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time,
+        0, NULL, NULL);
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
+
+        /* Prepare to send data */
+        if (ret == 0) {
+            test_ctx->stream0_target = 0;
+            ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+
+            if (ret != 0)
+            {
+                DBG_PRINTF("Init send receive scenario returns %d\n", ret);
+            }
+        }
+
+        /* Set the direct receive API for the stream number 4. */
+        if (ret == 0) {
+            ret = picoquic_mark_direct_receive_stream(test_ctx->cnx_client, 4, test_api_direct_receive_callback, (void*)&test_ctx->client_callback);
+
+            if (ret != 0)
+            {
+                DBG_PRINTF("Mark direct receive stream returns %d\n", ret);
+            }
+        }
+
+        /* Perform a data sending loop */
+        if (ret == 0) {
+            ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+
+            if (ret != 0)
+            {
+                DBG_PRINTF("Data sending loop returns %d\n", ret);
+            }
+        }
+
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, max_completion_microsec);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+* Application limited test.
+* The application is set to limit the max data values to stay lower than a set flow control window.
+* We verify that in these scenario the CWIN does not grow too much above the flow control window.
+*/
+#define APP_LIMIT_TRACE_CSV "app_limit_trace.csv"
+#define APP_LIMIT_TRACE_BIN "app_limit_trace.bin"
+
+int app_limit_cc_test_one(
+    picoquic_congestion_algorithm_t* ccalgo, uint64_t max_completion_time)
+{
+    uint64_t simulated_time = 0;
+    uint64_t latency = 300000;
+    uint64_t picoseq_per_byte_1 = (1000000ull * 8) / 1;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_tp_t client_parameters;
+    uint64_t cwin_limit = 100000;
+    int ret = 0;
+
+    memset(&client_parameters, 0, sizeof(picoquic_tp_t));
+    picoquic_init_transport_parameters(&client_parameters, 1);
+    client_parameters.initial_max_data = 40000;
+
+    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, &client_parameters, NULL);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
+        picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
+        picoquic_set_binlog(test_ctx->qserver, APP_LIMIT_TRACE_BIN);
+        test_ctx->qserver->use_long_log = 1;
+        test_ctx->cnx_client->is_flow_control_limited = 1;
+
+        test_ctx->c_to_s_link->jitter = 0;
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->c_to_s_link->picosec_per_byte = picoseq_per_byte_1;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->picosec_per_byte = picoseq_per_byte_1;
+        test_ctx->s_to_c_link->jitter = 0;
+
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+                test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 2 * latency, max_completion_time);
+        }
+    }
+
+    /* Free the resource, which will close the log file.
+     */
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    /* Create a CSV file from the .bin log file */
+    if (ret == 0) {
+        ret = picoquic_cc_log_file_to_csv(APP_LIMIT_TRACE_BIN, APP_LIMIT_TRACE_CSV);
+    }
+
+    /* Compute the max CWIN from the trace file */
+    if (ret == 0)
+    {
+        FILE* F = picoquic_file_open(APP_LIMIT_TRACE_CSV, "r");
+        uint64_t cwin_max = 0;
+
+        if (F == NULL) {
+            DBG_PRINTF("Cannot open <%s>", APP_LIMIT_TRACE_CSV);
+            ret = -1;
+        }
+        else {
+            char buffer[512];
+
+            while (fgets(buffer, 512, F) != NULL) {
+                /* only consider number lines line */
+                if (buffer[0] >= '0' && buffer[0] <= '9') {
+                    uint64_t cwin = 0;
+                    int nb_comma = 0;
+                    int c_index = 0;
+
+                    while (nb_comma < 5 && buffer[c_index] != 0 && c_index < 512) {
+                        if (buffer[c_index] == ',') {
+                            nb_comma++;
+                        }
+                        c_index++;
+                    }
+                    while (c_index < 512 && buffer[c_index] == ' ') {
+                        c_index++;
+                    }
+                    while (c_index < 512 && buffer[c_index] >= '0' && buffer[c_index] <= '9') {
+                        cwin *= 10;
+                        cwin += buffer[c_index] - '0';
+                        c_index++;
+                    }
+                    if (cwin > cwin_max) {
+                        cwin_max = cwin;
+                    }
+                }
+            }
+
+            (void)picoquic_file_close(F);
+
+            if (cwin_max > cwin_limit) {
+                DBG_PRINTF("MAX CWIN = %" PRIu64 ", larger than %" PRIu64, cwin_max, cwin_limit);
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int app_limit_cc_test()
+{
+
+    picoquic_congestion_algorithm_t* ccalgos[] = {
+        picoquic_newreno_algorithm,
+        picoquic_cubic_algorithm,
+        picoquic_dcubic_algorithm,
+        picoquic_bbr_algorithm,
+        picoquic_fastcc_algorithm };
+    uint64_t max_completion_times[] = {
+        23000000,
+        22000000,
+        22000000,
+        22000000,
+        29000000 };
+    int ret = 0;
+
+    for (size_t i = 0; i < sizeof(ccalgos) / sizeof(picoquic_congestion_algorithm_t*); i++) {
+        ret = app_limit_cc_test_one(ccalgos[i], max_completion_times[i]);
+        if (ret != 0) {
+            DBG_PRINTF("Appplication limited congestion test fails for <%s>", ccalgos[i]->congestion_algorithm_id);
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/* Initial race condition.
+* What happens if the client immediately repeats the Initial packet?
+*/
+
+int initial_race_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    /* Run an initial loop to make to send the client's first packet, and then replicate it. */
+    if (ret == 0) {
+        int was_active = 0;
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+
+        if (ret == 0) {
+            /* Force a repeat of the first packet */
+            simulated_time += 100;
+            test_ctx->cnx_client->initial_repeat_needed = 1;
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+            test_ctx->cnx_client->initial_repeat_needed = 0;
+            /* Verify that there are two packets in the initial queue */
+            if (ret == 0) {
+                if (test_ctx->c_to_s_link->first_packet == NULL) {
+                    DBG_PRINTF("%s", "No packet queued");
+                    ret = -1;
+                }
+                else if (test_ctx->c_to_s_link->last_packet == test_ctx->c_to_s_link->first_packet) {
+                    DBG_PRINTF("%s", "Only one packet queued");
+                    ret = -1;
+                }
+            }
+        }
+
+        while (ret == 0 && test_ctx->s_to_c_link->first_packet == NULL){
+            /* run a couple of simulation round to process the first server packets,
+             * but make sure the server sends only one packet */
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+        }
+
+        if (ret == 0) {
+            if (test_ctx->cnx_server == NULL) {
+                DBG_PRINTF("%s", "No server connection");
+                ret = -1;
+
+            }
+            else {
+                /* Make sure that the server waits before sending the next packet. */
+                test_ctx->cnx_server->next_wake_time += 2000;
+            }
+        }
+    }
+
+    /* Run a connection loop */
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    /* Prepare to send data */
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2));
+    }
+
+    /* Try send data */
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    /* Check that the data was sent and received */
+    if (ret == 0) {
+        ret = tls_api_one_scenario_verify(test_ctx);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+
+        if (ret != 0)
+        {
+            DBG_PRINTF("Connection close returns %d\n", ret);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/* Test of the pacing functions.
+ */
+
+int pacing_test()
+{
+    /* Create a connection so as to instantiate the pacing context */
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
+    const uint64_t test_byte_per_sec = 1250000;
+    const uint64_t test_quantum = 0x4000;
+    int nb_sent = 0;
+    int nb_round = 0;
+    const int nb_target = 10000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Set pacing parameters to specified value */
+        picoquic_update_pacing_rate(cnx, cnx->path[0], test_byte_per_sec, test_quantum);
+        /* Run a loop of N tests based on next wake time. */
+        while (ret == 0 && nb_sent < nb_target) {
+            nb_round++;
+            if (nb_round > 4 * nb_target) {
+                DBG_PRINTF("Pacing needs more that %d rounds for %d packets", nb_round, nb_target);
+                ret = -1;
+            }
+            else {
+                uint64_t next_time = current_time + 10000000;
+                if (picoquic_is_sending_authorized_by_pacing(cnx, cnx->path[0], current_time, &next_time)) {
+                    nb_sent++;
+                    (void)picoquic_update_pacing_after_send(cnx->path[0], current_time);
+                }
+                else {
+                    if (current_time < next_time) {
+                        current_time = next_time;
+                    }
+                    else {
+                        DBG_PRINTF("Pacing next = %" PRIu64", current = %d" PRIu64, next_time, current_time);
+                        ret = -1;
+                    }
+                }
+            }
+        }
+
+        /* Verify that the total send time matches expectations */
+        if (ret == 0) {
+            uint64_t volume_sent = nb_target * cnx->path[0]->send_mtu;
+            uint64_t time_max = ((volume_sent * 1000000) / test_byte_per_sec) + 1;
+            uint64_t time_min = (((volume_sent - test_quantum) * 1000000) / test_byte_per_sec) + 1;
+
+            if (current_time > time_max) {
+                DBG_PRINTF("Pacing used = %" PRIu64", expected max = %d" PRIu64, current_time, time_max);
+                ret = -1;
+            }
+            else if (current_time < time_min) {
+                DBG_PRINTF("Pacing used = %" PRIu64", expected min = %d" PRIu64, current_time, time_min);
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+/* Test of the pacing offload. At 10 Gbps, a full size packet takes about
+ * one microsecond, so waking up every microsecond cannot pace accurately.
+ * With a horizon, packets are prepared ahead of time, and their departure
+ * times must be spaced by exactly the packet time, in nanoseconds.
+ * Also verify that small windows are paced.
+ */
+
+int pacing_horizon_test()
+{
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
+    const uint64_t test_byte_per_sec = 1250000000;
+    const uint64_t test_quantum = 0x4000;
+    const uint64_t test_horizon = 100;
+    const int nb_target = 100000;
+    int nb_sent = 0;
+    int nb_round = 0;
+    int nb_spaced = 0;
+    uint64_t last_departure = 0;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
         ret = -1;
     }
+    else {
+        picoquic_set_pacing_horizon(quic, test_horizon);
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
 
-    if (ret == 0) {
-        /* Prepare a first packet from the client to the server */
-        ret = picoquic_prepare_packet(test_ctx->cnx_client, simulated_time,
-            packet->bytes, PICOQUIC_MAX_PACKET_SIZE, &packet->length,
-            &packet->addr_to, &packet->addr_from);
-
-        if (packet->length == 0) {
-            ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
-        }
-        if (ret != 0 )
-        {
-            DBG_PRINTF("Could not create first client packet, ret=%x\n", ret);
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
         }
-        else {
-            data_sent_by_client += packet->length;
+    }
 
-            ret = picoquic_incoming_packet(test_ctx->qserver, packet->bytes, (uint32_t)packet->length,
-                (struct sockaddr*) & packet->addr_from,
-                (struct sockaddr*) & packet->addr_to, 0, 0,
-                simulated_time);
+    if (ret == 0) {
+        picoquic_update_pacing_rate(cnx, cnx->path[0], test_byte_per_sec, test_quantum);
 
-            if (ret == 0) {
-                picoquic_cnx_t* next = test_ctx->qserver->cnx_list;
+        while (ret == 0 && nb_sent < nb_target) {
+            nb_round++;
+            if (nb_round > nb_target) {
+                DBG_PRINTF("Pacing needs more that %d rounds for %d packets", nb_round, nb_target);
+                ret = -1;
+            }
+            else {
+                uint64_t next_time = current_time + 10000000;
 
-                while (next != NULL && picoquic_compare_connection_id(&next->initial_cnxid, &test_ctx->cnx_client->initial_cnxid) != 0) {
-                    next = next->next_in_table;
+                while (ret == 0 && nb_sent < nb_target &&
+                    picoquic_is_sending_authorized_by_pacing(cnx, cnx->path[0], current_time, &next_time)) {
+                    uint64_t departure = picoquic_update_pacing_after_send(cnx->path[0], current_time);
+
+                    if (departure < current_time * 1000 || departure > (current_time + test_horizon) * 1000) {
+                        DBG_PRINTF("Departure %" PRIu64 " out of range at time %" PRIu64, departure, current_time);
+                        ret = -1;
+                    }
+                    else if (nb_sent > 0 && departure < last_departure) {
+                        DBG_PRINTF("Departure %" PRIu64 " before previous %" PRIu64, departure, last_departure);
+                        ret = -1;
+                    }
+                    else if (nb_sent > 0 && departure - last_departure == (uint64_t)cnx->path[0]->pacing_packet_time_nanosec) {
+                        nb_spaced++;
+                    }
+                    last_departure = departure;
+                    nb_sent++;
                 }
 
-                if (next != NULL) {
-                    test_ctx->cnx_server = next;
-                } else {
-                    ret = -1;
-                    DBG_PRINTF("Could not create server side connection, ret = %d\n", ret);
+                if (ret == 0 && nb_sent < nb_target) {
+                    if (next_time > current_time) {
+                        current_time = next_time;
+                    }
+                    else {
+                        DBG_PRINTF("Pacing next = %" PRIu64", current = %" PRIu64, next_time, current_time);
+                        ret = -1;
+                    }
                 }
             }
         }
-    }
-
-    while (ret == 0 && test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state != picoquic_state_disconnected && nb_loops < 1024 && nb_inactive < 256) {
-        /* Update the time to the next server time */
-        simulated_time = test_ctx->cnx_server->next_wake_time;
-        packet->length = 0;
-        nb_loops++;
-
-        ret = picoquic_prepare_packet(test_ctx->cnx_server, simulated_time,
-            packet->bytes, PICOQUIC_MAX_PACKET_SIZE, &packet->length,
-            &packet->addr_to, &packet->addr_from);
 
-        if (ret == PICOQUIC_ERROR_DISCONNECTED) {
-            ret = 0;
-        }
+        /* Apart from the initial burst, all packets are spaced by the packet time */
+        if (ret == 0) {
+            int nb_burst = (int)(test_quantum / cnx->path[0]->send_mtu) + 1;
 
-        if (ret != 0)
-        {
-            DBG_PRINTF("Could not create server packet, ret=%x\n", ret);
-        }
-        else if (packet->length > 0) {
-            data_sent_by_server += packet->length;
-            nb_server_packets++;
-            nb_inactive = 0;
-        }
-        else {
-            nb_inactive++;
+            if (nb_spaced + nb_burst < nb_target - 1) {
+                DBG_PRINTF("Only %d packets out of %d are spaced by %" PRId64 "ns", nb_spaced, nb_target,
+                    cnx->path[0]->pacing_packet_time_nanosec);
+                ret = -1;
+            }
         }
-    }
 
-    if (ret == 0 && test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state != picoquic_state_disconnected) {
-        DBG_PRINTF("Simulation was looping, closed before termination, loops: %d, inactive: %d\n", nb_loops, nb_inactive);
-        ret = -1;
-    }
+        /* Verify that the total send time matches expectations, to the nanosecond */
+        if (ret == 0) {
+            uint64_t time_max = nb_target * (uint64_t)cnx->path[0]->pacing_packet_time_nanosec;
+            uint64_t time_min = time_max - (uint64_t)cnx->path[0]->pacing_bucket_max;
 
-    if (ret == 0 && data_sent_by_server > 3*data_sent_by_client) {
-        DBG_PRINTF("Client sent %d bytes, server sent >3x more, %d bytes, %d packets\n", (int)data_sent_by_client, (int)data_sent_by_server, nb_server_packets);
-        ret = -1;
+            if (last_departure > time_max) {
+                DBG_PRINTF("Pacing used = %" PRIu64"ns, expected max = %" PRIu64, last_departure, time_max);
+                ret = -1;
+            }
+            else if (last_departure < time_min) {
+                DBG_PRINTF("Pacing used = %" PRIu64"ns, expected min = %" PRIu64, last_departure, time_min);
+                ret = -1;
+            }
+        }
     }
 
+    /* Small windows are paced too */
+    if (ret == 0) {
+        cnx->path[0]->smoothed_rtt = 100000;
+        cnx->path[0]->cwin = 4 * (uint64_t)cnx->path[0]->send_mtu;
+        picoquic_update_pacing_data(cnx, cnx->path[0], 0);
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+        if (cnx->path[0]->pacing_packet_time_nanosec != 25000000) {
+            DBG_PRINTF("Small window packet time = %" PRId64 "ns, expected 25000000", cnx->path[0]->pacing_packet_time_nanosec);
+            ret = -1;
+        }
     }
 
-    if (packet != NULL) {
-        free(packet);
+    if (quic != NULL) {
+        picoquic_free(quic);
     }
 
     return ret;
 }
 
-/* ESNI Test. */
-uint64_t demo_server_test_time_from_esni_rr(char const* esni_rr_file)
+/* Delivery rate sampler test. Packets of 1250 bytes are sent every ms, i.e.,
+ * 1.25 MB/s, on a path with 20 ms RTT. The acknowledgements are either sent
+ * for each packet, sent every 10 packets as with ACK frequency, or compressed
+ * in bursts. The samples shall be within 10% of the sending rate. Compressed
+ * acknowledgements cause low samples at the beginning of each burst, which a
+ * max filter discards, but no sample shall exceed the sending rate by more
+ * than 10%. In the app limited variant, the rate is halved for 100 packets: the
+ * samples of that period shall be marked app limited, and shall not lower
+ * the bandwidth estimate.
+ */
+#define RATE_SAMPLER_TEST_NB_PACKETS 400
+#define RATE_SAMPLER_TEST_LENGTH 1250
+#define RATE_SAMPLER_TEST_RTT 20000
+#define RATE_SAMPLER_TEST_RATE 1250000
+
+static int rate_sampler_test_one(picoquic_cnx_t* cnx, int ack_every, int is_compressed, int is_app_limited)
 {
-    uint8_t esnikeys[2048];
-    size_t esnikeys_len;
-    uint64_t not_before = 0;
-    uint64_t not_after = 0;
-    uint64_t esni_start = 0;
-    uint16_t version = 0;
-    uint16_t l;
+    int ret = 0;
+    picoquic_path_t* path_x = cnx->path[0];
+    picoquic_packet_t* packets = (picoquic_packet_t*)malloc(RATE_SAMPLER_TEST_NB_PACKETS * sizeof(picoquic_packet_t));
+    uint64_t send_time[RATE_SAMPLER_TEST_NB_PACKETS];
+    uint64_t ack_time[RATE_SAMPLER_TEST_NB_PACKETS];
+    uint64_t start_time = 1000000;
+    uint64_t current_time = start_time;
+    int nb_sent = 0;
+    int nb_acked = 0;
+    int nb_valid = 0;
+    int nb_limited = 0;
+    uint64_t rate_max = 0;
 
-    /* Load the rr file */
-    if (picoquic_esni_load_rr(esni_rr_file, esnikeys, sizeof(esnikeys), &esnikeys_len) == 0)
-    {
-        size_t byte_index = 0;
+    if (packets == NULL) {
+        return -1;
+    }
+    memset(packets, 0, RATE_SAMPLER_TEST_NB_PACKETS * sizeof(picoquic_packet_t));
 
-        if (byte_index + 2 <= esnikeys_len) {
-            version = PICOPARSE_16(&esnikeys[byte_index]);
-            byte_index += 2;
-        }
-        /* 4 bytes checksum */
-        byte_index += 4;
-        /* If > V2, 16 bits length + published SNI */
-        if (version != 0xFF01 && byte_index + 2 <= esnikeys_len) {
-            l = PICOPARSE_16(&esnikeys[byte_index]);
-            byte_index += (size_t)l + 2;
-        }
-        /* 16 bits length + key exchanges */
-        if (byte_index + 2 <= esnikeys_len) {
-            l = PICOPARSE_16(&esnikeys[byte_index]);
-            byte_index += (size_t)l + 2;
-        }
-        /* 16 bits length + ciphersuites */
-        if (byte_index + 2 <= esnikeys_len) {
-            l = PICOPARSE_16(&esnikeys[byte_index]);
-            byte_index += (size_t)l + 2;
+    /* Reset the path delivery state */
+    path_x->delivered = 0;
+    path_x->delivered_time_last = 0;
+    path_x->delivered_sent_last = 0;
+    path_x->delivered_limited_index = 0;
+    path_x->bytes_in_transit = 0;
+    path_x->bandwidth_estimate = 0;
+    path_x->rtt_min = RATE_SAMPLER_TEST_RTT;
+    memset(&path_x->rate_sample, 0, sizeof(picoquic_rate_sample_t));
+
+    /* Compute the schedule of sending and acknowledgements */
+    for (int i = 0; i < RATE_SAMPLER_TEST_NB_PACKETS; i++) {
+        send_time[i] = current_time;
+        current_time += (is_app_limited && i >= 200 && i < 300) ? 2000 : 1000;
+    }
+    for (int i = 0; i < RATE_SAMPLER_TEST_NB_PACKETS; i++) {
+        int last = i - (i % ack_every) + ack_every - 1;
+        if (last >= RATE_SAMPLER_TEST_NB_PACKETS) {
+            last = RATE_SAMPLER_TEST_NB_PACKETS - 1;
         }
-        /* 16 bits padded length */
-        byte_index += 2;
-        /* 64 bits not before */
-        if (byte_index + 8 <= esnikeys_len) {
-            not_before = PICOPARSE_64(&esnikeys[byte_index]);
-            byte_index += 8;
+        ack_time[i] = send_time[last] + RATE_SAMPLER_TEST_RTT;
+    }
+    if (is_compressed) {
+        /* Acknowledgements are held, and delivered in bursts of 20, 50us apart */
+        for (int i = 0; i < RATE_SAMPLER_TEST_NB_PACKETS; i++) {
+            int last = i - (i % 20) + 19;
+            if (last >= RATE_SAMPLER_TEST_NB_PACKETS) {
+                last = RATE_SAMPLER_TEST_NB_PACKETS - 1;
+            }
+            ack_time[i] = send_time[last] + RATE_SAMPLER_TEST_RTT + 50 * (i % 20);
         }
-        /* 64 bits not after */
-        if (byte_index + 8 <= esnikeys_len) {
-            not_after = PICOPARSE_64(&esnikeys[byte_index]);
+    }
+
+    while (ret == 0 && nb_acked < RATE_SAMPLER_TEST_NB_PACKETS) {
+        if (nb_sent < RATE_SAMPLER_TEST_NB_PACKETS && send_time[nb_sent] < ack_time[nb_acked]) {
+            picoquic_packet_t* packet = &packets[nb_sent];
+            current_time = send_time[nb_sent];
+            if (is_app_limited && nb_sent >= 200 && nb_sent < 300) {
+                picoquic_rate_sampler_app_limited(path_x);
+            }
+            packet->length = RATE_SAMPLER_TEST_LENGTH;
+            packet->send_time = current_time;
+            picoquic_rate_sampler_packet_sent(cnx, path_x, packet, current_time);
+            path_x->bytes_in_transit += packet->length;
+            nb_sent++;
         }
         else {
-            not_after = not_before;
+            picoquic_rate_sample_t* rs = &path_x->rate_sample;
+            current_time = ack_time[nb_acked];
+            while (nb_acked < nb_sent && ack_time[nb_acked] == current_time) {
+                path_x->bytes_in_transit -= packets[nb_acked].length;
+                picoquic_rate_sampler_packet_acked(path_x, &packets[nb_acked], current_time);
+                nb_acked++;
+            }
+            picoquic_rate_sampler_generate(cnx, path_x, current_time);
+
+            if (rs->is_valid && current_time > start_time + 3 * RATE_SAMPLER_TEST_RTT) {
+                nb_valid++;
+                if (rs->is_app_limited) {
+                    nb_limited++;
+                    if (path_x->bandwidth_estimate < (9 * RATE_SAMPLER_TEST_RATE) / 10) {
+                        DBG_PRINTF("App limited sample at %" PRIu64 " lowered the estimate to %" PRIu64,
+                            current_time, path_x->bandwidth_estimate);
+                        ret = -1;
+                    }
+                }
+                else if ((!is_compressed && rs->delivery_rate < (9 * RATE_SAMPLER_TEST_RATE) / 10) ||
+                    rs->delivery_rate > (11 * RATE_SAMPLER_TEST_RATE) / 10) {
+                    DBG_PRINTF("Ack every %d, compressed %d: sample at %" PRIu64 ", rate %" PRIu64 ", delivered %" PRIu64 " in %" PRIu64 "us",
+                        ack_every, is_compressed,
+                        current_time, rs->delivery_rate, rs->delivered, rs->interval);
+                    ret = -1;
+                }
+                else if (rs->delivery_rate > rate_max) {
+                    rate_max = rs->delivery_rate;
+                }
+            }
         }
-        /* 16 bits length + extensions. ignored */
-    }
-    esni_start = ((not_before + not_after) / 2) * 1000000;
-
-    return esni_start;
-}
-
-
-int esni_test()
-{
-    uint64_t simulated_time = 0;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    char test_server_esni_key_file[512];
-    char test_server_esni_rr_file[512];
-    int ret = 0;
-
-    /* Locate the esni record and key files */
-    ret = picoquic_get_input_path(test_server_esni_key_file, sizeof(test_server_esni_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_ESNI_KEY);
-
-    if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_esni_rr_file, sizeof(test_server_esni_rr_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_ESNI_RR);
     }
 
-    /* Set the simulated time to conform to the ESNI ticket */
-    if (ret == 0) {
-        simulated_time = demo_server_test_time_from_esni_rr(test_server_esni_rr_file);
+    if (ret == 0 && (nb_valid == 0 || rate_max < (9 * RATE_SAMPLER_TEST_RATE) / 10 || (is_app_limited && nb_limited < 50) || (!is_app_limited && nb_limited != 0))) {
+        DBG_PRINTF("Ack every %d, compressed %d, app limited %d: %d valid samples, %d app limited, max rate %" PRIu64,
+            ack_every, is_compressed, is_app_limited, nb_valid, nb_limited, rate_max);
+        ret = -1;
     }
 
-    /* Create the test context */
-    if (ret == 0) {
-        tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL);
+    path_x->bytes_in_transit = 0;
+    free(packets);
 
-        if (ret == 0 && test_ctx == NULL) {
-            ret = -1;
-        }
-    }
+    return ret;
+}
 
-    /* Add the esni parameters to the server */
-    if (ret == 0) {
-        ret = picoquic_esni_load_key(test_ctx->qserver, test_server_esni_key_file);
-    }
+int rate_sampler_test()
+{
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
 
-    if (ret == 0) {
-        ret = picoquic_esni_server_setup(test_ctx->qserver, test_server_esni_rr_file);
-    }
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
 
-    /* Add the SNI parameters to the client */
-    if (ret == 0) {
-        ret = picoquic_esni_client_from_file(test_ctx->cnx_client, test_server_esni_rr_file);
-    }
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
 
-    /* Perform the transmission test */
-    if (ret == 0) {
-        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 0, 250000);
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
     }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
 
-    /* Verify that ESNI was properly negotiated */
-    if (ret == 0) {
-        if (picoquic_esni_version(test_ctx->cnx_client) == 0) {
-            DBG_PRINTF("%s", "ESNI not negotiated for client connection.\n");
-            ret = -1;
-        }
-        else if (picoquic_esni_version(test_ctx->cnx_server) == 0) {
-            DBG_PRINTF("%s", "ESNI not negotiated for server connection.\n");
-            ret = -1;
-        }
-        else if (picoquic_esni_version(test_ctx->cnx_client) != picoquic_esni_version(test_ctx->cnx_server)) {
-            DBG_PRINTF("ESNI client version %d, server version %d.\n",
-                picoquic_esni_version(test_ctx->cnx_client), picoquic_esni_version(test_ctx->cnx_server));
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
             ret = -1;
         }
-        else if (memcmp(picoquic_esni_nonce(test_ctx->cnx_client), picoquic_esni_nonce(test_ctx->cnx_server), PTLS_ESNI_NONCE_SIZE) != 0) {
-            DBG_PRINTF("%s", "Client and server nonce do not match.\n");
-            ret = -1;
+        else {
+            cnx->cnx_state = picoquic_state_ready;
         }
     }
 
-    /* And then free the resource
-     */
+    if (ret == 0) {
+        ret = rate_sampler_test_one(cnx, 1, 0, 0);
+    }
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+    if (ret == 0) {
+        ret = rate_sampler_test_one(cnx, 10, 0, 0);
     }
 
-    return ret;
+    if (ret == 0) {
+        ret = rate_sampler_test_one(cnx, 1, 1, 0);
+    }
+
+    if (ret == 0) {
+        ret = rate_sampler_test_one(cnx, 2, 0, 1);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
 
+    return ret;
 }
 
-static int blackhole_test_one(picoquic_congestion_algorithm_t* ccalgo, uint64_t max_completion_time, uint64_t jitter)
+/* Verify that the integer implementations of the Cubic formulas and of the
+ * pacing rate computation match the floating point versions that they
+ * replaced, within 0.1%.
+ */
+static double cubic_fixed_point_root_ref(double x)
 {
-    uint64_t simulated_time = 0;
-    uint64_t latency = 15000;
-    uint64_t picoseq_per_byte_10 = (1000000ull * 8) / 10;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = 0;
+    double v = 1;
+    double y = 1.0;
+    double y2;
+    double y3;
 
-    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL);
+    while (v > x * 8) {
+        v /= 8;
+        y /= 2;
+    }
 
-    if (ret == 0 && test_ctx == NULL) {
-        ret = -1;
+    while (v < x) {
+        v *= 8;
+        y *= 2;
     }
 
-    /* Simulate 10 ms link, 15ms latency, 2 seconds blackhole */
-    if (ret == 0) {
-        picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
-        picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
+    /* The original code stopped after 3 steps, which is not quite
+     * enough for the largest values tested here. */
+    for (int i = 0; i < 8; i++) {
+        y2 = y * y;
+        y3 = y2 * y;
+        y += (x - y3) / (3.0 * y2);
+    }
 
-        test_ctx->c_to_s_link->jitter = jitter;
-        test_ctx->c_to_s_link->microsec_latency = latency;
-        test_ctx->c_to_s_link->picosec_per_byte = picoseq_per_byte_10;
-        test_ctx->s_to_c_link->microsec_latency = latency;
-        test_ctx->s_to_c_link->picosec_per_byte = picoseq_per_byte_10;
-        test_ctx->s_to_c_link->jitter = jitter;
-        test_ctx->blackhole_end = 7000000;
-        test_ctx->blackhole_start = 5000000;
+    return y;
+}
 
-        if (ret == 0) {
-            ret = tls_api_one_scenario_body(test_ctx, &simulated_time, test_scenario_10mb, sizeof(test_scenario_10mb), 0, 0, 0, 2 * latency, max_completion_time);
-        }
-    }
+static int cubic_fixed_point_check(char const* label, uint64_t x, double fixed, double ref, double slack)
+{
+    int ret = 0;
+    double delta = (fixed > ref) ? fixed - ref : ref - fixed;
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+    if (delta > ref * 0.001 + slack) {
+        DBG_PRINTF("%s(%llu): fixed %f, floating point %f\n", label, (unsigned long long)x, fixed, ref);
+        ret = -1;
     }
-
     return ret;
 }
 
-int blackhole_test()
+static int cubic_fixed_point_root_test()
 {
-    int ret = blackhole_test_one(picoquic_bbr_algorithm, 15000000, 0);
+    int ret = 0;
+    uint64_t random_ctx = 0xcc0bec0bec0bec0bull;
+
+    /* Small values are exact */
+    for (uint64_t x = 0; ret == 0 && x < 100000; x++) {
+        uint64_t y = picoquic_cc_cube_root(x);
+        if (y * y * y > x || (y + 1) * (y + 1) * (y + 1) <= x) {
+            DBG_PRINTF("Cube root(%llu) = %llu\n", (unsigned long long)x, (unsigned long long)y);
+            ret = -1;
+        }
+    }
+    /* Large values within 0.1% of the floating point root */
+    for (int i = 0; ret == 0 && i < 100000; i++) {
+        uint64_t x = picoquic_test_random(&random_ctx) >> (i % 40);
+        ret = cubic_fixed_point_check("cube root", x, (double)picoquic_cc_cube_root(x),
+            cubic_fixed_point_root_ref((double)x), 1.0);
+    }
+    if (ret == 0 && picoquic_cc_cube_root(UINT64_MAX) != 2642245) {
+        DBG_PRINTF("Cube root(UINT64_MAX) = %llu\n", (unsigned long long)picoquic_cc_cube_root(UINT64_MAX));
+        ret = -1;
+    }
 
     return ret;
 }
 
-/* Verify that the code operates correctly when the ack frequency extension is no used
- */
-
-int no_ack_frequency_test()
+static int cubic_fixed_point_curve_test()
 {
     int ret = 0;
-    picoquic_tp_t client_parameters;
-    picoquic_tp_t server_parameters;
+    const uint64_t mtu[3] = { 1232, 1440, 1500 };
 
-    for (int i = 1; ret == 0 && i <= 3; i++) {
-        memset(&client_parameters, 0, sizeof(picoquic_tp_t));
-        memset(&server_parameters, 0, sizeof(picoquic_tp_t));
-        picoquic_init_transport_parameters(&client_parameters, 1);
-        picoquic_init_transport_parameters(&server_parameters, 0);
+    for (int m = 0; ret == 0 && m < 3; m++) {
+        for (uint64_t W_max = 2 * mtu[m]; ret == 0 && W_max < 4000000000ull; W_max += W_max / 3) {
+            double W_max_packets = (double)W_max / (double)mtu[m];
+            double K_ref = cubic_fixed_point_root_ref(W_max_packets * (1.0 - 7.0 / 8.0) / 0.4);
+            uint64_t K = picoquic_cubic_K(W_max, mtu[m]);
 
-        client_parameters.min_ack_delay = ((uint64_t)(1u-(i & 1)))*1000u;
-        server_parameters.enable_loss_bit = (1 - ((i > 1) & 1))*1000;
+            ret = cubic_fixed_point_check("K", W_max, (double)K, K_ref * 1000000.0, 1.0);
 
-        ret = tls_api_one_scenario_test(test_scenario_very_long, sizeof(test_scenario_very_long), 0, 128, 0, 0, 0, 2000000, &client_parameters, &server_parameters);
-        if (ret != 0) {
-            DBG_PRINTF("No min ack delay test fails for client: %d, server: %d, ret = %d", i & 1, i >> 1, ret);
+            for (uint64_t elapsed = 0; ret == 0 && elapsed < 4 * K + 1000000; elapsed += (K / 16) + 1000) {
+                double delta_t_sec = ((double)elapsed / 1000000.0) - ((double)K / 1000000.0);
+                double W_cubic = (0.4 * delta_t_sec * delta_t_sec * delta_t_sec) + W_max_packets;
+
+                ret = cubic_fixed_point_check("W_cubic", elapsed, (double)picoquic_cubic_W_cubic(W_max, K, mtu[m], elapsed),
+                    W_cubic * (double)mtu[m], 2.0);
+            }
         }
     }
 
     return ret;
 }
 
-/* Check that a connection does fail in a reasonable time after a transmission
- * drops.
- */
-
-static int connection_drop_test_one(picoquic_state_enum target_client_state, picoquic_state_enum target_server_state, int target_is_client)
+static int cubic_fixed_point_pacing_test()
 {
-    uint64_t simulated_time = 0;
-    uint64_t target_time = PICOQUIC_MICROSEC_HANDSHAKE_MAX;
-    const char* target_name = (target_is_client) ? "client" : "server";
-    picoquic_cnx_t* target_cnx = NULL;
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
 
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
 
-    if (ret == 0) {
-        int nb_trials = 0;
-        int nb_inactive = 0;
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
 
-        while (ret == 0 && nb_trials < 1024 && nb_inactive < 512 && (!TEST_CLIENT_READY || (test_ctx->cnx_server == NULL || !TEST_SERVER_READY))) {
-            int was_active = 0;
-            nb_trials++;
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
 
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+    }
 
-            if (test_ctx->cnx_client->cnx_state == picoquic_state_disconnected &&
-                (test_ctx->cnx_server == NULL || test_ctx->cnx_server->cnx_state == picoquic_state_disconnected)) {
-                break;
+    for (uint64_t cwin = 4 * PICOQUIC_MAX_PACKET_SIZE; ret == 0 && cwin < 1000000000ull; cwin += cwin / 2) {
+        for (uint64_t rtt = 1000; ret == 0 && rtt < 2000000; rtt *= 3) {
+            picoquic_path_t* path_x = cnx->path[0];
+            double pacing_rate = ((double)cwin / (double)(rtt * 1000)) * 1000000000.0;
+            double quantum = (double)(cwin / 4);
+
+            if (quantum < 2.0 * path_x->send_mtu) {
+                quantum = 2.0 * path_x->send_mtu;
+            }
+            else if (quantum > 16.0 * path_x->send_mtu) {
+                quantum = 16.0 * path_x->send_mtu;
             }
 
-            if (test_ctx->cnx_client->cnx_state >= target_client_state ||
-                (test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state >= target_server_state)) {
-                break;
+            path_x->cwin = cwin;
+            path_x->smoothed_rtt = rtt;
+            picoquic_update_pacing_data(cnx, path_x, 0);
+
+            ret = cubic_fixed_point_check("pacing rate", cwin, (double)path_x->pacing_rate, pacing_rate, 1.0);
+            if (ret == 0) {
+                double packet_time = ((double)path_x->send_mtu / pacing_rate) * 1000000000.0;
+                if (packet_time > 1000000000.0) {
+                    packet_time = 1000000000.0;
+                }
+                ret = cubic_fixed_point_check("packet time", cwin, (double)path_x->pacing_packet_time_nanosec, packet_time, 1.0);
+            }
+            if (ret == 0) {
+                ret = cubic_fixed_point_check("bucket max", cwin, (double)path_x->pacing_bucket_max,
+                    (quantum / pacing_rate) * 1000000000.0, 1.0);
             }
         }
     }
 
-    if (ret == 0) {
-        target_cnx = (target_is_client) ? test_ctx->cnx_client : test_ctx->cnx_server;
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
 
-        if (target_cnx == NULL) {
-            DBG_PRINTF("Target connection (%s) already dropped", target_name);
-            ret = -1;
-        }
-        else if (target_cnx->cnx_state >= picoquic_state_ready) {
-            DBG_PRINTF("Target connection (%s) already ready", target_name);
-            ret = -1;
-        }
+    return ret;
+}
+
+int cubic_fixed_point_test()
+{
+    int ret = cubic_fixed_point_root_test();
+
+    if (ret == 0) {
+        ret = cubic_fixed_point_curve_test();
     }
 
     if (ret == 0) {
-        int nb_trials = 0;
-        int nb_inactive = 0;
-        int disconnected_in_time = 0;
+        ret = cubic_fixed_point_pacing_test();
+    }
 
-        while (ret == 0 && nb_trials < 1024 && nb_inactive < 512) {
-            struct sockaddr_storage a_from;
-            struct sockaddr_storage a_to;
-            uint8_t packet[PICOQUIC_MAX_PACKET_SIZE];
-            size_t length = 0;
+    return ret;
+}
 
-            if (target_cnx->next_wake_time > simulated_time) {
-                simulated_time = target_cnx->next_wake_time;
-            }
+/* Test of the statistics counters. Packets sent by the client must be
+ * counted as received by the server, the context totals must include the
+ * connections, and must not change when a connection is deleted.
+ */
+#ifndef PICOQUIC_DISABLE_STATS
+static int stats_test_one()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_stats_t client_stats;
+    picoquic_stats_t server_stats;
+    picoquic_stats_t client_total;
+    picoquic_stats_t client_after;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
 
-            if (simulated_time > target_time + target_cnx->start_time) {
-                break;
-            }
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
 
-            ret = picoquic_prepare_packet(target_cnx, simulated_time, packet, PICOQUIC_MAX_PACKET_SIZE,
-                &length, &a_to, &a_from);
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 20000, 3600000);
+    }
 
-            if (ret == PICOQUIC_ERROR_DISCONNECTED) {
-                ret = 0;
-            }
+    if (ret == 0 && (picoquic_get_stats(test_ctx->qclient, test_ctx->cnx_client, &client_stats) != 0 ||
+        picoquic_get_stats(test_ctx->qserver, NULL, &server_stats) != 0 ||
+        picoquic_get_stats(test_ctx->qclient, NULL, &client_total) != 0)) {
+        DBG_PRINTF("%s", "Cannot get the statistics");
+        ret = -1;
+    }
 
-            if (target_cnx->cnx_state == picoquic_state_disconnected) {
-                disconnected_in_time = 1;
-                break;
-            }
+    for (int epoch = 0; ret == 0 && epoch < PICOQUIC_STATS_NB_EPOCHS; epoch++) {
+        DBG_PRINTF("Epoch %d, client sent %" PRIu64 " packets, %" PRIu64 " bytes, server received %" PRIu64 " packets, %" PRIu64 " bytes\n",
+            epoch, client_stats.nb_packets_sent[epoch], client_stats.nb_bytes_sent[epoch],
+            server_stats.nb_packets_received[epoch], server_stats.nb_bytes_received[epoch]);
+        if (epoch != picoquic_epoch_0rtt && client_stats.nb_packets_sent[epoch] == 0) {
+            DBG_PRINTF("No packet sent in epoch %d", epoch);
+            ret = -1;
+        }
+        else if (server_stats.nb_packets_received[epoch] != client_stats.nb_packets_sent[epoch] ||
+            server_stats.nb_bytes_received[epoch] != client_stats.nb_bytes_sent[epoch]) {
+            DBG_PRINTF("Packets received by the server do not match those sent in epoch %d", epoch);
+            ret = -1;
         }
+    }
 
-        if (ret == 0 && !disconnected_in_time) {
-            DBG_PRINTF("Connection not disconnected after %lld microsec", simulated_time);
+    if (ret == 0 && (client_stats.nb_ack_frames_received == 0 ||
+        client_stats.nb_ack_ranges_received < client_stats.nb_ack_frames_received ||
+        server_stats.nb_stream_frames_received == 0 ||
+        server_stats.nb_packets_with_stream_frames > server_stats.nb_stream_frames_received ||
+        server_stats.nb_decryption_failures != 0 || server_stats.nb_duplicate_packets != 0)) {
+        DBG_PRINTF("Unexpected frame counts, %" PRIu64 " acks, %" PRIu64 " ranges, %" PRIu64 " stream frames in %" PRIu64 " packets",
+            client_stats.nb_ack_frames_received, client_stats.nb_ack_ranges_received,
+            server_stats.nb_stream_frames_received, server_stats.nb_packets_with_stream_frames);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        uint64_t nb_wake_ups = 0;
+        for (int i = 0; i < PICOQUIC_STATS_NB_WAKE_SOURCES; i++) {
+            nb_wake_ups += client_stats.nb_wake_ups[i];
+        }
+        if (nb_wake_ups == 0 || client_total.nb_packet_pool_hits + client_total.nb_packet_pool_misses == 0 ||
+            client_stats.nb_packet_pool_misses != 0 ||
+            client_total.nb_packets_sent[picoquic_epoch_1rtt] != client_stats.nb_packets_sent[picoquic_epoch_1rtt]) {
+            DBG_PRINTF("Unexpected context counts, %" PRIu64 " wake ups, %" PRIu64 " pool hits, %" PRIu64 " misses",
+                nb_wake_ups, client_total.nb_packet_pool_hits, client_total.nb_packet_pool_misses);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = NULL;
+        if (picoquic_get_stats(test_ctx->qclient, NULL, &client_after) != 0 ||
+            memcmp(&client_total, &client_after, sizeof(picoquic_stats_t)) != 0) {
+            DBG_PRINTF("%s", "Context statistics changed when deleting the connection");
             ret = -1;
         }
     }
@@ -8005,152 +10629,255 @@ static int connection_drop_test_one(picoquic_state_enum target_client_state, pic
 
     return ret;
 }
+#endif
 
-int connection_drop_test()
+int stats_test()
+{
+#ifdef PICOQUIC_DISABLE_STATS
+    /* The counters are compiled out, the call must fail */
+    picoquic_stats_t stats;
+    return (picoquic_get_stats(NULL, NULL, &stats) != 0) ? 0 : -1;
+#else
+    return stats_test_one();
+#endif
+}
+
+/* Test of the latency histograms: precision of the percentiles, merging,
+ * and round trip of the binary snapshot. After a simple scenario, the
+ * client must have recorded RTT, handshake and stream latencies.
+ */
+static int histogram_percentile_test()
 {
     int ret = 0;
-    picoquic_state_enum target_state[9] = {
-        picoquic_state_client_init_sent,
-        picoquic_state_client_renegotiate,
-        picoquic_state_client_init_resent,
-        picoquic_state_server_init,
-        picoquic_state_server_handshake,
-        picoquic_state_client_handshake_start,
-        picoquic_state_server_false_start,
-        picoquic_state_server_almost_ready,
-        picoquic_state_client_almost_ready
-    };
-    int target_is_client[9] = {
-        1, 1, 1, 0, 0, 1, 0, 0, 1 };
+    picoquic_histogram_t* h_all = (picoquic_histogram_t*)malloc(sizeof(picoquic_histogram_t));
+    picoquic_histogram_t* h_odd = (picoquic_histogram_t*)malloc(sizeof(picoquic_histogram_t));
+    picoquic_histogram_t* h_even = (picoquic_histogram_t*)malloc(sizeof(picoquic_histogram_t));
+
+    if (h_all == NULL || h_odd == NULL || h_even == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(h_all, 0, sizeof(picoquic_histogram_t));
+        memset(h_odd, 0, sizeof(picoquic_histogram_t));
+        memset(h_even, 0, sizeof(picoquic_histogram_t));
+
+        if (picoquic_histogram_value_at_percentile(h_all, 50.0) != 0) {
+            DBG_PRINTF("%s", "Empty histogram should return 0");
+            ret = -1;
+        }
+
+        /* Small values are recorded exactly */
+        for (uint64_t v = 0; ret == 0 && v < 32; v++) {
+            picoquic_histogram_t h_one;
+            memset(&h_one, 0, sizeof(h_one));
+            picoquic_histogram_record(&h_one, v);
+            if (picoquic_histogram_value_at_percentile(&h_one, 50.0) != v) {
+                DBG_PRINTF("Value %" PRIu64 " not recorded exactly", v);
+                ret = -1;
+            }
+        }
+
+        for (uint64_t v = 1; v <= 100000; v++) {
+            picoquic_histogram_record(h_all, v);
+            picoquic_histogram_record((v & 1) ? h_odd : h_even, v);
+        }
+
+        if (ret == 0 && (h_all->count != 100000 || h_all->min != 1 || h_all->max != 100000 ||
+            h_all->sum != 5000050000ull)) {
+            DBG_PRINTF("%s", "Unexpected count, min, max or sum");
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            const double percentiles[] = { 50.0, 99.0, 99.9 };
+
+            for (size_t i = 0; ret == 0 && i < sizeof(percentiles) / sizeof(double); i++) {
+                uint64_t expected = (uint64_t)(percentiles[i] * 1000.0);
+                uint64_t value = picoquic_histogram_value_at_percentile(h_all, percentiles[i]);
 
-    for (int i = 0; ret == 0 && i < 9; i++) {
-        picoquic_state_enum c_state = (target_is_client[i]) ? target_state[i] : picoquic_state_ready;
-        picoquic_state_enum s_state = (target_is_client[i]) ? picoquic_state_ready : target_state[i];
+                if (value < expected || value > expected + expected / PICOQUIC_HISTOGRAM_SUB_BUCKETS) {
+                    DBG_PRINTF("Percentile %f = %" PRIu64 ", expected %" PRIu64, percentiles[i], value, expected);
+                    ret = -1;
+                }
+            }
+        }
 
-        ret = connection_drop_test_one(c_state, s_state, target_is_client[i]);
-        if (ret == -1) {
-            DBG_PRINTF("connection drop test %d fails", i);
+        if (ret == 0 && (picoquic_histogram_value_at_percentile(h_all, 0.0) != 1 ||
+            picoquic_histogram_value_at_percentile(h_all, 100.0) != 100000)) {
+            DBG_PRINTF("%s", "Percentiles 0 and 100 should be min and max");
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            picoquic_histogram_merge(h_odd, h_even);
+            if (memcmp(h_odd, h_all, sizeof(picoquic_histogram_t)) != 0) {
+                DBG_PRINTF("%s", "Merged histogram differs");
+                ret = -1;
+            }
         }
     }
 
+    free(h_all);
+    free(h_odd);
+    free(h_even);
+
     return ret;
 }
 
-/* testing the pacing rate update function and the congestion
- * control parameter assessors.
- */
-
-#ifdef _WINDOWS
-#define PACING_RATE_TEST_REF "picoquictest\\pacing_rate_ref.txt"
-#else
-#define PACING_RATE_TEST_REF "picoquictest/pacing_rate_ref.txt"
-#endif
-#define PACING_RATE_CSV "pacing_rate.csv"
-
-
-int pacing_update_test()
+#ifndef PICOQUIC_DISABLE_STATS
+static int histogram_snapshot_test()
 {
     uint64_t simulated_time = 0;
-
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+    size_t bytes_max = 0x10000;
+    uint8_t* bytes = (uint8_t*)malloc(bytes_max);
+    picoquic_histogram_t* merged = (picoquic_histogram_t*)malloc(sizeof(picoquic_histogram_t) * picoquic_histogram_max);
+    picoquic_histogram_t* expected = (picoquic_histogram_t*)malloc(sizeof(picoquic_histogram_t) * picoquic_histogram_max);
+    size_t length = 0;
+    int ret = (bytes == NULL || merged == NULL || expected == NULL) ? -1 :
+        tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
 
     if (ret == 0 && test_ctx == NULL) {
         ret = -1;
     }
+
     if (ret == 0) {
-        /* Open a file to log bandwidth updates and document it in context */
-        test_ctx->bw_update = picoquic_file_open(PACING_RATE_CSV, "w");
-        if (test_ctx->bw_update == NULL) {
-            DBG_PRINTF("Could not write file <%s>", PACING_RATE_CSV);
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 0, 0, 0, 20000, 3600000);
+    }
+
+    if (ret == 0) {
+        const picoquic_histogram_id_t required[] = {
+            picoquic_histogram_rtt, picoquic_histogram_handshake,
+            picoquic_histogram_stream_first_byte, picoquic_histogram_stream_completion,
+            picoquic_histogram_ack_delay };
+
+        for (size_t i = 0; ret == 0 && i < sizeof(required) / sizeof(picoquic_histogram_id_t); i++) {
+            picoquic_histogram_t const* h = picoquic_get_histogram(test_ctx->qclient, required[i]);
+            if (h == NULL || h->count == 0) {
+                DBG_PRINTF("Client histogram %d is empty", (int)required[i]);
+                ret = -1;
+            }
+            else {
+                DBG_PRINTF("Histogram %d, %" PRIu64 " samples, p50 %" PRIu64 ", p99 %" PRIu64 ", p999 %" PRIu64 "\n",
+                    (int)required[i], h->count, picoquic_histogram_value_at_percentile(h, 50.0),
+                    picoquic_histogram_value_at_percentile(h, 99.0), picoquic_histogram_value_at_percentile(h, 99.9));
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* Merging the snapshots of client and server gives the merge of their histograms */
+        memset(merged, 0, sizeof(picoquic_histogram_t) * picoquic_histogram_max);
+        memset(expected, 0, sizeof(picoquic_histogram_t) * picoquic_histogram_max);
+        for (int i = 0; i < picoquic_histogram_max; i++) {
+            picoquic_histogram_merge(&expected[i], picoquic_get_histogram(test_ctx->qclient, i));
+            picoquic_histogram_merge(&expected[i], picoquic_get_histogram(test_ctx->qserver, i));
+        }
+
+        if (picoquic_get_histogram_snapshot(test_ctx->qclient, bytes, bytes_max, &length) != 0 ||
+            picoquic_histogram_snapshot_merge(merged, bytes, length) != 0 ||
+            picoquic_get_histogram_snapshot(test_ctx->qserver, bytes, bytes_max, &length) != 0 ||
+            picoquic_histogram_snapshot_merge(merged, bytes, length) != 0) {
+            DBG_PRINTF("%s", "Cannot export or merge the snapshots");
             ret = -1;
         }
-        else {
-            fprintf(test_ctx->bw_update, "Time, Pacing_rate_CB, Pacing_rate, CWIN, RTT\n");
-            /* Request bandwidth updates */
-            picoquic_subscribe_pacing_rate_updates(test_ctx->cnx_client, 0x8000, 0x10000);
+        else if (memcmp(merged, expected, sizeof(picoquic_histogram_t) * picoquic_histogram_max) != 0) {
+            DBG_PRINTF("%s", "Merged snapshots differ from merged histograms");
+            ret = -1;
+        }
+    }
 
-            /* Start a standard scenario, pushing 1MB from the client*/
-            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-                test_scenario_q_and_r, sizeof(test_scenario_q_and_r), 1000000, 0, 0, 20000, 3600000);
+    if (ret == 0) {
+        /* Truncated snapshots and small buffers are rejected */
+        size_t short_length = 0;
+
+        if (picoquic_histogram_snapshot_merge(merged, bytes, length - 1) == 0 ||
+            picoquic_get_histogram_snapshot(test_ctx->qserver, bytes, length - 1, &short_length) == 0 ||
+            short_length != 0) {
+            DBG_PRINTF("%s", "Truncated snapshot not detected");
+            ret = -1;
         }
     }
 
-    /* Free the test contex, which closes the trace file  */
     if (test_ctx != NULL) {
         tls_api_delete_ctx(test_ctx);
         test_ctx = NULL;
     }
 
-    /* compare the trace to the expected value */
-    if (ret == 0)
-    {
-        char pacing_rate_ref[512];
+    free(bytes);
+    free(merged);
+    free(expected);
 
-        ret = picoquic_get_input_path(pacing_rate_ref, sizeof(pacing_rate_ref), picoquic_solution_dir, PACING_RATE_TEST_REF);
+    return ret;
+}
+#endif
 
-        if (ret != 0) {
-            DBG_PRINTF("%s", "Cannot set the pacing rate test ref file name.\n");
-        }
-        else {
-            ret = picoquic_test_compare_text_files(PACING_RATE_CSV, pacing_rate_ref);
-        }
+int histogram_test()
+{
+    int ret = histogram_percentile_test();
+
+#ifndef PICOQUIC_DISABLE_STATS
+    if (ret == 0) {
+        ret = histogram_snapshot_test();
     }
+#endif
 
     return ret;
 }
 
-/* Test the direct receive API
+/* Test of the wake-up profile. Only the client profiles its wake-ups. Each
+ * call must be attributed to exactly one reason, and the profile must show
+ * the calls triggered by incoming packets and by the sending of packets.
  */
-
-int direct_receive_test()
+#ifndef PICOQUIC_DISABLE_STATS
+static int wake_profile_test_one()
 {
-    int ret = 0;
     uint64_t simulated_time = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    uint64_t loss_mask = 8;
-    uint64_t max_completion_microsec = 3500000;
+    picoquic_wake_profile_t profile;
+    picoquic_wake_profile_t server_profile;
+    uint64_t nb_calls = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
 
-    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time,
-        0, NULL, NULL);
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
 
     if (ret == 0) {
-        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
+        picoquic_set_wake_profiling(test_ctx->qclient, 1);
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 20000, 1000000);
+    }
 
-        /* Prepare to send data */
+    if (ret == 0) {
+        ret = picoquic_get_wake_profile(test_ctx->qclient, &profile);
         if (ret == 0) {
-            test_ctx->stream0_target = 0;
-            ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
-
-            if (ret != 0)
-            {
-                DBG_PRINTF("Init send receive scenario returns %d\n", ret);
-            }
+            ret = picoquic_get_wake_profile(test_ctx->qserver, &server_profile);
         }
+    }
 
-        /* Set the direct receive API for the stream number 4. */
-        if (ret == 0) {
-            ret = picoquic_mark_direct_receive_stream(test_ctx->cnx_client, 4, test_api_direct_receive_callback, (void*)&test_ctx->client_callback);
-
-            if (ret != 0)
-            {
-                DBG_PRINTF("Mark direct receive stream returns %d\n", ret);
-            }
+    for (int i = 0; ret == 0 && i < picoquic_wake_reason_max; i++) {
+        DBG_PRINTF("%s: %" PRIu64 " calls, %" PRIu64 " empty, %" PRIu64 " early, %" PRIu64 " late\n",
+            picoquic_wake_reason_name((picoquic_wake_reason_enum)i), profile.nb_calls[i], profile.nb_empty[i],
+            profile.nb_early[i], profile.nb_late[i]);
+        if (profile.nb_empty[i] > profile.nb_calls[i] ||
+            profile.nb_early[i] + profile.nb_late[i] > profile.nb_calls[i] ||
+            (profile.nb_late[i] == 0 && profile.late_delay[i] != 0)) {
+            DBG_PRINTF("Inconsistent profile for %s", picoquic_wake_reason_name((picoquic_wake_reason_enum)i));
+            ret = -1;
         }
-
-        /* Perform a data sending loop */
-        if (ret == 0) {
-            ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
-
-            if (ret != 0)
-            {
-                DBG_PRINTF("Data sending loop returns %d\n", ret);
-            }
+        else if (server_profile.nb_calls[i] != 0) {
+            DBG_PRINTF("%s", "Server wake-ups profiled without profiling");
+            ret = -1;
         }
+        nb_calls += profile.nb_calls[i];
+    }
 
-        if (ret == 0) {
-            ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, max_completion_microsec);
-        }
+    if (ret == 0 && (nb_calls == 0 || profile.nb_calls[picoquic_wake_reason_input] == 0 ||
+        profile.nb_calls[picoquic_wake_reason_send_more] == 0)) {
+        DBG_PRINTF("%s", "Missing wake-up reasons in the client profile");
+        ret = -1;
     }
 
     if (test_ctx != NULL) {
@@ -8160,235 +10887,415 @@ int direct_receive_test()
 
     return ret;
 }
+#endif
 
-/*
-* Application limited test.
-* The application is set to limit the max data values to stay lower than a set flow control window.
-* We verify that in these scenario the CWIN does not grow too much above the flow control window.
-*/
-#define APP_LIMIT_TRACE_CSV "app_limit_trace.csv"
-#define APP_LIMIT_TRACE_BIN "app_limit_trace.bin"
+int wake_profile_test()
+{
+#ifdef PICOQUIC_DISABLE_STATS
+    /* The profile is compiled out, the call must fail */
+    picoquic_wake_profile_t profile;
+    return (picoquic_get_wake_profile(NULL, &profile) != 0) ? 0 : -1;
+#else
+    return wake_profile_test_one();
+#endif
+}
 
-int app_limit_cc_test_one(
-    picoquic_congestion_algorithm_t* ccalgo, uint64_t max_completion_time)
+/* Test of the send limit accounting. The client allows little data, so the
+ * server sending the long stream must spend time limited by flow control.
+ * The times must not exceed the duration of the connection, the stream must
+ * be charged part of the congestion window time of the connection, and the server
+ * must log the summaries of the connection and of the stream when closing.
+ */
+#ifndef PICOQUIC_DISABLE_STATS
+typedef struct st_send_limits_test_log_t {
+    int nb_cnx_records;
+    int nb_stream_records;
+    int nb_errors;
+} send_limits_test_log_t;
+
+static void send_limits_test_sink(void* sink_ctx, const uint8_t* record, size_t length)
+{
+    send_limits_test_log_t* log = (send_limits_test_log_t*)sink_ctx;
+    bytestream_buf stream;
+    bytestream* s;
+    picoquic_connection_id_t cid;
+    uint64_t time_stamp = 0;
+    uint64_t event_type = 0;
+    uint64_t is_stream = 0;
+    uint64_t stream_id = 0;
+    uint64_t state = 0;
+    uint64_t nb_states = 0;
+
+    if (record == NULL) {
+        return;
+    }
+
+    s = bytestream_ref_init((bytestream*)&stream, record, length);
+    if (byteread_cid(s, &cid) != 0 || byteread_vint(s, &time_stamp) != 0 || byteread_vint(s, &event_type) != 0) {
+        log->nb_errors++;
+    }
+    else if (event_type == picoquic_log_event_send_limits) {
+        if (byteread_vint(s, &is_stream) != 0 || (is_stream && byteread_vint(s, &stream_id) != 0) ||
+            byteread_vint(s, &state) != 0 || byteread_vint(s, &nb_states) != 0 ||
+            state >= picoquic_send_limit_max || nb_states != picoquic_send_limit_max) {
+            log->nb_errors++;
+        }
+        else {
+            for (uint64_t i = 0; i < nb_states; i++) {
+                if (byteread_skip_vint(s) != 0) {
+                    log->nb_errors++;
+                    break;
+                }
+            }
+            if (is_stream) {
+                log->nb_stream_records++;
+            }
+            else {
+                log->nb_cnx_records++;
+            }
+        }
+    }
+}
+
+static int send_limits_test_one()
 {
     uint64_t simulated_time = 0;
-    uint64_t latency = 300000;
-    uint64_t picoseq_per_byte_1 = (1000000ull * 8) / 1;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_connection_id_t initial_cid = { {0x5e, 0x11, 0x11, 0x00, 5, 6, 7, 8}, 8 };
     picoquic_tp_t client_parameters;
-    uint64_t cwin_limit = 100000;
-    int ret = 0;
-
-    memset(&client_parameters, 0, sizeof(picoquic_tp_t));
-    picoquic_init_transport_parameters(&client_parameters, 1);
-    client_parameters.initial_max_data = 40000;
+    picoquic_send_limits_t limits;
+    picoquic_send_limits_t stream_limits;
+    send_limits_test_log_t log;
+    uint64_t total_time = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
 
-    ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, &client_parameters, NULL);
+    memset(&log, 0, sizeof(log));
 
     if (ret == 0 && test_ctx == NULL) {
         ret = -1;
     }
 
     if (ret == 0) {
-
-        picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
-        picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
-        picoquic_set_binlog(test_ctx->qserver, APP_LIMIT_TRACE_BIN);
-        test_ctx->qserver->use_long_log = 1;
-        test_ctx->cnx_client->is_flow_control_limited = 1;
-
-        test_ctx->c_to_s_link->jitter = 0;
-        test_ctx->c_to_s_link->microsec_latency = latency;
-        test_ctx->c_to_s_link->picosec_per_byte = picoseq_per_byte_1;
-        test_ctx->s_to_c_link->microsec_latency = latency;
-        test_ctx->s_to_c_link->picosec_per_byte = picoseq_per_byte_1;
-        test_ctx->s_to_c_link->jitter = 0;
-
-        if (ret == 0) {
-            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-                test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 2 * latency, max_completion_time);
-        }
+        picoquic_init_transport_parameters(&client_parameters, 1);
+        client_parameters.initial_max_data = 0x8000;
+        client_parameters.initial_max_stream_data_bidi_local = 0x8000;
+        ret = picoquic_set_default_tp(test_ctx->qclient, &client_parameters);
     }
 
-    /* Free the resource, which will close the log file.
-     */
+    if (ret == 0) {
+        ret = picoquic_set_binlog_sink(test_ctx->qserver, send_limits_test_sink, &log);
+    }
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+    if (ret == 0) {
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            initial_cid, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, 0,
+            PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        }
     }
 
-    /* Create a CSV file from the .bin log file */
     if (ret == 0) {
-        ret = picoquic_cc_log_file_to_csv(APP_LIMIT_TRACE_BIN, APP_LIMIT_TRACE_CSV);
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 20000, 2000000);
     }
 
-    /* Compute the max CWIN from the trace file */
-    if (ret == 0)
-    {
-        FILE* F = picoquic_file_open(APP_LIMIT_TRACE_CSV, "r");
-        uint64_t cwin_max = 0;
+    if (ret == 0 && (test_ctx->cnx_server == NULL ||
+        picoquic_get_send_limits(test_ctx->cnx_server, simulated_time, &limits) != 0 ||
+        picoquic_get_stream_send_limits(test_ctx->cnx_server, 4, simulated_time, &stream_limits) != 0)) {
+        DBG_PRINTF("%s", "Cannot get the send limits");
+        ret = -1;
+    }
 
-        if (F == NULL) {
-            DBG_PRINTF("Cannot open <%s>", APP_LIMIT_TRACE_CSV);
-            ret = -1;
-        }
-        else {
-            char buffer[512];
+    for (int i = 0; ret == 0 && i < picoquic_send_limit_max; i++) {
+        DBG_PRINTF("%s: connection %" PRIu64 ", stream %" PRIu64 "\n",
+            picoquic_send_limit_name((picoquic_send_limit_enum)i), limits.time_in_state[i], stream_limits.time_in_state[i]);
+        total_time += limits.time_in_state[i];
+    }
 
-            while (fgets(buffer, 512, F) != NULL) {
-                /* only consider number lines line */
-                if (buffer[0] >= '0' && buffer[0] <= '9') {
-                    uint64_t cwin = 0;
-                    int nb_comma = 0;
-                    int c_index = 0;
+    if (ret == 0 && (total_time == 0 || total_time > simulated_time ||
+        limits.time_in_state[picoquic_send_limit_cwin] + limits.time_in_state[picoquic_send_limit_pacing] == 0 ||
+        limits.time_in_state[picoquic_send_limit_flow] + limits.time_in_state[picoquic_send_limit_stream_flow] == 0 ||
+        stream_limits.time_in_state[picoquic_send_limit_cwin] == 0 ||
+        stream_limits.time_in_state[picoquic_send_limit_cwin] > limits.time_in_state[picoquic_send_limit_cwin])) {
+        DBG_PRINTF("Unexpected send limit times, total %" PRIu64 " for %" PRIu64, total_time, simulated_time);
+        ret = -1;
+    }
 
-                    while (nb_comma < 5 && buffer[c_index] != 0 && c_index < 512) {
-                        if (buffer[c_index] == ',') {
-                            nb_comma++;
-                        }
-                        c_index++;
-                    }
-                    while (c_index < 512 && buffer[c_index] == ' ') {
-                        c_index++;
-                    }
-                    while (c_index < 512 && buffer[c_index] >= '0' && buffer[c_index] <= '9') {
-                        cwin *= 10;
-                        cwin += buffer[c_index] - '0';
-                        c_index++;
-                    }
-                    if (cwin > cwin_max) {
-                        cwin_max = cwin;
-                    }
-                }
-            }
+    if (ret == 0 && picoquic_get_stream_send_limits(test_ctx->cnx_server, 1000, simulated_time, &stream_limits) == 0) {
+        DBG_PRINTF("%s", "Send limits of unknown stream not rejected");
+        ret = -1;
+    }
 
-            (void)picoquic_file_close(F);
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
 
-            if (cwin_max > cwin_limit) {
-                DBG_PRINTF("MAX CWIN = %" PRIu64 ", larger than %" PRIu64, cwin_max, cwin_limit);
-                ret = -1;
-            }
-        }
+    if (ret == 0 && (log.nb_errors != 0 || log.nb_cnx_records == 0 || log.nb_stream_records == 0)) {
+        DBG_PRINTF("Send limit records: %d connection, %d stream, %d errors",
+            log.nb_cnx_records, log.nb_stream_records, log.nb_errors);
+        ret = -1;
     }
 
     return ret;
 }
+#endif
 
-int app_limit_cc_test()
+int send_limits_test()
 {
+#ifdef PICOQUIC_DISABLE_STATS
+    /* The accounting is compiled out, the call must fail */
+    picoquic_send_limits_t limits;
+    return (picoquic_get_send_limits(NULL, 0, &limits) != 0) ? 0 : -1;
+#else
+    return send_limits_test_one();
+#endif
+}
 
-    picoquic_congestion_algorithm_t* ccalgos[] = {
-        picoquic_newreno_algorithm,
-        picoquic_cubic_algorithm,
-        picoquic_dcubic_algorithm,
-        picoquic_bbr_algorithm,
-        picoquic_fastcc_algorithm };
-    uint64_t max_completion_times[] = {
-        23000000,
-        22000000,
-        22000000,
-        22000000,
-        29000000 };
-    int ret = 0;
-
-    for (size_t i = 0; i < sizeof(ccalgos) / sizeof(picoquic_congestion_algorithm_t*); i++) {
-        ret = app_limit_cc_test_one(ccalgos[i], max_completion_times[i]);
-        if (ret != 0) {
-            DBG_PRINTF("Appplication limited congestion test fails for <%s>", ccalgos[i]->congestion_algorithm_id);
-            break;
+/* Tests of the automatic binary log triggers. The watched connection is not
+ * logged, but its last records are retained. When the trigger fires, the
+ * new connection record is written, followed by the retained records and
+ * by the live records of the rest of the connection. The ring is not used,
+ * so the sink is called directly by the writing code and can tell the
+ * retained records from the live ones by checking whether the connection
+ * has switched to full mode.
+ */
+#define BINLOG_TRIGGER_TEST_DEPTH 16
+
+typedef enum {
+    binlog_trigger_test_spurious = 0,
+    binlog_trigger_test_window,
+    binlog_trigger_test_stall,
+    binlog_trigger_test_handshake_local,
+    binlog_trigger_test_handshake_peer
+} binlog_trigger_test_enum;
+
+typedef struct st_binlog_trigger_test_log_t {
+    picoquic_quic_t* quic;
+    picoquic_connection_id_t cid;
+    uint64_t trigger_time;
+    int nb_new_connection;
+    int nb_early;
+    int nb_retro;
+    int nb_live;
+    int nb_errors;
+} binlog_trigger_test_log_t;
+
+static void binlog_trigger_test_sink(void* sink_ctx, const uint8_t* record, size_t length)
+{
+    binlog_trigger_test_log_t* log = (binlog_trigger_test_log_t*)sink_ctx;
+    bytestream_buf stream;
+    bytestream* s;
+    picoquic_connection_id_t cid;
+    uint64_t time_stamp = 0;
+    uint64_t event_type = 0;
+    picoquic_cnx_t* cnx;
+
+    if (record == NULL) {
+        return;
+    }
+
+    s = bytestream_ref_init((bytestream*)&stream, record, length);
+    if (byteread_cid(s, &cid) != 0 || byteread_vint(s, &time_stamp) != 0 || byteread_vint(s, &event_type) != 0) {
+        log->nb_errors++;
+    }
+    else if (picoquic_compare_connection_id(&cid, &log->cid) == 0) {
+        cnx = picoquic_get_first_cnx(log->quic);
+        while (cnx != NULL && picoquic_compare_connection_id(&cnx->initial_cnxid, &log->cid) != 0) {
+            cnx = picoquic_get_next_cnx(cnx);
+        }
+
+        if (event_type == picoquic_log_event_new_connection) {
+            /* Only written when the trigger fires */
+            log->trigger_time = picoquic_get_quic_time(log->quic);
+            log->nb_new_connection++;
+        }
+        else if (log->nb_new_connection == 0) {
+            log->nb_early++;
+        }
+        else if (cnx != NULL && cnx->binlog_mode != picoquic_binlog_mode_full) {
+            log->nb_retro++;
+        }
+        else {
+            log->nb_live++;
         }
     }
+}
+
+/* Log only the connections of an unrelated CID, retain the records of the others */
+static int binlog_trigger_test_policy(picoquic_quic_t* quic, binlog_trigger_test_log_t* log,
+    uint64_t nb_spurious_max, uint64_t stall_delay)
+{
+    picoquic_connection_id_t other_cid = { {0xb1, 0x06, 0, 0, 0, 0, 0, 0}, 8 };
+    int ret = picoquic_add_binlog_cid(quic, &other_cid);
+
+    log->quic = quic;
+
+    if (ret == 0) {
+        picoquic_set_binlog_ring_size(quic, 0);
+        picoquic_set_binlog_retro_depth(quic, BINLOG_TRIGGER_TEST_DEPTH);
+        picoquic_set_binlog_triggers(quic, nb_spurious_max, stall_delay);
+        ret = picoquic_set_binlog_sink(quic, binlog_trigger_test_sink, log);
+    }
 
     return ret;
 }
 
-/* Initial race condition.
-* What happens if the client immediately repeats the Initial packet?
-*/
-
-int initial_race_test()
+static int binlog_trigger_test_one(binlog_trigger_test_enum test_type)
 {
     uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
+    uint64_t stall_delay = 200000;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    picoquic_connection_id_t initial_cid = { {0xb1, 0x06, 0x7a, 0x19, 0, 0, 0, (uint8_t)test_type}, 8 };
+    int is_handshake = (test_type == binlog_trigger_test_handshake_local || test_type == binlog_trigger_test_handshake_peer);
+    int is_server = (test_type != binlog_trigger_test_window && test_type != binlog_trigger_test_handshake_peer);
+    picoquic_quic_t* quic = NULL;
+    binlog_trigger_test_log_t log;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI,
+        (is_handshake) ? PICOQUIC_TEST_WRONG_ALPN : PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    memset(&log, 0, sizeof(log));
+    log.cid = initial_cid;
 
     if (ret == 0 && test_ctx == NULL) {
-        ret = PICOQUIC_ERROR_MEMORY;
+        ret = -1;
     }
 
-    /* Run an initial loop to make to send the client's first packet, and then replicate it. */
     if (ret == 0) {
-        int was_active = 0;
-        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+        quic = (is_server) ? test_ctx->qserver : test_ctx->qclient;
+        switch (test_type) {
+        case binlog_trigger_test_spurious:
+            /* Jitter causes reordering, and thus spurious retransmissions */
+            test_ctx->s_to_c_link->jitter = 3000;
+            test_ctx->s_to_c_link->reorder = 1;
+            ret = binlog_trigger_test_policy(quic, &log, 1, 0);
+            break;
+        case binlog_trigger_test_stall:
+            ret = binlog_trigger_test_policy(quic, &log, 0, stall_delay);
+            break;
+        case binlog_trigger_test_handshake_local:
+        case binlog_trigger_test_handshake_peer:
+            /* The client proposes an ALPN that the server does not support */
+            free((void*)test_ctx->qserver->default_alpn);
+            test_ctx->qserver->default_alpn = picoquic_string_duplicate(PICOQUIC_TEST_ALPN);
+            ret = binlog_trigger_test_policy(quic, &log, 0, 0);
+            break;
+        default:
+            ret = binlog_trigger_test_policy(quic, &log, 0, 0);
+            break;
+        }
+    }
+
+    if (ret == 0) {
+        /* Recreate the client connection so the policy applies to it */
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            initial_cid, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, simulated_time,
+            PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI,
+            (is_handshake) ? PICOQUIC_TEST_WRONG_ALPN : PICOQUIC_TEST_ALPN, 1);
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        }
+    }
 
+    if (ret == 0 && is_handshake) {
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
         if (ret == 0) {
-            /* Force a repeat of the first packet */
-            simulated_time += 100;
-            test_ctx->cnx_client->initial_repeat_needed = 1;
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
-            test_ctx->cnx_client->initial_repeat_needed = 0;
-            /* Verify that there are two packets in the initial queue */
-            if (ret == 0) {
-                if (test_ctx->c_to_s_link->first_packet == NULL) {
-                    DBG_PRINTF("%s", "No packet queued");
-                    ret = -1;
-                }
-                else if (test_ctx->c_to_s_link->last_packet == test_ctx->c_to_s_link->first_packet) {
-                    DBG_PRINTF("%s", "Only one packet queued");
-                    ret = -1;
-                }
-            }
+            ret = tls_api_connection_loop(test_ctx, NULL, 0, &simulated_time);
+        }
+        if (ret == 0 && (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected ||
+            test_ctx->cnx_client->remote_error != PICOQUIC_TLS_ALERT_WRONG_ALPN)) {
+            DBG_PRINTF("Handshake did not fail, client state %d, error 0x%x",
+                (int)test_ctx->cnx_client->cnx_state, test_ctx->cnx_client->remote_error);
+            ret = -1;
         }
+        if (ret == 0 && test_type == binlog_trigger_test_handshake_peer &&
+            test_ctx->cnx_client->binlog_mode != picoquic_binlog_mode_full) {
+            DBG_PRINTF("%s", "Connection close did not trigger the client log");
+            ret = -1;
+        }
+    }
+    else if (ret == 0) {
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
 
-        while (ret == 0 && test_ctx->s_to_c_link->first_packet == NULL){
-            /* run a couple of simulation round to process the first server packets,
-             * but make sure the server sends only one packet */
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+        if (ret == 0 && (test_ctx->cnx_server == NULL ||
+            ((is_server) ? test_ctx->cnx_server : test_ctx->cnx_client)->binlog_mode != picoquic_binlog_mode_off)) {
+            DBG_PRINTF("%s", "Connection is logged before the trigger");
+            ret = -1;
         }
 
-        if (ret == 0) {
-            if (test_ctx->cnx_server == NULL) {
-                DBG_PRINTF("%s", "No server connection");
-                ret = -1;
+        if (ret == 0 && test_type == binlog_trigger_test_window) {
+            /* Up to nb_spurious_max events per window do not trigger, and
+             * the count restarts when a new window begins */
+            picoquic_cnx_t* cnx = test_ctx->cnx_client;
+            uint64_t t0 = simulated_time + PICOQUIC_BINLOG_SPURIOUS_WINDOW;
 
+            picoquic_set_binlog_triggers(test_ctx->qclient, 3, 0);
+            for (int i = 0; i < 3; i++) {
+                binlog_count_spurious(cnx, t0);
+            }
+            if (cnx->binlog_mode == picoquic_binlog_mode_off) {
+                for (int i = 0; i < 3; i++) {
+                    binlog_count_spurious(cnx, t0 + PICOQUIC_BINLOG_SPURIOUS_WINDOW);
+                }
+                if (cnx->binlog_mode == picoquic_binlog_mode_off) {
+                    binlog_count_spurious(cnx, t0 + 2 * PICOQUIC_BINLOG_SPURIOUS_WINDOW - 1);
+                    if (cnx->binlog_mode != picoquic_binlog_mode_full) {
+                        DBG_PRINTF("%s", "Spurious retransmissions within the window did not trigger");
+                        ret = -1;
+                    }
+                }
+                else {
+                    DBG_PRINTF("%s", "Spurious count not reset in the new window");
+                    ret = -1;
+                }
             }
             else {
-                /* Make sure that the server waits before sending the next packet. */
-                test_ctx->cnx_server->next_wake_time += 2000;
+                DBG_PRINTF("%s", "Triggered at nb_spurious_max spurious retransmissions");
+                ret = -1;
+            }
+            /* Produce live records after the trigger */
+            if (ret == 0) {
+                ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
             }
         }
-    }
+        else if (ret == 0) {
+            uint64_t blackhole_start = 0;
 
-    /* Run a connection loop */
-    if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
-    }
+            if (test_type == binlog_trigger_test_stall) {
+                /* Lose all packets in the middle of the transfer */
+                blackhole_start = simulated_time + 200000;
+                test_ctx->blackhole_start = blackhole_start;
+                test_ctx->blackhole_end = blackhole_start + 1000000;
+            }
 
-    /* Prepare to send data */
-    if (ret == 0) {
-        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2));
-    }
+            ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
 
-    /* Try send data */
-    if (ret == 0) {
-        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
-    }
+            if (ret == 0) {
+                ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+            }
 
-    /* Check that the data was sent and received */
-    if (ret == 0) {
-        ret = tls_api_one_scenario_verify(test_ctx);
-    }
+            if (ret == 0) {
+                ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 6000000);
+            }
 
-    if (ret == 0) {
-        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+            if (ret == 0 && test_ctx->cnx_server->binlog_mode != picoquic_binlog_mode_full) {
+                DBG_PRINTF("Server log not triggered, %" PRIu64 " spurious retransmissions",
+                    test_ctx->cnx_server->nb_spurious);
+                ret = -1;
+            }
 
-        if (ret != 0)
-        {
-            DBG_PRINTF("Connection close returns %d\n", ret);
+            if (ret == 0 && test_type == binlog_trigger_test_stall &&
+                (log.trigger_time < blackhole_start + stall_delay || log.trigger_time > test_ctx->blackhole_end)) {
+                DBG_PRINTF("Stall triggered at %" PRIu64 ", blackhole from %" PRIu64,
+                    log.trigger_time, blackhole_start);
+                ret = -1;
+            }
         }
     }
 
@@ -8397,97 +11304,91 @@ int initial_race_test()
         test_ctx = NULL;
     }
 
+    if (ret == 0 && (log.nb_errors != 0 || log.nb_new_connection != 1 || log.nb_early != 0 ||
+        log.nb_retro == 0 || log.nb_retro > BINLOG_TRIGGER_TEST_DEPTH || log.nb_live == 0)) {
+        DBG_PRINTF("Binlog records: %d new connection, %d early, %d retro, %d live, %d errors",
+            log.nb_new_connection, log.nb_early, log.nb_retro, log.nb_live, log.nb_errors);
+        ret = -1;
+    }
+
     return ret;
 }
 
-/* Test of the pacing functions.
- */
+int binlog_trigger_spurious_test()
+{
+    return binlog_trigger_test_one(binlog_trigger_test_spurious);
+}
 
-int pacing_test()
+int binlog_trigger_window_test()
 {
-    /* Create a connection so as to instantiate the pacing context */
-    int ret = 0;
-    uint64_t current_time = 0;
-    picoquic_quic_t* quic = NULL;
-    picoquic_cnx_t* cnx = NULL;
-    struct sockaddr_in saddr;
-    const uint64_t test_byte_per_sec = 1250000;
-    const uint64_t test_quantum = 0x4000;
-    int nb_sent = 0;
-    int nb_round = 0;
-    const int nb_target = 10000;
+    return binlog_trigger_test_one(binlog_trigger_test_window);
+}
 
-    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
-        NULL, NULL, NULL, NULL, current_time,
-        &current_time, NULL, NULL, 0);
+int binlog_trigger_stall_test()
+{
+    return binlog_trigger_test_one(binlog_trigger_test_stall);
+}
 
-    memset(&saddr, 0, sizeof(struct sockaddr_in));
-    saddr.sin_family = AF_INET;
-    saddr.sin_port = 1000;
+int binlog_trigger_handshake_test()
+{
+    return binlog_trigger_test_one(binlog_trigger_test_handshake_local);
+}
 
-    if (quic == NULL) {
-        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+int binlog_trigger_close_test()
+{
+    return binlog_trigger_test_one(binlog_trigger_test_handshake_peer);
+}
+
+/* Test that ACKs delayed by the maximum ack delay still provide RTT samples.
+ * With a minimum RTT above 4 times PICOQUIC_ACK_DELAY_MAX, the peer delays
+ * ACKs by exactly that maximum. The streams are sent one after the other, so
+ * a single packet is in flight and every ACK is delayed. After the connection
+ * is established the link latency increases, and the smoothed RTT must follow.
+ */
+int ack_delay_max_rtt_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t latency = 3 * PICOQUIC_ACK_DELAY_MAX;
+    uint64_t new_latency = 100000;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL);
+
+    if (ret == 0 && test_ctx == NULL) {
         ret = -1;
     }
-    else {
-        cnx = picoquic_create_cnx(quic,
-            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
-            current_time, 0, "test-sni", "test-alpn", 1);
 
-        if (cnx == NULL) {
-            DBG_PRINTF("%s", "Cannot create connection\n");
-            ret = -1;
-        }
+    if (ret == 0) {
+        test_ctx->c_to_s_link->microsec_latency = latency;
+        test_ctx->s_to_c_link->microsec_latency = latency;
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
     }
 
     if (ret == 0) {
-        /* Set pacing parameters to specified value */
-        picoquic_update_pacing_rate(cnx, cnx->path[0], (double)test_byte_per_sec, test_quantum);
-        /* Run a loop of N tests based on next wake time. */
-        while (ret == 0 && nb_sent < nb_target) {
-            nb_round++;
-            if (nb_round > 4 * nb_target) {
-                DBG_PRINTF("Pacing needs more that %d rounds for %d packets", nb_round, nb_target);
-                ret = -1;
-            }
-            else {
-                uint64_t next_time = current_time + 10000000;
-                if (picoquic_is_sending_authorized_by_pacing(cnx->path[0], current_time, &next_time)) {
-                    nb_sent++;
-                    picoquic_update_pacing_after_send(cnx->path[0], current_time);
-                }
-                else {
-                    if (current_time < next_time) {
-                        current_time = next_time;
-                    }
-                    else {
-                        DBG_PRINTF("Pacing next = %" PRIu64", current = %d" PRIu64, next_time, current_time);
-                        ret = -1;
-                    }
-                }
-            }
-        }
+        test_ctx->c_to_s_link->microsec_latency = new_latency;
+        test_ctx->s_to_c_link->microsec_latency = new_latency;
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_multipath_chain, sizeof(test_scenario_multipath_chain));
+    }
 
-        /* Verify that the total send time matches expectations */
-        if (ret == 0) {
-            uint64_t volume_sent = nb_target * cnx->path[0]->send_mtu;
-            uint64_t time_max = ((volume_sent * 1000000) / test_byte_per_sec) + 1;
-            uint64_t time_min = (((volume_sent - test_quantum) * 1000000) / test_byte_per_sec) + 1;
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
 
-            if (current_time > time_max) {
-                DBG_PRINTF("Pacing used = %" PRIu64", expected max = %d" PRIu64, current_time, time_max);
-                ret = -1;
-            }
-            else if (current_time < time_min) {
-                DBG_PRINTF("Pacing used = %" PRIu64", expected min = %d" PRIu64, current_time, time_min);
-                ret = -1;
-            }
-        }
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 20000000);
     }
 
-    if (quic != NULL) {
-        picoquic_free(quic);
+    if (ret == 0 && (test_ctx->cnx_client->path[0]->smoothed_rtt < 3 * new_latency / 2 ||
+        test_ctx->cnx_server->path[0]->smoothed_rtt < 3 * new_latency / 2)) {
+        DBG_PRINTF("The RTT does not track the latency increase, client %" PRIu64 ", server %" PRIu64,
+            test_ctx->cnx_client->path[0]->smoothed_rtt, test_ctx->cnx_server->path[0]->smoothed_rtt);
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
     }
 
     return ret;
-}
\ No newline at end of file
+}
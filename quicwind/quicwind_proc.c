@@ -826,6 +826,11 @@ DWORD WINAPI quicwind_background_thread(LPVOID lpParam)
             events[i] = 0;
         }
         else {
+            int recv_set = 0;
+            int send_set = 0;
+
+            (void)picoquic_socket_set_ecn_options(sock_ctx[i]->fd, socket_family[i],
+                qclient->default_ecn_codepoint, &recv_set, &send_set);
             events[i] = sock_ctx[i]->overlap.hEvent;
         }
     }
@@ -950,10 +955,11 @@ DWORD WINAPI quicwind_background_thread(LPVOID lpParam)
                         int i_sock = (peer_addr.ss_family == AF_INET) ? 1 : 0;
                         SOCKET s = sock_ctx[i_sock]->fd;
 
-                        (void)picoquic_send_through_socket(s,
+                        (void)picoquic_send_through_socket_at(s,
                             (struct sockaddr *)&peer_addr, (struct sockaddr *)&local_addr, 
                             picoquic_get_local_if_index(cnx_next),
-                            (const char*)send_buffer, (int)send_length);
+                            (const char*)send_buffer, (int)send_length,
+                            0, 0, picoquic_get_last_ecn_codepoint(qclient));
 
                         AppendText(_T("Packet sent\r\n"));
 